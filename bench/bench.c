@@ -0,0 +1,452 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+/*
+ * Lexer and parser throughput and how long an edit to an open document takes, run
+ * with `py build.py bench`. Every input is generated from a fixed seed, so the
+ * numbers of two builds are comparable.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "lexer.h"
+#include "parser.h"
+#include "document.h"
+#include "arena.h"
+#include "intern.h"
+#include "diagnostics.h"
+#include "profile.h"
+
+#define DEFAULT_SIZE (4u * 1024 * 1024)
+#define DEFAULT_ITERATIONS 11
+/* Typed and taken back again, so the document ends up as it started */
+#define EDIT_COUNT 500
+
+typedef struct Text {
+    char *data;
+    size_t length;
+    size_t capacity;
+} Text;
+
+static void append(Text *text, const char *format, ...) {
+    for (;;) {
+        va_list args;
+        va_start(args, format);
+        int written = vsnprintf(text->data + text->length, text->capacity - text->length, format, args);
+        va_end(args);
+        if (written < 0) {
+            fprintf(stderr, "Fatal: Couldn't format benchmark input.\n");
+            exit(1);
+        }
+        if ((size_t)written < text->capacity - text->length) {
+            text->length += (size_t)written;
+            return;
+        }
+        text->capacity = text->capacity * 2 + (size_t)written + 1;
+        text->data = realloc(text->data, text->capacity);
+        if (text->data == NULL) {
+            fprintf(stderr, "Fatal: Out of memory while generating benchmark input.\n");
+            exit(1);
+        }
+    }
+}
+
+/* xorshift64*, the seed is reset before every workload */
+static uint64_t randomState;
+
+static uint32_t nextRandom(uint32_t bound) {
+    randomState ^= randomState >> 12;
+    randomState ^= randomState << 25;
+    randomState ^= randomState >> 27;
+    return (uint32_t)((randomState * 2685821657736338717u) >> 32) % bound;
+}
+
+static const char *binaryOperators[] = {
+    "+", "-", "*", "/", "%", "<<", ">>", "&", "|", "^", "<", ">", "<=", ">=", "==", "!=", "&&", "||"
+};
+
+static void appendOperand(Text *text) {
+    switch (nextRandom(5)) {
+        case 0: append(text, "%u", nextRandom(100000)); break;
+        case 1: append(text, "%u.%u", nextRandom(1000), nextRandom(1000)); break;
+        case 2: append(text, "v%u", nextRandom(64)); break;
+        case 3: append(text, "a%u[i]", nextRandom(8)); break;
+        default: append(text, "p->f%u", nextRandom(8)); break;
+    }
+}
+
+/* The parser recurses on parentheses, depth stays small */
+static void appendExpression(Text *text, unsigned depth) {
+    if (depth == 0 || nextRandom(4) == 0) {
+        appendOperand(text);
+        return;
+    }
+    size_t terms = 2 + nextRandom(4);
+    for (size_t i = 0; i < terms; i++) {
+        if (i > 0)
+            append(text, " %s ", binaryOperators[nextRandom(sizeof(binaryOperators) / sizeof(*binaryOperators))]);
+        if (nextRandom(3) == 0) {
+            append(text, "(");
+            appendExpression(text, depth - 1);
+            append(text, ")");
+        } else if (nextRandom(6) == 0) {
+            append(text, "-");
+            appendOperand(text);
+        } else {
+            appendOperand(text);
+        }
+    }
+}
+
+static void generateExpressions(Text *text, size_t size) {
+    while (text->length < size) {
+        append(text, "v%u = ", nextRandom(64));
+        appendExpression(text, 8);
+        append(text, ";\n");
+    }
+}
+
+static void generateIfChains(Text *text, size_t size) {
+    for (unsigned function = 0; text->length < size; function++) {
+        append(text, "U0 Branch%u(I64 x) {\n  I64 y = 0;\n  if (x == 0) {\n    y = 1;\n  }", function);
+        for (unsigned arm = 1; arm < 2000; arm++)
+            append(text, " else if (x == %u) {\n    y = x * %u + %u;\n  }", arm, nextRandom(100), arm);
+        append(text, " else {\n    y = -1;\n  }\n}\n");
+    }
+}
+
+static void generateClasses(Text *text, size_t size) {
+    for (unsigned i = 0; text->length < size; i++) {
+        append(text, "class C%u {\n  C%u *next;\n  I64 value;\n  U8 *name;\n  U16 flags[%u];\n};\n", i, i, 1 + nextRandom(16));
+        append(text, "extern I64 Visit%u(C%u *node, I64 depth = %u);\n", i, i, nextRandom(8));
+        append(text, "U0 Walk%u(C%u *node) {\n  C%u *it = node;\n  while (it) {\n    it->value = it->next->value + Visit%u(it);\n    it = it->next;\n  }\n}\n", i, i, i, i);
+    }
+}
+
+static void generateStrings(Text *text, size_t size) {
+    static const char *words[] = { "alpha", "beta", "gamma", "delta", "HolyC", "temple", "\\n", "\\t", "\\\"quoted\\\"", "%d", "%s" };
+    while (text->length < size) {
+        append(text, "Print(\"");
+        size_t count = 2 + nextRandom(12);
+        for (size_t i = 0; i < count; i++)
+            append(text, "%s%s", i ? " " : "", words[nextRandom(sizeof(words) / sizeof(*words))]);
+        append(text, "\", v%u, '%c', '\\n');\n", nextRandom(64), 'a' + nextRandom(26));
+    }
+}
+
+/* Roughly what real code looks like, declarations mixed with control flow */
+static void generateMixed(Text *text, size_t size) {
+    for (unsigned i = 0; text->length < size; i++) {
+        append(text, "class M%u {\n  I64 f0;\n  I64 f1;\n  M%u *p;\n};\n", i, i);
+        append(text, "I64 Compute%u(M%u *p, I64 n, ...) {\n  I64 total = 0;\n", i, i);
+        append(text, "  for (I64 i = 0; i < n; i += 1) {\n    if (p->f0 > i) {\n      total += ");
+        appendExpression(text, 4);
+        append(text, ";\n    } else if (p->f1) {\n      Print(\"%%d\\n\", total);\n    } else {\n      break;\n    }\n  }\n");
+        append(text, "  return total;\n}\n");
+    }
+}
+
+typedef struct Workload {
+    const char *name;
+    void (*generate)(Text *text, size_t size);
+} Workload;
+
+static const Workload workloads[] = {
+    { "expressions", generateExpressions },
+    { "if_chains", generateIfChains },
+    { "classes", generateClasses },
+    { "strings", generateStrings },
+    { "mixed", generateMixed }
+};
+
+#define WORKLOAD_COUNT (sizeof(workloads) / sizeof(*workloads))
+
+static Text generate(const Workload *workload, size_t size) {
+    Text text = { NULL, 0, 0 };
+    randomState = 0x9E3779B97F4A7C15u;
+    append(&text, "/* Generated by the tinyhcc benchmarks, workload '%s' */\n", workload->name);
+    workload->generate(&text, size);
+    return text;
+}
+
+typedef struct Samples {
+    double *values;
+    size_t count;
+} Samples;
+
+typedef struct Percentiles {
+    double p10;
+    double p50;
+    double p90;
+} Percentiles;
+
+static int compareDoubles(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest rank */
+static Percentiles percentiles(Samples *samples) {
+    qsort(samples->values, samples->count, sizeof(double), compareDoubles);
+    Percentiles result = {
+        samples->values[(samples->count - 1) * 10 / 100],
+        samples->values[(samples->count - 1) * 50 / 100],
+        samples->values[(samples->count - 1) * 90 / 100]
+    };
+    return result;
+}
+
+typedef struct Result {
+    size_t bytes;
+    size_t tokens;
+    size_t nodes;
+    Percentiles tokenizeBytes; /* Bytes per second */
+    Percentiles parseBytes;
+    Percentiles parseNodes;    /* Nodes per second */
+    Percentiles edits;         /* Single character edits per second on an open document */
+} Result;
+
+/* Fails loudly, a generator producing something the parser rejects would make the numbers meaningless */
+static size_t countParsedNodes(const Text *text, const char *name) {
+    Interner interner;
+    Arena arena;
+    Diagnostics diagnostics;
+    initInterner(&interner);
+    initArena(&arena, ARENA_BLOCK_SIZE);
+    initDiagnostics(&diagnostics);
+    Lexer lexer;
+    initLexer(&lexer, text->data, text->length, name, &interner, &diagnostics);
+    Node *AST = parse(&lexer, &arena);
+    freeLexer(&lexer);
+    if (AST == NULL) {
+        flushDiagnostics(&diagnostics, stderr);
+        fprintf(stderr, "Fatal: The '%s' workload doesn't parse.\n", name);
+        exit(1);
+    }
+    UnitProfile profile;
+    memset(&profile, 0, sizeof(UnitProfile));
+    countNodes(&profile, AST);
+    size_t nodes = 0;
+    for (size_t i = 0; i <= NT_COMPOUND; i++)
+        nodes += profile.nodes[i];
+    freeDiagnostics(&diagnostics);
+    freeArena(&arena);
+    freeInterner(&interner);
+    return nodes;
+}
+
+/* What an editor sends while someone types, one character in at a random place and out again */
+static Percentiles runEdits(const Text *text, const char *name) {
+    static const char typed[] = { ' ', ';', '(', '}', 'x', '"' };
+    Samples samples = { calloc(EDIT_COUNT * 2, sizeof(double)), EDIT_COUNT * 2 };
+    if (samples.values == NULL) {
+        fprintf(stderr, "Fatal: Out of memory.\n");
+        exit(1);
+    }
+    Interner interner;
+    initInterner(&interner);
+    Document document;
+    openDocument(&document, name, text->data, text->length, &interner, NULL);
+    randomState = 0x9E3779B97F4A7C15u;
+    for (size_t i = 0; i < EDIT_COUNT; i++) {
+        size_t offset = nextRandom((uint32_t)text->length);
+        uint64_t start = profileClock();
+        editDocument(&document, offset, 0, &typed[nextRandom(sizeof(typed))], 1);
+        uint64_t elapsed = profileClock() - start;
+        samples.values[i * 2] = 1e9 / (elapsed ? elapsed : 1);
+        start = profileClock();
+        editDocument(&document, offset, 1, NULL, 0);
+        elapsed = profileClock() - start;
+        samples.values[i * 2 + 1] = 1e9 / (elapsed ? elapsed : 1);
+    }
+    closeDocument(&document);
+    freeInterner(&interner);
+    Percentiles result = percentiles(&samples);
+    free(samples.values);
+    return result;
+}
+
+/* Every iteration starts with an empty string table, like the first unit of a worker */
+static Result run(const Text *text, const char *name, size_t iterations) {
+    Result result = { text->length, 0, countParsedNodes(text, name), { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } };
+    Samples tokenizeSamples = { calloc(iterations, sizeof(double)), iterations };
+    Samples parseSamples = { calloc(iterations, sizeof(double)), iterations };
+    Samples nodeSamples = { calloc(iterations, sizeof(double)), iterations };
+    if (tokenizeSamples.values == NULL || parseSamples.values == NULL || nodeSamples.values == NULL) {
+        fprintf(stderr, "Fatal: Out of memory.\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < iterations; i++) {
+        Interner interner;
+        Diagnostics diagnostics;
+        initInterner(&interner);
+        initDiagnostics(&diagnostics);
+        TokenStream tokens;
+        uint64_t start = profileClock();
+        tokenize(&tokens, text->data, text->length, name, &interner, &diagnostics);
+        uint64_t elapsed = profileClock() - start;
+        result.tokens = tokens.count - 1;
+        tokenizeSamples.values[i] = text->length / (elapsed / 1e9);
+        freeTokenStream(&tokens);
+        freeInterner(&interner);
+
+        Arena arena;
+        initInterner(&interner);
+        initArena(&arena, ARENA_BLOCK_SIZE);
+        start = profileClock();
+        Lexer lexer;
+        initLexer(&lexer, text->data, text->length, name, &interner, &diagnostics);
+        parse(&lexer, &arena);
+        freeLexer(&lexer);
+        elapsed = profileClock() - start;
+        parseSamples.values[i] = text->length / (elapsed / 1e9);
+        nodeSamples.values[i] = result.nodes / (elapsed / 1e9);
+        freeArena(&arena);
+        freeInterner(&interner);
+        freeDiagnostics(&diagnostics);
+    }
+    result.tokenizeBytes = percentiles(&tokenizeSamples);
+    result.parseBytes = percentiles(&parseSamples);
+    result.parseNodes = percentiles(&nodeSamples);
+    free(tokenizeSamples.values);
+    free(parseSamples.values);
+    free(nodeSamples.values);
+    result.edits = runEdits(text, name);
+    return result;
+}
+
+static void printPercentiles(FILE *out, const char *name, Percentiles value) {
+    fprintf(out, "\"%s\": {\"p10\": %.1f, \"p50\": %.1f, \"p90\": %.1f}", name, value.p10, value.p50, value.p90);
+}
+
+static void writeJson(FILE *out, const Result *results, size_t iterations) {
+    fprintf(out, "{\n  \"iterations\": %zu,\n  \"workloads\": {\n", iterations);
+    for (size_t i = 0; i < WORKLOAD_COUNT; i++) {
+        const Result *result = &results[i];
+        fprintf(out, "    \"%s\": {\"bytes\": %zu, \"tokens\": %zu, \"nodes\": %zu,\n      ", workloads[i].name, result->bytes, result->tokens, result->nodes);
+        printPercentiles(out, "tokenize_bytes_per_second", result->tokenizeBytes);
+        fprintf(out, ",\n      ");
+        printPercentiles(out, "parse_bytes_per_second", result->parseBytes);
+        fprintf(out, ",\n      ");
+        printPercentiles(out, "parse_nodes_per_second", result->parseNodes);
+        fprintf(out, ",\n      ");
+        printPercentiles(out, "edits_per_second", result->edits);
+        fprintf(out, "}%s\n", i + 1 < WORKLOAD_COUNT ? "," : "");
+    }
+    fprintf(out, "  }\n}\n");
+}
+
+static bool writeCorpus(const char *directory, size_t size) {
+    for (size_t i = 0; i < WORKLOAD_COUNT; i++) {
+        Text text = generate(&workloads[i], size);
+        size_t len = strlen(directory) + strlen(workloads[i].name) + 5;
+        char *path = malloc(len);
+        if (path == NULL) {
+            fprintf(stderr, "Fatal: Out of memory.\n");
+            exit(1);
+        }
+        snprintf(path, len, "%s/%s.HC", directory, workloads[i].name);
+        FILE *f = fopen(path, "wb");
+        bool ok = f != NULL && fwrite(text.data, 1, text.length, f) == text.length;
+        if (f != NULL)
+            ok = fclose(f) == 0 && ok;
+        if (!ok)
+            fprintf(stderr, "Couldn't write '%s'.\n", path);
+        free(path);
+        free(text.data);
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+static void showHelp(const char *argv0) {
+    printf("tinyhcc benchmarks - Lexer and parser throughput on generated inputs.\n");
+    printf("Usage: %s [options]\n", argv0);
+    printf(" -n, --iterations <n>: Runs per workload, default %u\n", DEFAULT_ITERATIONS);
+    printf(" -s, --size <MiB>: Size of every workload, default %u\n", DEFAULT_SIZE / (1024 * 1024));
+    printf(" --json <path>: Also write the results to path as JSON\n");
+    printf(" --corpus <dir>: Write the workloads to dir as .HC files and exit\n");
+    printf(" -h, --help: Show this menu\n");
+}
+
+static size_t positiveArgument(int argc, const char **argv, int i) {
+    if (i >= argc) {
+        fprintf(stderr, "Expected argument to '%s'.\n", argv[i - 1]);
+        exit(1);
+    }
+    char *end;
+    unsigned long value = strtoul(argv[i], &end, 10);
+    if (*end || end == argv[i] || value == 0) {
+        fprintf(stderr, "Invalid number '%s'.\n", argv[i]);
+        exit(1);
+    }
+    return value;
+}
+
+int main(int argc, const char **argv) {
+    size_t iterations = DEFAULT_ITERATIONS;
+    size_t size = DEFAULT_SIZE;
+    const char *json = NULL;
+    const char *corpus = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            showHelp(argv[0]);
+            return 0;
+        } else if (!strcmp(argv[i], "-n") || !strcmp(argv[i], "--iterations")) {
+            iterations = positiveArgument(argc, argv, ++i);
+        } else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--size")) {
+            size = positiveArgument(argc, argv, ++i) * 1024 * 1024;
+        } else if (!strcmp(argv[i], "--json") || !strcmp(argv[i], "--corpus")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Expected argument to '%s'.\n", argv[i]);
+                return 1;
+            }
+            if (!strcmp(argv[i], "--json"))
+                json = argv[++i];
+            else
+                corpus = argv[++i];
+        } else {
+            fprintf(stderr, "Unrecognized argument '%s'.\n", argv[i]);
+            return 1;
+        }
+    }
+    if (corpus != NULL)
+        return writeCorpus(corpus, size) ? 0 : 1;
+
+    Result results[WORKLOAD_COUNT];
+    printf("%-12s %9s %9s %10s | %-26s | %-26s | %-26s | %-26s\n", "workload", "MiB", "tokens", "nodes",
+        "tokenize MiB/s p10/50/90", "parse MiB/s p10/50/90", "parse Mnodes/s p10/50/90", "edit us p10/50/90");
+    for (size_t i = 0; i < WORKLOAD_COUNT; i++) {
+        Text text = generate(&workloads[i], size);
+        results[i] = run(&text, workloads[i].name, iterations);
+        free(text.data);
+        const Result *r = &results[i];
+        const double MiB = 1024.0 * 1024.0;
+        printf("%-12s %9.2f %9zu %10zu | %8.1f %8.1f %8.1f | %8.1f %8.1f %8.1f | %8.2f %8.2f %8.2f | %8.1f %8.1f %8.1f\n", workloads[i].name,
+            r->bytes / MiB, r->tokens, r->nodes,
+            r->tokenizeBytes.p10 / MiB, r->tokenizeBytes.p50 / MiB, r->tokenizeBytes.p90 / MiB,
+            r->parseBytes.p10 / MiB, r->parseBytes.p50 / MiB, r->parseBytes.p90 / MiB,
+            r->parseNodes.p10 / 1e6, r->parseNodes.p50 / 1e6, r->parseNodes.p90 / 1e6,
+            1e6 / r->edits.p90, 1e6 / r->edits.p50, 1e6 / r->edits.p10);
+        fflush(stdout);
+    }
+    if (json != NULL) {
+        FILE *out = fopen(json, "w");
+        if (out == NULL) {
+            fprintf(stderr, "Couldn't open '%s' for writing.\n", json);
+            return 1;
+        }
+        writeJson(out, results, iterations);
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1 @@
+gcc -o bin/bench.exe obj/bench/lexer.o obj/bench/parser.o obj/bench/arena.o obj/bench/intern.o obj/bench/registry.o obj/bench/symtab.o obj/bench/source.o obj/bench/diagnostics.o obj/bench/thread.o obj/bench/scan.o obj/bench/sourcemap.o obj/bench/vector.o obj/bench/flatast.o obj/bench/visitor.o obj/bench/astcache.o obj/bench/pch.o obj/bench/profile.o obj/bench/document.o obj/bench/server.o obj/bench/fold.o obj/bench/object.o obj/bench/x86.o obj/bench/regalloc.o obj/bench/codegen.o obj/bench/jit.o obj/bench/bench.o -lpthread -ldl
\ No newline at end of file
@@ -0,0 +1 @@
+gcc -o bin/fuzz.exe obj/fuzz/lexer.o obj/fuzz/parser.o obj/fuzz/arena.o obj/fuzz/intern.o obj/fuzz/registry.o obj/fuzz/symtab.o obj/fuzz/source.o obj/fuzz/diagnostics.o obj/fuzz/thread.o obj/fuzz/scan.o obj/fuzz/sourcemap.o obj/fuzz/vector.o obj/fuzz/flatast.o obj/fuzz/visitor.o obj/fuzz/astcache.o obj/fuzz/pch.o obj/fuzz/profile.o obj/fuzz/document.o obj/fuzz/server.o obj/fuzz/fold.o obj/fuzz/object.o obj/fuzz/x86.o obj/fuzz/regalloc.o obj/fuzz/codegen.o obj/fuzz/jit.o obj/fuzz/fuzz.o -lpthread -ldl
\ No newline at end of file
@@ -0,0 +1 @@
+gcc -o bin/thcc.exe obj/cli.o obj/lexer.o obj/parser.o obj/arena.o obj/intern.o obj/registry.o obj/symtab.o obj/source.o obj/diagnostics.o obj/thread.o obj/scan.o obj/sourcemap.o obj/vector.o obj/flatast.o obj/visitor.o obj/astcache.o obj/pch.o obj/profile.o obj/document.o obj/server.o obj/fold.o obj/object.o obj/x86.o obj/regalloc.o obj/codegen.o obj/jit.o -lpthread -ldl
\ No newline at end of file
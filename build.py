@@ -6,8 +6,12 @@ See LICENSE for license.
 
 import os
 import sys
+import json
 import shutil
+import hashlib
+import threading
 import subprocess
+import concurrent.futures
 
 from typing import Callable, TypeVar, ParamSpec, Type
 
@@ -40,7 +44,8 @@ class Builder:
         cflags: list[str]   | None = None,      # Extra C flags to pass to the C compiler. POSIX STYLE
         ldflags: list[str]  | None = None,      # Extra linker flags to pass to the linker. POSIX STYLE
         debug: bool                = False,     # Whether to compile a debug build.
-        rebuild: bool              = False      # Whether to rebuild up-to-date files.
+        rebuild: bool              = False,     # Whether to rebuild up-to-date files.
+        jobs: int                  = 0          # How many files to compile at once, 0 for one per CPU
     ) -> None:
         self.cc: str = cc
         self.ld: str = ld
@@ -60,6 +65,10 @@ class Builder:
         self.errors: int = 0
         self.cdefinitions: dict[str, str] = {}
         self.rebuild = rebuild
+        self.jobs: int = jobs if jobs > 0 else (os.cpu_count() or 1)
+        # Compile commands queued by build, run by wait
+        self.pending: list[tuple[list[str], str]] = []
+        self.output_lock: threading.Lock = threading.Lock()
 
         if self.debug:
             self.cdefine("DEBUG", "1")
@@ -80,14 +89,27 @@ class Builder:
         sys.stdout.write(f"[!] {message}\n")
         sys.stdout.flush()
 
-    def cmd(self, command: list[str]) -> None:
+    def cmd(self, command: list[str], env: dict[str, str] | None = None) -> None:
         sys.stdout.write(f"[>] {' '.join(command)}\n")
         sys.stdout.flush()
-        res: subprocess.CompletedProcess[bytes] = subprocess.run(command)
+        res: subprocess.CompletedProcess[bytes] = subprocess.run(command, env=env)
         if res.returncode != 0:
             self.warn(f"Command failed with returncode {res.returncode}.")
             self.errors += 1
 
+    def run_captured(self, command: list[str]) -> bool:
+        """Runs command from a worker thread, its output is printed in one piece once it is done."""
+        res: subprocess.CompletedProcess[bytes] = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+        with self.output_lock:
+            sys.stdout.write(f"[>] {' '.join(command)}\n")
+            if res.stdout:
+                sys.stdout.write(res.stdout.decode(errors="replace"))
+            sys.stdout.flush()
+            if res.returncode != 0:
+                self.warn(f"Command failed with returncode {res.returncode}.")
+                self.errors += 1
+        return res.returncode == 0
+
     @raises(BuilderError)
     def last_update_date(self, path: str) -> float:
         if not os.path.exists(path):
@@ -106,7 +128,7 @@ class Builder:
         del self.cdefinitions[key]
 
     def filename_from_path(self, path: str) -> str:
-        return path.split("\\")[-1]
+        return os.path.basename(path)
 
     def base_filename(self, path: str) -> str:
         filename: str = self.filename_from_path(path)
@@ -120,55 +142,323 @@ class Builder:
     #
 
     @raises(BuilderError)
-    def build(self, path: str) -> None:
+    def read_depfile(self, depfile: str) -> list[str]:
+        """The prerequisites in a make-style depfile written by -MMD, the source included."""
+        with open(depfile) as f:
+            text: str = f.read().replace("\\\n", " ")
+        # The target is followed by ": ", a bare ':' can be part of a Windows drive
+        colon: int = text.find(": ")
+        if colon < 0:
+            self.err(f"Malformed depfile '{depfile}'")
+        paths: list[str] = []
+        current: str = ""
+        escaped: bool = False
+        for char in text[colon + 2:]:
+            if escaped:
+                current += char
+                escaped = False
+            elif char == "\\":
+                escaped = True
+            elif char.isspace():
+                if current:
+                    paths.append(current)
+                current = ""
+            else:
+                current += char
+        if escaped:
+            current += "\\"
+        if current:
+            paths.append(current)
+        return paths
+
+    def read_command(self, path: str) -> str | None:
+        if not os.path.exists(path):
+            return None
+        with open(path) as f:
+            return f.read()
+
+    def write_command(self, path: str, command: list[str]) -> None:
+        with open(path, "w") as f:
+            f.write(" ".join(command))
+
+    @raises(BuilderError)
+    def up_to_date(self, target: str, prerequisites: list[str], command: list[str]) -> bool:
+        """Whether target is newer than every prerequisite and was made by the same command."""
+        if self.rebuild or not os.path.exists(target):
+            return False
+        if self.read_command(target + ".cmd") != " ".join(command):
+            return False
+        built: float = self.last_update_date(target)
+        for path in prerequisites:
+            # A header that went away forces a rebuild, the compiler sorts out whether it is still needed
+            if not os.path.exists(path) or self.last_update_date(path) > built:
+                return False
+        return True
+
+    @raises(BuilderError)
+    def build(self, path: str, definitions: dict[str, str] | None = None) -> None:
+        """Queues path for compilation if it or any header it includes changed, see wait. definitions are for path alone."""
         path = os.path.join(self.src, path)
         if not os.path.exists(path):
             self.err(f"Attempt to build file '{path}' which does not exist")
         if not os.path.exists(self.obj):
             os.makedirs(self.obj)
         objfile: str = os.path.join(self.obj, self.base_filename(path) + ".o")
-        if os.path.exists(objfile):
-            if self.last_update_date(path) <= self.last_update_date(objfile) and not self.rebuild:
-                self.log(f"File {path} already up to date. Skipping")
-                return
-        self.cmd([
-            self.cc, "-c", "-o", objfile, *self.cflags, path, *[f"-I{x}" for x in self.include], *[f"-D{key}={self.cdefinitions[key]}" for key in self.cdefinitions.keys()]
-        ])
+        depfile: str = os.path.join(self.obj, self.base_filename(path) + ".d")
+        command: list[str] = [
+            self.cc, "-c", "-o", objfile, *self.cflags, path, *[f"-I{x}" for x in self.include], *[f"-D{key}={self.cdefinitions[key]}" for key in self.cdefinitions.keys()],
+            *[f"-D{key}={value}" for key, value in (definitions or {}).items()]
+        ]
+        prerequisites: list[str] | None = self.read_depfile(depfile) if os.path.exists(depfile) else None
+        # Without a depfile there is no telling which headers it uses
+        if prerequisites is not None and self.up_to_date(objfile, prerequisites, command):
+            self.log(f"File {path} already up to date. Skipping")
+            return
+        self.pending.append(([*command, "-MMD", "-MF", depfile], objfile))
+
+    @raises(BuilderError)
+    def wait(self) -> None:
+        """Compiles everything queued by build, up to jobs files at once."""
+        pending, self.pending = self.pending, []
+        def compile_job(job: tuple[list[str], str]) -> None:
+            command, objfile = job
+            if self.run_captured(command):
+                # Recorded without the depfile flags, which is what build compares against
+                self.write_command(objfile + ".cmd", command[:-3])
+        # The work is done by the compiler processes, threads are enough to keep jobs of them running
+        with concurrent.futures.ThreadPoolExecutor(max_workers=self.jobs) as pool:
+            for future in [pool.submit(compile_job, job) for job in pending]:
+                future.result()
 
     @raises(BuilderError)
     def link(self, objects: list[str], binpath: str) -> None:
+        self.wait()
         if self.errors:
             self.err(f"Errors encountered while building, aborting")
         if not os.path.exists(self.bin):
             os.makedirs(self.bin)
         objects = [os.path.join(self.obj, path) for path in objects]
         binpath = os.path.join(self.bin, binpath)
-        skiplink: bool = not self.rebuild
         for path in objects:
             if not os.path.exists(path):
                 self.err(f"Attempt to link file '{path}' which does not exist")
-            if os.path.exists(binpath):
-                if self.last_update_date(path) >= self.last_update_date(binpath):
-                    skiplink = False
-            else:
-                skiplink = False
-        if skiplink:
+        command: list[str] = [self.ld, "-o", binpath, *objects, *self.ldflags]
+        if self.up_to_date(binpath, objects, command):
             self.log(f"File {binpath} already up to date. Skipping")
             return
-        self.cmd([
-            self.ld, "-o", binpath, *self.ldflags, *objects
-        ])
+        self.cmd(command)
+        if not self.errors:
+            self.write_command(binpath + ".cmd", command)
+
+SOURCES: list[str] = [
+    "cli.c", "lexer.c", "parser.c", "arena.c", "intern.c", "registry.c", "symtab.c", "source.c", "diagnostics.c", "thread.c",
+    "scan.c", "sourcemap.c", "vector.c", "flatast.c", "visitor.c", "astcache.c", "pch.c", "profile.c",
+    "document.c", "server.c", "fold.c", "object.c", "x86.c", "regalloc.c", "codegen.c", "jit.c"
+]
+
+# Compiled with THCC_BUILD_ID, the AST cache and the compile server use it to tell builds apart
+BUILD_ID_SOURCES: list[str] = ["cli.c", "astcache.c"]
+
+# Medians that drop by more than this against the baseline fail the benchmark run
+BENCH_REGRESSION: float = 0.10
+
+@raises(BuilderError)
+def compare_bench(builder: Builder, results_path: str, baseline_path: str) -> None:
+    with open(results_path) as f:
+        results = json.load(f)["workloads"]
+    with open(baseline_path) as f:
+        baseline = json.load(f)["workloads"]
+    regressions: list[str] = []
+    for workload, metrics in results.items():
+        if workload not in baseline:
+            builder.warn(f"No baseline for workload '{workload}'")
+            continue
+        for metric, value in metrics.items():
+            if not isinstance(value, dict) or metric not in baseline[workload]:
+                continue
+            old: float = baseline[workload][metric]["p50"]
+            new: float = value["p50"]
+            change: float = new / old - 1 if old else 0.0
+            builder.log(f"{workload:<12} {metric:<28} {old:>16.1f} -> {new:>16.1f} ({change:+.1%})")
+            if change < -BENCH_REGRESSION:
+                regressions.append(f"{workload} {metric} {change:+.1%}")
+    if regressions:
+        builder.err(f"Throughput regressed against the baseline: {', '.join(regressions)}")
+
+def build_id(builder: Builder, sources: list[str]) -> str:
+    """A hash of the sources, every header and how they are compiled, it changes whenever the compiler might."""
+    digest = hashlib.sha256()
+    digest.update(" ".join([builder.cc, *builder.cflags, *[f"{key}={value}" for key, value in sorted(builder.cdefinitions.items())]]).encode())
+    paths: list[str] = [os.path.join(builder.src, source) for source in sorted(sources)]
+    for directory in builder.include:
+        paths += sorted(os.path.join(directory, name) for name in os.listdir(directory) if name.endswith(".h"))
+    for path in paths:
+        digest.update(path.encode() + b"\0")
+        with open(path, "rb") as f:
+            digest.update(f.read())
+    return digest.hexdigest()[:16]
+
+@raises(BuilderError)
+def build_sources(builder: Builder, flp: Callable[[str], str], sources: list[str]) -> None:
+    """Queues sources, the ones in BUILD_ID_SOURCES only rebuild when the id changes."""
+    identity: str = build_id(builder, [flp(source) for source in sources])
+    for source in sources:
+        builder.build(flp(source), {"THCC_BUILD_ID": f'"{identity}"'} if source in BUILD_ID_SOURCES else None)
+
+def option(name: str, default: str) -> str:
+    """The value of a name=value argument."""
+    for arg in sys.argv[1:]:
+        if arg.startswith(name + "="):
+            return arg[len(name) + 1:]
+    return default
+
+@raises(BuilderError)
+def make_builder(obj: str, debug: bool = False) -> Builder:
+    jobs: str = option("jobs", "0")
+    if not jobs.isdigit():
+        raise BuilderError(f"Invalid job count '{jobs}'")
+    builder: Builder = Builder(
+        cc=option("cc", "clang"), ld=option("ld", option("cc", "clang")), obj=obj,
+        debug=debug, rebuild="rebuild" in sys.argv, jobs=int(jobs)
+    )
+    builder.cdefine("_CRT_SECURE_NO_WARNINGS", "1")
+    if os.name != "nt":
+        builder.ldflags += ["-lpthread", "-ldl"]
+    return builder
+
+@raises(BuilderError)
+def build_bench(flp: Callable[[str], str]) -> str:
+    """Builds bench.exe, returns its path."""
+    # Optimized objects of their own, so a bench run never leaves a debug build half rebuilt
+    builder: Builder = make_builder(os.path.join("obj", "bench"))
+    builder.cflags.append("-O2")
+    library: list[str] = [source for source in SOURCES if source != "cli.c"]
+    build_sources(builder, flp, library)
+    builder.src = "bench"
+    builder.build(flp("bench.c"))
+    builder.link([flp(builder.base_filename(source) + ".o") for source in library] + [flp("bench.o")], "bench.exe")
+    return os.path.join(builder.bin, "bench.exe")
+
+@raises(BuilderError)
+def bench(flp: Callable[[str], str]) -> None:
+    builder: Builder = make_builder(os.path.join("obj", "bench"))
+    executable: str = build_bench(flp)
+    results: str = os.path.join(builder.bin, "bench.json")
+    baseline: str = os.path.join(builder.bin, "bench-baseline.json")
+    builder.cmd([executable, "--json", results])
+    if builder.errors:
+        builder.err("Benchmarks failed")
+    if "baseline" in sys.argv:
+        shutil.copyfile(results, baseline)
+        builder.log(f"Saved the results as the baseline in {baseline}")
+    elif os.path.exists(baseline):
+        compare_bench(builder, results, baseline)
+    else:
+        builder.log(f"No baseline to compare against, run 'build.py bench baseline' to save one")
+
+@raises(BuilderError)
+def fuzz(flp: Callable[[str], str]) -> None:
+    """Builds fuzz.exe and runs it over the regression corpus, the stress inputs and mutations of the corpus."""
+    libfuzzer: bool = "libfuzzer" in sys.argv
+    builder: Builder = make_builder(os.path.join("obj", "libfuzzer" if libfuzzer else "fuzz"))
+    if libfuzzer:
+        # Coverage for the whole library, only the harness links libFuzzer's main
+        builder.cflags += ["-g", "-O1", "-fsanitize=fuzzer-no-link,address"]
+        builder.ldflags.append("-fsanitize=fuzzer,address")
+        builder.cdefine("LIBFUZZER", "1")
+    else:
+        builder.cflags.append("-O2")
+    library: list[str] = [source for source in SOURCES if source != "cli.c"]
+    build_sources(builder, flp, library)
+    builder.src = "fuzz"
+    builder.build(flp("fuzz.c"))
+    builder.link([flp(builder.base_filename(source) + ".o") for source in library] + [flp("fuzz.o")], "fuzz.exe")
+    executable: str = os.path.join(builder.bin, "fuzz.exe")
+    corpus: str = os.path.join("fuzz", "corpus")
+    seconds: str = option("seconds", "60")
+    if libfuzzer:
+        # What libFuzzer finds new coverage with is kept apart, only the failing cases join the corpus
+        scratch: str = os.path.join(builder.obj, "corpus")
+        if not os.path.exists(scratch):
+            os.makedirs(scratch)
+        builder.cmd([executable, scratch, corpus, f"-max_total_time={seconds}", "-timeout=1", "-rss_limit_mb=1024",
+                     f"-artifact_prefix={corpus}{os.sep}"])
+    else:
+        builder.cmd([executable, "--corpus", corpus, "--seconds", seconds])
+    if builder.errors:
+        builder.err(f"Fuzzing failed, the failing inputs were saved in {corpus}")
+
+def pgo_flags(cc: str, profile: str, generate: bool) -> list[str]:
+    """Instrumentation or profile use flags, profile is the directory the profile data goes in."""
+    if "gcc" in os.path.basename(cc):
+        # gcc names the .gcda files after the objects, both stages have to build into the same directory
+        if generate:
+            return [f"-fprofile-generate={profile}"]
+        return [f"-fprofile-use={profile}", "-fprofile-partial-training", "-Wno-missing-profile"]
+    if generate:
+        return [f"-fprofile-instr-generate={os.path.join(profile, 'thcc-%p.profraw')}"]
+    return [f"-fprofile-instr-use={os.path.join(profile, 'thcc.profdata')}"]
+
+@raises(BuilderError)
+def train(flp: Callable[[str], str], builder: Builder, profile: str) -> None:
+    """Builds an instrumented thcc.exe and runs it over the benchmark corpus."""
+    if os.path.exists(profile):
+        shutil.rmtree(profile)
+    os.makedirs(profile)
+    flags: list[str] = pgo_flags(builder.cc, profile, True)
+    builder.cflags += flags
+    builder.ldflags += flags
+    build_sources(builder, flp, SOURCES)
+    builder.link([flp(builder.base_filename(source) + ".o") for source in SOURCES], "thcc-instrumented.exe")
+    for flag in flags:
+        builder.cflags.remove(flag)
+        builder.ldflags.remove(flag)
+
+    corpus: str = os.path.join(builder.obj, "corpus")
+    if not os.path.exists(corpus):
+        os.makedirs(corpus)
+    builder.cmd([build_bench(flp), "--corpus", corpus])
+    inputs: list[str] = sorted(os.path.join(corpus, name) for name in os.listdir(corpus) if name.endswith(".HC"))
+    builder.cmd([os.path.join(builder.bin, "thcc-instrumented.exe"), *inputs])
+    if builder.errors:
+        builder.err("Training run failed")
+    if "gcc" not in os.path.basename(builder.cc):
+        raws: list[str] = [os.path.join(profile, name) for name in os.listdir(profile) if name.endswith(".profraw")]
+        builder.cmd([option("profdata", "llvm-profdata"), "merge", "-o", os.path.join(profile, "thcc.profdata"), *raws])
+        if builder.errors:
+            builder.err("Couldn't merge the profile data")
+
+@raises(BuilderError)
+def release(flp: Callable[[str], str]) -> None:
+    """An optimized, link-time optimized thcc.exe, trained on the benchmark corpus with pgo."""
+    builder: Builder = make_builder(os.path.join("obj", "release"))
+    builder.cflags += ["-O2", "-flto"]
+    builder.ldflags += ["-O2", "-flto"]
+    if "pgo" in sys.argv:
+        profile: str = os.path.join(builder.obj, "profile")
+        train(flp, builder, profile)
+        flags: list[str] = pgo_flags(builder.cc, profile, False)
+        builder.cflags += flags
+        builder.ldflags += flags
+    build_sources(builder, flp, SOURCES)
+    builder.link([flp(builder.base_filename(source) + ".o") for source in SOURCES], "thcc.exe")
 
 def main() -> None:
     flp: Callable[[str], str] = lambda path: os.path.join(*path.split("/"))
-    builder: Builder = Builder(debug="debug" in sys.argv, rebuild="rebuild" in sys.argv)
+    if "bench" in sys.argv:
+        bench(flp)
+        return
+    if "release" in sys.argv:
+        release(flp)
+        return
+    if "fuzz" in sys.argv:
+        fuzz(flp)
+        return
+    builder: Builder = make_builder("obj", debug="debug" in sys.argv)
     if "transpiler" in sys.argv:
         builder.cdefine("TRANSPILER", "1")
-    builder.cdefine("_CRT_SECURE_NO_WARNINGS", "1")
-    builder.build(flp("cli.c"))
-    builder.build(flp("lexer.c"))
-    builder.build(flp("parser.c"))
-    builder.link([flp("cli.o"), flp("lexer.o"), flp("parser.o")], "thcc.exe")
+    build_sources(builder, flp, SOURCES)
+    builder.link([flp(builder.base_filename(source) + ".o") for source in SOURCES], "thcc.exe")
 
 if __name__ == "__main__":
     main()
@@ -0,0 +1,807 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+/*
+ * Fuzzing harness for the lexer and the parser, run with `py build.py fuzz`. Every input
+ * is tokenized and then parsed the way a unit is. What it looks for is a crash, an input
+ * that runs past the timeout or the memory cap, and an input that takes far longer per
+ * byte than the others, which is what super-linear behaviour looks like. Inputs that do
+ * any of that are written to the corpus directory, which is replayed on every run after.
+ *
+ * Built with -DLIBFUZZER only LLVMFuzzerTestOneInput is left and libFuzzer drives it and
+ * enforces the caps, see `py build.py fuzz libfuzzer`. Otherwise the harness mutates the
+ * corpus itself, without coverage feedback, and runs the stress generators: a family of
+ * inputs generated at two sizes, the time per byte mustn't grow with the size. Given
+ * files instead of a corpus it runs just those, so AFL can drive it too:
+ *   afl-fuzz -i fuzz/corpus -o out -- bin/fuzz.exe @@
+ */
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+/* sigaltstack */
+#define _DEFAULT_SOURCE
+#define _DARWIN_C_SOURCE
+#endif /* _WIN32 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif /* _WIN32 */
+
+#include "lexer.h"
+#include "parser.h"
+#include "arena.h"
+#include "intern.h"
+#include "diagnostics.h"
+
+/* The same as compiling a unit up to its AST, which is thrown away */
+static void tokenizeAndParse(const uint8_t *data, size_t size) {
+    const char *source = (const char*)data;
+    Interner interner;
+    Diagnostics diagnostics;
+    initInterner(&interner);
+    initDiagnostics(&diagnostics);
+    TokenStream tokens;
+    tokenize(&tokens, source, size, "fuzz.HC", &interner, &diagnostics);
+    freeTokenStream(&tokens);
+
+    Arena arena;
+    initArena(&arena, ARENA_BLOCK_SIZE);
+    Lexer lexer;
+    initLexer(&lexer, source, size, "fuzz.HC", &interner, &diagnostics);
+    parse(&lexer, &arena);
+    freeLexer(&lexer);
+    freeArena(&arena);
+    freeDiagnostics(&diagnostics);
+    freeInterner(&interner);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    tokenizeAndParse(data, size);
+    return 0;
+}
+
+#ifndef LIBFUZZER
+
+#include "source.h"
+#include "profile.h"
+
+#define DEFAULT_TIMEOUT_MS 1000
+#define DEFAULT_MEMORY_MIB 1024
+#define DEFAULT_MAX_SIZE (64 * 1024)
+/* Inputs kept to mutate, the corpus is always kept */
+#define POOL_CAPACITY 1024
+/* Smaller inputs are mostly fixed cost, their time per byte says little */
+#define MIN_MEASURED_SIZE 256
+/* Time per byte of the inputs that were run, sampled to find the median */
+#define SAMPLE_CAPACITY 4096
+/* An input this many times slower per byte than the median is kept as a slow case */
+#define SLOW_FACTOR 50.0
+/* Stress inputs are generated at STRESS_SIZE and STRESS_SCALE times that */
+#define STRESS_SIZE (128 * 1024)
+#define STRESS_SCALE 4
+/* Linear takes STRESS_SCALE times as long, quadratic STRESS_SCALE squared */
+#define STRESS_LIMIT (STRESS_SCALE * 2.0)
+#define STRESS_RUNS 3
+
+typedef struct Text {
+    char *data;
+    size_t length;
+    size_t capacity;
+} Text;
+
+static void *allocOrDie(void *ptr, size_t size) {
+    ptr = realloc(ptr, size ? size : 1);
+    if (ptr == NULL) {
+        fprintf(stderr, "Fatal: Out of memory.\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static void append(Text *text, const char *format, ...) {
+    for (;;) {
+        va_list args;
+        va_start(args, format);
+        int written = vsnprintf(text->data + text->length, text->capacity - text->length, format, args);
+        va_end(args);
+        if (written < 0) {
+            fprintf(stderr, "Fatal: Couldn't format fuzzing input.\n");
+            exit(1);
+        }
+        if ((size_t)written < text->capacity - text->length) {
+            text->length += (size_t)written;
+            return;
+        }
+        text->capacity = text->capacity * 2 + (size_t)written + 1;
+        text->data = allocOrDie(text->data, text->capacity);
+    }
+}
+
+/* xorshift64*, seeded with --seed so a run can be repeated */
+static uint64_t randomState;
+
+static uint32_t nextRandom(uint32_t bound) {
+    randomState ^= randomState >> 12;
+    randomState ^= randomState << 25;
+    randomState ^= randomState >> 27;
+    return (uint32_t)((randomState * 2685821657736338717u) >> 32) % bound;
+}
+
+/* --- Caps, and saving the inputs that break them */
+
+/* What is being run right now, for the handlers */
+static const uint8_t *currentData;
+static size_t currentSize;
+static const char *currentStress; /* Generated inputs are named rather than saved, they can be remade */
+static char casePrefix[4096]; /* The corpus directory and a separator, "" if there is none */
+static unsigned timeoutMs = DEFAULT_TIMEOUT_MS;
+
+static uint64_t hashInput(const uint8_t *data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325u;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ data[i]) * 0x100000001b3u;
+    return hash;
+}
+
+/* <corpus>/<kind>-<hash>.HC, only copies characters so it is safe in a signal handler */
+static void casePath(char *path, size_t capacity, const char *kind, uint64_t hash) {
+    static const char digits[] = "0123456789abcdef";
+    size_t length = 0;
+    for (const char *c = casePrefix; *c && length + 1 < capacity; c++)
+        path[length++] = *c;
+    for (const char *c = kind; *c && length + 1 < capacity; c++)
+        path[length++] = *c;
+    if (length + 21 < capacity) {
+        path[length++] = '-';
+        for (int shift = 60; shift >= 0; shift -= 4)
+            path[length++] = digits[(hash >> shift) & 0xF];
+        memcpy(path + length, ".HC", 3);
+        length += 3;
+    }
+    path[length] = '\0';
+}
+
+static bool saveCase(const char *kind, const uint8_t *data, size_t size) {
+    char path[sizeof(casePrefix) + 64];
+    casePath(path, sizeof(path), kind, hashInput(data, size));
+    FILE *f = fopen(path, "wb");
+    bool saved = f != NULL && fwrite(data, 1, size, f) == size;
+    if (f != NULL)
+        saved = fclose(f) == 0 && saved;
+    if (saved)
+        fprintf(stderr, "Saved the %s case as '%s'.\n", kind, path);
+    else
+        fprintf(stderr, "Couldn't save the %s case as '%s'.\n", kind, path);
+    return saved;
+}
+
+#ifndef _WIN32
+static void writeString(const char *string) {
+    ssize_t written = write(STDERR_FILENO, string, strlen(string));
+    (void)written;
+}
+
+/* saveCase with what is allowed in a signal handler */
+static void saveCurrentCase(const char *kind) {
+    if (currentStress != NULL) {
+        writeString("The ");
+        writeString(currentStress);
+        writeString(" stress input failed, with a ");
+        writeString(kind);
+        writeString(".\n");
+        return;
+    }
+    char path[sizeof(casePrefix) + 64];
+    casePath(path, sizeof(path), kind, hashInput(currentData, currentSize));
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    size_t done = 0;
+    while (fd >= 0 && done < currentSize) {
+        ssize_t written = write(fd, currentData + done, currentSize - done);
+        if (written <= 0)
+            break;
+        done += (size_t)written;
+    }
+    if (fd >= 0)
+        close(fd);
+    writeString(fd >= 0 && done == currentSize ? "Saved the " : "Couldn't save the ");
+    writeString(kind);
+    writeString(" case as '");
+    writeString(path);
+    writeString("'.\n");
+}
+
+static void onSignal(int signal) {
+    if (currentData != NULL)
+        saveCurrentCase(signal == SIGALRM ? "timeout" : "crash");
+    else
+        writeString("Fatal: The harness itself crashed.\n");
+    _exit(1);
+}
+
+static void setTimer(unsigned ms) {
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    timer.it_value.tv_sec = ms / 1000;
+    timer.it_value.tv_usec = (ms % 1000) * 1000;
+    setitimer(ITIMER_REAL, &timer, NULL);
+}
+#else
+static void saveCurrentCase(const char *kind) {
+    if (currentStress != NULL)
+        fprintf(stderr, "The %s stress input failed, with a %s.\n", currentStress, kind);
+    else
+        saveCase(kind, currentData, currentSize);
+}
+#endif /* _WIN32 */
+
+/* Running out of memory is fatal for the compiler, it exits */
+static void onExit(void) {
+    if (currentData != NULL)
+        saveCurrentCase("oom");
+}
+
+/*
+ * The memory cap is on the whole harness, which is the inputs it keeps and not much else.
+ * Windows gets neither the cap nor the handlers, a timeout is only noticed once the input
+ * is done and a crash is left to the system.
+ */
+static void installCaps(size_t memoryMiB) {
+#ifndef _WIN32
+    /* A stack overflow leaves no stack for the handler */
+    static char alternateStack[64 * 1024];
+    stack_t stack;
+    memset(&stack, 0, sizeof(stack));
+    stack.ss_sp = alternateStack;
+    stack.ss_size = sizeof(alternateStack);
+    sigaltstack(&stack, NULL);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSignal;
+    action.sa_flags = SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    static const int signals[] = { SIGSEGV, SIGBUS, SIGABRT, SIGFPE, SIGILL, SIGALRM };
+    for (size_t i = 0; i < sizeof(signals) / sizeof(*signals); i++)
+        sigaction(signals[i], &action, NULL);
+    if (memoryMiB > 0) {
+        struct rlimit limit;
+        limit.rlim_cur = limit.rlim_max = (rlim_t)memoryMiB * 1024 * 1024;
+        if (setrlimit(RLIMIT_AS, &limit) != 0)
+            fprintf(stderr, "Warning: Couldn't cap the memory at %zu MiB.\n", memoryMiB);
+    }
+#else
+    (void)memoryMiB;
+#endif /* _WIN32 */
+    atexit(onExit);
+}
+
+/* Nanoseconds the input took, an input past the timeout doesn't come back on POSIX */
+static uint64_t runInput(const uint8_t *data, size_t size, bool *timedOut) {
+    currentData = data;
+    currentSize = size;
+#ifndef _WIN32
+    setTimer(timeoutMs);
+#endif /* _WIN32 */
+    uint64_t start = profileClock();
+    tokenizeAndParse(data, size);
+    uint64_t elapsed = profileClock() - start;
+#ifndef _WIN32
+    setTimer(0);
+#endif /* _WIN32 */
+    *timedOut = elapsed / 1000000 >= timeoutMs;
+    if (*timedOut)
+        saveCurrentCase("timeout");
+    currentData = NULL;
+    return elapsed;
+}
+
+/* --- Inputs */
+
+typedef struct Input {
+    uint8_t *data;
+    size_t size;
+} Input;
+
+typedef struct Pool {
+    Input *inputs;
+    size_t count;
+    size_t capacity;
+    size_t kept; /* The first kept came from the corpus and are never replaced */
+} Pool;
+
+static void addInput(Pool *pool, const uint8_t *data, size_t size) {
+    Input input = { allocOrDie(NULL, size), size };
+    memcpy(input.data, data, size);
+    if (pool->count == POOL_CAPACITY + pool->kept) {
+        /* Full, one of the mutants goes */
+        size_t replaced = pool->kept + nextRandom((uint32_t)(pool->count - pool->kept));
+        free(pool->inputs[replaced].data);
+        pool->inputs[replaced] = input;
+        return;
+    }
+    if (pool->count == pool->capacity) {
+        pool->capacity = pool->capacity ? pool->capacity * 2 : 64;
+        pool->inputs = allocOrDie(pool->inputs, pool->capacity * sizeof(Input));
+    }
+    pool->inputs[pool->count++] = input;
+}
+
+static bool addFile(Pool *pool, const char *path) {
+    SourceFile source;
+    if (!openSourceFile(&source, path, NULL))
+        return false;
+    addInput(pool, (const uint8_t*)source.data, source.length);
+    closeSourceFile(&source);
+    return true;
+}
+
+/* Every file in directory, in no particular order */
+static bool addDirectory(Pool *pool, const char *directory) {
+    char path[sizeof(casePrefix) + 260];
+#ifdef _WIN32
+    WIN32_FIND_DATAA found;
+    snprintf(path, sizeof(path), "%s\\*", directory);
+    HANDLE find = FindFirstFileA(path, &found);
+    if (find == INVALID_HANDLE_VALUE)
+        return false;
+    do {
+        if (found.cFileName[0] == '.' || (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            continue;
+        snprintf(path, sizeof(path), "%s\\%s", directory, found.cFileName);
+        addFile(pool, path);
+    } while (FindNextFileA(find, &found));
+    FindClose(find);
+#else
+    DIR *dir = opendir(directory);
+    if (dir == NULL)
+        return false;
+    for (struct dirent *entry; (entry = readdir(dir)) != NULL;) {
+        if (entry->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+        addFile(pool, path);
+    }
+    closedir(dir);
+#endif /* _WIN32 */
+    return true;
+}
+
+/* Splicing these in gets through the lexer more often than random bytes do */
+static const char *dictionary[] = {
+    "(", ")", "{", "}", "[", "]", ";", ",", ".", "->", "...", "-", "*", "=", "<", "<=",
+    "if", "else", "for", "while", "switch", "goto", "return", "break", "try", "catch",
+    "class", "union", "extern", "static", "reg", "noreg", "U0", "U8", "I64", "F64",
+    "\"", "'", "\\", "/*", "*/", "//", "\n", "0x", "1e", "9999999999999999999999",
+    "x", "main", "I64 x", "(I64)", "RAX"
+};
+
+/* One random change, the result is at most maxSize bytes */
+static void mutate(Text *out, const Pool *pool, size_t maxSize) {
+    size_t at = out->length ? nextRandom((uint32_t)out->length + 1) : 0;
+    size_t span = out->length > at ? 1 + nextRandom((uint32_t)(out->length - at < 64 ? out->length - at : 64)) : 0;
+    char insert[256];
+    size_t nInsert = 0;
+    size_t removed = 0;
+    switch (nextRandom(6)) {
+        case 0: /* Flip bits */
+            if (out->length > 0) {
+                out->data[nextRandom((uint32_t)out->length)] ^= (char)(1u << nextRandom(8));
+                return;
+            }
+            /* fall through */
+        case 1: /* A random byte */
+            insert[nInsert++] = (char)nextRandom(256);
+            break;
+        case 2: { /* A token */
+            const char *token = dictionary[nextRandom(sizeof(dictionary) / sizeof(*dictionary))];
+            nInsert = strlen(token);
+            memcpy(insert, token, nInsert);
+        } break;
+        case 3: /* Drop a span */
+            removed = span;
+            break;
+        case 4: { /* Repeat a span, the way to find what gets slower the more of it there is */
+            size_t copies = 1 + nextRandom(8);
+            for (size_t i = 0; i < copies && nInsert + span <= sizeof(insert); i++) {
+                memcpy(insert + nInsert, out->data + at, span);
+                nInsert += span;
+            }
+        } break;
+        default: { /* Part of another input */
+            const Input *other = &pool->inputs[nextRandom((uint32_t)pool->count)];
+            if (other->size == 0)
+                return;
+            size_t from = nextRandom((uint32_t)other->size);
+            nInsert = other->size - from < sizeof(insert) ? other->size - from : sizeof(insert);
+            nInsert = 1 + nextRandom((uint32_t)nInsert);
+            memcpy(insert, other->data + from, nInsert);
+        } break;
+    }
+    if (out->length - removed + nInsert > maxSize)
+        return;
+    if (out->length - removed + nInsert + 1 > out->capacity) {
+        out->capacity = (out->length + nInsert) * 2 + 1;
+        out->data = allocOrDie(out->data, out->capacity);
+    }
+    memmove(out->data + at + nInsert, out->data + at + removed, out->length - at - removed);
+    memcpy(out->data + at, insert, nInsert);
+    out->length = out->length - removed + nInsert;
+}
+
+/* --- Statistics */
+
+typedef struct Measurements {
+    uint64_t overhead; /* Of an empty input, taken off every time before dividing by the size */
+    double samples[SAMPLE_CAPACITY]; /* Nanoseconds per byte, reservoir sampled */
+    size_t nSamples;
+    size_t seen;
+    double worst;
+    Text worstInput;
+    size_t inputs;
+    uint64_t bytes;
+    size_t failures; /* Timeouts, everything else ends the run */
+} Measurements;
+
+static double perByte(const Measurements *stats, uint64_t elapsed, size_t size) {
+    return elapsed > stats->overhead ? (double)(elapsed - stats->overhead) / (double)size : 0.0;
+}
+
+/* True if it is the slowest per byte so far */
+static bool measure(Measurements *stats, const uint8_t *data, size_t size) {
+    bool timedOut;
+    uint64_t elapsed = runInput(data, size, &timedOut);
+    stats->inputs += 1;
+    stats->bytes += size;
+    stats->failures += timedOut;
+    if (size < MIN_MEASURED_SIZE)
+        return false;
+    double value = perByte(stats, elapsed, size);
+    if (stats->nSamples < SAMPLE_CAPACITY)
+        stats->samples[stats->nSamples++] = value;
+    else if (nextRandom((uint32_t)(stats->seen + 1)) < SAMPLE_CAPACITY)
+        stats->samples[nextRandom(SAMPLE_CAPACITY)] = value;
+    stats->seen += 1;
+    if (value <= stats->worst)
+        return false;
+    stats->worst = value;
+    stats->worstInput.length = 0;
+    if (size + 1 > stats->worstInput.capacity) {
+        stats->worstInput.capacity = size + 1;
+        stats->worstInput.data = allocOrDie(stats->worstInput.data, stats->worstInput.capacity);
+    }
+    memcpy(stats->worstInput.data, data, size);
+    stats->worstInput.length = size;
+    return true;
+}
+
+static int compareDoubles(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double median(Measurements *stats) {
+    if (stats->nSamples == 0)
+        return 0.0;
+    qsort(stats->samples, stats->nSamples, sizeof(double), compareDoubles);
+    return stats->samples[stats->nSamples / 2];
+}
+
+/* Fastest of a few runs, one slow run is more likely the machine than the input */
+static uint64_t fastestRun(const char *data, size_t size, size_t runs) {
+    uint64_t fastest = UINT64_MAX;
+    for (size_t i = 0; i < runs; i++) {
+        bool timedOut;
+        uint64_t elapsed = runInput((const uint8_t*)data, size, &timedOut);
+        if (elapsed < fastest)
+            fastest = elapsed;
+    }
+    return fastest;
+}
+
+/* --- Stress */
+
+static void generateParens(Text *text, size_t size) {
+    while (text->length < size) {
+        append(text, "x = ");
+        for (unsigned i = 0; i < PARSER_MAX_DEPTH - 16; i++)
+            append(text, "(");
+        append(text, "1");
+        for (unsigned i = 0; i < PARSER_MAX_DEPTH - 16; i++)
+            append(text, ")");
+        append(text, ";\n");
+    }
+}
+
+static void generateBlocks(Text *text, size_t size) {
+    for (unsigned function = 0; text->length < size; function++) {
+        append(text, "U0 F%u() ", function);
+        for (unsigned i = 0; i < PARSER_MAX_DEPTH - 16; i++)
+            append(text, "{");
+        for (unsigned i = 0; i < PARSER_MAX_DEPTH - 16; i++)
+            append(text, "}");
+        append(text, "\n");
+    }
+}
+
+/* One chain for the whole input */
+static void generateElseIf(Text *text, size_t size) {
+    append(text, "U0 F(I64 x) {\n  if (x == 0) { x = 1; }");
+    for (unsigned arm = 1; text->length < size; arm++)
+        append(text, " else if (x == %u) { x = %u; }", arm, arm);
+    append(text, "\n}\n");
+}
+
+/* Every statement is an error the parser has to recover from */
+static void generateErrors(Text *text, size_t size) {
+    for (unsigned i = 0; text->length < size; i++)
+        append(text, "I64 x%u = ;\n", i);
+}
+
+/* The same on a single line, every error quotes the line it is on */
+static void generateErrorsOnOneLine(Text *text, size_t size) {
+    for (unsigned i = 0; text->length < size; i++)
+        append(text, "I64 x%u = ; ", i);
+}
+
+static void generateCasts(Text *text, size_t size) {
+    while (text->length < size) {
+        append(text, "x = ");
+        for (unsigned i = 0; i < 64; i++)
+            append(text, "(I64)");
+        append(text, "y;\n");
+    }
+}
+
+/* A single call with all of the arguments, some of them skipped */
+static void generateArguments(Text *text, size_t size) {
+    append(text, "F(");
+    for (unsigned i = 0; text->length < size; i++)
+        append(text, i % 7 ? "%u, " : ", ", i);
+    append(text, "0);\n");
+}
+
+static void generateClasses(Text *text, size_t size) {
+    for (unsigned i = 0; text->length < size; i++)
+        append(text, "class C%u { I64 a; C%u *next; };\n", i, i);
+}
+
+static void generateIdentifier(Text *text, size_t size) {
+    append(text, "I64 ");
+    while (text->length < size)
+        append(text, "abcdefghijklmnopqrstuvwxyz");
+    append(text, ";\n");
+}
+
+static void generateComment(Text *text, size_t size) {
+    append(text, "/*");
+    while (text->length < size)
+        append(text, " /* nested? */ \" ' \\\n");
+    append(text, "*/\n");
+}
+
+/* Never closed, the lexer gives up at the end of the file */
+static void generateUnterminatedString(Text *text, size_t size) {
+    append(text, "\"");
+    while (text->length < size)
+        append(text, "no end \\\" in sight ");
+}
+
+typedef struct Stress {
+    const char *name;
+    void (*generate)(Text *text, size_t size);
+} Stress;
+
+static const Stress stresses[] = {
+    { "parens", generateParens },
+    { "blocks", generateBlocks },
+    { "else_if", generateElseIf },
+    { "errors", generateErrors },
+    { "errors_one_line", generateErrorsOnOneLine },
+    { "casts", generateCasts },
+    { "arguments", generateArguments },
+    { "classes", generateClasses },
+    { "identifier", generateIdentifier },
+    { "comment", generateComment },
+    { "unterminated_string", generateUnterminatedString }
+};
+
+#define STRESS_COUNT (sizeof(stresses) / sizeof(*stresses))
+
+/* Returns how many grew faster than linearly */
+static size_t runStresses(const Measurements *stats) {
+    size_t failed = 0;
+    printf("%-20s %10s %10s %8s\n", "stress", "ns/B", "ns/B x" "4", "growth");
+    for (size_t i = 0; i < STRESS_COUNT; i++) {
+        currentStress = stresses[i].name;
+        double times[2];
+        size_t sizes[2] = { STRESS_SIZE, STRESS_SIZE * STRESS_SCALE };
+        for (size_t j = 0; j < 2; j++) {
+            Text text = { NULL, 0, 0 };
+            stresses[i].generate(&text, sizes[j]);
+            sizes[j] = text.length;
+            times[j] = (double)(fastestRun(text.data, text.length, STRESS_RUNS) - stats->overhead);
+            free(text.data);
+        }
+        /* How much longer it took than the same number of bytes would have at the small size */
+        double growth = times[1] / times[0] * (double)sizes[0] / (double)sizes[1] * STRESS_SCALE;
+        bool superLinear = growth > STRESS_LIMIT;
+        failed += superLinear;
+        printf("%-20s %10.2f %10.2f %7.1fx%s\n", stresses[i].name, times[0] / (double)sizes[0],
+               times[1] / (double)sizes[1], growth, superLinear ? "  super-linear" : "");
+        fflush(stdout);
+    }
+    currentStress = NULL;
+    return failed;
+}
+
+/* --- Driver */
+
+static void showHelp(const char *argv0) {
+    printf("tinyhcc fuzzer - Looks for inputs that crash, hang or slow down the lexer and parser.\n");
+    printf("Usage: %s [options] [files]\n", argv0);
+    printf(" Files are run once each and nothing else is done, the way AFL runs a target.\n");
+    printf(" --corpus <dir>: Replays dir, mutates it, and saves the cases that fail into it\n");
+    printf(" --seconds <n>: How long to mutate for, default 0\n");
+    printf(" --timeout <ms>: Time an input may take, default %u\n", DEFAULT_TIMEOUT_MS);
+    printf(" --memory <MiB>: Memory the harness may use, 0 for no cap, default %u\n", DEFAULT_MEMORY_MIB);
+    printf(" --max-size <bytes>: Largest input a mutation makes, default %u\n", DEFAULT_MAX_SIZE);
+    printf(" --seed <n>: Seed for the mutations, default 1\n");
+    printf(" --no-stress: Skip the stress inputs\n");
+    printf(" -h, --help: Show this menu\n");
+}
+
+static size_t numberArgument(int argc, const char **argv, int i) {
+    if (i >= argc) {
+        fprintf(stderr, "Expected argument to '%s'.\n", argv[i - 1]);
+        exit(1);
+    }
+    char *end;
+    unsigned long value = strtoul(argv[i], &end, 10);
+    if (*end || end == argv[i]) {
+        fprintf(stderr, "Invalid number '%s'.\n", argv[i]);
+        exit(1);
+    }
+    return value;
+}
+
+int main(int argc, const char **argv) {
+    const char *corpus = NULL;
+    size_t seconds = 0, memoryMiB = DEFAULT_MEMORY_MIB, maxSize = DEFAULT_MAX_SIZE;
+    uint64_t seed = 1;
+    bool stress = true;
+    Pool pool = { NULL, 0, 0, 0 };
+    size_t nFiles = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            showHelp(argv[0]);
+            return 0;
+        } else if (!strcmp(argv[i], "--corpus")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Expected argument to '%s'.\n", argv[i]);
+                return 1;
+            }
+            corpus = argv[++i];
+        } else if (!strcmp(argv[i], "--seconds")) {
+            seconds = numberArgument(argc, argv, ++i);
+        } else if (!strcmp(argv[i], "--timeout")) {
+            timeoutMs = (unsigned)numberArgument(argc, argv, ++i);
+        } else if (!strcmp(argv[i], "--memory")) {
+            memoryMiB = numberArgument(argc, argv, ++i);
+        } else if (!strcmp(argv[i], "--max-size")) {
+            maxSize = numberArgument(argc, argv, ++i);
+        } else if (!strcmp(argv[i], "--seed")) {
+            seed = numberArgument(argc, argv, ++i);
+        } else if (!strcmp(argv[i], "--no-stress")) {
+            stress = false;
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            fprintf(stderr, "Unrecognized argument '%s'.\n", argv[i]);
+            return 1;
+        } else if (!addFile(&pool, argv[i])) {
+            return 1;
+        } else {
+            nFiles += 1;
+        }
+    }
+    if (timeoutMs == 0) {
+        fprintf(stderr, "The timeout has to be at least a millisecond.\n");
+        return 1;
+    }
+    /* Zero would never advance */
+    randomState = seed ? seed : 1;
+    if (corpus != NULL) {
+        int written = snprintf(casePrefix, sizeof(casePrefix), "%s/", corpus);
+        if (written < 0 || (size_t)written >= sizeof(casePrefix)) {
+            fprintf(stderr, "The corpus path is too long.\n");
+            return 1;
+        }
+    }
+    installCaps(memoryMiB);
+
+    if (nFiles > 0) {
+        for (size_t i = 0; i < pool.count; i++) {
+            bool timedOut;
+            runInput(pool.inputs[i].data, pool.inputs[i].size, &timedOut);
+            if (timedOut)
+                return 1;
+        }
+        return 0;
+    }
+
+    static Measurements stats;
+    stats.overhead = fastestRun("", 0, 32);
+    if (corpus != NULL && !addDirectory(&pool, corpus)) {
+        fprintf(stderr, "Couldn't read the corpus '%s'.\n", corpus);
+        return 1;
+    }
+    pool.kept = pool.count;
+    for (size_t i = 0; i < pool.kept; i++)
+        measure(&stats, pool.inputs[i].data, pool.inputs[i].size);
+    printf("Replayed %zu inputs from the corpus.\n", pool.kept);
+    if (pool.count == 0) {
+        static const char seedInput[] = "I64 F(I64 x) {\n  return x * 2;\n}\nF(21);\n";
+        addInput(&pool, (const uint8_t*)seedInput, sizeof(seedInput) - 1);
+    }
+
+    size_t superLinear = stress ? runStresses(&stats) : 0;
+
+    Text mutant = { NULL, 0, 0 };
+    uint64_t deadline = profileClock() + (uint64_t)seconds * 1000000000u;
+    while (seconds > 0 && profileClock() < deadline) {
+        for (size_t batch = 0; batch < 64; batch++) {
+            const Input *parent = &pool.inputs[nextRandom((uint32_t)pool.count)];
+            if (parent->size + 1 > mutant.capacity) {
+                mutant.capacity = parent->size + 1;
+                mutant.data = allocOrDie(mutant.data, mutant.capacity);
+            }
+            memcpy(mutant.data, parent->data, parent->size);
+            mutant.length = parent->size;
+            for (size_t changes = 1 + nextRandom(4); changes > 0; changes--)
+                mutate(&mutant, &pool, maxSize);
+            /* Climbing toward whatever is slowest finds the super-linear paths */
+            if (measure(&stats, (const uint8_t*)mutant.data, mutant.length) || nextRandom(64) == 0)
+                addInput(&pool, (const uint8_t*)mutant.data, mutant.length);
+        }
+    }
+    free(mutant.data);
+
+    double typical = median(&stats);
+    bool slow = false;
+    if (stats.worstInput.length > 0) {
+        double worst = perByte(&stats, fastestRun(stats.worstInput.data, stats.worstInput.length, 5), stats.worstInput.length);
+        slow = typical > 0 && worst > typical * SLOW_FACTOR;
+        printf("Ran %zu inputs, %.2f MiB. Median %.2f ns/B, worst %.2f ns/B on %zu bytes%s.\n", stats.inputs,
+               (double)stats.bytes / (1024.0 * 1024.0), typical, worst, stats.worstInput.length,
+               slow ? ", which is slow" : "");
+        if (slow && corpus != NULL)
+            saveCase("slow", (const uint8_t*)stats.worstInput.data, stats.worstInput.length);
+    } else {
+        printf("Ran %zu inputs, none of them large enough to time.\n", stats.inputs);
+    }
+    if (superLinear > 0)
+        fprintf(stderr, "%zu of the stress inputs took super-linear time.\n", superLinear);
+    for (size_t i = 0; i < pool.count; i++)
+        free(pool.inputs[i].data);
+    free(pool.inputs);
+    free(stats.worstInput.data);
+    return stats.failures > 0 || superLinear > 0 || slow ? 1 : 0;
+}
+
+#endif /* LIBFUZZER */
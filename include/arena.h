@@ -0,0 +1,38 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* Default size of a single arena block. Bigger allocations get a block of their own. */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16
+
+typedef struct ArenaBlock ArenaBlock;
+
+/*
+ * A bump allocator. Everything allocated from an arena lives until the arena is
+ * reset or freed, so nothing allocated from it may be passed to free().
+ */
+typedef struct Arena {
+    ArenaBlock *blocks; /* The block currently allocated from, linked to the older ones */
+    size_t blockSize;
+    /* Running totals of arenaAlloc calls and the bytes they handed out, resetting doesn't clear them */
+    size_t allocations;
+    size_t allocatedBytes;
+} Arena;
+
+void initArena(Arena *arena, size_t blockSize);
+void *arenaAlloc(Arena *arena, size_t size);
+/* Grows the last allocation in place if possible, otherwise copies it into a new allocation. */
+void *arenaRealloc(Arena *arena, void *ptr, size_t oldSize, size_t newSize);
+/* Releases every allocation but keeps the first block around for reuse. */
+void resetArena(Arena *arena);
+void freeArena(Arena *arena);
+
+#endif /* ARENA_H */
@@ -0,0 +1,50 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef ASTCACHE_H
+#define ASTCACHE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "flatast.h"
+#include "source.h"
+
+/*
+ * On-disk cache of flattened ASTs. Entries are named after a hash of the
+ * source, the compiler build and the context, so editing a file, its
+ * header or rebuilding the compiler is a miss. An entry is the FlatAst arrays as they are in memory
+ * behind a small header, loading one maps the file and points the arrays
+ * into it, checking a checksum and every reference once but copying nothing.
+ */
+
+/*
+ * Identifies the sources the compiler was built from, build.py passes a hash of all of them.
+ * Without it only a rebuild of the file that uses it tells builds apart
+ */
+#ifndef THCC_BUILD_ID
+#define THCC_BUILD_ID __DATE__ " " __TIME__
+#endif
+
+/* A loaded entry, ast points into file and must not be passed to freeFlatAst */
+typedef struct CachedAst {
+    FlatAst ast;
+    SourceFile file;
+} CachedAst;
+
+/*
+ * Identifies what a source is parsed against besides the built-ins, e.g. the text of a
+ * precompiled header, since that decides which names are types. 0 for nothing.
+ */
+uint64_t cacheContext(const char *prefix, size_t length);
+/* Returns false on a miss, nothing is reported */
+bool loadCachedAst(CachedAst *cached, const char *directory, uint64_t context, const char *source, size_t length);
+void closeCachedAst(CachedAst *cached);
+/* Creates directory if needed. Best effort, returns false if the entry couldn't be written */
+bool storeCachedAst(const char *directory, uint64_t context, const char *source, size_t length, const FlatAst *ast);
+
+#endif /* ASTCACHE_H */
@@ -0,0 +1,44 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#include <stdbool.h>
+
+#include "lexer.h"
+#include "parser.h"
+#include "object.h"
+#include "x86.h"
+
+/*
+ * x86-64 code generation straight from the AST. Every function becomes a symbol
+ * in .text, variables declared at the top level go in .data or .bss, and string
+ * literals in .rodata. Statements at the top level are compiled, in order, into
+ * a main that returns 0. A string on its own as a statement prints it with printf.
+ *
+ * Variables get registers from a linear scan over the whole function, see
+ * regalloc.h, and expressions are evaluated on a small stack of the registers
+ * left over. Classes are laid out like C structs, so they can be shared with C.
+ */
+
+typedef struct Target {
+    ObjectFormat format;
+    const CallingConvention *convention;
+} Target;
+
+/* COFF and the Windows calling convention on Windows, ELF and System V everywhere else */
+Target hostTarget(void);
+
+/*
+ * lexer is the one unit was parsed with, errors and warnings go to its diagnostics.
+ * Functions are compiled on up to jobs threads and then added to object in the order
+ * they were declared, so object is the same however many there are.
+ * Returns false if there were errors, object is incomplete then.
+ */
+bool generateCode(ObjectCode *object, Node *unit, Lexer *lexer, Target target, size_t jobs);
+
+#endif /* CODEGEN_H */
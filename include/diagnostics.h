@@ -0,0 +1,48 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "sourcemap.h"
+
+/*
+ * Buffered error and warning messages of one translation unit. Translation units
+ * compiled in parallel each get their own, the driver prints them in input order.
+ */
+typedef struct Diagnostics {
+    char *buffer;
+    size_t length;
+    size_t capacity;
+} Diagnostics;
+
+void initDiagnostics(Diagnostics *diagnostics);
+void freeDiagnostics(Diagnostics *diagnostics);
+/* printf-style. A NULL diagnostics buffer writes straight to stderr */
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((format(printf, 2, 3)))
+#endif
+void report(Diagnostics *diagnostics, const char *format, ...);
+/*
+ * "file:line:col: message" followed by the offending source line with a caret
+ * under offset. The message is printf-style and has no trailing newline.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((format(printf, 5, 6)))
+#endif
+void reportAt(Diagnostics *diagnostics, SourceMap *map, const char *file, size_t offset, const char *format, ...);
+/* Same as reportAt, but the length bytes from offset on are underlined */
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((format(printf, 6, 7)))
+#endif
+void reportSpan(Diagnostics *diagnostics, SourceMap *map, const char *file, size_t offset, size_t length, const char *format, ...);
+/* Writes out everything reported so far and empties the buffer */
+void flushDiagnostics(Diagnostics *diagnostics, FILE *stream);
+
+#endif /* DIAGNOSTICS_H */
@@ -0,0 +1,76 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "arena.h"
+#include "diagnostics.h"
+#include "intern.h"
+#include "parser.h"
+#include "registry.h"
+#include "sourcemap.h"
+
+/*
+ * A source file kept parsed while it is being edited, e.g. by a language server.
+ * The unit is held as its top-level statements, each in its own arena. An edit
+ * relexes and reparses from the statement it starts in up to the first statement
+ * boundary after it that lines up with an untouched statement, everything from
+ * there on is kept as is.
+ */
+
+typedef struct DocumentItem {
+    Node *node; /* NULL if the statement couldn't be parsed */
+    Arena arena;
+    /* The statement's errors and warnings, reported as if the whole unit had been parsed */
+    Diagnostics diagnostics;
+    /* Had errors, or came after a lexer error. Parsed again by the next edit near it, as is one with warnings */
+    bool failed;
+    /* Offset of the first token, the statement runs up to where the next one starts */
+    size_t start;
+    /* Token offsets in node are off by this much, see documentItem */
+    ptrdiff_t shift;
+    /* Type the statement declares, NULL for most. A top-level statement only ever declares its own name */
+    const char *declares;
+    /* Number of types registered before the statement */
+    size_t typesMark;
+} DocumentItem;
+
+typedef struct Document {
+    char *source;
+    size_t length;
+    size_t capacity;
+    const char *file;
+    /* Lines for the errors, patched by every edit so it isn't built from scratch each time */
+    SourceMap map;
+    Interner *interner;
+    /* The built-ins or header the document started with, plus everything the items declare */
+    TypeRegistry types;
+    DocumentItem *items;
+    size_t nItems;
+    size_t itemsCapacity;
+} Document;
+
+/* Copies source. prefix is as for parseUnit */
+void openDocument(Document *document, const char *file, const char *source, size_t length, Interner *interner, const TypeRegistry *prefix);
+void closeDocument(Document *document);
+/*
+ * Replaces the removed bytes at offset with the length bytes of text and brings the
+ * items up to date. Returns how many statements were parsed again.
+ */
+size_t editDocument(Document *document, size_t offset, size_t removed, const char *text, size_t length);
+/* Top-level statement i with its token offsets matching the current source, NULL if it couldn't be parsed */
+Node *documentItem(Document *document, size_t i);
+/* True if any statement had errors, same as parseUnit returning NULL */
+bool documentFailed(const Document *document);
+/* Appends the errors of every statement in source order */
+void documentDiagnostics(const Document *document, Diagnostics *diagnostics);
+
+#endif /* DOCUMENT_H */
@@ -0,0 +1,181 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef FLATAST_H
+#define FLATAST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lexer.h"
+#include "parser.h"
+
+/* Index of a node, token or extra slot in a FlatAst */
+typedef uint32_t NodeRef;
+
+/* Missing child, token or string, e.g. a for loop without a condition or a skipped argument */
+#define NO_NODE UINT32_MAX
+
+/*
+ * 16 bytes, no pointers. What token, lhs and rhs hold depends on the type:
+ *
+ *   NT_NONE, NT_BREAK                  nothing
+ *   NT_INT, NT_FLOAT, NT_STRING,
+ *   NT_CHAR, NT_VARACCESS, NT_GOTO,
+ *   NT_LABEL                           token is the literal, name or label
+ *   NT_BINOP, NT_ASSIGN                token is the operator, lhs and rhs the operands
+ *   NT_UNARYOP                         token is the operator, lhs the operand
+ *   NT_RETURN                          lhs is the value
+ *   NT_ACCESS                          token is the operator, token + 1 the member, lhs the object
+ *   NT_ARRAYACCESS                     lhs is the array, rhs the index
+ *   NT_WHILE                           lhs is the condition, rhs the body
+ *   NT_TRY                             lhs is the body, rhs the catch body
+ *   NT_FOR                             extra[lhs..lhs+4) is initializer, condition, increment, body
+ *   NT_IF                              rhs cases, extra[lhs..lhs+2*rhs) alternates condition and body,
+ *                                      extra[lhs+2*rhs] is the else case
+ *   NT_FUNCCALL                        extra[lhs] is the function, extra(lhs..lhs+rhs] the arguments
+ *   NT_COMPOUND                        extra[lhs..lhs+rhs) are the statements
+ *   NT_CLASS, NT_UNION                 token is the name, extra[lhs..lhs+rhs) the NT_VARDECL fields
+ *   NT_VARDECL                         token is the name, lhs the initializer, rhs a FlatDeclaration
+ *   NT_FUNCDECL                        token is the name, lhs the NT_COMPOUND body, rhs a FlatDeclaration
+ *
+ * Unused fields are NO_NODE.
+ */
+typedef struct FlatNode {
+    uint8_t type; /* NodeType */
+    NodeRef token;
+    NodeRef lhs;
+    NodeRef rhs;
+} FlatNode;
+
+/* Token with its value as an offset into strings, see flatTokenValue */
+typedef struct FlatToken {
+    uint32_t index;
+    uint32_t len;
+    NodeRef value;
+    uint8_t type; /* TokenType */
+} FlatToken;
+
+typedef struct FlatType {
+    uint32_t qualifiers; /* Qualifier */
+    uint32_t ptrDepth;
+    /* Index of the return type in types for functions, offset of the base type name in strings otherwise */
+    NodeRef base;
+    /* extra[parameters..parameters+nParameters) are NT_VARDECL nodes */
+    NodeRef parameters;
+    uint32_t nParameters;
+} FlatType;
+
+/* Variable and function declarations */
+typedef struct FlatDeclaration {
+    NodeRef type; /* Index into types */
+    uint32_t reg; /* Register */
+    /* sizes[arraySizes..arraySizes+arrayDepth) */
+    NodeRef arraySizes;
+    uint32_t arrayDepth;
+} FlatDeclaration;
+
+/*
+ * AST stored in a few contiguous arrays, everything refers to everything else
+ * by index. There are no pointers, so a FlatAst can be written out and mapped
+ * back in as is. Children always come before their parent, so a forward scan
+ * over nodes sees every operand before the operation using it, and root is the
+ * last node.
+ */
+typedef struct FlatAst {
+    FlatNode *nodes;
+    size_t nNodes;
+    size_t nodesCapacity;
+    FlatToken *tokens;
+    size_t nTokens;
+    size_t tokensCapacity;
+    /* Variable length child lists */
+    NodeRef *extra;
+    size_t nExtra;
+    size_t extraCapacity;
+    /* NUL-terminated token values and type names, each distinct one is stored once */
+    char *strings;
+    size_t nStrings;
+    size_t stringsCapacity;
+    FlatType *types;
+    size_t nTypes;
+    size_t typesCapacity;
+    FlatDeclaration *declarations;
+    size_t nDeclarations;
+    size_t declarationsCapacity;
+    uint64_t *sizes;
+    size_t nSizes;
+    size_t sizesCapacity;
+    NodeRef root;
+} FlatAst;
+
+void initFlatAst(FlatAst *ast);
+void freeFlatAst(FlatAst *ast);
+/* Appends a copy of the tree at node and makes it the root, returns its index */
+NodeRef flattenNode(FlatAst *ast, const Node *node);
+/*
+ * False unless every reference in ast is in bounds, children come before their parents and
+ * tokens are within a source of sourceLength. For ASTs that weren't flattened by this process
+ */
+bool validFlatAst(const FlatAst *ast, size_t sourceLength);
+/*
+ * The pointer AST back from ast, for what still works on Nodes. Nodes and types are
+ * allocated from arena and strings interned, nothing points into ast afterwards.
+ * ast has to be valid, see validFlatAst. Returns the root, NULL if ast is empty.
+ */
+Node *inflateFlatAst(const FlatAst *ast, Arena *arena, Interner *interner);
+
+static inline const FlatNode *flatNode(const FlatAst *ast, NodeRef ref) {
+    return &ast->nodes[ref];
+}
+
+static inline NodeType flatType(const FlatAst *ast, NodeRef ref) {
+    return (NodeType)ast->nodes[ref].type;
+}
+
+/* NULL for nodes without a token */
+static inline const FlatToken *flatToken(const FlatAst *ast, NodeRef ref) {
+    NodeRef token = ast->nodes[ref].token;
+    return token == NO_NODE ? NULL : &ast->tokens[token];
+}
+
+/* Same as Token.value, but not interned and NULL if the token had none */
+static inline const char *flatTokenValue(const FlatAst *ast, const FlatToken *token) {
+    return token->value == NO_NODE ? NULL : &ast->strings[token->value];
+}
+
+static inline const char *flatString(const FlatAst *ast, NodeRef offset) {
+    return &ast->strings[offset];
+}
+
+static inline const NodeRef *flatExtra(const FlatAst *ast, NodeRef start) {
+    return &ast->extra[start];
+}
+
+/* Statements of a compound, or fields of a class or union */
+static inline const NodeRef *flatList(const FlatAst *ast, NodeRef ref, size_t *count) {
+    *count = ast->nodes[ref].rhs;
+    return &ast->extra[ast->nodes[ref].lhs];
+}
+
+static inline NodeRef flatCallee(const FlatAst *ast, NodeRef ref) {
+    return ast->extra[ast->nodes[ref].lhs];
+}
+
+static inline const NodeRef *flatArguments(const FlatAst *ast, NodeRef ref, size_t *count) {
+    *count = ast->nodes[ref].rhs;
+    return &ast->extra[ast->nodes[ref].lhs + 1];
+}
+
+static inline const FlatDeclaration *flatDeclaration(const FlatAst *ast, NodeRef ref) {
+    return &ast->declarations[ast->nodes[ref].rhs];
+}
+
+static inline const FlatType *flatDeclarationType(const FlatAst *ast, NodeRef ref) {
+    return &ast->types[flatDeclaration(ast, ref)->type];
+}
+
+#endif /* FLATAST_H */
@@ -0,0 +1,28 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef FOLD_H
+#define FOLD_H
+
+#include <stdbool.h>
+
+#include "parser.h"
+#include "intern.h"
+
+/*
+ * Constant folding, done by the parser as it builds each operation. Operations on
+ * NT_INT and NT_FLOAT literals are worked out the way HolyC does it at run time,
+ * 64-bit two's complement integers and doubles, and replaced with a literal. Its
+ * token spans the whole expression and its value is the result as text, e.g. "-1".
+ * Anything that would trap or isn't exact, like a division by zero, is left alone.
+ */
+
+/* True if lhs now holds the result, rhs isn't used anymore */
+bool foldBinary(Interner *interner, const char *source, Node *lhs, Token op, const Node *rhs);
+/* True if operand now holds the result of op applied to it */
+bool foldUnary(Interner *interner, const char *source, Token op, Node *operand);
+
+#endif /* FOLD_H */
@@ -0,0 +1,57 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+/* Small integer identifying an interned string, atoms are handed out in insertion order starting at 0 */
+typedef uint32_t Atom;
+
+typedef struct InternEntry {
+    const char *str;
+    uint32_t len;
+    uint32_t hash;
+} InternEntry;
+
+/*
+ * Hash set of unique NUL-terminated strings. Interning the same characters twice
+ * yields the same pointer, so interned strings can be compared with ==.
+ * The strings live until the interner is freed.
+ */
+typedef struct Interner {
+    InternEntry *entries; /* Open addressing, str == NULL marks an empty slot */
+    size_t capacity;
+    size_t count;
+    const char **byAtom; /* Interned strings indexed by atom */
+    size_t byAtomCapacity;
+    Arena strings;
+} Interner;
+
+void initInterner(Interner *interner);
+void freeInterner(Interner *interner);
+const char *intern(Interner *interner, const char *str, size_t len);
+
+static inline const char *internString(Interner *interner, const char *str) {
+    size_t len = 0;
+    while (str[len]) len++;
+    return intern(interner, str, len);
+}
+
+/* Only valid for strings returned by intern */
+static inline Atom atomOf(const char *interned) {
+    return ((const Atom*)interned)[-1];
+}
+
+static inline const char *atomString(const Interner *interner, Atom atom) {
+    return interner->byAtom[atom];
+}
+
+#endif /* INTERN_H */
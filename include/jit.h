@@ -0,0 +1,29 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdbool.h>
+
+#include "object.h"
+#include "diagnostics.h"
+
+/*
+ * Runs a unit's code in this process instead of writing it out. The sections are
+ * copied into memory of their own, relocated against where they ended up, and
+ * main is called. Symbols the unit doesn't define are looked up in the process,
+ * so the C runtime the compiler itself is linked against is available, calls to
+ * them go through stubs since they can be too far away for a rel32.
+ */
+
+/*
+ * Returns false without running anything if object can't be loaded, e.g. because of a
+ * symbol that can't be found, status is main's return value otherwise.
+ */
+bool runObjectCode(const ObjectCode *object, Diagnostics *diagnostics, int *status);
+
+#endif /* JIT_H */
@@ -8,18 +8,46 @@
 #define LEXER_H
 
 #include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "intern.h"
+#include "diagnostics.h"
+#include "sourcemap.h"
 
 typedef enum TokenType {
     TT_EOF,
 
     /* Identifiers */
     TT_IDENTIFIER,
-    TT_KEYWORD,
     TT_INT,
     TT_FLOAT,
     TT_STRING,
     TT_CHAR,
 
+    /* Keywords */
+    TT_KW_IF,
+    TT_KW_ELSE,
+    TT_KW_WHILE,
+    TT_KW_FOR,
+    TT_KW_SWITCH,
+    TT_KW_CASE,
+    TT_KW_ASM,
+    TT_KW_TRY,
+    TT_KW_CATCH,
+    TT_KW_THROW,
+    TT_KW_BREAK,
+    TT_KW_GOTO,
+    TT_KW_RETURN,
+    TT_KW_CLASS,
+    TT_KW_UNION,
+    /* Pseudo keywords */
+    TT_KW_NO_WARN,
+    TT_KW_REG,
+    TT_KW_NOREG,
+    TT_KW_STATIC,
+    TT_KW_EXTERN,
+
     /* Operations */
     TT_ADD,
     TT_SUB,
@@ -78,23 +106,94 @@ typedef enum TokenType {
     TT_DOT,
     TT_COMMA,
     TT_ARROW,
-    TT_ELLIPSIS,
-    TT_COMMA,
-
+    TT_ELLIPSIS
 } TokenType;
 
+/* Limits of the packed Token fields, the lexer rejects sources and tokens that don't fit */
+#define TOKEN_MAX_INDEX UINT32_MAX
+#define TOKEN_MAX_LEN ((1u << 24) - 1)
+
+/* 16 bytes on 64-bit hosts, tokens are copied around freely */
 typedef struct Token {
-    TokenType type;
+    /*
+     * Interned. Identifiers, and the decoded value of string and char literals
+     * that contain escape sequences. NULL for everything else, those tokens are
+     * read straight from the source, see tokenText
+     */
     char *value;
-    /* Positional data for error messages */
-    size_t index;
-    size_t line;
-    size_t col;
-    size_t len;
+    /* Byte offset into the source. Lines and columns are only worked out for diagnostics, see SourceMap */
+    uint32_t index;
+    unsigned len : 24;
+    unsigned type : 8; /* TokenType */
 } Token;
 
-Token *tokenize(const char *source, const char *file);
-void freeTokens(Token* tokens, size_t nTokens);
+/*
+ * A whole file worth of tokens as parallel arrays, 13 bytes per token. values
+ * holds the atom of Token.value, or NO_ATOM if it is NULL. The last token is TT_EOF.
+ */
+#define NO_ATOM UINT32_MAX
+
+typedef struct TokenStream {
+    uint8_t *types;
+    uint32_t *offsets;
+    uint32_t *lengths;
+    Atom *values;
+    size_t count;
+    size_t capacity;
+} TokenStream;
+
+/* Pull-style lexer, produces one token per nextToken call */
+typedef struct Lexer {
+    /* Not necessarily NUL-terminated */
+    const char *source;
+    size_t length;
+    const char *file;
+    Interner *interner;
+    /* Where errors and warnings go, NULL for stderr */
+    Diagnostics *diagnostics;
+    /* Offset of the next token */
+    size_t index;
+    /* Turns offsets into lines and columns for diagnostics, shared with the parser */
+    SourceMap map;
+    /* Set once an error was reported, nextToken only returns TT_EOF afterwards */
+    bool failed;
+} Lexer;
+
+/*
+ * The text a token was lexed from, or its decoded value if it has one.
+ * Quotes are not included for string and char literals.
+ */
+static inline const char *tokenText(Token token, const char *source, size_t *len) {
+    if (token.value != NULL) {
+        size_t n = 0;
+        while (token.value[n]) n++;
+        *len = n;
+        return token.value;
+    }
+    if (token.type == TT_STRING || token.type == TT_CHAR) {
+        *len = token.len - 2;
+        return source + token.index + 1;
+    }
+    *len = token.len;
+    return source + token.index;
+}
+
+void initLexer(Lexer *lexer, const char *source, size_t length, const char *file, Interner *interner, Diagnostics *diagnostics);
+void freeLexer(Lexer *lexer);
+Token nextToken(Lexer *lexer);
+/* Lexes the whole source into stream, false on error */
+bool tokenize(TokenStream *stream, const char *source, size_t length, const char *file, Interner *interner, Diagnostics *diagnostics);
+void freeTokenStream(TokenStream *stream);
+
+static inline Token streamToken(const TokenStream *stream, size_t i, const Interner *interner) {
+    Token token = {
+        .value = stream->values[i] == NO_ATOM ? NULL : (char*)atomString(interner, stream->values[i]),
+        .index = stream->offsets[i],
+        .len = stream->lengths[i],
+        .type = stream->types[i]
+    };
+    return token;
+}
 #ifdef DEBUG
 const char *tokenTypeAsString(Token token);
 #endif /* DEBUG */
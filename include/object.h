@@ -0,0 +1,101 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Machine code and data of a translation unit as the code generator produced
+ * it, before it is written out as an ELF or COFF relocatable object. Symbols
+ * are referred to by index, the first OBJECT_SECTIONS of them stand for the
+ * sections themselves, for references to unnamed data like string literals.
+ */
+
+typedef enum ObjectFormat {
+    OBJECT_ELF,
+    OBJECT_COFF
+} ObjectFormat;
+
+typedef enum SectionId {
+    OBJECT_TEXT,
+    OBJECT_DATA,
+    OBJECT_RODATA,
+    OBJECT_BSS,
+    OBJECT_SECTIONS
+} SectionId;
+
+/* Growable byte buffer */
+typedef struct Section {
+    uint8_t *data; /* Always NULL for .bss, only its length counts */
+    size_t length;
+    size_t capacity;
+    size_t alignment;
+} Section;
+
+typedef struct Symbol {
+    const char *name; /* Interned, except for the section symbols */
+    SectionId section;
+    size_t offset;
+    bool defined; /* Otherwise it comes from another object or library */
+    bool global;
+    bool function;
+} Symbol;
+
+typedef enum RelocationKind {
+    RELOCATION_CALL,     /* rel32 of a call, may go through a PLT */
+    RELOCATION_RELATIVE, /* rel32 to the symbol */
+    RELOCATION_GOT       /* rel32 to a slot holding the address of the symbol, ELF only */
+} RelocationKind;
+
+/*
+ * A 32-bit field at offset in section. It is filled in with the symbol's address plus
+ * addend, relative to the end of the field, which always ends the instruction.
+ */
+typedef struct Relocation {
+    SectionId section;
+    size_t offset;
+    size_t symbol;
+    int64_t addend;
+    RelocationKind kind;
+} Relocation;
+
+typedef struct ObjectCode {
+    Section sections[OBJECT_SECTIONS];
+    Symbol *symbols;
+    size_t nSymbols;
+    size_t symbolsCapacity;
+    Relocation *relocations;
+    size_t nRelocations;
+    size_t relocationsCapacity;
+} ObjectCode;
+
+void initSection(Section *section, size_t alignment);
+void freeSection(Section *section);
+void sectionBytes(Section *section, const void *bytes, size_t length);
+/* Pads the section with zeros to a multiple of alignment, returns the new length */
+size_t alignSection(Section *section, size_t alignment);
+
+static inline void sectionByte(Section *section, uint8_t byte) {
+    if (section->length < section->capacity)
+        section->data[section->length++] = byte;
+    else
+        sectionBytes(section, &byte, 1);
+}
+
+void initObjectCode(ObjectCode *object);
+void freeObjectCode(ObjectCode *object);
+/* Returns the index of the new symbol */
+size_t addSymbol(ObjectCode *object, Symbol symbol);
+void addRelocation(ObjectCode *object, Relocation relocation);
+
+/* Returns false if path couldn't be written */
+bool writeObjectFile(const ObjectCode *object, ObjectFormat format, const char *path);
+
+#endif /* OBJECT_H */
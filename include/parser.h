@@ -12,6 +12,10 @@
 #include <stdbool.h>
 
 #include "lexer.h"
+#include "arena.h"
+#include "intern.h"
+#include "registry.h"
+#include "vector.h"
 
 typedef enum NodeType {
     /* Empty node */
@@ -66,8 +70,9 @@ typedef struct VariableDeclerationNode VariableDeclerationNode;
 
 typedef enum Register {
     /* Pseudo */
-    NONE, /* Either noreg qualifier or no register qualifier at all */
-    AUTO, /* reg qualifier with no provided register */
+    NONE,  /* No register qualifier, the compiler decides */
+    AUTO,  /* reg qualifier with no provided register */
+    NOREG, /* noreg qualifier, always kept in memory */
     /* 64bit */
     REG_RAX,
     REG_RBX,
@@ -188,7 +193,7 @@ typedef struct FunctionCallNode {
 typedef struct FunctionDeclerationNode {
     Type type;
     Token name;
-    CompoundNode *body;
+    Node *body; /* NT_COMPOUND, NULL for prototypes */
 } FunctionDeclerationNode;
 
 typedef struct ArrayAccessNode {
@@ -241,7 +246,7 @@ typedef struct TryNode {
 
 /* For class and union declerations */
 typedef struct TypeNode {
-    VariableDeclerationNode **fields;
+    Node **fields; /* NT_VARDECL */
     size_t nFields;
     Token name;
 } TypeNode;
@@ -258,43 +263,133 @@ struct Node {
 
 /* --- */
 
+/* Number of tokens buffered ahead of the parser, has to be a power of two */
+#define PARSER_LOOKAHEAD 4
+/*
+ * Statements and expressions nested deeper than this are an error. Every level takes
+ * stack, in the parser and in every pass over the tree, and a worker's stack can be small
+ */
+#define PARSER_MAX_DEPTH 256
+
 typedef struct ParserContext {
-    Token *tokens;
-    Token current;
+    /* Tokens are pulled on demand into a ring buffer, lookahead[index % PARSER_LOOKAHEAD] is the current one */
+    Lexer *lexer;
+    Token lookahead[PARSER_LOOKAHEAD];
     size_t index;
-    /* For type parsing */
-    char **types;
-    size_t nTypes;
+    /* Where AST nodes and types are allocated. NULL means malloc, for use with freeNode */
+    Arena *arena;
+    /* For type parsing, type names are interned */
+    Interner *interner;
+    TypeRegistry types;
+    /*
+     * Child lists are built up here and copied out at their final size. A nested
+     * list is always finished before the enclosing one grows again, so each list
+     * is contiguous above the mark it started at, see beginList
+     */
+    Vector scratch;
     /* For printing errors */
     const char *file;
     const char *source;
+    SourceMap *map;
+    Diagnostics *diagnostics;
+    /* Syntax errors reported so far, the unit failed if there were any */
+    size_t errors;
+    /*
+     * Set by the first error of a statement and cleared once the parser has skipped
+     * past it. Whatever goes wrong in between is fallout from that error, not reported
+     */
+    bool panicking;
+    size_t depth; /* Statements and expressions being parsed, see enterNesting */
 } ParserContext;
 
 static inline void advance(ParserContext *ctx) {
-    ctx->current = ctx->tokens[++ctx->index];
+    /* The slot of the current token is refilled with the one PARSER_LOOKAHEAD tokens ahead */
+    ctx->lookahead[ctx->index++ & (PARSER_LOOKAHEAD - 1)] = nextToken(ctx->lexer);
+}
+
+static inline Token *peekToken(ParserContext *ctx, size_t offset) {
+    return &ctx->lookahead[(ctx->index + offset) & (PARSER_LOOKAHEAD - 1)];
+}
+
+static inline void *parserAlloc(ParserContext *ctx, size_t size) {
+    return ctx->arena ? arenaAlloc(ctx->arena, size) : malloc(size);
 }
 
-static inline void registerType(ParserContext *ctx, char *type) {
-    ctx->types = (char**)realloc(ctx->types, (ctx->nTypes + 1) * sizeof(char*));
-    ctx->types[ctx->nTypes++] = type;
+static inline void *parserRealloc(ParserContext *ctx, void *ptr, size_t oldSize, size_t newSize) {
+    return ctx->arena ? arenaRealloc(ctx->arena, ptr, oldSize, newSize) : realloc(ptr, newSize);
 }
 
-static inline void registerTypes(ParserContext *ctx, char **types) {
+static inline void registerType(ParserContext *ctx, const char *type) {
+    addType(&ctx->types, type);
+}
+
+static inline void registerTypes(ParserContext *ctx, const char **types) {
     while (*types) {
-        registerType(ctx, *(types++));
+        registerType(ctx, internString(ctx->interner, *(types++)));
     }
 }
 
+static inline size_t beginList(ParserContext *ctx) {
+    return ctx->scratch.count;
+}
+
+static inline void pushList(ParserContext *ctx, void *item) {
+    vectorPush(&ctx->scratch, item);
+}
+
+/* Throws away a list that won't be finished */
+static inline void dropList(ParserContext *ctx, size_t mark) {
+    ctx->scratch.count = mark;
+}
+
 static inline bool isType(ParserContext *ctx, Token token) {
-    for (size_t i = 0; i < ctx->nTypes; i++)
-        if (!strcmp(token.value, ctx->types[i]))
-            return true;
-    return false;
+    return token.type == TT_IDENTIFIER && containsType(&ctx->types, token.value);
+}
+
+/*
+ * If arena is NULL the AST is allocated with malloc and has to be released with freeNode.
+ * Errors go to the lexer's diagnostics, NULL is returned if there were any. A statement
+ * with a syntax error is skipped up to its ';' or '}' and parsing carries on after it,
+ * so every error in the unit is reported in one go.
+ */
+Node *parse(Lexer *lexer, Arena *arena);
+/*
+ * Same as parse, but the unit starts out with the types in prefix registered instead of
+ * only the built-ins, e.g. the ones declared by a precompiled header. If types isn't NULL
+ * it receives the registry as it was at the end of the unit, it is left alone on errors.
+ */
+Node *parseUnit(Lexer *lexer, Arena *arena, const TypeRegistry *prefix, TypeRegistry *types);
+/* The types a unit starts out with, a copy of prefix, or the built-ins if it is NULL */
+void initUnitTypes(TypeRegistry *types, Interner *interner, const TypeRegistry *prefix);
+
+/*
+ * For parsing a unit one top-level statement at a time, e.g. just the part of it an edit
+ * touched. The parser owns types, the registry as it is where parsing starts, until
+ * endParser hands it back with whatever the statements declared added.
+ */
+void beginParser(ParserContext *ctx, Lexer *lexer, TypeRegistry types);
+TypeRegistry endParser(ParserContext *ctx);
+/* Carries on at offset in the lexer's source, which has to be where a token or the source ends */
+void seekParser(ParserContext *ctx, size_t offset);
+/*
+ * Parses the statement at the current token into arena. One with errors is reported and
+ * skipped, NULL is returned for it and ctx->errors goes up. Must not be called at the end.
+ */
+Node *parseTopLevel(ParserContext *ctx, Arena *arena);
+
+/* Where the next statement starts */
+static inline size_t parserOffset(ParserContext *ctx) {
+    return peekToken(ctx, 0)->index;
+}
+
+static inline bool parserAtEnd(ParserContext *ctx) {
+    return peekToken(ctx, 0)->type == TT_EOF;
 }
 
-Node *parse(Token *tokens, const char *file, const char *source);
 void freeNode(Node *node);
+/* Upper case name of a register, e.g. "RAX" */
+char *regAsString(Register reg);
 #ifdef TRANSPILER
-void printNode(Node *node, size_t depth);
+void printNode(FILE *out, Node *node, size_t depth, const char *source);
 #endif /* TRANSPILER */
 #endif /* PARSER_H */
@@ -0,0 +1,37 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef PCH_H
+#define PCH_H
+
+#include <stdbool.h>
+
+#include "parser.h"
+#include "arena.h"
+#include "intern.h"
+#include "registry.h"
+#include "source.h"
+#include "diagnostics.h"
+
+/*
+ * Declarations shared by every translation unit, parsed once and kept around.
+ * The nodes live in their own arena and the names are interned in the interner
+ * the header was loaded with, so it can only be used with units parsed against
+ * that same interner. Units start out from a copy of types instead of parsing
+ * the header again, see parseUnit.
+ */
+typedef struct PrecompiledHeader {
+    SourceFile file;
+    Arena arena;
+    Node *declarations; /* NT_COMPOUND */
+    TypeRegistry types; /* The built-ins and every type the header declared */
+} PrecompiledHeader;
+
+/* Errors go to diagnostics, false if the header couldn't be read or parsed */
+bool loadPrecompiledHeader(PrecompiledHeader *header, const char *path, Interner *interner, Diagnostics *diagnostics);
+void freePrecompiledHeader(PrecompiledHeader *header);
+
+#endif /* PCH_H */
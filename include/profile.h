@@ -0,0 +1,51 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "parser.h"
+#include "flatast.h"
+
+/* Front-end profiling for --time-report */
+
+typedef enum Phase {
+    PHASE_READ,        /* Opening and mapping the source */
+    PHASE_LEX,         /* A lexing pass of its own, only made for the report */
+    PHASE_CACHE_LOAD,
+    PHASE_PARSE,       /* Includes lexing, the parser pulls tokens on demand */
+    PHASE_CACHE_STORE, /* Flattening and writing the cache entry */
+    PHASE_CODEGEN,     /* Generating and writing the object file */
+    PHASE_RELEASE,     /* Resetting the arena and unmapping the source */
+    PHASE_COUNT
+} Phase;
+
+typedef struct UnitProfile {
+    uint64_t phases[PHASE_COUNT]; /* Nanoseconds */
+    size_t bytes;
+    size_t tokens;
+    size_t nodes[NT_COMPOUND + 1]; /* Indexed by NodeType */
+    /* Arena allocations made for the AST and for interned strings */
+    size_t astAllocations;
+    size_t astBytes;
+    size_t stringAllocations;
+    size_t stringBytes;
+    bool cached;
+} UnitProfile;
+
+/* Nanoseconds since some fixed point, only differences mean anything */
+uint64_t profileClock(void);
+void countNodes(UnitProfile *profile, Node *root);
+void countFlatNodes(UnitProfile *profile, const FlatAst *ast);
+/* One entry per unit and their sum as JSON, wall is how long the whole run took */
+void printTimeReport(FILE *out, const char **paths, const UnitProfile *profiles, size_t count, uint64_t wall, size_t jobs);
+
+#endif /* PROFILE_H */
@@ -0,0 +1,40 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "parser.h"
+#include "x86.h"
+
+/*
+ * Linear scan register allocation for the variables of a function. Every variable
+ * is live from where it is declared to where it is last used, stretched over any
+ * loop it is used in. Explicit reg pins are honoured, reg on its own wins over no
+ * qualifier when registers run out, and noreg variables always live in memory.
+ */
+
+typedef struct LiveInterval {
+    size_t start;
+    size_t end;
+    bool crossesCall; /* Only registers preserved by calls can hold it */
+    Register request; /* The declared register, AUTO, NONE or NOREG */
+    /* Results */
+    X86Register assigned; /* X86_NONE if it lives in memory */
+    bool pinRefused; /* A pinned register was taken or clobbered by a call, it was allocated as if it were AUTO */
+} LiveInterval;
+
+/* The 64-bit register a variable pinned to reg lives in, e.g. RBX for BL. X86_NONE for XMM registers */
+X86Register machineRegister(Register reg);
+
+/* available are the registers variables can be put in, a request for any other one is treated as AUTO */
+void allocateRegisters(LiveInterval *intervals, size_t count, const X86Register *available, size_t nAvailable,
+                       const CallingConvention *convention);
+
+#endif /* REGALLOC_H */
@@ -0,0 +1,40 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Set of type names keyed by their interner atom. Names have to come from
+ * intern(). Scopes are popped in LIFO order: popping removes everything
+ * registered since the matching push, nothing is ever copied.
+ */
+typedef struct TypeRegistry {
+    const char **slots; /* Open addressing, NULL marks an empty slot */
+    size_t capacity;
+    const char **order; /* Every registered name in insertion order */
+    size_t count;
+    size_t orderCapacity;
+} TypeRegistry;
+
+void initTypeRegistry(TypeRegistry *registry);
+void freeTypeRegistry(TypeRegistry *registry);
+/* copy starts out with everything registered in registry, scopes pushed on it can't pop past that */
+void copyTypeRegistry(TypeRegistry *copy, const TypeRegistry *registry);
+/* Returns false if the name was already registered */
+bool addType(TypeRegistry *registry, const char *name);
+bool containsType(const TypeRegistry *registry, const char *name);
+
+static inline size_t pushTypeScope(const TypeRegistry *registry) {
+    return registry->count;
+}
+
+void popTypeScope(TypeRegistry *registry, size_t scope);
+
+#endif /* REGISTRY_H */
@@ -0,0 +1,32 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+/*
+ * Bulk scanners for the lexer's hot loops. They work on 16 or 32 byte blocks
+ * with SSE2 or AVX2 when the compiler targets them, and byte by byte otherwise.
+ * None of them read at or past length, so the source doesn't have to be padded
+ * or NUL-terminated.
+ */
+
+/* First byte at or after i that isn't ' ', '\t', '\r' or '\n' */
+size_t scanWhitespace(const char *source, size_t i, size_t length);
+/* First byte at or after i that isn't [A-Za-z0-9_] */
+size_t scanIdentifier(const char *source, size_t i, size_t length);
+/* First byte at or after i that isn't [0-9] */
+size_t scanDigits(const char *source, size_t i, size_t length);
+/* First '"' or '\\' at or after i */
+size_t scanString(const char *source, size_t i, size_t length);
+/* First '*' at or after i, for block comments */
+size_t scanStar(const char *source, size_t i, size_t length);
+/* First '\n' at or after i, for line comments */
+size_t scanLine(const char *source, size_t i, size_t length);
+
+#endif /* SCAN_H */
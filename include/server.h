@@ -0,0 +1,59 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * What the compile server and its clients need from the platform. A server is
+ * reached by name, a Unix domain socket at that path, or the named pipe
+ * \\.\pipe\<name> on Windows. A connection is a byte stream both ways.
+ */
+
+typedef struct Listener {
+#ifdef _WIN32
+    char *pipe;
+    void *instance; /* The next client connects to this one */
+#else
+    int socket;
+    char *path; /* Removed again when the listener is closed */
+#endif /* _WIN32 */
+} Listener;
+
+typedef struct Connection {
+#ifdef _WIN32
+    void *handle;
+    bool server;
+    unsigned timeout; /* Milliseconds, 0 for none, see setReceiveTimeout */
+#else
+    int socket;
+#endif /* _WIN32 */
+} Connection;
+
+/* Fails if name is taken by a server that is still up, a socket left behind by one that isn't is replaced */
+bool listenServer(Listener *listener, const char *name);
+void closeListener(Listener *listener);
+/* Blocks until a client connects */
+bool acceptClient(Listener *listener, Connection *connection);
+/* Fails right away if no server is listening on name */
+bool connectServer(Connection *connection, const char *name);
+void closeConnection(Connection *connection);
+
+/* Both return false once the other end is gone */
+bool sendBytes(Connection *connection, const void *data, size_t length);
+bool receiveBytes(Connection *connection, void *data, size_t length);
+/* receiveBytes fails once it has waited milliseconds for the other end, so a stalled client can't hold the server */
+bool setReceiveTimeout(Connection *connection, unsigned milliseconds);
+
+/* Clients send where they were started from, the server resolves their paths against it. NULL if unknown, free it */
+char *workingDirectory(void);
+/* path as seen from directory, a copy of it if it is absolute. NULL if out of memory, free it */
+char *resolvePath(const char *directory, const char *path);
+
+#endif /* SERVER_H */
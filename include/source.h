@@ -0,0 +1,34 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "diagnostics.h"
+
+/*
+ * Contents of an input file. Regular files are memory-mapped, anything that
+ * can't be mapped (pipes, stdin, empty files) is read into a heap buffer.
+ * The data is NOT NUL-terminated, always go by length.
+ */
+typedef struct SourceFile {
+    const char *data;
+    size_t length;
+    bool mapped;
+#ifdef _WIN32
+    void *file;
+    void *mapping;
+#endif /* _WIN32 */
+} SourceFile;
+
+/* A path of "-" reads stdin. Reports to diagnostics and returns false on failure */
+bool openSourceFile(SourceFile *source, const char *path, Diagnostics *diagnostics);
+void closeSourceFile(SourceFile *source);
+
+#endif /* SOURCE_H */
@@ -0,0 +1,38 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef SOURCEMAP_H
+#define SOURCEMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Maps byte offsets to lines and columns. Tokens only carry their offset, the
+ * table of line starts is built the first time a position is asked for, which
+ * normally only happens when a diagnostic is printed.
+ */
+typedef struct SourceMap {
+    const char *source;
+    size_t length;
+    uint32_t *lineStarts; /* NULL until the first lookup */
+    size_t nLines;
+    size_t capacity;
+} SourceMap;
+
+void initSourceMap(SourceMap *map, const char *source, size_t length);
+void freeSourceMap(SourceMap *map);
+/* 1-based line and column of the byte at offset, offset may be length for the end of the file */
+void sourcePosition(SourceMap *map, size_t offset, size_t *line, size_t *col);
+/* Text of a 1-based line without its line break */
+const char *sourceLine(SourceMap *map, size_t line, size_t *len);
+/*
+ * For a source that had the removed bytes at offset replaced with length new ones, source
+ * is the edited text. A table that was built already is patched instead of being thrown away.
+ */
+void editSourceMap(SourceMap *map, const char *source, size_t newLength, size_t offset, size_t removed, size_t length);
+
+#endif /* SOURCEMAP_H */
@@ -0,0 +1,61 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef SYMTAB_H
+#define SYMTAB_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "arena.h"
+
+/*
+ * Scoped symbol table. Every scope is a hash map of its own, keyed by interned
+ * name, with types and everything else kept apart so a variable can share its
+ * name with a type. Names have to come from intern(). The maps are allocated
+ * from an arena and a popped scope's map is reused by the next one pushed, so
+ * nothing is freed until the arena is.
+ */
+
+typedef struct ScopeEntry {
+    const char *name; /* NULL marks an empty slot */
+    bool isType;
+    void *symbol;
+} ScopeEntry;
+
+typedef struct Scope {
+    const struct Scope *parent; /* The enclosing scope, NULL for the outermost one */
+    ScopeEntry *slots; /* Open addressing */
+    size_t capacity;
+    size_t count;
+    struct Scope *unused; /* Next on the list of popped scopes */
+} Scope;
+
+/* Scopes pushed on top of an outer scope the table itself never declares anything in */
+typedef struct SymbolTable {
+    Arena *arena;
+    const Scope *outer;
+    Scope *innermost; /* NULL until a scope is pushed */
+    Scope *unused;
+} SymbolTable;
+
+void initScope(Scope *scope, const Scope *parent);
+/* Replaces what name was declared as in scope itself, returns what that was or NULL */
+void *declareInScope(Scope *scope, Arena *arena, const char *name, bool isType, void *symbol);
+/* Only looks in scope itself, not the ones enclosing it */
+void *findInScope(const Scope *scope, const char *name, bool isType);
+/* The innermost declaration of name visible from scope, NULL if there is none */
+void *lookupInScopes(const Scope *scope, const char *name, bool isType);
+
+/* outer is visible from every scope pushed on table, it may be NULL */
+void initSymbolTable(SymbolTable *table, Arena *arena, const Scope *outer);
+void pushScope(SymbolTable *table);
+void popScope(SymbolTable *table);
+/* Declares name in the innermost scope, one has to be pushed */
+void *declareSymbol(SymbolTable *table, const char *name, bool isType, void *symbol);
+void *lookupSymbol(const SymbolTable *table, const char *name, bool isType);
+
+#endif /* SYMTAB_H */
@@ -0,0 +1,60 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef THREAD_H
+#define THREAD_H
+
+#include <stdbool.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif /* _WIN32 */
+
+/* Thin wrapper over Win32 threads and pthreads, only what the driver needs */
+typedef void (*ThreadFunction)(void *argument);
+
+typedef struct Thread {
+#ifdef _WIN32
+    void *handle;
+#else
+    pthread_t handle;
+#endif /* _WIN32 */
+    ThreadFunction function;
+    void *argument;
+} Thread;
+
+typedef struct Mutex {
+#ifdef _WIN32
+    void *lock; /* SRWLOCK, which is pointer-sized */
+#else
+    pthread_mutex_t lock;
+#endif /* _WIN32 */
+} Mutex;
+
+typedef struct Condition {
+#ifdef _WIN32
+    void *condition; /* CONDITION_VARIABLE, which is pointer-sized */
+#else
+    pthread_cond_t condition;
+#endif /* _WIN32 */
+} Condition;
+
+/* The Thread has to stay alive until it is joined */
+bool startThread(Thread *thread, ThreadFunction function, void *argument);
+void joinThread(Thread *thread);
+
+void initMutex(Mutex *mutex);
+void freeMutex(Mutex *mutex);
+void lockMutex(Mutex *mutex);
+void unlockMutex(Mutex *mutex);
+void initCondition(Condition *condition);
+void freeCondition(Condition *condition);
+/* mutex has to be locked, it is released while waiting. Wakeups can be spurious, check what was waited for again */
+void waitCondition(Condition *condition, Mutex *mutex);
+/* Wakes every thread waiting on condition */
+void wakeCondition(Condition *condition);
+
+#endif /* THREAD_H */
@@ -0,0 +1,29 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef VECTOR_H
+#define VECTOR_H
+
+#include <stddef.h>
+
+/* Growable array of pointers, the capacity doubles whenever it runs out */
+typedef struct Vector {
+    void **items;
+    size_t count;
+    size_t capacity;
+} Vector;
+
+void initVector(Vector *vector);
+void freeVector(Vector *vector);
+void growVector(Vector *vector);
+
+static inline void vectorPush(Vector *vector, void *item) {
+    if (vector->count == vector->capacity)
+        growVector(vector);
+    vector->items[vector->count++] = item;
+}
+
+#endif /* VECTOR_H */
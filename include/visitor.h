@@ -0,0 +1,38 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef VISITOR_H
+#define VISITOR_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "parser.h"
+
+typedef enum VisitStep {
+    VISIT_ENTER, /* Before the first child */
+    VISIT_CHILD, /* Before each child, including missing ones */
+    VISIT_LEAVE  /* After the last child */
+} VisitStep;
+
+/*
+ * child is the position of the child for VISIT_CHILD. Returning false from
+ * VISIT_ENTER skips all children of node, from VISIT_CHILD just that child.
+ * VISIT_LEAVE is always called, the return value is ignored.
+ */
+typedef bool (*NodeVisitor)(void *data, Node *node, VisitStep step, size_t child);
+
+/*
+ * Children in source order. Missing optional children, like the condition of
+ * for (;;) or skipped arguments, are NULL. Types are not traversed.
+ */
+size_t nodeChildCount(const Node *node);
+Node *nodeChild(const Node *node, size_t child);
+
+/* Depth first without recursion, the path to the current node is kept on the heap */
+void visitNode(Node *root, NodeVisitor visitor, void *data);
+
+#endif /* VISITOR_H */
@@ -0,0 +1,162 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef X86_H
+#define X86_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "object.h"
+
+/*
+ * x86-64 instruction encoding. Instructions are appended to the assembler's code,
+ * jumps to labels are patched once every label is bound. Only the forms the code
+ * generator uses are here, all of them operate on 64-bit registers unless a size
+ * is given.
+ */
+
+/* In encoding order */
+typedef enum X86Register {
+    X86_RAX,
+    X86_RCX,
+    X86_RDX,
+    X86_RBX,
+    X86_RSP,
+    X86_RBP,
+    X86_RSI,
+    X86_RDI,
+    X86_R8,
+    X86_R9,
+    X86_R10,
+    X86_R11,
+    X86_R12,
+    X86_R13,
+    X86_R14,
+    X86_R15,
+    X86_REGISTERS,
+    X86_NONE = X86_REGISTERS
+} X86Register;
+
+/* Condition codes as they are encoded in jcc and setcc */
+typedef enum X86Condition {
+    X86_B  = 0x2, /* Unsigned < */
+    X86_AE = 0x3,
+    X86_E  = 0x4,
+    X86_NE = 0x5,
+    X86_BE = 0x6,
+    X86_A  = 0x7,
+    X86_L  = 0xC, /* Signed < */
+    X86_GE = 0xD,
+    X86_LE = 0xE,
+    X86_G  = 0xF
+} X86Condition;
+
+typedef enum X86Operation {
+    X86_ADD = 0,
+    X86_OR  = 1,
+    X86_AND = 4,
+    X86_SUB = 5,
+    X86_XOR = 6,
+    X86_CMP = 7
+} X86Operation;
+
+typedef enum X86Shift {
+    X86_SHL = 4,
+    X86_SHR = 5,
+    X86_SAR = 7
+} X86Shift;
+
+/* How registers are used across calls, see codegen.c for which ones hold what */
+typedef struct CallingConvention {
+    const X86Register *arguments;
+    size_t nArguments;
+    /* Preserved by calls */
+    const X86Register *calleeSaved;
+    size_t nCalleeSaved;
+    /* Bytes the caller reserves for the callee above the return address, 32 on Windows */
+    size_t shadowSpace;
+} CallingConvention;
+
+extern const CallingConvention SYSV_CALLING_CONVENTION;
+extern const CallingConvention WINDOWS_CALLING_CONVENTION;
+
+static inline bool isCalleeSaved(const CallingConvention *convention, X86Register reg) {
+    for (size_t i = 0; i < convention->nCalleeSaved; i++) {
+        if (convention->calleeSaved[i] == reg)
+            return true;
+    }
+    return false;
+}
+
+#define LABEL_UNBOUND SIZE_MAX
+
+typedef struct LabelFixup {
+    size_t label;
+    size_t offset; /* Of the rel32 field */
+} LabelFixup;
+
+typedef struct Assembler {
+    Section code;
+    size_t *labels; /* Offset of every label, LABEL_UNBOUND until it is bound */
+    size_t nLabels;
+    size_t labelsCapacity;
+    LabelFixup *fixups;
+    size_t nFixups;
+    size_t fixupsCapacity;
+} Assembler;
+
+void initAssembler(Assembler *as);
+void freeAssembler(Assembler *as);
+size_t newLabel(Assembler *as);
+void bindLabel(Assembler *as, size_t label);
+/* Fills in every jump, all labels that were jumped to have to be bound */
+void resolveLabels(Assembler *as);
+
+void emitMove(Assembler *as, X86Register to, X86Register from);
+void emitMoveImmediate(Assembler *as, X86Register to, int64_t value);
+/* Loads size bytes from [base + displacement], sign or zero extended to 64 bits */
+void emitLoad(Assembler *as, X86Register to, X86Register base, int32_t displacement, size_t size, bool isSigned);
+void emitStore(Assembler *as, X86Register base, int32_t displacement, X86Register from, size_t size);
+void emitLea(Assembler *as, X86Register to, X86Register base, int32_t displacement);
+/* Sign or zero extends the low size bytes of the register into all of it */
+void emitExtend(Assembler *as, X86Register reg, size_t size, bool isSigned);
+/*
+ * lea to, [rip + rel32] and mov to, [rip + rel32]. Return the offset of the rel32
+ * field, for a relocation, it always ends the instruction.
+ */
+size_t emitLeaRelative(Assembler *as, X86Register to);
+size_t emitLoadRelative(Assembler *as, X86Register to);
+
+void emitOperation(Assembler *as, X86Operation operation, X86Register to, X86Register from);
+void emitOperationImmediate(Assembler *as, X86Operation operation, X86Register to, int32_t value);
+void emitTest(Assembler *as, X86Register a, X86Register b);
+void emitMultiply(Assembler *as, X86Register to, X86Register from);
+void emitMultiplyImmediate(Assembler *as, X86Register to, X86Register from, int32_t value);
+void emitNegate(Assembler *as, X86Register reg);
+void emitShift(Assembler *as, X86Shift shift, X86Register reg); /* By cl */
+void emitShiftImmediate(Assembler *as, X86Shift shift, X86Register reg, uint8_t count);
+/* rdx:rax by divisor, quotient in rax and remainder in rdx. Signed sign-extends rax into rdx first */
+void emitDivide(Assembler *as, X86Register divisor, bool isSigned);
+void emitExchange(Assembler *as, X86Register a, X86Register b);
+/* reg = condition ? 1 : 0 */
+void emitSet(Assembler *as, X86Condition condition, X86Register reg);
+
+void emitPush(Assembler *as, X86Register reg);
+void emitPop(Assembler *as, X86Register reg);
+void emitJump(Assembler *as, size_t label);
+void emitJumpIf(Assembler *as, X86Condition condition, size_t label);
+/* Returns the offset of the rel32 field, for a relocation */
+size_t emitCall(Assembler *as);
+void emitCallRegister(Assembler *as, X86Register reg);
+void emitReturn(Assembler *as);
+
+static inline X86Condition invertCondition(X86Condition condition) {
+    return (X86Condition)(condition ^ 1);
+}
+
+#endif /* X86_H */
@@ -0,0 +1 @@
+gcc -c -o obj/astcache.o -std=c99 -Wall -Werror -pedantic src/astcache.c -Iinclude -D_CRT_SECURE_NO_WARNINGS=1 -DTHCC_BUILD_ID="6257a6c6e4008c35"
\ No newline at end of file
@@ -0,0 +1 @@
+gcc -c -o obj/bench/astcache.o -std=c99 -Wall -Werror -pedantic -O2 src/astcache.c -Iinclude -D_CRT_SECURE_NO_WARNINGS=1 -DTHCC_BUILD_ID="094d9dc0b2dce9bf"
\ No newline at end of file
@@ -0,0 +1 @@
+gcc -c -o obj/bench/lexer.o -std=c99 -Wall -Werror -pedantic -O2 src/lexer.c -Iinclude -D_CRT_SECURE_NO_WARNINGS=1
\ No newline at end of file
@@ -0,0 +1 @@
+gcc -c -o obj/bench/x86.o -std=c99 -Wall -Werror -pedantic -O2 src/x86.c -Iinclude -D_CRT_SECURE_NO_WARNINGS=1
\ No newline at end of file
@@ -0,0 +1 @@
+gcc -c -o obj/fuzz/vector.o -std=c99 -Wall -Werror -pedantic -O2 src/vector.c -Iinclude -D_CRT_SECURE_NO_WARNINGS=1
\ No newline at end of file
@@ -0,0 +1 @@
+gcc -c -o obj/pch.o -std=c99 -Wall -Werror -pedantic src/pch.c -Iinclude -D_CRT_SECURE_NO_WARNINGS=1
\ No newline at end of file
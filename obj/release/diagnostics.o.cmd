@@ -0,0 +1 @@
+gcc -c -o obj/release/diagnostics.o -std=c99 -Wall -Werror -pedantic -O2 -flto src/diagnostics.c -Iinclude -D_CRT_SECURE_NO_WARNINGS=1
\ No newline at end of file
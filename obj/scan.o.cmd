@@ -0,0 +1 @@
+gcc -c -o obj/scan.o -std=c99 -Wall -Werror -pedantic src/scan.c -Iinclude -D_CRT_SECURE_NO_WARNINGS=1
\ No newline at end of file
@@ -0,0 +1 @@
+gcc -c -o obj/thread.o -std=c99 -Wall -Werror -pedantic src/thread.c -Iinclude -D_CRT_SECURE_NO_WARNINGS=1
\ No newline at end of file
@@ -0,0 +1,103 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ALIGN(SIZE) (((SIZE) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+struct ArenaBlock {
+    ArenaBlock *previous;
+    size_t size;
+    size_t used;
+    size_t last; /* Offset of the most recent allocation, for arenaRealloc */
+};
+
+#define BLOCKDATA(BLOCK) ((char*)(BLOCK) + ALIGN(sizeof(ArenaBlock)))
+
+static ArenaBlock *newBlock(ArenaBlock *previous, size_t size) {
+    ArenaBlock *block = malloc(ALIGN(sizeof(ArenaBlock)) + size);
+    if (block == NULL) {
+        fprintf(stderr, "Fatal: Out of memory while allocating an arena block of %zu bytes.\n", size);
+        exit(1);
+    }
+    block->previous = previous;
+    block->size = size;
+    block->used = 0;
+    block->last = 0;
+    return block;
+}
+
+void initArena(Arena *arena, size_t blockSize) {
+    arena->blocks = NULL;
+    arena->blockSize = blockSize ? ALIGN(blockSize) : ARENA_BLOCK_SIZE;
+    arena->allocations = 0;
+    arena->allocatedBytes = 0;
+}
+
+void *arenaAlloc(Arena *arena, size_t size) {
+    size = ALIGN(size ? size : 1);
+    arena->allocations += 1;
+    arena->allocatedBytes += size;
+    ArenaBlock *block = arena->blocks;
+    if (block == NULL || block->size - block->used < size) {
+        if (size > arena->blockSize / 2 && block != NULL) {
+            /* Oversized allocations get their own block behind the current one, so the rest of it isn't wasted */
+            ArenaBlock *big = newBlock(block->previous, size);
+            big->used = size;
+            block->previous = big;
+            return BLOCKDATA(big);
+        }
+        block = newBlock(block, size > arena->blockSize ? size : arena->blockSize);
+        arena->blocks = block;
+    }
+    void *result = BLOCKDATA(block) + block->used;
+    block->last = block->used;
+    block->used += size;
+    return result;
+}
+
+void *arenaRealloc(Arena *arena, void *ptr, size_t oldSize, size_t newSize) {
+    if (ptr == NULL)
+        return arenaAlloc(arena, newSize);
+    ArenaBlock *block = arena->blocks;
+    if ((char*)ptr == BLOCKDATA(block) + block->last && block->last + ALIGN(newSize) <= block->size) {
+        block->used = block->last + ALIGN(newSize ? newSize : 1);
+        return ptr;
+    }
+    if (newSize <= oldSize)
+        return ptr;
+    void *result = arenaAlloc(arena, newSize);
+    memcpy(result, ptr, oldSize);
+    return result;
+}
+
+void resetArena(Arena *arena) {
+    ArenaBlock *block = arena->blocks;
+    if (block == NULL)
+        return;
+    while (block->previous != NULL) {
+        ArenaBlock *previous = block->previous;
+        free(block);
+        block = previous;
+    }
+    block->used = 0;
+    block->last = 0;
+    arena->blocks = block;
+}
+
+void freeArena(Arena *arena) {
+    ArenaBlock *block = arena->blocks;
+    while (block != NULL) {
+        ArenaBlock *previous = block->previous;
+        free(block);
+        block = previous;
+    }
+    arena->blocks = NULL;
+}
@@ -0,0 +1,282 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif /* _WIN32 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define MAKE_DIRECTORY(PATH) _mkdir(PATH)
+#define PROCESS_ID() _getpid()
+#else
+#include <unistd.h>
+#include <sys/stat.h>
+#define MAKE_DIRECTORY(PATH) mkdir((PATH), 0777)
+#define PROCESS_ID() getpid()
+#endif /* _WIN32 */
+
+#include "astcache.h"
+
+/* Bump whenever FlatAst or the header changes shape */
+#define CACHE_FORMAT_VERSION "4"
+/* Every build of the compiler gets its own entries, any part of it might have changed */
+#define COMPILER_ID "tinyhcc/" CACHE_FORMAT_VERSION " " THCC_BUILD_ID
+
+#define CACHE_MAGIC "THCCAST"
+#define CACHE_BYTE_ORDER 0x01020304u
+#define CACHE_ALIGNMENT 8
+
+typedef enum CacheSection {
+    SECTION_NODES,
+    SECTION_TOKENS,
+    SECTION_EXTRA,
+    SECTION_STRINGS,
+    SECTION_TYPES,
+    SECTION_DECLARATIONS,
+    SECTION_SIZES,
+    SECTION_COUNT
+} CacheSection;
+
+static const size_t sectionItemSize[SECTION_COUNT] = {
+    sizeof(FlatNode), sizeof(FlatToken), sizeof(NodeRef), sizeof(char),
+    sizeof(FlatType), sizeof(FlatDeclaration), sizeof(uint64_t)
+};
+
+typedef struct CacheHeader {
+    char magic[8];
+    char compiler[48];
+    uint32_t byteOrder;
+    NodeRef root;
+    uint64_t key;
+    uint64_t sourceLength;
+    uint64_t fileLength;
+    /* Of the sections, a damaged entry is a miss */
+    uint64_t checksum;
+    /* Sections are CACHE_ALIGNMENT aligned, offsets are from the start of the file */
+    uint64_t offsets[SECTION_COUNT];
+    uint64_t counts[SECTION_COUNT];
+} CacheHeader;
+
+/* FNV-1a */
+static uint64_t hashBytes(uint64_t hash, const char *data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
+/* FNV-1a a word at a time, sections are hashed on every load */
+static uint64_t hashWords(uint64_t hash, const char *data, size_t length) {
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(uint64_t));
+        hash ^= word;
+        hash *= 1099511628211u;
+    }
+    return hashBytes(hash, data + i, length - i);
+}
+
+#define HASH_BASIS 14695981039346656037u
+
+uint64_t cacheContext(const char *prefix, size_t length) {
+    return prefix != NULL ? hashBytes(HASH_BASIS, prefix, length) : 0;
+}
+
+static uint64_t cacheKey(uint64_t context, const char *source, size_t length) {
+    uint64_t hash = hashBytes(HASH_BASIS, COMPILER_ID, sizeof(COMPILER_ID));
+    /* Entries are only ever read on the machine that wrote them, byte order doesn't matter */
+    hash = hashBytes(hash, (const char*)&context, sizeof(context));
+    return hashBytes(hash, source, length);
+}
+
+static char *entryPath(const char *directory, uint64_t key) {
+    size_t len = strlen(directory) + 1 + 16 + 4 + 1;
+    char *path = malloc(len);
+    if (path == NULL) {
+        fprintf(stderr, "Fatal: Out of memory while looking up the AST cache.\n");
+        exit(1);
+    }
+    snprintf(path, len, "%s/%016llx.ast", directory, (unsigned long long)key);
+    return path;
+}
+
+static void sectionsOf(const FlatAst *ast, const void **data, uint64_t *counts) {
+    data[SECTION_NODES] = ast->nodes;
+    counts[SECTION_NODES] = ast->nNodes;
+    data[SECTION_TOKENS] = ast->tokens;
+    counts[SECTION_TOKENS] = ast->nTokens;
+    data[SECTION_EXTRA] = ast->extra;
+    counts[SECTION_EXTRA] = ast->nExtra;
+    data[SECTION_STRINGS] = ast->strings;
+    counts[SECTION_STRINGS] = ast->nStrings;
+    data[SECTION_TYPES] = ast->types;
+    counts[SECTION_TYPES] = ast->nTypes;
+    data[SECTION_DECLARATIONS] = ast->declarations;
+    counts[SECTION_DECLARATIONS] = ast->nDeclarations;
+    data[SECTION_SIZES] = ast->sizes;
+    counts[SECTION_SIZES] = ast->nSizes;
+}
+
+static uint64_t sectionsChecksum(const void **data, const uint64_t *counts) {
+    uint64_t hash = HASH_BASIS;
+    for (size_t i = 0; i < SECTION_COUNT; i++)
+        hash = hashWords(hash, data[i], counts[i] * sectionItemSize[i]);
+    return hash;
+}
+
+static bool validHeader(const CacheHeader *header, uint64_t key, size_t sourceLength, size_t fileLength) {
+    char compiler[sizeof(header->compiler)] = { 0 };
+    strncpy(compiler, COMPILER_ID, sizeof(compiler) - 1);
+    if (memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) || memcmp(header->compiler, compiler, sizeof(compiler)))
+        return false;
+    if (header->byteOrder != CACHE_BYTE_ORDER || header->key != key || header->sourceLength != sourceLength)
+        return false;
+    /* A partially written entry is shorter than it claims */
+    if (header->fileLength != fileLength)
+        return false;
+    for (size_t i = 0; i < SECTION_COUNT; i++) {
+        uint64_t offset = header->offsets[i];
+        if (offset % CACHE_ALIGNMENT || offset < sizeof(CacheHeader) || offset > fileLength)
+            return false;
+        if (header->counts[i] > (fileLength - offset) / sectionItemSize[i])
+            return false;
+    }
+    return header->counts[SECTION_NODES] > 0 && header->root < header->counts[SECTION_NODES];
+}
+
+bool loadCachedAst(CachedAst *cached, const char *directory, uint64_t context, const char *source, size_t length) {
+    uint64_t key = cacheKey(context, source, length);
+    char *path = entryPath(directory, key);
+    /* A missing entry is the common case, not an error */
+    Diagnostics ignored;
+    initDiagnostics(&ignored);
+    bool opened = openSourceFile(&cached->file, path, &ignored);
+    freeDiagnostics(&ignored);
+    free(path);
+    if (!opened)
+        return false;
+
+    const char *data = cached->file.data;
+    CacheHeader header;
+    if (cached->file.length < sizeof(CacheHeader)) {
+        closeSourceFile(&cached->file);
+        return false;
+    }
+    memcpy(&header, data, sizeof(CacheHeader));
+    if (!validHeader(&header, key, length, cached->file.length)) {
+        closeSourceFile(&cached->file);
+        return false;
+    }
+
+    /* The arrays are used in place, nothing is copied or fixed up */
+    #define SECTION(INDEX, TYPE) ((TYPE*)(data + header.offsets[INDEX]))
+    cached->ast = (FlatAst) {
+        .nodes = SECTION(SECTION_NODES, FlatNode),
+        .nNodes = header.counts[SECTION_NODES],
+        .tokens = SECTION(SECTION_TOKENS, FlatToken),
+        .nTokens = header.counts[SECTION_TOKENS],
+        .extra = SECTION(SECTION_EXTRA, NodeRef),
+        .nExtra = header.counts[SECTION_EXTRA],
+        .strings = SECTION(SECTION_STRINGS, char),
+        .nStrings = header.counts[SECTION_STRINGS],
+        .types = SECTION(SECTION_TYPES, FlatType),
+        .nTypes = header.counts[SECTION_TYPES],
+        .declarations = SECTION(SECTION_DECLARATIONS, FlatDeclaration),
+        .nDeclarations = header.counts[SECTION_DECLARATIONS],
+        .sizes = SECTION(SECTION_SIZES, uint64_t),
+        .nSizes = header.counts[SECTION_SIZES],
+        .root = header.root
+    };
+    #undef SECTION
+    /* The file may have been damaged or written by something else, nothing in it is trusted. Entries are whole units */
+    const void *sections[SECTION_COUNT];
+    uint64_t counts[SECTION_COUNT];
+    sectionsOf(&cached->ast, sections, counts);
+    if (sectionsChecksum(sections, counts) != header.checksum || !validFlatAst(&cached->ast, length) ||
+            flatType(&cached->ast, cached->ast.root) != NT_COMPOUND) {
+        closeCachedAst(cached);
+        return false;
+    }
+    return true;
+}
+
+void closeCachedAst(CachedAst *cached) {
+    closeSourceFile(&cached->file);
+    initFlatAst(&cached->ast);
+}
+
+static bool writePadded(FILE *f, const void *data, size_t size, uint64_t *offset) {
+    static const char padding[CACHE_ALIGNMENT] = { 0 };
+    if (size > 0 && fwrite(data, 1, size, f) != size)
+        return false;
+    *offset += size;
+    size_t pad = (CACHE_ALIGNMENT - *offset % CACHE_ALIGNMENT) % CACHE_ALIGNMENT;
+    if (pad > 0 && fwrite(padding, 1, pad, f) != pad)
+        return false;
+    *offset += pad;
+    return true;
+}
+
+bool storeCachedAst(const char *directory, uint64_t context, const char *source, size_t length, const FlatAst *ast) {
+    uint64_t key = cacheKey(context, source, length);
+    CacheHeader header;
+    memset(&header, 0, sizeof(CacheHeader));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    strncpy(header.compiler, COMPILER_ID, sizeof(header.compiler) - 1);
+    header.byteOrder = CACHE_BYTE_ORDER;
+    header.root = ast->root;
+    header.key = key;
+    header.sourceLength = length;
+
+    const void *data[SECTION_COUNT];
+    sectionsOf(ast, data, header.counts);
+    header.checksum = sectionsChecksum(data, header.counts);
+    uint64_t offset = sizeof(CacheHeader);
+    offset += (CACHE_ALIGNMENT - offset % CACHE_ALIGNMENT) % CACHE_ALIGNMENT;
+    for (size_t i = 0; i < SECTION_COUNT; i++) {
+        header.offsets[i] = offset;
+        offset += header.counts[i] * sectionItemSize[i];
+        offset += (CACHE_ALIGNMENT - offset % CACHE_ALIGNMENT) % CACHE_ALIGNMENT;
+    }
+    header.fileLength = offset;
+
+    /* Written next to the entry and renamed into place, so readers never see half of one */
+    MAKE_DIRECTORY(directory);
+    char *path = entryPath(directory, key);
+    size_t tmpLen = strlen(path) + 48;
+    char *tmp = malloc(tmpLen);
+    if (tmp == NULL) {
+        fprintf(stderr, "Fatal: Out of memory while writing the AST cache.\n");
+        exit(1);
+    }
+    /* The stack address tells threads apart */
+    snprintf(tmp, tmpLen, "%s.%ld.%p.tmp", path, (long)PROCESS_ID(), (void*)&header);
+    FILE *f = fopen(tmp, "wb");
+    bool ok = f != NULL;
+    if (ok) {
+        uint64_t written = 0;
+        ok = writePadded(f, &header, sizeof(CacheHeader), &written);
+        for (size_t i = 0; ok && i < SECTION_COUNT; i++)
+            ok = writePadded(f, data[i], header.counts[i] * sectionItemSize[i], &written);
+        ok = fclose(f) == 0 && ok;
+    }
+    if (ok)
+        ok = rename(tmp, path) == 0;
+    if (!ok)
+        remove(tmp);
+    free(tmp);
+    free(path);
+    return ok;
+}
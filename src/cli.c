@@ -9,45 +9,188 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "lexer.h"
 #include "parser.h"
+#include "arena.h"
+#include "intern.h"
+#include "source.h"
+#include "diagnostics.h"
+#include "thread.h"
+#include "sourcemap.h"
+#include "flatast.h"
+#include "astcache.h"
+#include "pch.h"
+#include "profile.h"
+#include "server.h"
+#include "object.h"
+#include "codegen.h"
+#include "jit.h"
+
+/* Requests of clients built differently are turned away, they compile on their own */
+#define SERVER_PROTOCOL "tinyhcc/server/1 " THCC_BUILD_ID
+/* Sent for a NULL string */
+#define NO_STRING UINT32_MAX
+/* Milliseconds a server waits for the rest of a request, clients send it all at once */
+#define SERVER_RECEIVE_TIMEOUT 10000
 
 typedef struct CliArgs {
     const char *outFile;
     const char **inFiles;
     size_t nInFiles;
+    size_t jobs;
+    const char *cacheDirectory;
+    const char *headerFile;
+    bool timeReport;
+    bool run; /* --run, execute the files in this process instead of writing them out */
     bool showHelp;
+    const char *serverName; /* --server, run as a compile server listening on it */
+    const char *connectName; /* --connect, hand the files to the server listening on it */
+    const char *stopName; /* --stop-server */
+    const char *directory; /* Relative paths are resolved against it, NULL for the working directory */
 } CliArgs;
 
+/* One input file, compiled independently of the others */
+typedef struct CompileUnit {
+    const char *name; /* As it was given, what diagnostics and the time report call it */
+    char *path; /* What is opened, resolved against the client's directory on a server */
+    char *objectPath; /* Where the object file goes, NULL unless -o was given */
+    Diagnostics diagnostics;
+#ifdef DEBUG
+    FILE *output; /* Debug dumps, stdout when compiling on a single thread */
+#endif /* DEBUG */
+    UnitProfile profile;
+    ObjectCode object; /* Kept for --run until the unit's diagnostics are out */
+    bool hasObject;
+    bool failed;
+} CompileUnit;
+
+typedef struct WorkQueue {
+    CompileUnit *units;
+    size_t count;
+    size_t next;
+    Mutex lock;
+    const char *cacheDirectory; /* NULL unless --cache was given */
+    const char *headerFile; /* NULL unless --header was given */
+    uint64_t cacheContext;
+    bool timeReport;
+    bool run;
+    size_t functionJobs; /* Threads each unit's functions are compiled on, what -j leaves over per file */
+} WorkQueue;
+
+/* Nothing is shared between workers except the queue, each has its own arena and string table */
+typedef struct Worker {
+    WorkQueue *queue;
+    Thread thread;
+    Arena arena;
+    Interner interner;
+    /* Parsed against the worker's own interner, so every worker loads the header itself */
+    PrecompiledHeader header;
+    bool hasHeader;
+    /* What a unit starts out with if there is no header, registered once */
+    TypeRegistry builtins;
+} Worker;
+
+/* Workers and what they have loaded, a server keeps them from one request to the next */
+typedef struct Session {
+    Worker *workers;
+    size_t nWorkers;
+    /* cacheContext of the header the workers have loaded, if any have */
+    uint64_t header;
+} Session;
+
+typedef enum RequestKind {
+    REQUEST_COMPILE,
+    REQUEST_STOP
+} RequestKind;
+
 void showHelp(const char *argv0) {
     printf("tinyhcc - Tiny HolyC compiler.\n");
     printf("Usage: %s <file(s).HC>\n", argv0);
-    printf(" -o, --output <path>: The path to the file/folder to place the final binary in\n");
+    printf("  -: Read a source file from stdin\n");
+    printf(" -o, --output <path>: Write an object file to path, or one per input file into the folder path if there are several\n");
+    printf(" -j, --jobs <n>: Compile up to n files, or functions in a file, in parallel\n");
+    printf(" --cache <dir>: Keep parsed files in dir and skip parsing them again while they are unchanged\n");
+    printf(" --header <file.HC>: Parse the declarations in file once and start every input file with them\n");
+    printf(" --run: Run the files in this process one after the other, the exit code is the last one's\n");
+    printf(" --time-report: Print how long each phase took, node counts and allocations as JSON to stderr\n");
+    printf(" --server <name>: Run as a compile server on the socket or pipe name, -j is how many workers its clients share\n");
+    printf(" --connect <name>: Have the server on name compile the files, or compile them here if there is none\n");
+    printf(" --stop-server <name>: Stop the server on name\n");
     printf(" -h, --help: Show this menu\n");
 }
 
 CliArgs parseArgs(int argc, const char **argv) {
     CliArgs args;
+    args.outFile = NULL;
+    args.inFiles = NULL;
     args.nInFiles = 0;
+    args.jobs = 1;
+    args.cacheDirectory = NULL;
+    args.headerFile = NULL;
+    args.timeReport = false;
+    args.run = false;
+    args.showHelp = false;
+    args.serverName = NULL;
+    args.connectName = NULL;
+    args.stopName = NULL;
+    args.directory = NULL;
     for (int i = 1; i < argc; i++) {
         if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
             args.showHelp = true;
             return args;
         } else if(!strcmp(argv[i], "-o") || !strcmp(argv[i], "--output")) {
-            if (argc == i){
+            if (i + 1 >= argc) {
                 fprintf(stderr, "Expected argument to '%s'.\n", argv[i]);
                 exit(1);
             }
             args.outFile = argv[++i];
+        } else if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Expected argument to '%s'.\n", argv[i]);
+                exit(1);
+            }
+            char *end;
+            unsigned long jobs = strtoul(argv[++i], &end, 10);
+            if (*end || end == argv[i] || jobs == 0) {
+                fprintf(stderr, "Invalid job count '%s'.\n", argv[i]);
+                exit(1);
+            }
+            args.jobs = jobs;
+        } else if (!strcmp(argv[i], "--cache")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Expected argument to '%s'.\n", argv[i]);
+                exit(1);
+            }
+            args.cacheDirectory = argv[++i];
+        } else if (!strcmp(argv[i], "--header")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Expected argument to '%s'.\n", argv[i]);
+                exit(1);
+            }
+            args.headerFile = argv[++i];
+        } else if (!strcmp(argv[i], "--run")) {
+            args.run = true;
+        } else if (!strcmp(argv[i], "--time-report")) {
+            args.timeReport = true;
+        } else if (!strcmp(argv[i], "--server") || !strcmp(argv[i], "--connect") || !strcmp(argv[i], "--stop-server")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Expected argument to '%s'.\n", argv[i]);
+                exit(1);
+            }
+            const char **name = !strcmp(argv[i], "--server") ? &args.serverName :
+                !strcmp(argv[i], "--connect") ? &args.connectName : &args.stopName;
+            *name = argv[++i];
         } else {
             size_t len = strlen(argv[i]);
-            if (len < 3) goto err;
-            if (argv[i][len - 3] == '.' && tolower(argv[i][len - 2]) == 'h' && tolower(argv[i][len - 1]) == 'c') {
+            bool isStdin = !strcmp(argv[i], "-");
+            if (len < 3 && !isStdin) goto err;
+            if (isStdin || (argv[i][len - 3] == '.' && tolower(argv[i][len - 2]) == 'h' && tolower(argv[i][len - 1]) == 'c')) {
                 if (args.nInFiles == 0) {
                     args.inFiles = malloc(sizeof(char*));
                 } else {
-                    args.inFiles = realloc(args.inFiles, sizeof(char*) * args.nInFiles + 1);
+                    args.inFiles = realloc(args.inFiles, sizeof(char*) * (args.nInFiles + 1));
                 }
                 args.inFiles[args.nInFiles++] = argv[i];
                 continue;
@@ -60,66 +203,800 @@ CliArgs parseArgs(int argc, const char **argv) {
     return args;
 }
 
-int main(int argc, const char **argv) {
-    if (argc < 2) {
-        showHelp(argv[0]);
-        return 0;
+/* Lexes the file on its own, so the report can tell lexing and parsing apart */
+static size_t countTokens(Worker *worker, const char *buffer, size_t length, const char *file) {
+    /* Anything wrong is reported by the real pass */
+    Diagnostics ignored;
+    initDiagnostics(&ignored);
+    Lexer lexer;
+    initLexer(&lexer, buffer, length, file, &worker->interner, &ignored);
+    size_t tokens = 0;
+    while (nextToken(&lexer).type != TT_EOF)
+        tokens += 1;
+    freeLexer(&lexer);
+    freeDiagnostics(&ignored);
+    return tokens;
+}
+
+static void releaseUnit(Worker *worker, CompileUnit *unit, SourceFile *source) {
+    uint64_t start = profileClock();
+    resetArena(&worker->arena);
+    closeSourceFile(source);
+    unit->profile.phases[PHASE_RELEASE] += profileClock() - start;
+}
+
+static void generateUnit(Worker *worker, CompileUnit *unit, Node *AST, Lexer *lexer) {
+    uint64_t start = profileClock();
+    ObjectCode object;
+    initObjectCode(&object);
+    Target target = hostTarget();
+    if (!generateCode(&object, AST, lexer, target, worker->queue->functionJobs)) {
+        unit->failed = true;
+    } else if (unit->objectPath != NULL && !writeObjectFile(&object, target.format, unit->objectPath)) {
+        report(&unit->diagnostics, "Fatal: couldn't write object file '%s'.\n", unit->objectPath);
+        unit->failed = true;
     }
-    CliArgs args = parseArgs(argc, argv);
-    for (size_t i = 0; i < args.nInFiles; i++) {
-        FILE *f = fopen(args.inFiles[i], "rb");
-        if (f == NULL) {
-            fprintf(stderr, "Fatal: couldn't open input file '%s'.", args.inFiles[i]);
-            fprintf(stderr, "Aborting.\n");
-            return 1;
-        }
-        fseek(f, 0, SEEK_END);
-        long len = ftell(f);
-        rewind(f);
-
-        char *buffer = malloc(len + 1);
-        if (buffer == NULL) {
-            fprintf(stderr, "Fatal: Input file '%s' too big.", args.inFiles[i]);
-            fprintf(stderr, "Aborting.\n");
-            fclose(f);
-            return 1;
+    if (worker->queue->run && !unit->failed) {
+        unit->object = object;
+        unit->hasObject = true;
+    } else {
+        freeObjectCode(&object);
+    }
+    unit->profile.phases[PHASE_CODEGEN] = profileClock() - start;
+}
+
+static void compileUnit(Worker *worker, CompileUnit *unit) {
+    const char *file = strcmp(unit->name, "-") ? unit->name : "<stdin>";
+    UnitProfile *profile = &unit->profile;
+    uint64_t start = profileClock();
+    SourceFile source;
+    if (!openSourceFile(&source, unit->path, &unit->diagnostics)) {
+        unit->failed = true;
+        return;
+    }
+    /* Not NUL-terminated when mapped, the lexer goes by length */
+    const char *buffer = source.data;
+    profile->phases[PHASE_READ] = profileClock() - start;
+    profile->bytes = source.length;
+
+#ifdef DEBUG
+    TokenStream tokens;
+    /* Lines and columns for the dump only, the lexer has its own map */
+    SourceMap map;
+    initSourceMap(&map, buffer, source.length);
+    bool lexed = tokenize(&tokens, buffer, source.length, file, &worker->interner, &unit->diagnostics);
+    for (size_t i = 0; lexed && tokens.types[i] != TT_EOF; i++) {
+        Token token = streamToken(&tokens, i, &worker->interner);
+        size_t len, line, col;
+        const char *text = tokenText(token, buffer, &len);
+        sourcePosition(&map, token.index, &line, &col);
+        fprintf(unit->output, "%zu type='%s' value='%.*s' line=%zu column=%zu index=%zu len=%zu\n", i, tokenTypeAsString(token), (int)len, text, line, col, (size_t)token.index, (size_t)token.len);
+    }
+    freeTokenStream(&tokens);
+    freeSourceMap(&map);
+#endif /* DEBUG */
+    const char *cache = worker->queue->cacheDirectory;
+    bool timeReport = worker->queue->timeReport;
+#ifndef TRANSPILER
+    /* The transpiler prints the pointer AST, only the flat one is cached */
+    start = profileClock();
+    CachedAst cached;
+    if (cache != NULL && loadCachedAst(&cached, cache, worker->queue->cacheContext, buffer, source.length)) {
+        profile->cached = true;
+        if (timeReport)
+            countFlatNodes(profile, &cached.ast);
+        /* Code is generated from the pointer AST, it's rebuilt from the mapped file instead of parsed */
+        Node *AST = NULL;
+        if (unit->objectPath != NULL || worker->queue->run)
+            AST = inflateFlatAst(&cached.ast, &worker->arena, &worker->interner);
+        closeCachedAst(&cached);
+        profile->phases[PHASE_CACHE_LOAD] = profileClock() - start;
+        if (AST != NULL) {
+            /* Nothing is parsed, the lexer only gives codegen the source and its diagnostics */
+            Lexer lexer;
+            initLexer(&lexer, buffer, source.length, file, &worker->interner, &unit->diagnostics);
+            generateUnit(worker, unit, AST, &lexer);
+            freeLexer(&lexer);
         }
+        releaseUnit(worker, unit, &source);
+        return;
+    }
+    profile->phases[PHASE_CACHE_LOAD] = profileClock() - start;
+#endif /* TRANSPILER */
+    size_t astAllocations = worker->arena.allocations, astBytes = worker->arena.allocatedBytes;
+    size_t stringAllocations = worker->interner.strings.allocations, stringBytes = worker->interner.strings.allocatedBytes;
+    if (timeReport) {
+        start = profileClock();
+        profile->tokens = countTokens(worker, buffer, source.length, file);
+        profile->phases[PHASE_LEX] = profileClock() - start;
+    }
+    /* Tokens are lexed on demand while parsing */
+    start = profileClock();
+    Lexer lexer;
+    initLexer(&lexer, buffer, source.length, file, &worker->interner, &unit->diagnostics);
+    const TypeRegistry *prefix = worker->queue->headerFile != NULL ? &worker->header.types : &worker->builtins;
+    Node *AST = parseUnit(&lexer, &worker->arena, prefix, NULL);
+    profile->phases[PHASE_PARSE] = profileClock() - start;
+    profile->astAllocations = worker->arena.allocations - astAllocations;
+    profile->astBytes = worker->arena.allocatedBytes - astBytes;
+    profile->stringAllocations = worker->interner.strings.allocations - stringAllocations;
+    profile->stringBytes = worker->interner.strings.allocatedBytes - stringBytes;
+    if (AST == NULL) {
+        unit->failed = true;
+        freeLexer(&lexer);
+        releaseUnit(worker, unit, &source);
+        return;
+    }
+    if (timeReport)
+        countNodes(profile, AST);
+    /* Warnings would be lost on a hit, only files that compile cleanly are cached */
+    if (cache != NULL && unit->diagnostics.length == 0) {
+        start = profileClock();
+        FlatAst flat;
+        initFlatAst(&flat);
+        flattenNode(&flat, AST);
+        storeCachedAst(cache, worker->queue->cacheContext, buffer, source.length, &flat);
+        freeFlatAst(&flat);
+        profile->phases[PHASE_CACHE_STORE] = profileClock() - start;
+    }
+#ifdef DEBUG
+#ifdef TRANSPILER
+    for (size_t i = 0; i < ((CompoundNode*)AST->node)->nStatements; i++) {
+        printNode(unit->output, ((CompoundNode*)AST->node)->statements[i], 1, buffer);
+        if (((CompoundNode*)AST->node)->statements[i]->type != NT_LABEL)
+            fprintf(unit->output, ";\n");
+        else
+            fprintf(unit->output, "\n");
+    }
+#else
+    fprintf(unit->output, "Number of statements parsed: %zu\n", ((CompoundNode*)AST->node)->nStatements);
+#endif /* TRANSPILER */
+#endif /* DEBUG */
+
+    if (unit->objectPath != NULL || worker->queue->run)
+        generateUnit(worker, unit, AST, &lexer);
+    freeLexer(&lexer);
+    releaseUnit(worker, unit, &source);
+}
+
+static void runWorker(void *argument) {
+    Worker *worker = argument;
+    WorkQueue *queue = worker->queue;
+    if (queue->headerFile != NULL && !worker->hasHeader) {
+        /* The main thread loaded it first and reported any errors, a worker that can't load it takes no work */
+        Diagnostics ignored;
+        initDiagnostics(&ignored);
+        worker->hasHeader = loadPrecompiledHeader(&worker->header, queue->headerFile, &worker->interner, &ignored);
+        freeDiagnostics(&ignored);
+        if (!worker->hasHeader)
+            return;
+    }
+    for (;;) {
+        lockMutex(&queue->lock);
+        size_t next = queue->next < queue->count ? queue->next++ : queue->count;
+        unlockMutex(&queue->lock);
+        if (next == queue->count)
+            return;
+        compileUnit(worker, &queue->units[next]);
+    }
+}
+
+#ifdef DEBUG
+static void copyStream(FILE *from, FILE *to) {
+    char buffer[4096];
+    size_t read;
+    rewind(from);
+    while ((read = fread(buffer, 1, sizeof(buffer), from)) != 0)
+        fwrite(buffer, 1, read, to);
+}
+#endif /* DEBUG */
+
+static void initSession(Session *session, size_t jobs) {
+    session->workers = calloc(jobs, sizeof(Worker));
+    if (session->workers == NULL) {
+        fprintf(stderr, "Fatal: Out of memory.\n");
+        exit(1);
+    }
+    session->nWorkers = jobs;
+    session->header = 0;
+    for (size_t i = 0; i < jobs; i++) {
+        /* The AST is released with a single arena reset after every translation unit */
+        initArena(&session->workers[i].arena, ARENA_BLOCK_SIZE);
+        /* Identifiers are interned once per worker, for all of its translation units */
+        initInterner(&session->workers[i].interner);
+        initUnitTypes(&session->workers[i].builtins, &session->workers[i].interner, NULL);
+    }
+}
+
+static void dropHeaders(Session *session) {
+    for (size_t i = 0; i < session->nWorkers; i++) {
+        if (session->workers[i].hasHeader)
+            freePrecompiledHeader(&session->workers[i].header);
+        session->workers[i].hasHeader = false;
+    }
+}
+
+static void freeSession(Session *session) {
+    dropHeaders(session);
+    for (size_t i = 0; i < session->nWorkers; i++) {
+        freeTypeRegistry(&session->workers[i].builtins);
+        freeArena(&session->workers[i].arena);
+        freeInterner(&session->workers[i].interner);
+    }
+    free(session->workers);
+}
+
+/*
+ * Has the first worker load the header, the others load it once they start. A header
+ * loaded for an earlier request is kept if the file still has the same contents.
+ */
+static bool prepareHeader(Session *session, const char *path, Diagnostics *diagnostics) {
+    Worker *worker = &session->workers[0];
+    if (worker->hasHeader) {
+        SourceFile file;
+        if (!openSourceFile(&file, path, diagnostics))
+            return false;
+        uint64_t context = cacheContext(file.data, file.length);
+        closeSourceFile(&file);
+        if (context == session->header)
+            return true;
+        dropHeaders(session);
+    }
+    worker->hasHeader = loadPrecompiledHeader(&worker->header, path, &worker->interner, diagnostics);
+    if (worker->hasHeader)
+        session->header = cacheContext(worker->header.file.data, worker->header.file.length);
+    return worker->hasHeader;
+}
+
+/* output itself for a single file, otherwise the folder output with the file's name and an object extension */
+static char *objectPathFor(const char *output, const char *path, bool single) {
+#ifdef _WIN32
+    const char *extension = ".obj";
+#else
+    const char *extension = ".o";
+#endif /* _WIN32 */
+    const char *base = !strcmp(path, "-") ? "stdin" : path;
+    for (const char *c = base; *c; c++) {
+        if (*c == '/' || *c == '\\')
+            base = c + 1;
+    }
+    size_t baseLength = strlen(base), outputLength = strlen(output);
+    const char *dot = strrchr(base, '.');
+    if (dot != NULL && dot != base)
+        baseLength = (size_t)(dot - base);
+    bool separated = outputLength > 0 && (output[outputLength - 1] == '/' || output[outputLength - 1] == '\\');
+    char *objectPath = malloc(outputLength + baseLength + strlen(extension) + 2);
+    if (objectPath == NULL) {
+        fprintf(stderr, "Fatal: Out of memory.\n");
+        exit(1);
+    }
+    if (single)
+        strcpy(objectPath, output);
+    else
+        sprintf(objectPath, "%s%s%.*s%s", output, separated ? "" : "/", (int)baseLength, base, extension);
+    return objectPath;
+}
+
+/* A copy of path as seen from the directory of args, NULL for NULL. stdin is never resolved */
+static char *argumentPath(const CliArgs *args, const char *path) {
+    if (path == NULL)
+        return NULL;
+    char *resolved = resolvePath(args->directory != NULL && strcmp(path, "-") ? args->directory : "", path);
+    if (resolved == NULL) {
+        fprintf(stderr, "Fatal: Out of memory.\n");
+        exit(1);
+    }
+    return resolved;
+}
+
+/* Compiles what args asks for with the session's workers, dumps go to out and diagnostics to err */
+static int compile(Session *session, const CliArgs *args, FILE *out, FILE *err) {
+    uint64_t wallStart = profileClock();
+
+    WorkQueue queue = {
+        .units = calloc(args->nInFiles ? args->nInFiles : 1, sizeof(CompileUnit)),
+        .count = args->nInFiles,
+        .next = 0,
+        .cacheContext = 0,
+        .timeReport = args->timeReport,
+        .run = args->run,
+        /* The server doesn't check what a client sends, so there may be no files at all */
+        .functionJobs = args->nInFiles == 0 ? 1 : args->jobs > args->nInFiles ? args->jobs / args->nInFiles : 1
+    };
+    size_t jobs = args->jobs < args->nInFiles ? args->jobs : args->nInFiles;
+    if (jobs > session->nWorkers)
+        jobs = session->nWorkers;
+    if (jobs == 0)
+        jobs = 1;
+    Worker *workers = session->workers;
+    bool *started = calloc(jobs, sizeof(bool));
+    if (queue.units == NULL || started == NULL) {
+        fprintf(err, "Fatal: Out of memory.\n");
+        free(queue.units);
+        free(started);
+        return 1;
+    }
+    initMutex(&queue.lock);
+    char *outFile = argumentPath(args, args->outFile), *cacheDirectory = argumentPath(args, args->cacheDirectory);
+    char *headerFile = argumentPath(args, args->headerFile);
+    queue.cacheDirectory = cacheDirectory;
+    queue.headerFile = headerFile;
+    for (size_t i = 0; i < args->nInFiles; i++) {
+        queue.units[i].name = args->inFiles[i];
+        queue.units[i].path = argumentPath(args, args->inFiles[i]);
+        queue.units[i].objectPath = outFile != NULL ? objectPathFor(outFile, args->inFiles[i], args->nInFiles == 1) : NULL;
+        initDiagnostics(&queue.units[i].diagnostics);
+    #ifdef DEBUG
+        /* Every unit's dump is collected separately when compiling in parallel, to keep the output in input order */
+        queue.units[i].output = jobs > 1 ? tmpfile() : NULL;
+        if (queue.units[i].output == NULL)
+            queue.units[i].output = out;
+    #endif /* DEBUG */
+    }
 
-        size_t read = fread(buffer, 1, len, f);
-        if (read != len) {
-            fprintf(stderr, "Fatal: Failed to read input file '%s'.", args.inFiles[i]);
-            fprintf(stderr, "Aborting.\n");
-            free(buffer);
-            fclose(f);
-            return 1;
+    for (size_t i = 0; i < jobs; i++)
+        workers[i].queue = &queue;
+    int result = 0;
+    if (args->headerFile != NULL) {
+        Diagnostics diagnostics;
+        initDiagnostics(&diagnostics);
+        if (prepareHeader(session, headerFile, &diagnostics))
+            queue.cacheContext = session->header;
+        else
+            result = 1; /* Nothing is compiled without it */
+        flushDiagnostics(&diagnostics, err);
+        freeDiagnostics(&diagnostics);
+    }
+    if (result == 0) {
+        /* The main thread works the queue too. A worker that failed to start just leaves more work to the others */
+        for (size_t i = 1; i < jobs; i++)
+            started[i] = startThread(&workers[i].thread, runWorker, &workers[i]);
+        runWorker(&workers[0]);
+        for (size_t i = 1; i < jobs; i++) {
+            if (started[i])
+                joinThread(&workers[i].thread);
         }
-        buffer[len] = 0;
+    }
+    free(started);
+    uint64_t wall = profileClock() - wallStart;
 
-        Token *tokens = tokenize(buffer, args.inFiles[i]);
+    for (size_t i = 0; i < args->nInFiles; i++) {
+        CompileUnit *unit = &queue.units[i];
     #ifdef DEBUG
-        for (size_t i = 0; tokens[i].type != TT_EOF; i++) {
-            printf("%zu type='%s' value='%s' line=%zu column=%zu index=%zu len=%zu\n", i, tokenTypeAsString(tokens[i]), tokens[i].value, tokens[i].line, tokens[i].col, tokens[i].index, tokens[i].len);
+        if (unit->output != out) {
+            copyStream(unit->output, out);
+            fclose(unit->output);
         }
     #endif /* DEBUG */
-        Node *AST = parse(tokens, args.inFiles[i], buffer);
-    #ifdef DEBUG
-    #ifdef TRANSPILER
-        for (size_t i = 0; i < ((CompoundNode*)AST->node)->nStatements; i++) {
-            printNode(((CompoundNode*)AST->node)->statements[i], 1);
-            if (((CompoundNode*)AST->node)->statements[i]->type != NT_LABEL)
-                printf(";\n");
+        flushDiagnostics(&unit->diagnostics, err);
+        if (unit->failed)
+            result = 1;
+        /* In input order like the top-level statements of a unit, nothing runs after a unit that failed */
+        if (unit->hasObject && result == 0) {
+            int status;
+            fflush(out);
+            if (runObjectCode(&unit->object, &unit->diagnostics, &status))
+                result = status;
             else
-                printf("\n");
+                result = 1;
+            flushDiagnostics(&unit->diagnostics, err);
         }
-    #else
-        printf("Number of statements parsed: %zu\n", ((CompoundNode*)AST->node)->nStatements);
-    #endif /* TRANSPILER */
-    #endif /* DEBUG */
+        if (unit->hasObject)
+            freeObjectCode(&unit->object);
+        freeDiagnostics(&unit->diagnostics);
+        free(unit->path);
+        free(unit->objectPath);
+    }
+    free(outFile);
+    free(cacheDirectory);
+    free(headerFile);
+    if (args->timeReport) {
+        /* Last, so the report can be cut out of stderr after the diagnostics */
+        UnitProfile *profiles = malloc((args->nInFiles ? args->nInFiles : 1) * sizeof(UnitProfile));
+        if (profiles == NULL) {
+            fprintf(err, "Fatal: Out of memory.\n");
+            result = 1;
+        } else {
+            for (size_t i = 0; i < args->nInFiles; i++)
+                profiles[i] = queue.units[i].profile;
+            printTimeReport(err, args->inFiles, profiles, args->nInFiles, wall, jobs);
+            free(profiles);
+        }
+    }
+    freeMutex(&queue.lock);
+    free(queue.units);
+    return result;
+}
+
+static bool sendNumber(Connection *connection, uint32_t number) {
+    return sendBytes(connection, &number, sizeof(number));
+}
+
+static bool receiveNumber(Connection *connection, uint32_t *number) {
+    return receiveBytes(connection, number, sizeof(*number));
+}
+
+static bool sendString(Connection *connection, const char *string, size_t length) {
+    if (string == NULL)
+        return sendNumber(connection, NO_STRING);
+    return sendNumber(connection, (uint32_t)length) && sendBytes(connection, string, length);
+}
+
+/* NUL-terminated, NULL for a NULL string */
+static bool receiveString(Connection *connection, char **string, size_t *length) {
+    uint32_t received;
+    *string = NULL;
+    if (!receiveNumber(connection, &received))
+        return false;
+    if (received == NO_STRING)
+        return true;
+    *string = malloc((size_t)received + 1);
+    if (*string == NULL || !receiveBytes(connection, *string, received)) {
+        free(*string);
+        *string = NULL;
+        return false;
+    }
+    (*string)[received] = '\0';
+    if (length != NULL)
+        *length = received;
+    return true;
+}
+
+/* Everything written to a temporary file, or NULL if it can't be read back */
+static char *readTemporary(FILE *file, size_t *length) {
+    if (fflush(file) != 0 || fseek(file, 0, SEEK_END) != 0)
+        return NULL;
+    long size = ftell(file);
+    if (size < 0)
+        return NULL;
+    rewind(file);
+    char *contents = malloc((size_t)size + 1);
+    if (contents == NULL)
+        return NULL;
+    *length = fread(contents, 1, (size_t)size, file);
+    return contents;
+}
+
+/* A connection, served on a thread of its own */
+typedef struct Client {
+    struct Server *server;
+    Thread thread;
+    Connection connection;
+    bool finished; /* Set under the server's lock once the thread can be joined */
+    struct Client *next;
+} Client;
+
+/*
+ * What the threads of a server share. Requests are compiled at the same time with sessions
+ * from a pool, which keep what they loaded for later requests. Between them they use no
+ * more workers than the server's -j, a request that would go over waits for some.
+ */
+typedef struct Server {
+    const char *name;
+    Mutex lock;
+    Condition released; /* Workers were given back */
+    size_t jobs;
+    size_t busyWorkers;
+    /* Every request holds at least one worker, so there are never more than jobs sessions */
+    Session **idle;
+    size_t nIdle;
+    size_t nSessions;
+    Client *clients;
+    bool stopping;
+} Server;
+
+/* A session with at least workers workers, which counts workers of the server's as busy until it is released */
+static Session *acquireSession(Server *server, size_t workers, size_t *taken) {
+    lockMutex(&server->lock);
+    while (server->busyWorkers == server->jobs)
+        waitCondition(&server->released, &server->lock);
+    /* What is free now rather than waiting for all of it, the request gets going sooner */
+    size_t available = server->jobs - server->busyWorkers;
+    *taken = workers < available ? workers : available;
+    server->busyWorkers += *taken;
+    Session *session = NULL, *replaced = NULL;
+    size_t fit = server->nIdle;
+    for (size_t i = 0; i < server->nIdle; i++) {
+        size_t size = server->idle[i]->nWorkers;
+        if (size >= *taken && (fit == server->nIdle || size < server->idle[fit]->nWorkers))
+            fit = i;
+    }
+    if (fit < server->nIdle) {
+        session = server->idle[fit];
+        server->idle[fit] = server->idle[--server->nIdle];
+    } else if (server->nSessions == server->jobs) {
+        /* All too small, one makes way for a larger one */
+        replaced = server->idle[--server->nIdle];
+    } else {
+        server->nSessions++;
+    }
+    unlockMutex(&server->lock);
+    if (session != NULL)
+        return session;
+    if (replaced != NULL)
+        freeSession(replaced);
+    session = replaced != NULL ? replaced : malloc(sizeof(Session));
+    if (session == NULL) {
+        fprintf(stderr, "Fatal: Out of memory.\n");
+        exit(1);
+    }
+    initSession(session, *taken);
+    return session;
+}
+
+static void releaseSession(Server *server, Session *session, size_t taken) {
+    lockMutex(&server->lock);
+    server->busyWorkers -= taken;
+    server->idle[server->nIdle++] = session;
+    wakeCondition(&server->released);
+    unlockMutex(&server->lock);
+}
+
+/*
+ * One request. Paths are resolved against the client's working directory. Diagnostics name
+ * the files as the client gave them, except for files that couldn't be opened or written,
+ * which are named by where the server looked.
+ */
+static void serveClient(Server *server, Connection *connection) {
+    char *protocol = NULL;
+    uint32_t kind;
+    bool valid = setReceiveTimeout(connection, SERVER_RECEIVE_TIMEOUT) && receiveString(connection, &protocol, NULL) &&
+        protocol != NULL && !strcmp(protocol, SERVER_PROTOCOL) && receiveNumber(connection, &kind);
+    free(protocol);
+    /* Hanging up tells a client of another build to compile on its own */
+    if (!valid)
+        return;
+    if (kind == REQUEST_STOP) {
+        lockMutex(&server->lock);
+        server->stopping = true;
+        unlockMutex(&server->lock);
+        sendNumber(connection, 0);
+        /* The accepting thread is waiting for a client, this one tells it to look at stopping */
+        Connection wake;
+        if (connectServer(&wake, server->name))
+            closeConnection(&wake);
+        return;
+    }
+
+    CliArgs args;
+    memset(&args, 0, sizeof(CliArgs));
+    char *directory = NULL, *outFile = NULL, *cacheDirectory = NULL, *headerFile = NULL;
+    uint32_t jobs = 0, timeReport = 0, nInFiles = 0;
+    valid = kind == REQUEST_COMPILE && receiveString(connection, &directory, NULL) && directory != NULL &&
+        receiveString(connection, &outFile, NULL) && receiveString(connection, &cacheDirectory, NULL) &&
+        receiveString(connection, &headerFile, NULL) && receiveNumber(connection, &jobs) &&
+        receiveNumber(connection, &timeReport) && receiveNumber(connection, &nInFiles);
+    char **inFiles = valid ? calloc(nInFiles ? nInFiles : 1, sizeof(char*)) : NULL;
+    for (uint32_t i = 0; inFiles != NULL && i < nInFiles; i++) {
+        if (!receiveString(connection, &inFiles[i], NULL) || inFiles[i] == NULL) {
+            valid = false;
+            break;
+        }
+    }
+    /* Workers are only taken once the whole request is in, a client that stalls holds none */
+    if (valid && inFiles != NULL) {
+        size_t taken, wanted = jobs > 0 ? jobs : 1;
+        Session *session = acquireSession(server, wanted < server->jobs ? wanted : server->jobs, &taken);
+        args.outFile = outFile;
+        args.cacheDirectory = cacheDirectory;
+        args.headerFile = headerFile;
+        args.jobs = taken;
+        args.timeReport = timeReport != 0;
+        args.inFiles = (const char**)inFiles;
+        args.nInFiles = nInFiles;
+        args.directory = directory;
+        FILE *out = tmpfile(), *err = tmpfile();
+        int result = 1;
+        /* If there's nowhere to write, the client is told it failed but nothing else */
+        if (out != NULL && err != NULL)
+            result = compile(session, &args, out, err);
+        releaseSession(server, session, taken);
+        size_t outLength = 0, errLength = 0;
+        char *outText = out != NULL ? readTemporary(out, &outLength) : NULL;
+        char *errText = err != NULL ? readTemporary(err, &errLength) : NULL;
+        /* A client that hung up has nothing left to be told */
+        if (sendNumber(connection, (uint32_t)result) && sendString(connection, outText, outLength))
+            sendString(connection, errText, errLength);
+        free(outText);
+        free(errText);
+        if (out != NULL)
+            fclose(out);
+        if (err != NULL)
+            fclose(err);
+    }
+    for (uint32_t i = 0; inFiles != NULL && i < nInFiles; i++)
+        free(inFiles[i]);
+    free(inFiles);
+    free(directory);
+    free(outFile);
+    free(cacheDirectory);
+    free(headerFile);
+}
+
+static void runClient(void *argument) {
+    Client *client = argument;
+    serveClient(client->server, &client->connection);
+    closeConnection(&client->connection);
+    lockMutex(&client->server->lock);
+    client->finished = true;
+    unlockMutex(&client->server->lock);
+}
+
+/* Joins the clients that are done, or all of them. Only the accepting thread changes the list */
+static void joinClients(Server *server, bool all) {
+    Client **link = &server->clients;
+    while (*link != NULL) {
+        Client *client = *link;
+        lockMutex(&server->lock);
+        bool finished = client->finished;
+        unlockMutex(&server->lock);
+        if (!finished && !all) {
+            link = &client->next;
+            continue;
+        }
+        joinThread(&client->thread);
+        *link = client->next;
+        free(client);
+    }
+}
+
+/* Every client is served on a thread of its own, each request with up to -j of the server's workers */
+static int serve(const CliArgs *args) {
+    Listener listener;
+    if (!listenServer(&listener, args->serverName)) {
+        fprintf(stderr, "Couldn't listen on '%s', is another server running on it?\n", args->serverName);
+        return 1;
+    }
+    Server server = {
+        .name = args->serverName,
+        .jobs = args->jobs,
+        .busyWorkers = 0,
+        .idle = calloc(args->jobs, sizeof(Session*)),
+        .nIdle = 0,
+        .nSessions = 0,
+        .clients = NULL,
+        .stopping = false
+    };
+    if (server.idle == NULL) {
+        fprintf(stderr, "Fatal: Out of memory.\n");
+        exit(1);
+    }
+    initMutex(&server.lock);
+    initCondition(&server.released);
+    int result = 0;
+    for (;;) {
+        Connection connection;
+        if (!acceptClient(&listener, &connection)) {
+            fprintf(stderr, "Couldn't accept a client on '%s'.\n", args->serverName);
+            result = 1;
+            break;
+        }
+        lockMutex(&server.lock);
+        bool stopping = server.stopping;
+        unlockMutex(&server.lock);
+        if (stopping) {
+            closeConnection(&connection);
+            break;
+        }
+        joinClients(&server, false);
+        Client *client = calloc(1, sizeof(Client));
+        if (client != NULL) {
+            client->server = &server;
+            client->connection = connection;
+        }
+        if (client == NULL || !startThread(&client->thread, runClient, client)) {
+            /* Hanging up, the client compiles on its own */
+            closeConnection(&connection);
+            free(client);
+            continue;
+        }
+        client->next = server.clients;
+        server.clients = client;
+    }
+    /* Requests that came in before the stop are finished */
+    joinClients(&server, true);
+    for (size_t i = 0; i < server.nIdle; i++) {
+        freeSession(server.idle[i]);
+        free(server.idle[i]);
+    }
+    free(server.idle);
+    freeCondition(&server.released);
+    freeMutex(&server.lock);
+    closeListener(&listener);
+    return result;
+}
 
-        freeNode(AST);
-        freeTokens(tokens);
-        free(buffer);
-        fclose(f);
+static bool sendRequest(Connection *connection, RequestKind kind) {
+    const char *protocol = SERVER_PROTOCOL;
+    return sendString(connection, protocol, strlen(protocol)) && sendNumber(connection, kind);
+}
+
+/* The exit code, or -1 if there is no server to compile the files and they have to be compiled here */
+static int forward(const CliArgs *args) {
+    Connection connection;
+    if (!connectServer(&connection, args->connectName))
+        return -1;
+    char *directory = workingDirectory();
+    bool sent = directory != NULL && sendRequest(&connection, REQUEST_COMPILE) &&
+        sendString(&connection, directory, strlen(directory)) &&
+        sendString(&connection, args->outFile, args->outFile ? strlen(args->outFile) : 0) &&
+        sendString(&connection, args->cacheDirectory, args->cacheDirectory ? strlen(args->cacheDirectory) : 0) &&
+        sendString(&connection, args->headerFile, args->headerFile ? strlen(args->headerFile) : 0) &&
+        sendNumber(&connection, (uint32_t)args->jobs) && sendNumber(&connection, args->timeReport) &&
+        sendNumber(&connection, (uint32_t)args->nInFiles);
+    for (size_t i = 0; sent && i < args->nInFiles; i++)
+        sent = sendString(&connection, args->inFiles[i], strlen(args->inFiles[i]));
+    free(directory);
+    uint32_t result;
+    char *out = NULL, *err = NULL;
+    size_t outLength = 0, errLength = 0;
+    bool received = sent && receiveNumber(&connection, &result) && receiveString(&connection, &out, &outLength) &&
+        receiveString(&connection, &err, &errLength);
+    closeConnection(&connection);
+    if (!received) {
+        free(out);
+        free(err);
+        return -1;
+    }
+    if (out != NULL)
+        fwrite(out, 1, outLength, stdout);
+    if (err != NULL)
+        fwrite(err, 1, errLength, stderr);
+    free(out);
+    free(err);
+    return (int)result;
+}
+
+static int stopServer(const char *name) {
+    Connection connection;
+    uint32_t result;
+    if (!connectServer(&connection, name)) {
+        fprintf(stderr, "No server is running on '%s'.\n", name);
+        return 1;
+    }
+    bool stopped = sendRequest(&connection, REQUEST_STOP) && receiveNumber(&connection, &result);
+    closeConnection(&connection);
+    if (!stopped) {
+        fprintf(stderr, "The server on '%s' didn't stop, is it another build of thcc?\n", name);
+        return 1;
     }
     return 0;
 }
+
+int main(int argc, const char **argv) {
+    if (argc < 2) {
+        showHelp(argv[0]);
+        return 0;
+    }
+    CliArgs args = parseArgs(argc, argv);
+    if (args.showHelp) {
+        showHelp(argv[0]);
+        free(args.inFiles);
+        return 0;
+    }
+    int result = -1;
+    if (args.stopName != NULL) {
+        result = stopServer(args.stopName);
+    } else if (args.serverName != NULL) {
+        result = serve(&args);
+    } else if (args.nInFiles == 0) {
+        fprintf(stderr, "No input files given.\n");
+        result = 1;
+    } else if (args.connectName != NULL) {
+        /* stdin is the client's, a file read from it is compiled here. So is code that is run, it runs in this process */
+        bool readsStdin = false;
+        for (size_t i = 0; i < args.nInFiles; i++)
+            readsStdin = readsStdin || !strcmp(args.inFiles[i], "-");
+        if (!readsStdin && !args.run)
+            result = forward(&args);
+    }
+    if (result < 0) {
+        size_t jobs = args.jobs < args.nInFiles ? args.jobs : args.nInFiles;
+        Session session;
+        initSession(&session, jobs ? jobs : 1);
+        result = compile(&session, &args, stdout, stderr);
+        freeSession(&session);
+    }
+    free(args.inFiles);
+    return result;
+}
@@ -0,0 +1,2418 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "codegen.h"
+#include "regalloc.h"
+#include "visitor.h"
+#include "arena.h"
+#include "symtab.h"
+#include "thread.h"
+#include "vector.h"
+
+#define CODEGEN_INITIAL_CAPACITY 16
+
+/*
+ * Expressions are evaluated on a stack of these, the value of the n-th pending
+ * operand is in temporaries[n % TEMPORARIES]. Once the stack is deeper than that,
+ * the register of the operand TEMPORARIES below is pushed before it is reused.
+ */
+#define TEMPORARIES 4
+static const X86Register temporaries[TEMPORARIES] = { X86_RAX, X86_RCX, X86_RDX, X86_R10 };
+/* Free for the sequences a single operation expands to, never holds a value across nodes */
+#define SCRATCH X86_R11
+/* Stands for printf in the relocations of a function until it is merged, if the unit didn't declare it */
+#define PRINT_SYMBOL SIZE_MAX
+/*
+ * Types, frames and globals are addressed with 32-bit displacements, nothing may be larger.
+ * A multiple of 16, so rounding a size below it up to any alignment still fits
+ */
+#define OBJECT_SIZE_MAX ((size_t)INT32_MAX & ~(size_t)15)
+
+#define CODEGEN_ERROR(CG, TOKEN, ...) do { \
+    reportSpan((CG)->diagnostics, &(CG)->lexer->map, (CG)->lexer->file, (TOKEN).index, (TOKEN).len, __VA_ARGS__); \
+    (CG)->errors++; \
+} while (0)
+
+/* The message has to start with "Warning: " */
+#define CODEGEN_WARNING(CG, TOKEN, ...) \
+    reportSpan((CG)->diagnostics, &(CG)->lexer->map, (CG)->lexer->file, (TOKEN).index, (TOKEN).len, __VA_ARGS__)
+
+#define PUSH(ITEMS, COUNT, CAPACITY, ...) do { \
+    if ((COUNT) == (CAPACITY)) \
+        (ITEMS) = grow((ITEMS), &(CAPACITY), sizeof(*(ITEMS))); \
+    (ITEMS)[(COUNT)++] = __VA_ARGS__; \
+} while (0)
+
+typedef struct BaseType BaseType;
+
+typedef struct ValueType {
+    const BaseType *base;
+    size_t ptrDepth;
+    /* Array dimensions, outermost first. An array used as a value is the address of its first element */
+    const size_t *dims;
+    size_t nDims;
+} ValueType;
+
+typedef struct Field {
+    const char *name;
+    ValueType type;
+    size_t offset;
+} Field;
+
+struct BaseType {
+    const char *name;
+    size_t size;
+    size_t alignment;
+    bool isSigned;
+    bool isAggregate; /* Class or union */
+    bool complete; /* False while the fields of a class are laid out */
+    Field *fields; /* In declaration order */
+    size_t nFields;
+    Scope members; /* Field name to its Field */
+};
+
+typedef enum NameKind {
+    NAME_LOCAL,
+    NAME_GLOBAL,
+    NAME_FUNCTION,
+    NAME_TYPE
+} NameKind;
+
+typedef struct Name {
+    NameKind kind;
+    const char *name;
+    Token token; /* Where it was declared */
+    ValueType type; /* Of a variable, the return type of a function, or the type itself */
+    /* Globals and functions */
+    size_t symbol;
+    /* Functions */
+    VariableDeclerationNode **parameters;
+    size_t nParameters;
+    bool vararg;
+    bool defined; /* Has a body, or isn't extern */
+    /* Locals */
+    Register request;
+    size_t interval; /* SIZE_MAX if it always lives in memory */
+    X86Register home; /* X86_NONE if it lives in memory */
+    int32_t offset; /* From rbp, if it lives in memory */
+} Name;
+
+/* Pointer keyed hash map, open addressing */
+typedef struct PointerMap {
+    const void **keys;
+    void **values;
+    size_t capacity;
+    size_t count;
+} PointerMap;
+
+/*
+ * Functions are compiled in parallel, every thread works on a copy of this with its
+ * own arena and diagnostics. Everything else is only read once the declarations at
+ * the top level are in, what a function produces is kept in its FunctionTask.
+ */
+typedef struct Codegen {
+    ObjectCode *object;
+    Target target;
+    Lexer *lexer; /* Only its interner is written to, before any function is compiled */
+    Diagnostics *diagnostics;
+    Arena arena; /* Types, their fields, and the names at the top level */
+    Scope globals; /* Everything declared at the top level and the built-in types */
+    /* Registers variables can be kept in, the ones calls clobber first */
+    X86Register variables[X86_REGISTERS];
+    size_t nVariables;
+    const BaseType *i64;
+    const BaseType *u64;
+    const BaseType *i32;
+    const BaseType *u8;
+    const BaseType *u0;
+    const char *printName; /* Interned "printf" */
+    size_t printSymbol; /* SIZE_MAX until a string statement needs it and it wasn't declared */
+    size_t errors;
+} Codegen;
+
+/* What compiling a function produced, merged into the object in declaration order */
+typedef struct FunctionTask {
+    const Name *function; /* NULL for main */
+    Node **statements;
+    size_t nStatements;
+    size_t symbol;
+    Section code;
+    Section rodata; /* String literals, relocations against OBJECT_RODATA are relative to it */
+    Relocation *relocations; /* Relative to code */
+    size_t nRelocations;
+    Diagnostics diagnostics;
+    size_t errors;
+} FunctionTask;
+
+typedef struct Span {
+    size_t start;
+    size_t end;
+} Span;
+
+typedef struct LabelName {
+    const char *name;
+    size_t position;
+    size_t label;
+} LabelName;
+
+typedef struct GotoSite {
+    Token label;
+    size_t position;
+} GotoSite;
+
+typedef struct FunctionContext {
+    Codegen *cg;
+    const Name *function; /* NULL for the top-level statements */
+    Node *root; /* The top-level statement being compiled, for telling globals from locals */
+    Assembler as;
+    Section rodata;
+    Relocation *relocations; /* Offsets are into as.code until the function is placed in .text */
+    size_t nRelocations;
+    size_t relocationsCapacity;
+    /* Variables and types declared in the function, parameters first, allocated from arena */
+    Name **locals;
+    size_t nLocals;
+    size_t localsCapacity;
+    Arena arena;
+    SymbolTable symbols; /* What is visible where the analysis is, the globals are the outer scope */
+    /* Node to the Name it refers to or declares */
+    PointerMap resolved;
+
+    /* Liveness, positions count the nodes in the order they are left */
+    size_t position;
+    LiveInterval *intervals;
+    size_t nIntervals;
+    size_t intervalsCapacity;
+    size_t *calls;
+    size_t nCalls;
+    size_t callsCapacity;
+    Span *loops;
+    size_t nLoops;
+    size_t loopsCapacity;
+    size_t *loopStarts;
+    size_t nLoopStarts;
+    size_t loopStartsCapacity;
+    LabelName *labels;
+    size_t nLabels;
+    size_t labelsCapacity;
+    GotoSite *gotos;
+    size_t nGotos;
+    size_t gotosCapacity;
+
+    /* Emission */
+    size_t depth; /* Temporaries in use */
+    Vector spine; /* Operations whose left operands are being generated, see genBinary */
+    size_t stack; /* 8 byte slots pushed since the prologue, rsp is 16 byte aligned when it is even */
+    size_t *breaks; /* Where break jumps to, innermost loop last */
+    size_t nBreaks;
+    size_t breaksCapacity;
+    size_t epilogue;
+    X86Register saved[X86_REGISTERS];
+    size_t nSaved;
+    size_t frameSize;
+} FunctionContext;
+
+typedef enum PlaceKind {
+    PLACE_NONE, /* There were errors */
+    PLACE_REGISTER,
+    PLACE_MEMORY
+} PlaceKind;
+
+/* Something that can be assigned to */
+typedef struct Place {
+    PlaceKind kind;
+    X86Register reg; /* The variable's register, or the base of the address */
+    int32_t displacement;
+    bool ownsTemporary; /* reg is the top temporary, it is released along with the place */
+    ValueType type;
+} Place;
+
+typedef struct Value {
+    X86Register reg; /* Always the top temporary */
+    ValueType type;
+} Value;
+
+static void *grow(void *items, size_t *capacity, size_t size) {
+    size_t grown = *capacity ? *capacity * 2 : CODEGEN_INITIAL_CAPACITY;
+    items = realloc(items, grown * size);
+    if (items == NULL) {
+        fprintf(stderr, "Fatal: Out of memory while generating code.\n");
+        exit(1);
+    }
+    *capacity = grown;
+    return items;
+}
+
+/* --- Pointer maps */
+
+static void initPointerMap(PointerMap *map) {
+    map->keys = NULL;
+    map->values = NULL;
+    map->capacity = 0;
+    map->count = 0;
+}
+
+static void freePointerMap(PointerMap *map) {
+    free((void*)map->keys);
+    free(map->values);
+    initPointerMap(map);
+}
+
+static size_t slotOf(const PointerMap *map, const void *key) {
+    uint64_t hash = ((uint64_t)(uintptr_t)key >> 3) * 0x9E3779B97F4A7C15ull;
+    size_t slot = (size_t)(hash >> 32) & (map->capacity - 1);
+    while (map->keys[slot] != NULL && map->keys[slot] != key)
+        slot = (slot + 1) & (map->capacity - 1);
+    return slot;
+}
+
+static void mapPut(PointerMap *map, const void *key, void *value) {
+    if ((map->count + 1) * 2 > map->capacity) {
+        PointerMap grown = {
+            .capacity = map->capacity ? map->capacity * 2 : CODEGEN_INITIAL_CAPACITY * 4,
+            .count = map->count
+        };
+        grown.keys = calloc(grown.capacity, sizeof(void*));
+        grown.values = malloc(grown.capacity * sizeof(void*));
+        if (grown.keys == NULL || grown.values == NULL) {
+            fprintf(stderr, "Fatal: Out of memory while generating code.\n");
+            exit(1);
+        }
+        for (size_t i = 0; i < map->capacity; i++) {
+            if (map->keys[i] == NULL)
+                continue;
+            size_t slot = slotOf(&grown, map->keys[i]);
+            grown.keys[slot] = map->keys[i];
+            grown.values[slot] = map->values[i];
+        }
+        freePointerMap(map);
+        *map = grown;
+    }
+    size_t slot = slotOf(map, key);
+    if (map->keys[slot] == NULL)
+        map->count += 1;
+    map->keys[slot] = key;
+    map->values[slot] = value;
+}
+
+/* NULL if key isn't in map */
+static void *mapGet(const PointerMap *map, const void *key) {
+    if (map->capacity == 0)
+        return NULL;
+    size_t slot = slotOf(map, key);
+    return map->keys[slot] != NULL ? map->values[slot] : NULL;
+}
+
+/* --- Types */
+
+static ValueType scalarType(const BaseType *base, size_t ptrDepth) {
+    return (ValueType) { .base = base, .ptrDepth = ptrDepth, .dims = NULL, .nDims = 0 };
+}
+
+/* SIZE_MAX if it doesn't fit in a size_t, which is over OBJECT_SIZE_MAX as well */
+static size_t typeSize(ValueType type) {
+    size_t size = type.ptrDepth ? 8 : type.base->size;
+    for (size_t i = 0; i < type.nDims; i++) {
+        if (type.dims[i] != 0 && size > SIZE_MAX / type.dims[i])
+            return SIZE_MAX;
+        size *= type.dims[i];
+    }
+    return size;
+}
+
+static size_t typeAlignment(ValueType type) {
+    if (type.ptrDepth)
+        return 8;
+    return type.base->alignment ? type.base->alignment : 1;
+}
+
+static bool isPointerLike(ValueType type) {
+    return type.ptrDepth > 0 || type.nDims > 0;
+}
+
+static bool isAggregate(ValueType type) {
+    return type.ptrDepth == 0 && type.nDims == 0 && type.base->isAggregate;
+}
+
+/* Fits in a register */
+static bool isScalar(ValueType type) {
+    return type.nDims == 0 && (type.ptrDepth > 0 || (!type.base->isAggregate && type.base->size > 0));
+}
+
+static bool isSignedType(ValueType type) {
+    return type.ptrDepth == 0 && type.nDims == 0 && type.base->isSigned;
+}
+
+/* U64 and pointers, everything narrower is widened to an I64 without losing anything */
+static bool isUnsignedOperand(ValueType type) {
+    return isPointerLike(type) || (!type.base->isSigned && type.base->size == 8);
+}
+
+/* What a pointer points to, or an array is made of, which is an array itself if it has more dimensions */
+static ValueType elementType(ValueType type) {
+    if (type.nDims > 0) {
+        type.dims += 1;
+        type.nDims -= 1;
+        if (type.nDims == 0)
+            type.dims = NULL;
+    } else if (type.ptrDepth > 0) {
+        type.ptrDepth -= 1;
+    }
+    return type;
+}
+
+/* For pointer arithmetic, U0* moves by bytes */
+static size_t elementSize(ValueType type) {
+    size_t size = typeSize(elementType(type));
+    return size ? size : 1;
+}
+
+/* Arithmetic is done on 64 bits, unsigned if either side is a U64 */
+static ValueType arithmeticType(const Codegen *cg, ValueType a, ValueType b) {
+    return scalarType(isUnsignedOperand(a) || isUnsignedOperand(b) ? cg->u64 : cg->i64, 0);
+}
+
+static BaseType *newBaseType(Codegen *cg, const char *name) {
+    BaseType *type = arenaAlloc(&cg->arena, sizeof(BaseType));
+    *type = (BaseType) { .name = name, .complete = true };
+    return type;
+}
+
+/* --- Names */
+
+static Name *newName(Arena *arena, Name name) {
+    Name *copy = arenaAlloc(arena, sizeof(Name));
+    *copy = name;
+    return copy;
+}
+
+static Name *addName(Codegen *cg, Name name) {
+    Name *global = newName(&cg->arena, name);
+    declareInScope(&cg->globals, &cg->arena, global->name, global->kind == NAME_TYPE, global);
+    return global;
+}
+
+/* Types and everything else share a namespace at the top level, only one of them is ever declared */
+static Name *lookupGlobal(const Codegen *cg, const char *name) {
+    Name *global = findInScope(&cg->globals, name, false);
+    return global != NULL ? global : findInScope(&cg->globals, name, true);
+}
+
+/* What node was resolved to by the liveness pass, NULL if it couldn't be */
+static Name *resolvedName(FunctionContext *fn, const void *node) {
+    return mapGet(&fn->resolved, node);
+}
+
+/* fn is NULL at the top level. False if it was reported as unknown */
+static bool resolveType(Codegen *cg, FunctionContext *fn, const Type *type, const VariableDeclerationNode *decl,
+                        Token where, ValueType *result) {
+    if (type->qualifiers & FUNCTION) {
+        /* Function pointers are called through, nothing is known about what they return */
+        *result = scalarType(cg->u0, 1);
+        return true;
+    }
+    const char *base = type->type.base;
+    const Name *found = fn != NULL ? lookupSymbol(&fn->symbols, base, true) : findInScope(&cg->globals, base, true);
+    if (found == NULL) {
+        CODEGEN_ERROR(cg, where, "'%s' is not a type.", base);
+        return false;
+    }
+    *result = scalarType(found->type.base, type->ptrDepth);
+    if (decl != NULL) {
+        result->dims = decl->arraySizes;
+        result->nDims = decl->arrayDepth;
+    }
+    return true;
+}
+
+/* Natural alignment like a C compiler, so the layout is the same as the equivalent struct or union */
+static void layoutType(Codegen *cg, FunctionContext *fn, BaseType *type, const TypeNode *node, bool isUnion) {
+    type->isAggregate = true;
+    type->complete = false;
+    type->fields = arenaAlloc(&cg->arena, (node->nFields ? node->nFields : 1) * sizeof(Field));
+    initScope(&type->members, NULL);
+    type->alignment = 1;
+    size_t size = 0;
+    for (size_t i = 0; i < node->nFields; i++) {
+        VariableDeclerationNode *decl = (VariableDeclerationNode*)node->fields[i]->node;
+        ValueType fieldType;
+        if (!resolveType(cg, fn, &decl->type, decl, decl->name, &fieldType))
+            continue;
+        if (fieldType.ptrDepth == 0 && !fieldType.base->complete) {
+            CODEGEN_ERROR(cg, decl->name, "'%s' can't contain itself, only a pointer to itself.", type->name);
+            continue;
+        }
+        size_t alignment = typeAlignment(fieldType);
+        size_t offset = isUnion ? 0 : (size + alignment - 1) / alignment * alignment;
+        if (typeSize(fieldType) > OBJECT_SIZE_MAX - offset) {
+            CODEGEN_ERROR(cg, decl->name, "'%s' is too large, %s can be at most %zu bytes.", decl->name.value, type->name,
+                          OBJECT_SIZE_MAX);
+            continue;
+        }
+        if (findInScope(&type->members, decl->name.value, false) != NULL) {
+            CODEGEN_ERROR(cg, decl->name, "'%s' already has a field called '%s'.", type->name, decl->name.value);
+            continue;
+        }
+        Field *field = &type->fields[type->nFields++];
+        *field = (Field) { .name = decl->name.value, .type = fieldType, .offset = offset };
+        declareInScope(&type->members, &cg->arena, field->name, false, field);
+        if (offset + typeSize(fieldType) > size)
+            size = offset + typeSize(fieldType);
+        if (alignment > type->alignment)
+            type->alignment = alignment;
+    }
+    type->size = (size + type->alignment - 1) / type->alignment * type->alignment;
+    type->complete = true;
+}
+
+static const Field *findField(const BaseType *type, const char *name) {
+    return findInScope(&type->members, name, false);
+}
+
+/* --- Literals */
+
+/* Decimal, negative if it was folded. Char literals pack their bytes little-endian, 'AB' is 0x4241 */
+static bool readInteger(const Codegen *cg, const Node *node, uint64_t *value) {
+    size_t len;
+    const char *text = tokenText(((ValueNode*)node->node)->value, cg->lexer->source, &len);
+    *value = 0;
+    if (node->type == NT_CHAR) {
+        for (size_t i = 0; i < len; i++)
+            *value |= (uint64_t)(unsigned char)text[i] << (8 * i);
+        return len <= 8;
+    }
+    bool negative = len > 0 && text[0] == '-';
+    for (size_t i = negative; i < len; i++) {
+        unsigned digit = (unsigned)(text[i] - '0');
+        if (*value > (UINT64_MAX - digit) / 10)
+            return false;
+        *value = *value * 10 + digit;
+    }
+    if (negative)
+        *value = 0 - *value;
+    return true;
+}
+
+static bool integerValue(Codegen *cg, const Node *node, uint64_t *value) {
+    if (readInteger(cg, node, value))
+        return true;
+    if (node->type == NT_CHAR)
+        CODEGEN_ERROR(cg, ((ValueNode*)node->node)->value, "A character literal can have at most 8 characters.");
+    else
+        CODEGEN_ERROR(cg, ((ValueNode*)node->node)->value, "Integer literal is too large.");
+    return false;
+}
+
+static bool isConstant(const Node *node) {
+    return node != NULL && (node->type == NT_INT || node->type == NT_CHAR);
+}
+
+/* A literal that fits in the 32-bit immediate of an instruction */
+static bool smallConstant(const Codegen *cg, const Node *node, int32_t *value) {
+    uint64_t constant;
+    if (!isConstant(node) || !readInteger(cg, node, &constant))
+        return false;
+    int64_t signedConstant = constant <= INT64_MAX ? (int64_t)constant : -(int64_t)~constant - 1;
+    if (signedConstant < INT32_MIN || signedConstant > INT32_MAX)
+        return false;
+    *value = (int32_t)signedConstant;
+    return true;
+}
+
+static Token nodeToken(const Node *node) {
+    switch (node->type) {
+        case NT_INT:
+        case NT_FLOAT:
+        case NT_STRING:
+        case NT_CHAR:
+            return ((ValueNode*)node->node)->value;
+        case NT_VARACCESS:
+            return ((VariableAccessNode*)node->node)->name;
+        case NT_VARDECL:
+            return ((VariableDeclerationNode*)node->node)->name;
+        case NT_FUNCDECL:
+            return ((FunctionDeclerationNode*)node->node)->name;
+        case NT_BINOP:
+        case NT_ASSIGN:
+            return ((BinaryOperationNode*)node->node)->op;
+        case NT_UNARYOP:
+            return ((UnaryOperationNode*)node->node)->op;
+        case NT_FUNCCALL:
+            return nodeToken(((FunctionCallNode*)node->node)->function);
+        case NT_ARRAYACCESS:
+            return nodeToken(((ArrayAccessNode*)node->node)->array);
+        case NT_ACCESS:
+            return ((AccessNode*)node->node)->member;
+        case NT_GOTO:
+            return ((GotoNode*)node->node)->label;
+        case NT_LABEL:
+            return ((LabelNode*)node->node)->name;
+        case NT_CLASS:
+        case NT_UNION:
+            return ((TypeNode*)node->node)->name;
+        default: {
+            Token none = { NULL, 0, 0, TT_EOF };
+            return none;
+        }
+    }
+}
+
+static bool isAssignment(TokenType op) {
+    return op >= TT_ASSIGN && op <= TT_XOREQ;
+}
+
+static bool isRelational(TokenType op) {
+    return op == TT_LT || op == TT_GT || op == TT_LTE || op == TT_GTE;
+}
+
+static bool isComparison(TokenType op) {
+    return isRelational(op) || op == TT_EQ || op == TT_NEQ;
+}
+
+/* a < b < c, lhs of the outer comparison is the inner one */
+static bool isChain(const Node *node) {
+    if (node->type != NT_BINOP)
+        return false;
+    BinaryOperationNode *binop = (BinaryOperationNode*)node->node;
+    return isRelational(binop->op.type) && binop->lhs->type == NT_BINOP &&
+        isRelational(((BinaryOperationNode*)binop->lhs->node)->op.type);
+}
+
+/* --- Liveness */
+
+static Name *addLocal(FunctionContext *fn, Name local, const void *key) {
+    Name *name = newName(&fn->arena, local);
+    PUSH(fn->locals, fn->nLocals, fn->localsCapacity, name);
+    declareSymbol(&fn->symbols, name->name, name->kind == NAME_TYPE, name);
+    if (key != NULL)
+        mapPut(&fn->resolved, key, name);
+    return name;
+}
+
+static void touch(FunctionContext *fn, const Name *local) {
+    if (local->kind != NAME_LOCAL || local->interval == SIZE_MAX)
+        return;
+    LiveInterval *interval = &fn->intervals[local->interval];
+    if (fn->position > interval->end)
+        interval->end = fn->position;
+}
+
+static void declareLocal(FunctionContext *fn, VariableDeclerationNode *decl, const void *key) {
+    Codegen *cg = fn->cg;
+    ValueType type;
+    if (!resolveType(cg, fn, &decl->type, decl, decl->name, &type))
+        return;
+    if (typeSize(type) == 0 && type.nDims == 0) {
+        CODEGEN_ERROR(cg, decl->name, "'%s' can't be of type %s, it has no value.", decl->name.value, type.base->name);
+        return;
+    }
+    Name local = {
+        .kind = NAME_LOCAL,
+        .name = decl->name.value,
+        .token = decl->name,
+        .type = type,
+        .request = decl->reg,
+        .interval = SIZE_MAX,
+        .home = X86_NONE
+    };
+    if (isScalar(type) && decl->reg != NOREG) {
+        local.interval = fn->nIntervals;
+        PUSH(fn->intervals, fn->nIntervals, fn->intervalsCapacity, (LiveInterval) {
+            .start = fn->position,
+            .end = fn->position,
+            .request = decl->reg
+        });
+    } else if (decl->reg != NONE && decl->reg != NOREG) {
+        CODEGEN_WARNING(cg, decl->name, "Warning: '%s' doesn't fit in a register, it is kept in memory.", local.name);
+    }
+    addLocal(fn, local, key);
+}
+
+static void declareLocalType(FunctionContext *fn, Node *node) {
+    Codegen *cg = fn->cg;
+    TypeNode *typeNode = (TypeNode*)node->node;
+    BaseType *type = newBaseType(cg, typeNode->name.value);
+    /* Visible to its own fields */
+    addLocal(fn, (Name) {
+        .kind = NAME_TYPE,
+        .name = type->name,
+        .token = typeNode->name,
+        .type = scalarType(type, 0),
+        .interval = SIZE_MAX,
+        .home = X86_NONE
+    }, NULL);
+    layoutType(cg, fn, type, typeNode, node->type == NT_UNION);
+}
+
+static void resolveAccess(FunctionContext *fn, Node *node) {
+    Codegen *cg = fn->cg;
+    Token name = ((VariableAccessNode*)node->node)->name;
+    Name *found = lookupSymbol(&fn->symbols, name.value, false);
+    if (found == NULL) {
+        CODEGEN_ERROR(cg, name, "'%s' is not declared.", name.value);
+        return;
+    }
+    mapPut(&fn->resolved, node, found);
+    touch(fn, found);
+}
+
+static bool analyzeNode(void *data, Node *node, VisitStep step, size_t child) {
+    FunctionContext *fn = data;
+    Codegen *cg = fn->cg;
+    if (step == VISIT_ENTER) {
+        switch (node->type) {
+            case NT_COMPOUND:
+                pushScope(&fn->symbols);
+                break;
+            case NT_FOR:
+                /* The scope of the initializer, the loop itself starts after it */
+                pushScope(&fn->symbols);
+                PUSH(fn->loopStarts, fn->nLoopStarts, fn->loopStartsCapacity, fn->position);
+                break;
+            case NT_WHILE:
+                PUSH(fn->loopStarts, fn->nLoopStarts, fn->loopStartsCapacity, fn->position);
+                break;
+            case NT_CLASS:
+            case NT_UNION:
+                declareLocalType(fn, node);
+                return false;
+            case NT_FUNCDECL:
+                CODEGEN_ERROR(cg, nodeToken(node), "Functions can only be declared at the top level.");
+                return false;
+            case NT_LABEL: {
+                Token name = ((LabelNode*)node->node)->name;
+                for (size_t i = 0; i < fn->nLabels; i++) {
+                    if (fn->labels[i].name == name.value)
+                        CODEGEN_ERROR(cg, name, "Label '%s' is already defined.", name.value);
+                }
+                PUSH(fn->labels, fn->nLabels, fn->labelsCapacity, (LabelName) {
+                    .name = name.value,
+                    .position = fn->position,
+                    .label = LABEL_UNBOUND
+                });
+            } break;
+            default:
+                break;
+        }
+        return true;
+    }
+    if (step == VISIT_CHILD) {
+        if (node->type == NT_FOR && child == 1)
+            fn->loopStarts[fn->nLoopStarts - 1] = fn->position;
+        return true;
+    }
+
+    fn->position += 1;
+    switch (node->type) {
+        case NT_COMPOUND:
+            popScope(&fn->symbols);
+            break;
+        case NT_FOR:
+        case NT_WHILE: {
+            size_t start = fn->loopStarts[--fn->nLoopStarts];
+            PUSH(fn->loops, fn->nLoops, fn->loopsCapacity, (Span) { .start = start, .end = fn->position });
+            if (node->type == NT_FOR)
+                popScope(&fn->symbols);
+        } break;
+        case NT_VARDECL:
+            /* Variables declared by top-level statements are globals */
+            if (node != fn->root || fn->function != NULL)
+                declareLocal(fn, (VariableDeclerationNode*)node->node, node);
+            break;
+        case NT_VARACCESS: {
+            resolveAccess(fn, node);
+            /* A function on its own is called */
+            Name *name = resolvedName(fn, node);
+            if (name != NULL && name->kind == NAME_FUNCTION)
+                PUSH(fn->calls, fn->nCalls, fn->callsCapacity, fn->position);
+        } break;
+        case NT_BINOP: {
+            /* The variable assigned to is written after the value is computed */
+            BinaryOperationNode *binop = (BinaryOperationNode*)node->node;
+            if (isAssignment(binop->op.type) && binop->lhs->type == NT_VARACCESS) {
+                Name *target = resolvedName(fn, binop->lhs);
+                if (target != NULL)
+                    touch(fn, target);
+            }
+        } break;
+        case NT_FUNCCALL:
+        case NT_STRING:
+            /* Only a string that is a statement is printed, counting the others too just costs a register */
+            PUSH(fn->calls, fn->nCalls, fn->callsCapacity, fn->position);
+            break;
+        case NT_GOTO:
+            PUSH(fn->gotos, fn->nGotos, fn->gotosCapacity, (GotoSite) {
+                .label = ((GotoNode*)node->node)->label,
+                .position = fn->position
+            });
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+/*
+ * A variable live when a loop starts is live for all of it, it is needed again on the
+ * next iteration. A goto back to a label is a loop from the label to the goto.
+ */
+static void finishLiveness(FunctionContext *fn) {
+    Codegen *cg = fn->cg;
+    for (size_t i = 0; i < fn->nGotos; i++) {
+        GotoSite *site = &fn->gotos[i];
+        size_t j = 0;
+        while (j < fn->nLabels && fn->labels[j].name != site->label.value)
+            j++;
+        if (j == fn->nLabels)
+            CODEGEN_ERROR(cg, site->label, "Label '%s' is not defined.", site->label.value);
+        else if (fn->labels[j].position < site->position)
+            PUSH(fn->loops, fn->nLoops, fn->loopsCapacity, (Span) { .start = fn->labels[j].position, .end = site->position });
+    }
+    /* Stretching over one loop can make an interval live at the start of another */
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t i = 0; i < fn->nLoops; i++) {
+            Span loop = fn->loops[i];
+            for (size_t j = 0; j < fn->nIntervals; j++) {
+                LiveInterval *interval = &fn->intervals[j];
+                if (interval->start < loop.start && interval->end >= loop.start && interval->end < loop.end) {
+                    interval->end = loop.end;
+                    changed = true;
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < fn->nIntervals; i++) {
+        LiveInterval *interval = &fn->intervals[i];
+        interval->crossesCall = false;
+        for (size_t j = 0; j < fn->nCalls && !interval->crossesCall; j++)
+            interval->crossesCall = interval->start < fn->calls[j] && fn->calls[j] < interval->end;
+    }
+}
+
+/* --- Emission helpers */
+
+static void addFunctionRelocation(FunctionContext *fn, size_t offset, size_t symbol, int64_t addend, RelocationKind kind) {
+    PUSH(fn->relocations, fn->nRelocations, fn->relocationsCapacity, (Relocation) {
+        .section = OBJECT_TEXT,
+        .offset = offset,
+        .symbol = symbol,
+        .addend = addend,
+        .kind = kind
+    });
+}
+
+static X86Register acquire(FunctionContext *fn) {
+    size_t depth = fn->depth++;
+    X86Register reg = temporaries[depth % TEMPORARIES];
+    if (depth >= TEMPORARIES) {
+        emitPush(&fn->as, reg);
+        fn->stack += 1;
+    }
+    return reg;
+}
+
+static void release(FunctionContext *fn) {
+    size_t depth = --fn->depth;
+    if (depth >= TEMPORARIES) {
+        emitPop(&fn->as, temporaries[depth % TEMPORARIES]);
+        fn->stack -= 1;
+    }
+}
+
+/* Stands in for the value of an expression that had errors, so the temporaries still add up */
+static Value invalidValue(FunctionContext *fn) {
+    return (Value) { .reg = acquire(fn), .type = scalarType(fn->cg->i64, 0) };
+}
+
+static void emitScale(FunctionContext *fn, X86Register reg, size_t size) {
+    if (size == 1)
+        return;
+    if ((size & (size - 1)) == 0) {
+        uint8_t shift = 0;
+        while ((size_t)1 << shift != size)
+            shift++;
+        emitShiftImmediate(&fn->as, X86_SHL, reg, shift);
+    } else {
+        emitMultiplyImmediate(&fn->as, reg, reg, (int32_t)size);
+    }
+}
+
+/* Address of a global or function, undefined ones go through the GOT on ELF, they may be in a shared library */
+static void emitAddress(FunctionContext *fn, X86Register to, const Name *global) {
+    const Symbol *symbol = &fn->cg->object->symbols[global->symbol];
+    if (!symbol->defined && fn->cg->target.format == OBJECT_ELF)
+        addFunctionRelocation(fn, emitLoadRelative(&fn->as, to), global->symbol, 0, RELOCATION_GOT);
+    else
+        addFunctionRelocation(fn, emitLeaRelative(&fn->as, to), global->symbol, 0, RELOCATION_RELATIVE);
+}
+
+static void emitString(FunctionContext *fn, X86Register to, const Node *node) {
+    Section *rodata = &fn->rodata;
+    size_t len;
+    const char *text = tokenText(((ValueNode*)node->node)->value, fn->cg->lexer->source, &len);
+    size_t offset = rodata->length;
+    sectionBytes(rodata, text, len);
+    sectionByte(rodata, 0);
+    addFunctionRelocation(fn, emitLeaRelative(&fn->as, to), OBJECT_RODATA, (int64_t)offset, RELOCATION_RELATIVE);
+}
+
+/* L = L / R or L % R. R can be anything but L, the quotient and remainder come out of rax and rdx */
+static void emitDivision(FunctionContext *fn, X86Register l, X86Register r, bool isSigned, bool remainder) {
+    Assembler *as = &fn->as;
+    emitMove(as, SCRATCH, r);
+    if (l != X86_RAX)
+        emitPush(as, X86_RAX);
+    if (l != X86_RDX)
+        emitPush(as, X86_RDX);
+    emitMove(as, X86_RAX, l);
+    emitDivide(as, SCRATCH, isSigned);
+    emitMove(as, l, remainder ? X86_RDX : X86_RAX);
+    if (l != X86_RDX)
+        emitPop(as, X86_RDX);
+    if (l != X86_RAX)
+        emitPop(as, X86_RAX);
+}
+
+/* L = L shifted by R, the count has to be in cl */
+static void emitVariableShift(FunctionContext *fn, X86Shift shift, X86Register l, X86Register r) {
+    Assembler *as = &fn->as;
+    emitMove(as, SCRATCH, r);
+    if (l == X86_RCX) {
+        emitExchange(as, X86_RCX, SCRATCH);
+        emitShift(as, shift, SCRATCH);
+        emitMove(as, X86_RCX, SCRATCH);
+        return;
+    }
+    emitPush(as, X86_RCX);
+    emitMove(as, X86_RCX, SCRATCH);
+    emitShift(as, shift, l);
+    emitPop(as, X86_RCX);
+}
+
+/* L = L ** R by repeated multiplication, a negative exponent gives 1 */
+static void emitPower(FunctionContext *fn, X86Register l, X86Register r) {
+    Assembler *as = &fn->as;
+    X86Register product = l == X86_RAX ? X86_RCX : X86_RAX;
+    size_t loop = newLabel(as), done = newLabel(as);
+    emitPush(as, product);
+    emitMove(as, SCRATCH, r);
+    emitMoveImmediate(as, product, 1);
+    bindLabel(as, loop);
+    emitOperationImmediate(as, X86_CMP, SCRATCH, 0);
+    emitJumpIf(as, X86_LE, done);
+    emitMultiply(as, product, l);
+    emitOperationImmediate(as, X86_SUB, SCRATCH, 1);
+    emitJump(as, loop);
+    bindLabel(as, done);
+    emitMove(as, l, product);
+    emitPop(as, product);
+}
+
+/* L = L op R for the arithmetic operators and their assignment forms */
+static void emitArithmetic(FunctionContext *fn, TokenType op, X86Register l, X86Register r, bool isSigned) {
+    Assembler *as = &fn->as;
+    switch (op) {
+        case TT_ADD: case TT_ADDEQ: emitOperation(as, X86_ADD, l, r); break;
+        case TT_SUB: case TT_SUBEQ: emitOperation(as, X86_SUB, l, r); break;
+        case TT_BAND: case TT_ANDEQ: emitOperation(as, X86_AND, l, r); break;
+        case TT_BOR: case TT_OREQ: emitOperation(as, X86_OR, l, r); break;
+        case TT_BXOR: case TT_XOREQ: emitOperation(as, X86_XOR, l, r); break;
+        case TT_MUL: case TT_MULEQ: emitMultiply(as, l, r); break;
+        case TT_DIV: case TT_DIVEQ: emitDivision(fn, l, r, isSigned, false); break;
+        case TT_MOD: case TT_MODEQ: emitDivision(fn, l, r, isSigned, true); break;
+        case TT_LSH: case TT_LSHEQ: emitVariableShift(fn, X86_SHL, l, r); break;
+        case TT_RSH: case TT_RSHEQ: emitVariableShift(fn, isSigned ? X86_SAR : X86_SHR, l, r); break;
+        case TT_POW: emitPower(fn, l, r); break;
+        default: break;
+    }
+}
+
+static X86Condition conditionOf(TokenType op, bool isSigned) {
+    switch (op) {
+        case TT_LT: return isSigned ? X86_L : X86_B;
+        case TT_GT: return isSigned ? X86_G : X86_A;
+        case TT_LTE: return isSigned ? X86_LE : X86_BE;
+        case TT_GTE: return isSigned ? X86_GE : X86_AE;
+        case TT_EQ: return X86_E;
+        default: return X86_NE;
+    }
+}
+
+/* --- Expressions */
+
+static Value genExpr(FunctionContext *fn, Node *node);
+static Value genCall(FunctionContext *fn, const Name *function, Node *callee, Node **arguments, size_t nArguments, Token where);
+
+static Place noPlace(void) {
+    Place place;
+    memset(&place, 0, sizeof(place));
+    place.kind = PLACE_NONE;
+    return place;
+}
+
+static Place memoryPlace(X86Register base, int32_t displacement, bool owns, ValueType type) {
+    return (Place) { .kind = PLACE_MEMORY, .reg = base, .displacement = displacement, .ownsTemporary = owns, .type = type };
+}
+
+static Place genPlace(FunctionContext *fn, Node *node);
+
+static bool canBePlace(const Node *node) {
+    return node->type == NT_VARACCESS || node->type == NT_ACCESS || node->type == NT_ARRAYACCESS ||
+        (node->type == NT_UNARYOP && ((UnaryOperationNode*)node->node)->op.type == TT_MUL);
+}
+
+static Place genVariablePlace(FunctionContext *fn, Node *node) {
+    Name *name = resolvedName(fn, node);
+    if (name == NULL)
+        return noPlace();
+    switch (name->kind) {
+        case NAME_LOCAL:
+            if (name->home != X86_NONE)
+                return (Place) { .kind = PLACE_REGISTER, .reg = name->home, .type = name->type };
+            return memoryPlace(X86_RBP, name->offset, false, name->type);
+        case NAME_GLOBAL: {
+            X86Register base = acquire(fn);
+            emitAddress(fn, base, name);
+            return memoryPlace(base, 0, true, name->type);
+        }
+        default:
+            CODEGEN_ERROR(fn->cg, nodeToken(node), "'%s' is a function, it can't be assigned to.", name->name);
+            return noPlace();
+    }
+}
+
+static Place genElementPlace(FunctionContext *fn, Node *node) {
+    ArrayAccessNode *access = (ArrayAccessNode*)node->node;
+    Value array = genExpr(fn, access->array);
+    if (!isPointerLike(array.type)) {
+        CODEGEN_ERROR(fn->cg, nodeToken(node), "Only arrays and pointers can be indexed.");
+        release(fn);
+        return noPlace();
+    }
+    ValueType element = elementType(array.type);
+    size_t size = elementSize(array.type);
+    int32_t index;
+    if (smallConstant(fn->cg, access->index, &index) && (int64_t)index * (int64_t)size >= INT32_MIN &&
+            (int64_t)index * (int64_t)size <= INT32_MAX)
+        return memoryPlace(array.reg, (int32_t)(index * (int64_t)size), true, element);
+    Value offset = genExpr(fn, access->index);
+    emitScale(fn, offset.reg, size);
+    emitOperation(&fn->as, X86_ADD, array.reg, offset.reg);
+    release(fn);
+    return memoryPlace(array.reg, 0, true, element);
+}
+
+static Place genMemberPlace(FunctionContext *fn, Node *node) {
+    AccessNode *access = (AccessNode*)node->node;
+    Place object;
+    if (canBePlace(access->object)) {
+        object = genPlace(fn, access->object);
+        if (object.kind == PLACE_NONE)
+            return object;
+    } else {
+        Value value = genExpr(fn, access->object);
+        object = memoryPlace(value.reg, 0, true, value.type);
+        object.kind = PLACE_REGISTER;
+    }
+    /* Members of a class the object points to */
+    if (object.type.ptrDepth == 1 && object.type.nDims == 0 && object.type.base->isAggregate) {
+        ValueType pointee = elementType(object.type);
+        if (object.kind == PLACE_REGISTER && object.ownsTemporary) {
+            object = memoryPlace(object.reg, 0, true, pointee);
+        } else {
+            X86Register base = object.ownsTemporary ? object.reg : acquire(fn);
+            if (object.kind == PLACE_REGISTER)
+                emitMove(&fn->as, base, object.reg);
+            else
+                emitLoad(&fn->as, base, object.reg, object.displacement, 8, false);
+            object = memoryPlace(base, 0, true, pointee);
+        }
+    }
+    if (object.kind != PLACE_MEMORY || !isAggregate(object.type)) {
+        CODEGEN_ERROR(fn->cg, access->member, "Only classes, unions and pointers to them have members.");
+        if (object.ownsTemporary)
+            release(fn);
+        return noPlace();
+    }
+    const Field *field = findField(object.type.base, access->member.value);
+    if (field == NULL) {
+        CODEGEN_ERROR(fn->cg, access->member, "'%s' has no member '%s'.", object.type.base->name, access->member.value);
+        if (object.ownsTemporary)
+            release(fn);
+        return noPlace();
+    }
+    object.displacement += (int32_t)field->offset;
+    object.type = field->type;
+    return object;
+}
+
+static Place genPlace(FunctionContext *fn, Node *node) {
+    switch (node->type) {
+        case NT_VARACCESS:
+            return genVariablePlace(fn, node);
+        case NT_ARRAYACCESS:
+            return genElementPlace(fn, node);
+        case NT_ACCESS:
+            return genMemberPlace(fn, node);
+        case NT_UNARYOP: {
+            UnaryOperationNode *unop = (UnaryOperationNode*)node->node;
+            if (unop->op.type != TT_MUL)
+                break;
+            Value pointer = genExpr(fn, unop->value);
+            if (!isPointerLike(pointer.type)) {
+                CODEGEN_ERROR(fn->cg, unop->op, "Only pointers can be dereferenced.");
+                release(fn);
+                return noPlace();
+            }
+            return memoryPlace(pointer.reg, 0, true, elementType(pointer.type));
+        }
+        default:
+            break;
+    }
+    CODEGEN_ERROR(fn->cg, nodeToken(node), "This expression can't be assigned to.");
+    return noPlace();
+}
+
+static Value loadPlace(FunctionContext *fn, Place place, Token where) {
+    if (place.kind == PLACE_NONE)
+        return invalidValue(fn);
+    if (place.kind == PLACE_REGISTER) {
+        X86Register reg = acquire(fn);
+        emitMove(&fn->as, reg, place.reg);
+        return (Value) { .reg = reg, .type = place.type };
+    }
+    X86Register reg = place.ownsTemporary ? place.reg : acquire(fn);
+    if (place.type.nDims > 0) {
+        emitLea(&fn->as, reg, place.reg, place.displacement);
+    } else if (!isScalar(place.type)) {
+        if (isAggregate(place.type))
+            CODEGEN_ERROR(fn->cg, where, "A %s can only be used through its members or a pointer.", place.type.base->name);
+        else
+            CODEGEN_ERROR(fn->cg, where, "%s has no value.", place.type.base->name);
+    } else {
+        emitLoad(&fn->as, reg, place.reg, place.displacement, typeSize(place.type), isSignedType(place.type));
+    }
+    return (Value) { .reg = reg, .type = place.type };
+}
+
+static Value genVariable(FunctionContext *fn, Node *node) {
+    Name *name = resolvedName(fn, node);
+    if (name == NULL)
+        return invalidValue(fn);
+    if (name->kind == NAME_FUNCTION) {
+        X86Register reg = acquire(fn);
+        emitAddress(fn, reg, name);
+        return (Value) { .reg = reg, .type = scalarType(fn->cg->u0, 1) };
+    }
+    return loadPlace(fn, genVariablePlace(fn, node), nodeToken(node));
+}
+
+/* The right operand in a register, without copying it if it is a variable already in one */
+static Value genOperand(FunctionContext *fn, Node *node, bool *owned) {
+    if (node->type == NT_VARACCESS) {
+        Name *name = resolvedName(fn, node);
+        if (name != NULL && name->kind == NAME_LOCAL && name->home != X86_NONE) {
+            *owned = false;
+            return (Value) { .reg = name->home, .type = name->type };
+        }
+    }
+    *owned = true;
+    return genExpr(fn, node);
+}
+
+/* The rest of node once its left operand is in l, as are genComparison and genExclusiveOr */
+static Value genArithmetic(FunctionContext *fn, Node *node, Value l) {
+    Codegen *cg = fn->cg;
+    BinaryOperationNode *binop = (BinaryOperationNode*)node->node;
+    TokenType op = binop->op.type;
+    int32_t immediate;
+    bool scaled = (op == TT_ADD || op == TT_SUB) && isPointerLike(l.type);
+    if (smallConstant(cg, binop->rhs, &immediate)) {
+        int64_t value = scaled ? (int64_t)immediate * (int64_t)elementSize(l.type) : immediate;
+        bool fits = value >= INT32_MIN && value <= INT32_MAX;
+        ValueType type = scaled ? l.type : arithmeticType(cg, l.type, scalarType(cg->i64, 0));
+        switch (op) {
+            case TT_ADD: case TT_SUB: case TT_BAND: case TT_BOR: case TT_BXOR: {
+                if (!fits)
+                    break;
+                X86Operation operation = op == TT_ADD ? X86_ADD : op == TT_SUB ? X86_SUB :
+                    op == TT_BAND ? X86_AND : op == TT_BOR ? X86_OR : X86_XOR;
+                emitOperationImmediate(&fn->as, operation, l.reg, (int32_t)value);
+                return (Value) { .reg = l.reg, .type = type };
+            }
+            case TT_MUL:
+                emitMultiplyImmediate(&fn->as, l.reg, l.reg, immediate);
+                return (Value) { .reg = l.reg, .type = type };
+            case TT_LSH:
+            case TT_RSH:
+                emitShiftImmediate(&fn->as, op == TT_LSH ? X86_SHL : isSignedType(type) ? X86_SAR : X86_SHR, l.reg,
+                                   (uint8_t)(immediate & 63));
+                return (Value) { .reg = l.reg, .type = type };
+            default:
+                break;
+        }
+    }
+    bool owned;
+    Value r = genOperand(fn, binop->rhs, &owned);
+    ValueType type = arithmeticType(cg, l.type, r.type);
+    if (op == TT_ADD || op == TT_SUB) {
+        if (isPointerLike(l.type) && isPointerLike(r.type) && op == TT_SUB) {
+            /* The distance in elements */
+            size_t size = elementSize(l.type);
+            emitOperation(&fn->as, X86_SUB, l.reg, r.reg);
+            if ((size & (size - 1)) == 0) {
+                uint8_t shift = 0;
+                while ((size_t)1 << shift != size)
+                    shift++;
+                if (shift)
+                    emitShiftImmediate(&fn->as, X86_SAR, l.reg, shift);
+            } else {
+                emitMoveImmediate(&fn->as, SCRATCH, (int64_t)size);
+                emitDivision(fn, l.reg, SCRATCH, true, false);
+            }
+            if (owned)
+                release(fn);
+            return (Value) { .reg = l.reg, .type = scalarType(cg->i64, 0) };
+        }
+        if (isPointerLike(l.type) && !isPointerLike(r.type)) {
+            if (!owned) {
+                emitMove(&fn->as, SCRATCH, r.reg);
+                r.reg = SCRATCH;
+            }
+            emitScale(fn, r.reg, elementSize(l.type));
+            type = l.type;
+        } else if (isPointerLike(r.type) && op == TT_ADD) {
+            emitScale(fn, l.reg, elementSize(r.type));
+            type = r.type;
+        }
+    }
+    emitArithmetic(fn, op, l.reg, r.reg, isSignedType(type) || !isUnsignedOperand(type));
+    if (owned)
+        release(fn);
+    return (Value) { .reg = l.reg, .type = type };
+}
+
+static void genBranch(FunctionContext *fn, Node *node, bool when, size_t label);
+
+/* a < b < c is a < b && b < c with b evaluated once */
+static Value genChain(FunctionContext *fn, Node *node) {
+    X86Register result = acquire(fn);
+    size_t fail = newLabel(&fn->as);
+    emitMoveImmediate(&fn->as, result, 0);
+    size_t base = fn->spine.count;
+    Node *first = node;
+    while (first->type == NT_BINOP && isRelational(((BinaryOperationNode*)first->node)->op.type)) {
+        vectorPush(&fn->spine, first);
+        first = ((BinaryOperationNode*)first->node)->lhs;
+    }
+    /* The last operand compared stays in the top temporary, the first comparison that doesn't hold jumps to fail */
+    Value l = genExpr(fn, first);
+    while (fn->spine.count > base) {
+        BinaryOperationNode *binop = (BinaryOperationNode*)((Node*)fn->spine.items[--fn->spine.count])->node;
+        Value r = genExpr(fn, binop->rhs);
+        bool isSigned = !isUnsignedOperand(l.type) && !isUnsignedOperand(r.type);
+        emitOperation(&fn->as, X86_CMP, l.reg, r.reg);
+        emitMove(&fn->as, l.reg, r.reg);
+        release(fn);
+        emitJumpIf(&fn->as, invertCondition(conditionOf(binop->op.type, isSigned)), fail);
+        l.type = r.type;
+    }
+    emitMoveImmediate(&fn->as, result, 1);
+    bindLabel(&fn->as, fail);
+    release(fn);
+    return (Value) { .reg = result, .type = scalarType(fn->cg->i64, 0) };
+}
+
+static Value genComparison(FunctionContext *fn, Node *node, Value l) {
+    Codegen *cg = fn->cg;
+    BinaryOperationNode *binop = (BinaryOperationNode*)node->node;
+    int32_t immediate;
+    bool isSigned;
+    if (smallConstant(cg, binop->rhs, &immediate)) {
+        isSigned = !isUnsignedOperand(l.type);
+        emitOperationImmediate(&fn->as, X86_CMP, l.reg, immediate);
+    } else {
+        bool owned;
+        Value r = genOperand(fn, binop->rhs, &owned);
+        isSigned = !isUnsignedOperand(l.type) && !isUnsignedOperand(r.type);
+        emitOperation(&fn->as, X86_CMP, l.reg, r.reg);
+        if (owned)
+            release(fn);
+    }
+    emitSet(&fn->as, conditionOf(binop->op.type, isSigned), l.reg);
+    return (Value) { .reg = l.reg, .type = scalarType(cg->i64, 0) };
+}
+
+static Value genExclusiveOr(FunctionContext *fn, Node *node, Value l) {
+    BinaryOperationNode *binop = (BinaryOperationNode*)node->node;
+    emitTest(&fn->as, l.reg, l.reg);
+    emitSet(&fn->as, X86_NE, l.reg);
+    Value r = genExpr(fn, binop->rhs);
+    emitTest(&fn->as, r.reg, r.reg);
+    emitSet(&fn->as, X86_NE, r.reg);
+    emitOperation(&fn->as, X86_XOR, l.reg, r.reg);
+    release(fn);
+    return (Value) { .reg = l.reg, .type = scalarType(fn->cg->i64, 0) };
+}
+
+/* && and || */
+static Value genLogical(FunctionContext *fn, Node *node) {
+    X86Register result = acquire(fn);
+    size_t fail = newLabel(&fn->as), done = newLabel(&fn->as);
+    genBranch(fn, node, false, fail);
+    emitMoveImmediate(&fn->as, result, 1);
+    emitJump(&fn->as, done);
+    bindLabel(&fn->as, fail);
+    emitMoveImmediate(&fn->as, result, 0);
+    bindLabel(&fn->as, done);
+    return (Value) { .reg = result, .type = scalarType(fn->cg->i64, 0) };
+}
+
+static Value genAssignment(FunctionContext *fn, Node *node) {
+    Codegen *cg = fn->cg;
+    BinaryOperationNode *binop = (BinaryOperationNode*)node->node;
+    TokenType op = binop->op.type;
+    Place place = genPlace(fn, binop->lhs);
+    if (place.kind == PLACE_NONE)
+        return invalidValue(fn);
+    if (!isScalar(place.type)) {
+        if (place.type.nDims > 0)
+            CODEGEN_ERROR(cg, binop->op, "Arrays can't be assigned to, only their elements.");
+        else if (isAggregate(place.type))
+            CODEGEN_ERROR(cg, binop->op, "A %s can't be assigned to as a whole, only its members.", place.type.base->name);
+        else
+            CODEGEN_ERROR(cg, binop->op, "%s has no value.", place.type.base->name);
+        if (place.ownsTemporary)
+            release(fn);
+        return invalidValue(fn);
+    }
+    size_t size = typeSize(place.type);
+    bool isSigned = isSignedType(place.type);
+    Value value = genExpr(fn, binop->rhs);
+    bool arithmeticSigned = !isUnsignedOperand(arithmeticType(cg, place.type, value.type));
+    if ((op == TT_ADDEQ || op == TT_SUBEQ) && isPointerLike(place.type) && !isPointerLike(value.type))
+        emitScale(fn, value.reg, elementSize(place.type));
+    if (place.kind == PLACE_REGISTER) {
+        if (op == TT_ASSIGN) {
+            emitExtend(&fn->as, value.reg, size, isSigned);
+            emitMove(&fn->as, place.reg, value.reg);
+        } else {
+            emitArithmetic(fn, op, place.reg, value.reg, arithmeticSigned);
+            emitExtend(&fn->as, place.reg, size, isSigned);
+            emitMove(&fn->as, value.reg, place.reg);
+        }
+    } else if (op == TT_ASSIGN) {
+        emitExtend(&fn->as, value.reg, size, isSigned);
+        emitStore(&fn->as, place.reg, place.displacement, value.reg, size);
+    } else {
+        X86Register current = acquire(fn);
+        emitLoad(&fn->as, current, place.reg, place.displacement, size, isSigned);
+        emitArithmetic(fn, op, current, value.reg, arithmeticSigned);
+        emitExtend(&fn->as, current, size, isSigned);
+        emitStore(&fn->as, place.reg, place.displacement, current, size);
+        emitMove(&fn->as, value.reg, current);
+        release(fn);
+    }
+    if (place.ownsTemporary) {
+        emitMove(&fn->as, place.reg, value.reg);
+        release(fn);
+        value.reg = place.reg;
+    }
+    value.type = place.type;
+    return value;
+}
+
+/* Operations that generate their left operand on its own first and keep it in a temporary */
+static bool leftOperandFirst(const Node *node) {
+    if (node->type != NT_BINOP)
+        return false;
+    TokenType op = ((BinaryOperationNode*)node->node)->op.type;
+    if (isAssignment(op) || op == TT_AND || op == TT_OR)
+        return false;
+    return !isComparison(op) || !isChain(node);
+}
+
+static Value genBinary(FunctionContext *fn, Node *node) {
+    TokenType op = ((BinaryOperationNode*)node->node)->op.type;
+    if (isAssignment(op))
+        return genAssignment(fn, node);
+    if (op == TT_AND || op == TT_OR)
+        return genLogical(fn, node);
+    if (!leftOperandFirst(node))
+        return genChain(fn, node);
+    /*
+     * a + b + c is (a + b) + c, the left operands of a chain nest as deep as it is long.
+     * They are walked down with a stack rather than a frame each, which would overflow
+     * on a long enough chain and sooner on a worker's stack.
+     */
+    size_t base = fn->spine.count;
+    Node *first = node;
+    while (leftOperandFirst(first)) {
+        vectorPush(&fn->spine, first);
+        first = ((BinaryOperationNode*)first->node)->lhs;
+    }
+    Value value = genExpr(fn, first);
+    while (fn->spine.count > base) {
+        Node *operation = fn->spine.items[--fn->spine.count];
+        op = ((BinaryOperationNode*)operation->node)->op.type;
+        if (op == TT_XOR)
+            value = genExclusiveOr(fn, operation, value);
+        else if (isComparison(op))
+            value = genComparison(fn, operation, value);
+        else
+            value = genArithmetic(fn, operation, value);
+    }
+    return value;
+}
+
+static Value genExpr(FunctionContext *fn, Node *node) {
+    Codegen *cg = fn->cg;
+    switch (node->type) {
+        case NT_INT:
+        case NT_CHAR: {
+            uint64_t value;
+            X86Register reg = acquire(fn);
+            if (!integerValue(cg, node, &value))
+                value = 0;
+            emitMoveImmediate(&fn->as, reg, value <= INT64_MAX ? (int64_t)value : -(int64_t)~value - 1);
+            /* Folded literals are I64 and can be negative, only one written too large for an I64 is a U64 */
+            size_t len;
+            bool negative = tokenText(((ValueNode*)node->node)->value, cg->lexer->source, &len)[0] == '-';
+            bool isUnsigned = node->type == NT_CHAR || (value > INT64_MAX && !negative);
+            return (Value) { .reg = reg, .type = scalarType(isUnsigned ? cg->u64 : cg->i64, 0) };
+        }
+        case NT_STRING: {
+            X86Register reg = acquire(fn);
+            emitString(fn, reg, node);
+            return (Value) { .reg = reg, .type = scalarType(cg->u8, 1) };
+        }
+        case NT_FLOAT:
+            CODEGEN_ERROR(cg, nodeToken(node), "Floating point numbers aren't supported by the code generator yet.");
+            return invalidValue(fn);
+        case NT_VARACCESS:
+            return genVariable(fn, node);
+        case NT_ARRAYACCESS:
+        case NT_ACCESS:
+            return loadPlace(fn, genPlace(fn, node), nodeToken(node));
+        case NT_UNARYOP: {
+            UnaryOperationNode *unop = (UnaryOperationNode*)node->node;
+            if (unop->op.type == TT_MUL)
+                return loadPlace(fn, genPlace(fn, node), unop->op);
+            Value value = genExpr(fn, unop->value);
+            emitNegate(&fn->as, value.reg);
+            value.type = arithmeticType(cg, value.type, value.type);
+            return value;
+        }
+        case NT_BINOP:
+            return genBinary(fn, node);
+        case NT_FUNCCALL: {
+            FunctionCallNode *call = (FunctionCallNode*)node->node;
+            Name *function = call->function->type == NT_VARACCESS ? resolvedName(fn, call->function) : NULL;
+            if (function != NULL && function->kind != NAME_FUNCTION)
+                function = NULL;
+            return genCall(fn, function, call->function, call->arguments, call->nArguments, nodeToken(node));
+        }
+        default:
+            CODEGEN_ERROR(cg, nodeToken(node), "This isn't an expression.");
+            return invalidValue(fn);
+    }
+}
+
+/* Jumps to label if node is true and when is, or if it is false and when isn't */
+static void genBranch(FunctionContext *fn, Node *node, bool when, size_t label) {
+    Codegen *cg = fn->cg;
+    if (isConstant(node)) {
+        uint64_t value;
+        if (integerValue(cg, node, &value) && (value != 0) == when)
+            emitJump(&fn->as, label);
+        return;
+    }
+    if (node->type == NT_BINOP && !isChain(node)) {
+        BinaryOperationNode *binop = (BinaryOperationNode*)node->node;
+        TokenType op = binop->op.type;
+        if (op == TT_AND || op == TT_OR) {
+            /*
+             * Jumping out as soon as the result is known. A chain of the same operator is
+             * walked down with a stack, like in genBinary. Every operand but the last
+             * jumps the same way: to label if one is enough to decide, past the chain if not.
+             */
+            bool decides = (op == TT_AND) != when;
+            size_t skip = decides ? 0 : newLabel(&fn->as);
+            size_t base = fn->spine.count;
+            Node *first = node;
+            do {
+                vectorPush(&fn->spine, first);
+                first = ((BinaryOperationNode*)first->node)->lhs;
+            } while (first->type == NT_BINOP && ((BinaryOperationNode*)first->node)->op.type == op && !isConstant(first));
+            genBranch(fn, first, decides ? when : !when, decides ? label : skip);
+            while (fn->spine.count > base) {
+                Node *rhs = ((BinaryOperationNode*)((Node*)fn->spine.items[--fn->spine.count])->node)->rhs;
+                bool last = fn->spine.count == base;
+                genBranch(fn, rhs, decides || last ? when : !when, decides || last ? label : skip);
+            }
+            if (!decides)
+                bindLabel(&fn->as, skip);
+            return;
+        }
+        if (isComparison(op)) {
+            Value l = genExpr(fn, binop->lhs);
+            int32_t immediate;
+            bool isSigned;
+            if (smallConstant(cg, binop->rhs, &immediate)) {
+                isSigned = !isUnsignedOperand(l.type);
+                emitOperationImmediate(&fn->as, X86_CMP, l.reg, immediate);
+            } else {
+                bool owned;
+                Value r = genOperand(fn, binop->rhs, &owned);
+                isSigned = !isUnsignedOperand(l.type) && !isUnsignedOperand(r.type);
+                emitOperation(&fn->as, X86_CMP, l.reg, r.reg);
+                if (owned)
+                    release(fn);
+            }
+            /* Popping a temporary leaves the flags alone */
+            release(fn);
+            X86Condition condition = conditionOf(op, isSigned);
+            emitJumpIf(&fn->as, when ? condition : invertCondition(condition), label);
+            return;
+        }
+    }
+    Value value = genExpr(fn, node);
+    emitTest(&fn->as, value.reg, value.reg);
+    release(fn);
+    emitJumpIf(&fn->as, when ? X86_NE : X86_E, label);
+}
+
+/*
+ * Every argument gets a slot in an area reserved below the live temporaries, so
+ * evaluating one can't disturb the others. The ones passed in registers are
+ * loaded from theirs right before the call, the rest are where the callee
+ * expects them already:
+ *   rsp -> shadow space, stack arguments, register arguments, the callee if it
+ *          is called through a pointer, padding to keep rsp aligned
+ */
+static Value genCall(FunctionContext *fn, const Name *function, Node *callee, Node **arguments, size_t nArguments, Token where) {
+    Codegen *cg = fn->cg;
+    Assembler *as = &fn->as;
+    const CallingConvention *convention = cg->target.convention;
+    size_t nParameters = function != NULL ? function->nParameters : 0;
+    bool vararg = function == NULL || function->vararg;
+    size_t total = nArguments > nParameters ? nArguments : nParameters;
+    if (function != NULL && nArguments > nParameters && !vararg) {
+        CODEGEN_ERROR(cg, where, "Too many arguments for '%s', it takes %zu.", function->name, nParameters);
+        return invalidValue(fn);
+    }
+    for (size_t i = 0; i < total; i++) {
+        Node *argument = i < nArguments ? arguments[i] : NULL;
+        if (argument != NULL)
+            continue;
+        Node *fallback = i < nParameters ? function->parameters[i]->initializer : NULL;
+        if (fallback == NULL) {
+            CODEGEN_ERROR(cg, where, "Argument %zu has no default value.", i + 1);
+            return invalidValue(fn);
+        }
+        if (fallback->type != NT_INT && fallback->type != NT_CHAR && fallback->type != NT_STRING) {
+            CODEGEN_ERROR(cg, nodeToken(fallback), "Only literals are supported as default arguments.");
+            return invalidValue(fn);
+        }
+    }
+
+    size_t depth = fn->depth;
+    size_t live = depth < TEMPORARIES ? depth : TEMPORARIES;
+    for (size_t i = depth - live; i < depth; i++)
+        emitPush(as, temporaries[i % TEMPORARIES]);
+    fn->stack += live;
+
+    size_t nRegister = total < convention->nArguments ? total : convention->nArguments;
+    size_t nStack = total - nRegister;
+    size_t shadow = convention->shadowSpace / 8;
+    size_t registerSlots = shadow + nStack, calleeSlot = registerSlots + nRegister;
+    size_t slots = calleeSlot + (function == NULL);
+    if ((fn->stack + slots) % 2)
+        slots += 1;
+    if (slots > 0)
+        emitOperationImmediate(as, X86_SUB, X86_RSP, (int32_t)(slots * 8));
+    fn->stack += slots;
+    size_t area = fn->stack;
+
+    if (function == NULL) {
+        Value target = genExpr(fn, callee);
+        emitStore(as, X86_RSP, (int32_t)((fn->stack - area + calleeSlot) * 8), target.reg, 8);
+        release(fn);
+    }
+    for (size_t i = 0; i < total; i++) {
+        Node *argument = i < nArguments && arguments[i] != NULL ? arguments[i] : function->parameters[i]->initializer;
+        Value value = genExpr(fn, argument);
+        if (i < nParameters) {
+            /* Converted to the parameter's type, a C callee may not widen it itself */
+            ValueType type;
+            VariableDeclerationNode *parameter = function->parameters[i];
+            if (resolveType(cg, NULL, &parameter->type, parameter, parameter->name, &type) && isScalar(type))
+                emitExtend(as, value.reg, typeSize(type), isSignedType(type));
+        }
+        size_t slot = i < nRegister ? registerSlots + i : shadow + i - nRegister;
+        emitStore(as, X86_RSP, (int32_t)((fn->stack - area + slot) * 8), value.reg, 8);
+        release(fn);
+    }
+    for (size_t i = 0; i < nRegister; i++)
+        emitLoad(as, convention->arguments[i], X86_RSP, (int32_t)((registerSlots + i) * 8), 8, false);
+    if (vararg)
+        emitMoveImmediate(as, X86_RAX, 0); /* No vector registers used, for System V */
+    if (function != NULL) {
+        addFunctionRelocation(fn, emitCall(as), function->symbol, 0, RELOCATION_CALL);
+    } else {
+        emitLoad(as, SCRATCH, X86_RSP, (int32_t)(calleeSlot * 8), 8, false);
+        emitCallRegister(as, SCRATCH);
+    }
+    emitMove(as, SCRATCH, X86_RAX);
+    if (slots > 0)
+        emitOperationImmediate(as, X86_ADD, X86_RSP, (int32_t)(slots * 8));
+    fn->stack -= slots;
+    for (size_t i = depth; i-- > depth - live;)
+        emitPop(as, temporaries[i % TEMPORARIES]);
+    fn->stack -= live;
+
+    X86Register result = acquire(fn);
+    emitMove(as, result, SCRATCH);
+    ValueType type = function != NULL ? function->type : scalarType(cg->i64, 0);
+    if (isScalar(type))
+        emitExtend(as, result, typeSize(type), isSignedType(type));
+    return (Value) { .reg = result, .type = type };
+}
+
+/* --- Statements */
+
+static void genStatement(FunctionContext *fn, Node *node);
+
+/* Expressions whose value isn't used */
+static void genDiscarded(FunctionContext *fn, Node *node) {
+    genExpr(fn, node);
+    release(fn);
+}
+
+/* Initial value of a global that can be written into .data */
+static bool isStaticInitializer(const VariableDeclerationNode *decl, ValueType type) {
+    return isConstant(decl->initializer) && isScalar(type);
+}
+
+static void genDeclaration(FunctionContext *fn, Node *node) {
+    Codegen *cg = fn->cg;
+    VariableDeclerationNode *decl = (VariableDeclerationNode*)node->node;
+    if (decl->initializer == NULL)
+        return;
+    Name *name = node == fn->root && fn->function == NULL ? lookupGlobal(cg, decl->name.value) : resolvedName(fn, node);
+    if (name == NULL || (name->kind == NAME_GLOBAL && isStaticInitializer(decl, name->type)))
+        return;
+    if (!isScalar(name->type)) {
+        CODEGEN_ERROR(cg, decl->name, "Only variables that fit in a register can be initialized.");
+        return;
+    }
+    size_t size = typeSize(name->type);
+    bool isSigned = isSignedType(name->type);
+    Value value = genExpr(fn, decl->initializer);
+    emitExtend(&fn->as, value.reg, size, isSigned);
+    if (name->kind == NAME_GLOBAL) {
+        emitAddress(fn, SCRATCH, name);
+        emitStore(&fn->as, SCRATCH, 0, value.reg, size);
+    } else if (name->home != X86_NONE) {
+        emitMove(&fn->as, name->home, value.reg);
+    } else {
+        emitStore(&fn->as, X86_RBP, name->offset, value.reg, size);
+    }
+    release(fn);
+}
+
+static void genReturn(FunctionContext *fn, Node *value) {
+    if (value != NULL) {
+        Value result = genExpr(fn, value);
+        ValueType type = fn->function != NULL ? fn->function->type : scalarType(fn->cg->i64, 0);
+        if (isScalar(type))
+            emitExtend(&fn->as, result.reg, typeSize(type), isSignedType(type));
+        emitMove(&fn->as, X86_RAX, result.reg);
+        release(fn);
+    }
+    emitJump(&fn->as, fn->epilogue);
+}
+
+static size_t findLabel(FunctionContext *fn, const char *name) {
+    for (size_t i = 0; i < fn->nLabels; i++) {
+        if (fn->labels[i].name == name)
+            return fn->labels[i].label;
+    }
+    return LABEL_UNBOUND;
+}
+
+static void genLoopBody(FunctionContext *fn, Node *body, size_t end) {
+    PUSH(fn->breaks, fn->nBreaks, fn->breaksCapacity, end);
+    genStatement(fn, body);
+    fn->nBreaks -= 1;
+}
+
+static void genStatement(FunctionContext *fn, Node *node) {
+    Codegen *cg = fn->cg;
+    Assembler *as = &fn->as;
+    switch (node->type) {
+        case NT_NONE:
+        case NT_CLASS:
+        case NT_UNION:
+        case NT_FUNCDECL:
+            break;
+        case NT_COMPOUND: {
+            CompoundNode *compound = (CompoundNode*)node->node;
+            for (size_t i = 0; i < compound->nStatements; i++)
+                genStatement(fn, compound->statements[i]);
+        } break;
+        case NT_VARDECL:
+            genDeclaration(fn, node);
+            break;
+        case NT_IF: {
+            IfNode *statement = (IfNode*)node->node;
+            size_t end = newLabel(as);
+            for (size_t i = 0; i < statement->nCases; i++) {
+                size_t next = newLabel(as);
+                genBranch(fn, statement->conditions[i], false, next);
+                genStatement(fn, statement->bodies[i]);
+                emitJump(as, end);
+                bindLabel(as, next);
+            }
+            if (statement->elseCase != NULL)
+                genStatement(fn, statement->elseCase);
+            bindLabel(as, end);
+        } break;
+        case NT_WHILE: {
+            WhileNode *loop = (WhileNode*)node->node;
+            size_t top = newLabel(as), end = newLabel(as);
+            bindLabel(as, top);
+            genBranch(fn, loop->condition, false, end);
+            genLoopBody(fn, loop->body, end);
+            emitJump(as, top);
+            bindLabel(as, end);
+        } break;
+        case NT_FOR: {
+            ForNode *loop = (ForNode*)node->node;
+            size_t top = newLabel(as), end = newLabel(as);
+            if (loop->initializer != NULL)
+                genStatement(fn, loop->initializer);
+            bindLabel(as, top);
+            if (loop->condition != NULL)
+                genBranch(fn, loop->condition, false, end);
+            genLoopBody(fn, loop->body, end);
+            if (loop->increment != NULL)
+                genStatement(fn, loop->increment);
+            emitJump(as, top);
+            bindLabel(as, end);
+        } break;
+        case NT_GOTO: {
+            size_t label = findLabel(fn, ((GotoNode*)node->node)->label.value);
+            if (label != LABEL_UNBOUND)
+                emitJump(as, label);
+        } break;
+        case NT_LABEL:
+            bindLabel(as, findLabel(fn, ((LabelNode*)node->node)->name.value));
+            break;
+        case NT_BREAK:
+            if (fn->nBreaks == 0)
+                CODEGEN_ERROR(cg, fn->function != NULL ? fn->function->token : nodeToken(fn->root),
+                              "'break' outside of a loop.");
+            else
+                emitJump(as, fn->breaks[fn->nBreaks - 1]);
+            break;
+        case NT_RETURN:
+            genReturn(fn, (Node*)node->node);
+            break;
+        case NT_TRY:
+            CODEGEN_ERROR(cg, fn->function != NULL ? fn->function->token : nodeToken(fn->root),
+                          "try and catch aren't supported by the code generator yet.");
+            break;
+        case NT_SWITCH:
+            CODEGEN_ERROR(cg, fn->function != NULL ? fn->function->token : nodeToken(fn->root),
+                          "switch isn't supported by the code generator yet.");
+            break;
+        case NT_STRING: {
+            /* Printing a string is a statement of its own in HolyC */
+            const Name *print = lookupGlobal(cg, cg->printName);
+            /* Declared for the unit when the function is merged, see mergeFunction */
+            Name implicit = {
+                .kind = NAME_FUNCTION,
+                .name = cg->printName,
+                .token = nodeToken(node),
+                .type = scalarType(cg->i32, 0),
+                .symbol = PRINT_SYMBOL,
+                .vararg = true,
+                .interval = SIZE_MAX,
+                .home = X86_NONE
+            };
+            if (print == NULL || print->kind != NAME_FUNCTION)
+                print = &implicit;
+            genCall(fn, print, NULL, &node, 1, nodeToken(node));
+            release(fn);
+        } break;
+        case NT_VARACCESS: {
+            /* A function on its own is called without arguments */
+            Name *name = resolvedName(fn, node);
+            if (name != NULL && name->kind == NAME_FUNCTION) {
+                genCall(fn, name, node, NULL, 0, nodeToken(node));
+                release(fn);
+                break;
+            }
+            genDiscarded(fn, node);
+        } break;
+        default:
+            genDiscarded(fn, node);
+            break;
+    }
+}
+
+/* --- Functions */
+
+static void initFunction(FunctionContext *fn, Codegen *cg, const Name *function) {
+    memset(fn, 0, sizeof(*fn));
+    fn->cg = cg;
+    fn->function = function;
+    initAssembler(&fn->as);
+    initSection(&fn->rodata, 1);
+    initPointerMap(&fn->resolved);
+    initArena(&fn->arena, ARENA_BLOCK_SIZE);
+    initSymbolTable(&fn->symbols, &fn->arena, &cg->globals);
+    initVector(&fn->spine);
+    /* The parameters' */
+    pushScope(&fn->symbols);
+}
+
+static void freeFunction(FunctionContext *fn) {
+    freeAssembler(&fn->as);
+    freeSection(&fn->rodata);
+    freePointerMap(&fn->resolved);
+    free(fn->relocations);
+    free(fn->locals);
+    freeArena(&fn->arena);
+    free(fn->intervals);
+    free(fn->calls);
+    free(fn->loops);
+    free(fn->loopStarts);
+    free(fn->labels);
+    free(fn->gotos);
+    free(fn->breaks);
+    freeVector(&fn->spine);
+}
+
+static bool isAvailable(const Codegen *cg, X86Register reg) {
+    for (size_t i = 0; i < cg->nVariables; i++) {
+        if (cg->variables[i] == reg)
+            return true;
+    }
+    return false;
+}
+
+/* Registers for the variables that get one, the frame for the rest. False if the frame is too large */
+static bool layoutFrame(FunctionContext *fn) {
+    Codegen *cg = fn->cg;
+    const CallingConvention *convention = cg->target.convention;
+    allocateRegisters(fn->intervals, fn->nIntervals, cg->variables, cg->nVariables, convention);
+    bool used[X86_REGISTERS] = { false };
+    for (size_t i = 0; i < fn->nLocals; i++) {
+        Name *local = fn->locals[i];
+        if (local->kind != NAME_LOCAL || local->interval == SIZE_MAX)
+            continue;
+        const LiveInterval *interval = &fn->intervals[local->interval];
+        local->home = interval->assigned;
+        if (local->home != X86_NONE)
+            used[local->home] = true;
+        if (!interval->pinRefused)
+            continue;
+        const char *reg = regAsString(local->request);
+        if (!isAvailable(cg, machineRegister(local->request)))
+            CODEGEN_WARNING(cg, local->token, "Warning: '%s' can't be kept in %s, the compiler needs it.", local->name, reg);
+        else
+            CODEGEN_WARNING(cg, local->token, "Warning: '%s' can't be kept in %s, it is taken or doesn't survive a call.",
+                            local->name, reg);
+    }
+    fn->nSaved = 0;
+    for (X86Register reg = 0; reg < X86_REGISTERS; reg++) {
+        if (used[reg] && isCalleeSaved(convention, reg))
+            fn->saved[fn->nSaved++] = reg;
+    }
+
+    /* Parameters passed on the stack stay where the caller put them */
+    size_t nParameters = fn->function != NULL ? fn->function->nParameters : 0;
+    size_t stackParameters = 16 + convention->shadowSpace;
+    for (size_t i = convention->nArguments; i < nParameters; i++)
+        fn->locals[i]->offset = (int32_t)(stackParameters + 8 * (i - convention->nArguments));
+
+    size_t frame = 8 * fn->nSaved;
+    for (size_t i = 0; i < fn->nLocals; i++) {
+        Name *local = fn->locals[i];
+        if (local->kind != NAME_LOCAL || local->home != X86_NONE || (i < nParameters && i >= convention->nArguments))
+            continue;
+        /* Scalars get a whole slot, they are stored with their size but the slot is never shared */
+        size_t size = isScalar(local->type) ? 8 : typeSize(local->type);
+        size_t alignment = isScalar(local->type) ? 8 : typeAlignment(local->type);
+        if (size > OBJECT_SIZE_MAX - frame) {
+            CODEGEN_ERROR(cg, local->token, "'%s' is too large, a stack frame can be at most %zu bytes.", local->name,
+                          OBJECT_SIZE_MAX);
+            return false;
+        }
+        frame = (frame + size + alignment - 1) / alignment * alignment;
+        local->offset = -(int32_t)frame;
+    }
+    frame = (frame + 15) / 16 * 16;
+    fn->frameSize = frame - 8 * fn->nSaved;
+    return true;
+}
+
+static void emitPrologue(FunctionContext *fn) {
+    Assembler *as = &fn->as;
+    const CallingConvention *convention = fn->cg->target.convention;
+    emitPush(as, X86_RBP);
+    emitMove(as, X86_RBP, X86_RSP);
+    for (size_t i = 0; i < fn->nSaved; i++)
+        emitPush(as, fn->saved[i]);
+    if (fn->frameSize > 0)
+        emitOperationImmediate(as, X86_SUB, X86_RSP, (int32_t)fn->frameSize);
+
+    /*
+     * Through the stack, a parameter's home can be the register another one arrives in.
+     * Narrow parameters are extended, the caller may have left garbage above them
+     */
+    size_t nParameters = fn->function != NULL ? fn->function->nParameters : 0;
+    size_t nRegister = nParameters < convention->nArguments ? nParameters : convention->nArguments;
+    for (size_t i = 0; i < nRegister; i++)
+        emitPush(as, convention->arguments[i]);
+    for (size_t i = nRegister; i-- > 0;) {
+        const Name *parameter = fn->locals[i];
+        size_t size = isScalar(parameter->type) ? typeSize(parameter->type) : 8;
+        if (parameter->home != X86_NONE) {
+            emitPop(as, parameter->home);
+            emitExtend(as, parameter->home, size, isSignedType(parameter->type));
+        } else {
+            emitPop(as, SCRATCH);
+            emitStore(as, X86_RBP, parameter->offset, SCRATCH, size);
+        }
+    }
+    for (size_t i = nRegister; i < nParameters; i++) {
+        const Name *parameter = fn->locals[i];
+        if (parameter->home != X86_NONE)
+            emitLoad(as, parameter->home, X86_RBP, parameter->offset, typeSize(parameter->type), isSignedType(parameter->type));
+    }
+}
+
+static void emitEpilogue(FunctionContext *fn) {
+    Assembler *as = &fn->as;
+    bindLabel(as, fn->epilogue);
+    if (fn->nSaved > 0)
+        emitLea(as, X86_RSP, X86_RBP, -(int32_t)(8 * fn->nSaved));
+    else
+        emitMove(as, X86_RSP, X86_RBP);
+    for (size_t i = fn->nSaved; i-- > 0;)
+        emitPop(as, fn->saved[i]);
+    emitPop(as, X86_RBP);
+    emitReturn(as);
+}
+
+/*
+ * Compiles statements as the body of function, or of main if it is NULL. The body is
+ * walked twice, once to resolve names and find out how long variables live, then to
+ * emit the code once they have their registers.
+ */
+static void compileFunction(Codegen *cg, FunctionTask *task) {
+    const Name *function = task->function;
+    FunctionContext fn;
+    initFunction(&fn, cg, function);
+    size_t errors = cg->errors;
+    for (size_t i = 0; function != NULL && i < function->nParameters; i++)
+        declareLocal(&fn, function->parameters[i], function->parameters[i]);
+    if (cg->errors == errors) {
+        for (size_t i = 0; i < task->nStatements; i++) {
+            fn.root = task->statements[i];
+            visitNode(task->statements[i], analyzeNode, &fn);
+        }
+        finishLiveness(&fn);
+    }
+    if (cg->errors != errors) {
+        task->errors = cg->errors - errors;
+        freeFunction(&fn);
+        return;
+    }
+
+    if (!layoutFrame(&fn)) {
+        task->errors = cg->errors - errors;
+        freeFunction(&fn);
+        return;
+    }
+    for (size_t i = 0; i < fn.nLabels; i++)
+        fn.labels[i].label = newLabel(&fn.as);
+    fn.epilogue = newLabel(&fn.as);
+    emitPrologue(&fn);
+    for (size_t i = 0; i < task->nStatements; i++) {
+        fn.root = task->statements[i];
+        genStatement(&fn, task->statements[i]);
+    }
+    if (function == NULL)
+        emitMoveImmediate(&fn.as, X86_RAX, 0);
+    emitEpilogue(&fn);
+    task->errors = cg->errors - errors;
+    if (task->errors == 0) {
+        /* Handed over to the task, freeFunction leaves them alone */
+        resolveLabels(&fn.as);
+        task->code = fn.as.code;
+        task->rodata = fn.rodata;
+        task->relocations = fn.relocations;
+        task->nRelocations = fn.nRelocations;
+        initSection(&fn.as.code, 1);
+        initSection(&fn.rodata, 1);
+        fn.relocations = NULL;
+    }
+    freeFunction(&fn);
+}
+
+static size_t printSymbol(Codegen *cg) {
+    if (cg->printSymbol == SIZE_MAX) {
+        cg->printSymbol = addSymbol(cg->object, (Symbol) {
+            .name = cg->printName,
+            .section = OBJECT_TEXT,
+            .global = true,
+            .function = true
+        });
+    }
+    return cg->printSymbol;
+}
+
+/* Appends what compiling a function produced to the object, its code goes in .text at its symbol */
+static void mergeFunction(Codegen *cg, FunctionTask *task) {
+    ObjectCode *object = cg->object;
+    if (task->diagnostics.length > 0)
+        report(cg->diagnostics, "%.*s", (int)task->diagnostics.length, task->diagnostics.buffer);
+    cg->errors += task->errors;
+    if (task->errors == 0) {
+        Section *text = &object->sections[OBJECT_TEXT], *rodata = &object->sections[OBJECT_RODATA];
+        size_t offset = alignSection(text, 16), strings = rodata->length;
+        sectionBytes(text, task->code.data, task->code.length);
+        if (task->rodata.length > 0)
+            sectionBytes(rodata, task->rodata.data, task->rodata.length);
+        object->symbols[task->symbol].offset = offset;
+        object->symbols[task->symbol].defined = true;
+        for (size_t i = 0; i < task->nRelocations; i++) {
+            Relocation relocation = task->relocations[i];
+            relocation.offset += offset;
+            if (relocation.symbol == OBJECT_RODATA)
+                relocation.addend += (int64_t)strings;
+            else if (relocation.symbol == PRINT_SYMBOL)
+                relocation.symbol = printSymbol(cg);
+            addRelocation(object, relocation);
+        }
+    }
+    freeSection(&task->code);
+    freeSection(&task->rodata);
+    free(task->relocations);
+    freeDiagnostics(&task->diagnostics);
+}
+
+/* --- Scheduling */
+
+/* The tasks a worker has left, it takes them from the front and the others steal from the back */
+typedef struct TaskRange {
+    Mutex lock;
+    size_t next;
+    size_t end;
+} TaskRange;
+
+typedef struct Scheduler {
+    const Codegen *shared;
+    FunctionTask *tasks;
+    TaskRange *ranges;
+    size_t nWorkers;
+} Scheduler;
+
+typedef struct CodegenWorker {
+    Scheduler *scheduler;
+    size_t index;
+    Thread thread;
+} CodegenWorker;
+
+static bool takeTask(Scheduler *scheduler, size_t worker, size_t *task) {
+    for (size_t i = 0; i < scheduler->nWorkers; i++) {
+        TaskRange *range = &scheduler->ranges[(worker + i) % scheduler->nWorkers];
+        bool taken = false;
+        lockMutex(&range->lock);
+        if (range->next < range->end) {
+            *task = i == 0 ? range->next++ : --range->end;
+            taken = true;
+        }
+        unlockMutex(&range->lock);
+        if (taken)
+            return true;
+    }
+    return false;
+}
+
+static void runTasks(void *argument) {
+    CodegenWorker *worker = argument;
+    Scheduler *scheduler = worker->scheduler;
+    /* Local classes are laid out in an arena of the worker's own */
+    Codegen cg = *scheduler->shared;
+    initArena(&cg.arena, ARENA_BLOCK_SIZE);
+    size_t task;
+    while (takeTask(scheduler, worker->index, &task)) {
+        cg.diagnostics = &scheduler->tasks[task].diagnostics;
+        compileFunction(&cg, &scheduler->tasks[task]);
+    }
+    freeArena(&cg.arena);
+}
+
+/* Every worker starts out with an even share of the tasks in declaration order */
+static void compileTasks(Codegen *cg, FunctionTask *tasks, size_t nTasks, size_t jobs) {
+    size_t nWorkers = jobs < nTasks ? jobs : nTasks;
+    if (nWorkers == 0)
+        nWorkers = 1;
+    Scheduler scheduler = {
+        .shared = cg,
+        .tasks = tasks,
+        .ranges = malloc(nWorkers * sizeof(TaskRange)),
+        .nWorkers = nWorkers
+    };
+    CodegenWorker *workers = malloc(nWorkers * sizeof(CodegenWorker));
+    bool *started = calloc(nWorkers, sizeof(bool));
+    if (scheduler.ranges == NULL || workers == NULL || started == NULL) {
+        fprintf(stderr, "Fatal: Out of memory while generating code.\n");
+        exit(1);
+    }
+    if (nWorkers > 1) {
+        /* The line table is built on the first lookup, afterwards reporting only reads it */
+        size_t line, col;
+        sourcePosition(&cg->lexer->map, 0, &line, &col);
+    }
+    for (size_t i = 0; i < nWorkers; i++) {
+        initMutex(&scheduler.ranges[i].lock);
+        scheduler.ranges[i].next = i * nTasks / nWorkers;
+        scheduler.ranges[i].end = (i + 1) * nTasks / nWorkers;
+        workers[i] = (CodegenWorker) { .scheduler = &scheduler, .index = i };
+    }
+    /* A worker that failed to start leaves its share to be stolen */
+    for (size_t i = 1; i < nWorkers; i++)
+        started[i] = startThread(&workers[i].thread, runTasks, &workers[i]);
+    runTasks(&workers[0]);
+    for (size_t i = 1; i < nWorkers; i++) {
+        if (started[i])
+            joinThread(&workers[i].thread);
+    }
+    for (size_t i = 0; i < nWorkers; i++)
+        freeMutex(&scheduler.ranges[i].lock);
+    free(scheduler.ranges);
+    free(workers);
+    free(started);
+}
+
+/* --- Globals */
+
+static size_t reserveBss(Section *bss, size_t size, size_t alignment) {
+    size_t offset = (bss->length + alignment - 1) / alignment * alignment;
+    bss->length = offset + size;
+    if (alignment > bss->alignment)
+        bss->alignment = alignment;
+    return offset;
+}
+
+static void declareGlobal(Codegen *cg, VariableDeclerationNode *decl) {
+    ValueType type;
+    if (!resolveType(cg, NULL, &decl->type, decl, decl->name, &type))
+        return;
+    if (typeSize(type) == 0) {
+        CODEGEN_ERROR(cg, decl->name, "'%s' can't be of type %s, it has no value.", decl->name.value, type.base->name);
+        return;
+    }
+    if (typeSize(type) > OBJECT_SIZE_MAX) {
+        CODEGEN_ERROR(cg, decl->name, "'%s' is too large, a global can be at most %zu bytes.", decl->name.value,
+                      OBJECT_SIZE_MAX);
+        return;
+    }
+    if (decl->reg != NONE && decl->reg != NOREG)
+        CODEGEN_WARNING(cg, decl->name, "Warning: '%s' is a global, it is kept in memory.", decl->name.value);
+    bool isExtern = (decl->type.qualifiers & EXTERN) != 0;
+    Name *previous = lookupGlobal(cg, decl->name.value);
+    if (previous != NULL) {
+        bool wasExtern = previous->kind == NAME_GLOBAL && !cg->object->symbols[previous->symbol].defined;
+        if (previous->kind != NAME_GLOBAL || (!isExtern && !wasExtern)) {
+            CODEGEN_ERROR(cg, decl->name, "'%s' is already declared.", decl->name.value);
+            return;
+        }
+        if (isExtern)
+            return;
+    }
+    Symbol symbol = {
+        .name = decl->name.value,
+        .section = OBJECT_BSS,
+        .defined = !isExtern,
+        .global = !(decl->type.qualifiers & STATIC)
+    };
+    size_t size = typeSize(type), alignment = typeAlignment(type);
+    if (isExtern) {
+        /* Defined somewhere else */
+    } else if (isStaticInitializer(decl, type)) {
+        Section *data = &cg->object->sections[OBJECT_DATA];
+        uint64_t value;
+        if (!integerValue(cg, decl->initializer, &value))
+            return;
+        symbol.section = OBJECT_DATA;
+        symbol.offset = alignSection(data, alignment);
+        for (size_t i = 0; i < size; i++)
+            sectionByte(data, (uint8_t)(value >> (8 * i)));
+    } else {
+        symbol.offset = reserveBss(&cg->object->sections[OBJECT_BSS], size, alignment);
+    }
+    if (previous != NULL) {
+        /* The definition of what was declared extern before */
+        cg->object->symbols[previous->symbol] = symbol;
+        previous->type = type;
+        return;
+    }
+    addName(cg, (Name) {
+        .kind = NAME_GLOBAL,
+        .name = decl->name.value,
+        .token = decl->name,
+        .type = type,
+        .symbol = addSymbol(cg->object, symbol),
+        .interval = SIZE_MAX,
+        .home = X86_NONE
+    });
+}
+
+static void declareFunction(Codegen *cg, FunctionDeclerationNode *decl) {
+    ValueType returns;
+    if (!resolveType(cg, NULL, decl->type.type.returnType, NULL, decl->name, &returns))
+        return;
+    if (isAggregate(returns)) {
+        CODEGEN_ERROR(cg, decl->name, "Functions can't return a %s, only a pointer to it.", returns.base->name);
+        return;
+    }
+    bool vararg = (decl->type.qualifiers & VARARG) != 0;
+    if (decl->body != NULL && vararg) {
+        CODEGEN_ERROR(cg, decl->name, "Functions with variable arguments can't be defined yet, only declared.");
+        return;
+    }
+    Name *previous = lookupGlobal(cg, decl->name.value);
+    if (previous != NULL) {
+        if (previous->kind != NAME_FUNCTION || (previous->defined && decl->body != NULL)) {
+            CODEGEN_ERROR(cg, decl->name, "'%s' is already declared.", decl->name.value);
+            return;
+        }
+        /* A prototype and then the definition, the definition's parameters count */
+        if (decl->body != NULL) {
+            previous->defined = true;
+            previous->parameters = decl->type.parameters;
+            previous->nParameters = decl->type.nParameters;
+            previous->type = returns;
+            previous->token = decl->name;
+            cg->object->symbols[previous->symbol].defined = true;
+            cg->object->symbols[previous->symbol].global = !(decl->type.qualifiers & STATIC);
+        }
+        return;
+    }
+    size_t symbol = addSymbol(cg->object, (Symbol) {
+        .name = decl->name.value,
+        .section = OBJECT_TEXT,
+        .defined = decl->body != NULL,
+        .global = !(decl->type.qualifiers & STATIC),
+        .function = true
+    });
+    addName(cg, (Name) {
+        .kind = NAME_FUNCTION,
+        .name = decl->name.value,
+        .token = decl->name,
+        .type = returns,
+        .symbol = symbol,
+        .parameters = decl->type.parameters,
+        .nParameters = decl->type.nParameters,
+        .vararg = vararg,
+        .defined = decl->body != NULL,
+        .interval = SIZE_MAX,
+        .home = X86_NONE
+    });
+}
+
+static void declareGlobalType(Codegen *cg, Node *node) {
+    TypeNode *typeNode = (TypeNode*)node->node;
+    Name *previous = lookupGlobal(cg, typeNode->name.value);
+    if (previous != NULL) {
+        CODEGEN_ERROR(cg, typeNode->name, "'%s' is already declared.", typeNode->name.value);
+        return;
+    }
+    BaseType *type = newBaseType(cg, typeNode->name.value);
+    addName(cg, (Name) {
+        .kind = NAME_TYPE,
+        .name = type->name,
+        .token = typeNode->name,
+        .type = scalarType(type, 0),
+        .interval = SIZE_MAX,
+        .home = X86_NONE
+    });
+    layoutType(cg, NULL, type, typeNode, node->type == NT_UNION);
+}
+
+/* Everything but declarations is compiled into main */
+static bool isTopLevelCode(Codegen *cg, const Node *node) {
+    switch (node->type) {
+        case NT_NONE:
+        case NT_FUNCDECL:
+        case NT_CLASS:
+        case NT_UNION:
+            return false;
+        case NT_VARDECL: {
+            VariableDeclerationNode *decl = (VariableDeclerationNode*)node->node;
+            Name *name = lookupGlobal(cg, decl->name.value);
+            return decl->initializer != NULL && name != NULL && name->kind == NAME_GLOBAL &&
+                !isStaticInitializer(decl, name->type);
+        }
+        default:
+            return true;
+    }
+}
+
+static void addBuiltinTypes(Codegen *cg) {
+    static const struct {
+        const char *name;
+        size_t size;
+        bool isSigned;
+    } builtins[] = {
+        { "U0", 0, false }, { "I0", 0, true },
+        { "U8", 1, false }, { "I8", 1, true },
+        { "U16", 2, false }, { "I16", 2, true },
+        { "U32", 4, false }, { "I32", 4, true },
+        { "U64", 8, false }, { "I64", 8, true }
+    };
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        BaseType *type = newBaseType(cg, internString(cg->lexer->interner, builtins[i].name));
+        type->size = builtins[i].size;
+        type->alignment = builtins[i].size ? builtins[i].size : 1;
+        type->isSigned = builtins[i].isSigned;
+        addName(cg, (Name) {
+            .kind = NAME_TYPE,
+            .name = type->name,
+            .type = scalarType(type, 0),
+            .interval = SIZE_MAX,
+            .home = X86_NONE
+        });
+    }
+    cg->u0 = lookupGlobal(cg, internString(cg->lexer->interner, "U0"))->type.base;
+    cg->u8 = lookupGlobal(cg, internString(cg->lexer->interner, "U8"))->type.base;
+    cg->i32 = lookupGlobal(cg, internString(cg->lexer->interner, "I32"))->type.base;
+    cg->i64 = lookupGlobal(cg, internString(cg->lexer->interner, "I64"))->type.base;
+    cg->u64 = lookupGlobal(cg, internString(cg->lexer->interner, "U64"))->type.base;
+}
+
+Target hostTarget(void) {
+#ifdef _WIN32
+    return (Target) { .format = OBJECT_COFF, .convention = &WINDOWS_CALLING_CONVENTION };
+#else
+    return (Target) { .format = OBJECT_ELF, .convention = &SYSV_CALLING_CONVENTION };
+#endif /* _WIN32 */
+}
+
+bool generateCode(ObjectCode *object, Node *unit, Lexer *lexer, Target target, size_t jobs) {
+    Codegen cg = {
+        .object = object,
+        .target = target,
+        .lexer = lexer,
+        .diagnostics = lexer->diagnostics,
+        .printName = internString(lexer->interner, "printf"),
+        .printSymbol = SIZE_MAX
+    };
+    initArena(&cg.arena, ARENA_BLOCK_SIZE);
+    initScope(&cg.globals, NULL);
+    addBuiltinTypes(&cg);
+
+    /* Registers calls clobber first, a variable that lives across a call can only use the others */
+    for (int pass = 0; pass < 2; pass++) {
+        for (X86Register reg = 0; reg < X86_REGISTERS; reg++) {
+            bool isTemporary = reg == SCRATCH || reg == X86_RSP || reg == X86_RBP;
+            for (size_t i = 0; i < TEMPORARIES; i++)
+                isTemporary = isTemporary || temporaries[i] == reg;
+            if (!isTemporary && isCalleeSaved(target.convention, reg) == (pass == 1))
+                cg.variables[cg.nVariables++] = reg;
+        }
+    }
+
+    CompoundNode *statements = (CompoundNode*)unit->node;
+    for (size_t i = 0; i < statements->nStatements; i++) {
+        Node *statement = statements->statements[i];
+        switch (statement->type) {
+            case NT_VARDECL:
+                declareGlobal(&cg, (VariableDeclerationNode*)statement->node);
+                break;
+            case NT_FUNCDECL:
+                declareFunction(&cg, (FunctionDeclerationNode*)statement->node);
+                break;
+            case NT_CLASS:
+            case NT_UNION:
+                declareGlobalType(&cg, statement);
+                break;
+            default:
+                break;
+        }
+    }
+
+    /* One task per function with a body and one more for main */
+    FunctionTask *tasks = calloc(statements->nStatements + 1, sizeof(FunctionTask));
+    Node **code = malloc((statements->nStatements ? statements->nStatements : 1) * sizeof(Node*));
+    if (tasks == NULL || code == NULL) {
+        fprintf(stderr, "Fatal: Out of memory while generating code.\n");
+        exit(1);
+    }
+    size_t nTasks = 0, nCode = 0;
+    for (size_t i = 0; i < statements->nStatements; i++) {
+        Node *statement = statements->statements[i];
+        if (isTopLevelCode(&cg, statement))
+            code[nCode++] = statement;
+        if (statement->type != NT_FUNCDECL || ((FunctionDeclerationNode*)statement->node)->body == NULL)
+            continue;
+        FunctionDeclerationNode *decl = (FunctionDeclerationNode*)statement->node;
+        Name *function = lookupGlobal(&cg, decl->name.value);
+        if (function == NULL || function->kind != NAME_FUNCTION || function->parameters != decl->type.parameters)
+            continue;
+        tasks[nTasks++] = (FunctionTask) {
+            .function = function,
+            .statements = &decl->body,
+            .nStatements = 1,
+            .symbol = function->symbol
+        };
+    }
+
+    if (nCode > 0) {
+        const char *mainName = internString(lexer->interner, "main");
+        Name *main = lookupGlobal(&cg, mainName);
+        if (main != NULL && (main->kind != NAME_FUNCTION || main->defined)) {
+            CODEGEN_ERROR(&cg, main->token, "'main' can't be defined in a unit with top-level statements, they are its body.");
+        } else {
+            size_t symbol = main != NULL ? main->symbol : addSymbol(object, (Symbol) {
+                .name = mainName,
+                .section = OBJECT_TEXT,
+                .global = true,
+                .function = true
+            });
+            object->symbols[symbol].global = true;
+            tasks[nTasks++] = (FunctionTask) {
+                .statements = code,
+                .nStatements = nCode,
+                .symbol = symbol
+            };
+        }
+    }
+
+    for (size_t i = 0; i < nTasks; i++)
+        initDiagnostics(&tasks[i].diagnostics);
+    compileTasks(&cg, tasks, nTasks, jobs);
+    for (size_t i = 0; i < nTasks; i++)
+        mergeFunction(&cg, &tasks[i]);
+    free(tasks);
+    free(code);
+
+    freeArena(&cg.arena);
+    return cg.errors == 0;
+}
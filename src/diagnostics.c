@@ -0,0 +1,117 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include "diagnostics.h"
+
+#define DIAGNOSTICS_INITIAL_CAPACITY 256
+/* Longer lines are only quoted around the column, quoting all of a generated line for each of its errors is quadratic */
+#define DIAGNOSTICS_QUOTE_WIDTH 160
+
+void initDiagnostics(Diagnostics *diagnostics) {
+    diagnostics->buffer = NULL;
+    diagnostics->length = 0;
+    diagnostics->capacity = 0;
+}
+
+void freeDiagnostics(Diagnostics *diagnostics) {
+    free(diagnostics->buffer);
+    initDiagnostics(diagnostics);
+}
+
+static void vreport(Diagnostics *diagnostics, const char *format, va_list args) {
+    if (diagnostics == NULL) {
+        vfprintf(stderr, format, args);
+        return;
+    }
+
+    va_list copy;
+    va_copy(copy, args);
+    int length = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+    if (length < 0)
+        return;
+
+    size_t required = diagnostics->length + (size_t)length + 1;
+    if (required > diagnostics->capacity) {
+        size_t capacity = diagnostics->capacity ? diagnostics->capacity : DIAGNOSTICS_INITIAL_CAPACITY;
+        while (capacity < required)
+            capacity *= 2;
+        char *buffer = realloc(diagnostics->buffer, capacity);
+        if (buffer == NULL) {
+            fprintf(stderr, "Fatal: Out of memory while buffering diagnostics.\n");
+            exit(1);
+        }
+        diagnostics->buffer = buffer;
+        diagnostics->capacity = capacity;
+    }
+
+    vsnprintf(diagnostics->buffer + diagnostics->length, (size_t)length + 1, format, args);
+    diagnostics->length += (size_t)length;
+}
+
+void report(Diagnostics *diagnostics, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vreport(diagnostics, format, args);
+    va_end(args);
+}
+
+static void vreportSpan(Diagnostics *diagnostics, SourceMap *map, const char *file, size_t offset, size_t length, const char *format, va_list args) {
+    size_t line, col;
+    sourcePosition(map, offset, &line, &col);
+    report(diagnostics, "%s:%zu:%zu: ", file, line, col);
+    vreport(diagnostics, format, args);
+
+    size_t len;
+    const char *text = sourceLine(map, line, &len);
+    const char *before = "", *after = "";
+    if (len > DIAGNOSTICS_QUOTE_WIDTH) {
+        size_t start = col - 1 > DIAGNOSTICS_QUOTE_WIDTH / 2 ? col - 1 - DIAGNOSTICS_QUOTE_WIDTH / 2 : 0;
+        if (start > len - DIAGNOSTICS_QUOTE_WIDTH)
+            start = len - DIAGNOSTICS_QUOTE_WIDTH;
+        before = start > 0 ? "..." : "";
+        after = start + DIAGNOSTICS_QUOTE_WIDTH < len ? "..." : "";
+        text += start;
+        len = DIAGNOSTICS_QUOTE_WIDTH;
+        col -= start;
+    }
+    report(diagnostics, "\n    %s%.*s%s\n    %s", before, (int)len, text, after, *before ? "   " : "");
+    /* The quote is at most DIAGNOSTICS_QUOTE_WIDTH long, so the caret and the span under it fit */
+    char marker[DIAGNOSTICS_QUOTE_WIDTH * 2 + 2];
+    size_t n = 0;
+    /* Tabs are kept so the caret lines up however wide the terminal renders them */
+    for (size_t i = 0; i + 1 < col && i < len; i++)
+        marker[n++] = text[i] == '\t' ? '\t' : ' ';
+    marker[n++] = '^';
+    /* Spans running past the end of the line are cut off there */
+    for (size_t i = col; i < col - 1 + length && i < len; i++)
+        marker[n++] = '~';
+    report(diagnostics, "%.*s\n", (int)n, marker);
+}
+
+void reportAt(Diagnostics *diagnostics, SourceMap *map, const char *file, size_t offset, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vreportSpan(diagnostics, map, file, offset, 1, format, args);
+    va_end(args);
+}
+
+void reportSpan(Diagnostics *diagnostics, SourceMap *map, const char *file, size_t offset, size_t length, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vreportSpan(diagnostics, map, file, offset, length, format, args);
+    va_end(args);
+}
+
+void flushDiagnostics(Diagnostics *diagnostics, FILE *stream) {
+    if (diagnostics->length)
+        fwrite(diagnostics->buffer, 1, diagnostics->length, stream);
+    diagnostics->length = 0;
+}
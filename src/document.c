@@ -0,0 +1,400 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "document.h"
+#include "lexer.h"
+#include "visitor.h"
+
+/* Most top-level statements are a few dozen nodes, the larger ones just take more blocks */
+#define DOCUMENT_ARENA_BLOCK_SIZE 4096
+#define DOCUMENT_INITIAL_CAPACITY 64
+
+typedef struct ItemList {
+    DocumentItem *items;
+    size_t count;
+    size_t capacity;
+} ItemList;
+
+static void pushItem(ItemList *list, DocumentItem item) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : DOCUMENT_INITIAL_CAPACITY;
+        list->items = realloc(list->items, list->capacity * sizeof(DocumentItem));
+        if (list->items == NULL) {
+            fprintf(stderr, "Fatal: Out of memory while updating a document.\n");
+            exit(1);
+        }
+    }
+    list->items[list->count++] = item;
+}
+
+static void freeItem(DocumentItem *item) {
+    freeArena(&item->arena);
+    freeDiagnostics(&item->diagnostics);
+}
+
+static void spliceSource(Document *document, size_t offset, size_t removed, const char *text, size_t length) {
+    size_t newLength = document->length - removed + length;
+    if (newLength + 1 > document->capacity) {
+        size_t capacity = document->capacity ? document->capacity : DOCUMENT_INITIAL_CAPACITY;
+        while (capacity < newLength + 1)
+            capacity *= 2;
+        char *source = realloc(document->source, capacity);
+        if (source == NULL) {
+            fprintf(stderr, "Fatal: Out of memory while editing a document.\n");
+            exit(1);
+        }
+        document->source = source;
+        document->capacity = capacity;
+    }
+    memmove(document->source + offset + length, document->source + offset + removed, document->length - offset - removed);
+    if (length > 0)
+        memcpy(document->source + offset, text, length);
+    document->length = newLength;
+    document->source[newLength] = '\0';
+}
+
+/* The lexer uses the document's line table */
+static void startLexer(Document *document, Lexer *lexer, Diagnostics *pending) {
+    initLexer(lexer, document->source, document->length, document->file, document->interner, pending);
+    lexer->map = document->map;
+}
+
+static void stopLexer(Document *document, Lexer *lexer) {
+    /* Along with whatever the errors had it build */
+    document->map = lexer->map;
+    initSourceMap(&lexer->map, document->source, document->length);
+    freeLexer(lexer);
+}
+
+/* Errors of the statement being parsed collect in pending, the lexer reports to it as well */
+static DocumentItem parseItem(ParserContext *ctx, Diagnostics *pending) {
+    DocumentItem item;
+    size_t errors = ctx->errors;
+    initArena(&item.arena, DOCUMENT_ARENA_BLOCK_SIZE);
+    item.start = parserOffset(ctx);
+    item.shift = 0;
+    item.typesMark = ctx->types.count;
+    item.node = parseTopLevel(ctx, &item.arena);
+    /*
+     * What a class tries to register, whether or not the name was taken already. Statements
+     * taken over by a later edit register it again, and which one gets it can change
+     */
+    if (item.node != NULL && (item.node->type == NT_CLASS || item.node->type == NT_UNION))
+        item.declares = ((TypeNode*)item.node->node)->name.value;
+    else
+        item.declares = ctx->types.count > item.typesMark ? ctx->types.order[item.typesMark] : NULL;
+    item.diagnostics = *pending;
+    initDiagnostics(pending);
+    /*
+     * A class missing its '}' is kept, but it is an error all the same. Past a lexer
+     * error the statement only ran up to a made up end of the file
+     */
+    item.failed = ctx->errors > errors || ctx->lexer->failed;
+    return item;
+}
+
+/* Messages quote line numbers, a statement with any is parsed again rather than moved */
+static bool reported(const DocumentItem *item) {
+    return item->failed || item->diagnostics.length > 0;
+}
+
+/* Whether the new statements from newFirst on declare the same types as the old ones from oldFirst to oldEnd */
+static bool sameDeclarations(const DocumentItem *old, size_t oldFirst, size_t oldEnd, const ItemList *next, size_t newFirst) {
+    size_t i = oldFirst, j = newFirst;
+    for (;;) {
+        while (i < oldEnd && old[i].declares == NULL)
+            i++;
+        while (j < next->count && next->items[j].declares == NULL)
+            j++;
+        if (i == oldEnd || j == next->count)
+            return i == oldEnd && j == next->count;
+        if (old[i++].declares != next->items[j++].declares)
+            return false;
+    }
+}
+
+/* Last item starting before offset, an edit right at the start of one might join it to the one before */
+static size_t findItem(const Document *document, size_t offset) {
+    size_t low = 0, high = document->nItems;
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+        if (document->items[middle].start < offset)
+            low = middle;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+void openDocument(Document *document, const char *file, const char *source, size_t length, Interner *interner, const TypeRegistry *prefix) {
+    document->source = NULL;
+    document->length = 0;
+    document->capacity = 0;
+    document->file = file;
+    initSourceMap(&document->map, NULL, 0);
+    document->interner = interner;
+    initUnitTypes(&document->types, interner, prefix);
+    document->items = NULL;
+    document->nItems = 0;
+    document->itemsCapacity = 0;
+    /* Everything is one big insertion into an empty document */
+    editDocument(document, 0, 0, source, length);
+}
+
+void closeDocument(Document *document) {
+    for (size_t i = 0; i < document->nItems; i++)
+        freeItem(&document->items[i]);
+    free(document->items);
+    free(document->source);
+    freeSourceMap(&document->map);
+    freeTypeRegistry(&document->types);
+}
+
+size_t editDocument(Document *document, size_t offset, size_t removed, const char *text, size_t length) {
+    if (offset > document->length)
+        offset = document->length;
+    if (removed > document->length - offset)
+        removed = document->length - offset;
+    spliceSource(document, offset, removed, text, length);
+    editSourceMap(&document->map, document->source, document->length, offset, removed, length);
+    DocumentItem *old = document->items;
+    size_t nOld = document->nItems;
+    ptrdiff_t delta = (ptrdiff_t)length - (ptrdiff_t)removed;
+    /* Old statements starting inside the removed bytes are gone, the ones after them moved by delta */
+    size_t oldEnd = offset + removed;
+    /* No statement boundary before this is trusted, the edit may have moved them all */
+    size_t limit = offset + length;
+
+    size_t first = findItem(document, offset);
+    /* Errors quote the whole line they are on, so statements earlier on the edited line go as well */
+    size_t lineStart = offset;
+    while (lineStart > 0 && document->source[lineStart - 1] != '\n')
+        lineStart--;
+    while (first > 0 && first < nOld && old[first].start > lineStart)
+        first--;
+    /*
+     * The lexer runs up to PARSER_LOOKAHEAD tokens ahead of the parser, so its messages
+     * about the first tokens of a statement can be with one of the statements before.
+     * Parsing starts early enough to lex them with the same one again.
+     */
+    for (size_t back = 1; back <= PARSER_LOOKAHEAD && back <= first && first < nOld; back++) {
+        if (reported(&old[first - back])) {
+            first -= back;
+            back = 0;
+        }
+    }
+    Diagnostics pending;
+    initDiagnostics(&pending);
+    Lexer lexer;
+    startLexer(document, &lexer, &pending);
+    ParserContext ctx;
+    for (;;) {
+        popTypeScope(&document->types, first < nOld ? old[first].typesMark : document->types.count);
+        /* Before the first statement there could be anything now, so the first one starts from scratch */
+        lexer.index = first == 0 || first >= nOld ? 0 : old[first].start;
+        beginParser(&ctx, &lexer, document->types);
+        /*
+         * What is lexed ahead right away was lexed by the statements before in a full parse.
+         * A token of theirs can run into the edit, if it has errors now those go with them.
+         */
+        if (pending.length == 0 || first == 0 || first >= nOld)
+            break;
+        document->types = endParser(&ctx);
+        stopLexer(document, &lexer);
+        freeDiagnostics(&pending);
+        initDiagnostics(&pending);
+        startLexer(document, &lexer, &pending);
+        first = first > PARSER_LOOKAHEAD ? first - PARSER_LOOKAHEAD : 0;
+    }
+    ItemList next = { NULL, 0, 0 };
+    for (size_t i = 0; i < first && i < nOld; i++)
+        pushItem(&next, old[i]);
+
+    /*
+     * Statements are parsed until one would start right where an old one that the edit
+     * didn't touch starts now. The old ones from there on are taken over, unless they
+     * reported something, those are parsed again so their messages show the right lines.
+     */
+    size_t reparsed = 0;
+    size_t candidate = first;
+    size_t runOld = first, runNew = next.count;
+    bool parsing = true;
+    for (;;) {
+        if (parsing) {
+            if (parserAtEnd(&ctx))
+                break;
+            size_t at = parserOffset(&ctx);
+            /* After a lexer error there is only what is in the lookahead left, it is parsed as is */
+            if (at >= limit && !lexer.failed) {
+                while (candidate < nOld && (old[candidate].start < oldEnd || (ptrdiff_t)old[candidate].start + delta < (ptrdiff_t)at))
+                    candidate++;
+                /* The same types have to be declared up to here, or the rest could parse differently */
+                if (candidate < nOld && (ptrdiff_t)old[candidate].start + delta == (ptrdiff_t)at &&
+                    sameDeclarations(old, runOld, candidate, &next, runNew)) {
+                    parsing = false;
+                    continue;
+                }
+            }
+            pushItem(&next, parseItem(&ctx, &pending));
+            reparsed++;
+        } else {
+            if (candidate == nOld)
+                break;
+            DocumentItem item = old[candidate];
+            item.start = (size_t)((ptrdiff_t)item.start + delta);
+            /* Same as for the first statement, lexer errors of a failed one can be with those before it */
+            bool clean = true;
+            for (size_t i = candidate; i < nOld && i <= candidate + PARSER_LOOKAHEAD; i++)
+                clean = clean && !reported(&old[i]);
+            if (!clean) {
+                parsing = true;
+                /*
+                 * Right after parsing stopped the lookahead has lexed into the statement already,
+                 * and lexer errors in it have been reported with what came before, as they would be.
+                 * Otherwise the statements before were taken over and had none to lex again.
+                 */
+                if (parserOffset(&ctx) != item.start)
+                    seekParser(&ctx, item.start);
+                limit = item.start + 1;
+                runOld = candidate;
+                runNew = next.count;
+                continue;
+            }
+            item.shift += delta;
+            item.typesMark = ctx.types.count;
+            if (item.declares != NULL)
+                addType(&ctx.types, item.declares);
+            pushItem(&next, item);
+            /* Taken over, what is left behind in old is freed below */
+            initArena(&old[candidate].arena, DOCUMENT_ARENA_BLOCK_SIZE);
+            initDiagnostics(&old[candidate].diagnostics);
+            candidate++;
+        }
+    }
+    if (pending.length > 0) {
+        /* A lexer error after the last statement, it is kept as a statement of its own */
+        DocumentItem item = {
+            .node = NULL,
+            .diagnostics = pending,
+            .failed = lexer.failed,
+            .start = parserOffset(&ctx),
+            .shift = 0,
+            .declares = NULL,
+            .typesMark = ctx.types.count
+        };
+        initArena(&item.arena, DOCUMENT_ARENA_BLOCK_SIZE);
+        pushItem(&next, item);
+    }
+
+    document->types = endParser(&ctx);
+    stopLexer(document, &lexer);
+    for (size_t i = first; i < nOld; i++)
+        freeItem(&old[i]);
+    free(old);
+    document->items = next.items;
+    document->nItems = next.count;
+    document->itemsCapacity = next.capacity;
+    return reparsed;
+}
+
+#define SHIFT(TOKEN, DELTA) ((TOKEN).index = (uint32_t)((ptrdiff_t)(TOKEN).index + (DELTA)))
+
+static bool shiftVisitor(void *data, Node *node, VisitStep step, size_t child);
+
+/* Parameters aren't children, their names and default values are moved along here */
+static void shiftType(Type *type, ptrdiff_t delta) {
+    for (size_t i = 0; i < type->nParameters; i++) {
+        VariableDeclerationNode *parameter = type->parameters[i];
+        SHIFT(parameter->name, delta);
+        shiftType(&parameter->type, delta);
+        if (parameter->initializer != NULL)
+            visitNode(parameter->initializer, shiftVisitor, &delta);
+    }
+    if (type->qualifiers & FUNCTION)
+        shiftType(type->type.returnType, delta);
+}
+
+static bool shiftVisitor(void *data, Node *node, VisitStep step, size_t child) {
+    (void)child;
+    if (step != VISIT_ENTER)
+        return true;
+    ptrdiff_t delta = *(ptrdiff_t*)data;
+    switch (node->type) {
+        case NT_INT:
+        case NT_FLOAT:
+        case NT_STRING:
+        case NT_CHAR:
+            SHIFT(((ValueNode*)node->node)->value, delta);
+            break;
+        case NT_BINOP:
+        case NT_ASSIGN:
+            SHIFT(((BinaryOperationNode*)node->node)->op, delta);
+            break;
+        case NT_UNARYOP:
+            SHIFT(((UnaryOperationNode*)node->node)->op, delta);
+            break;
+        case NT_VARACCESS:
+            SHIFT(((VariableAccessNode*)node->node)->name, delta);
+            break;
+        case NT_VARDECL: {
+            VariableDeclerationNode *decl = (VariableDeclerationNode*)node->node;
+            SHIFT(decl->name, delta);
+            shiftType(&decl->type, delta);
+        } break;
+        case NT_FUNCDECL: {
+            FunctionDeclerationNode *function = (FunctionDeclerationNode*)node->node;
+            SHIFT(function->name, delta);
+            shiftType(&function->type, delta);
+        } break;
+        case NT_ACCESS: {
+            AccessNode *access = (AccessNode*)node->node;
+            SHIFT(access->op, delta);
+            SHIFT(access->member, delta);
+        } break;
+        case NT_GOTO:
+            SHIFT(((GotoNode*)node->node)->label, delta);
+            break;
+        case NT_LABEL:
+            SHIFT(((LabelNode*)node->node)->name, delta);
+            break;
+        case NT_CLASS:
+        case NT_UNION:
+            SHIFT(((TypeNode*)node->node)->name, delta);
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+Node *documentItem(Document *document, size_t i) {
+    DocumentItem *item = &document->items[i];
+    /* Statements taken over by an edit are only fixed up once something looks at them */
+    if (item->shift != 0 && item->node != NULL)
+        visitNode(item->node, shiftVisitor, &item->shift);
+    item->shift = 0;
+    return item->node;
+}
+
+bool documentFailed(const Document *document) {
+    for (size_t i = 0; i < document->nItems; i++) {
+        if (document->items[i].failed)
+            return true;
+    }
+    return false;
+}
+
+void documentDiagnostics(const Document *document, Diagnostics *diagnostics) {
+    for (size_t i = 0; i < document->nItems; i++) {
+        const Diagnostics *item = &document->items[i].diagnostics;
+        if (item->length > 0)
+            report(diagnostics, "%.*s", (int)item->length, item->buffer);
+    }
+}
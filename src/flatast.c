@@ -0,0 +1,688 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flatast.h"
+#include "visitor.h"
+
+#define FLATAST_INITIAL_CAPACITY 256
+
+/* Makes room for needed more items, indices have to stay below NO_NODE */
+static void *reserve(void *items, size_t count, size_t *capacity, size_t itemSize, size_t needed) {
+    if (count + needed <= *capacity)
+        return items;
+    size_t newCapacity = *capacity ? *capacity : FLATAST_INITIAL_CAPACITY;
+    while (newCapacity < count + needed)
+        newCapacity *= 2;
+    if (count + needed >= NO_NODE) {
+        fprintf(stderr, "Fatal: AST too large to flatten.\n");
+        exit(1);
+    }
+    items = realloc(items, newCapacity * itemSize);
+    if (items == NULL) {
+        fprintf(stderr, "Fatal: Out of memory while flattening the AST.\n");
+        exit(1);
+    }
+    *capacity = newCapacity;
+    return items;
+}
+
+void initFlatAst(FlatAst *ast) {
+    *ast = (FlatAst) {
+        .root = NO_NODE
+    };
+}
+
+void freeFlatAst(FlatAst *ast) {
+    free(ast->nodes);
+    free(ast->tokens);
+    free(ast->extra);
+    free(ast->strings);
+    free(ast->types);
+    free(ast->declarations);
+    free(ast->sizes);
+    initFlatAst(ast);
+}
+
+/* Offset of a string already in the AST, keyed by pointer since values are interned */
+typedef struct StringSlot {
+    const char *str;
+    NodeRef offset;
+} StringSlot;
+
+typedef struct Flattener {
+    FlatAst *ast;
+    /* Index of every finished child whose parent hasn't been left yet, NO_NODE for missing ones */
+    NodeRef *results;
+    size_t nResults;
+    size_t resultsCapacity;
+    /* Open addressing, str == NULL marks an empty slot */
+    StringSlot *strings;
+    size_t nStrings;
+    size_t stringsCapacity;
+} Flattener;
+
+#define STRING_SLOT(STR, CAPACITY) ((((size_t)(STR) >> 3) * 2654435761u) & ((CAPACITY) - 1))
+
+static void insertString(StringSlot *slots, size_t capacity, StringSlot entry) {
+    size_t slot = STRING_SLOT(entry.str, capacity);
+    while (slots[slot].str != NULL)
+        slot = (slot + 1) & (capacity - 1);
+    slots[slot] = entry;
+}
+
+static NodeRef addString(Flattener *flattener, const char *str) {
+    if (str == NULL)
+        return NO_NODE;
+    if (flattener->stringsCapacity) {
+        size_t slot = STRING_SLOT(str, flattener->stringsCapacity);
+        while (flattener->strings[slot].str != NULL) {
+            if (flattener->strings[slot].str == str)
+                return flattener->strings[slot].offset;
+            slot = (slot + 1) & (flattener->stringsCapacity - 1);
+        }
+    }
+    if ((flattener->nStrings + 1) * 2 > flattener->stringsCapacity) {
+        size_t capacity = flattener->stringsCapacity ? flattener->stringsCapacity * 2 : FLATAST_INITIAL_CAPACITY;
+        StringSlot *slots = calloc(capacity, sizeof(StringSlot));
+        if (slots == NULL) {
+            fprintf(stderr, "Fatal: Out of memory while flattening the AST.\n");
+            exit(1);
+        }
+        for (size_t i = 0; i < flattener->stringsCapacity; i++)
+            if (flattener->strings[i].str != NULL)
+                insertString(slots, capacity, flattener->strings[i]);
+        free(flattener->strings);
+        flattener->strings = slots;
+        flattener->stringsCapacity = capacity;
+    }
+
+    FlatAst *ast = flattener->ast;
+    size_t len = strlen(str) + 1;
+    ast->strings = reserve(ast->strings, ast->nStrings, &ast->stringsCapacity, 1, len);
+    NodeRef offset = (NodeRef)ast->nStrings;
+    memcpy(ast->strings + offset, str, len);
+    ast->nStrings += len;
+    insertString(flattener->strings, flattener->stringsCapacity, (StringSlot) { str, offset });
+    flattener->nStrings += 1;
+    return offset;
+}
+
+static NodeRef addNode(FlatAst *ast, NodeType type, NodeRef token, NodeRef lhs, NodeRef rhs) {
+    ast->nodes = reserve(ast->nodes, ast->nNodes, &ast->nodesCapacity, sizeof(FlatNode), 1);
+    ast->nodes[ast->nNodes] = (FlatNode) {
+        .type = (uint8_t)type,
+        .token = token,
+        .lhs = lhs,
+        .rhs = rhs
+    };
+    return (NodeRef)ast->nNodes++;
+}
+
+static NodeRef addToken(Flattener *flattener, Token token) {
+    NodeRef value = addString(flattener, token.value);
+    FlatAst *ast = flattener->ast;
+    ast->tokens = reserve(ast->tokens, ast->nTokens, &ast->tokensCapacity, sizeof(FlatToken), 1);
+    ast->tokens[ast->nTokens] = (FlatToken) {
+        .index = token.index,
+        .len = token.len,
+        .value = value,
+        .type = (uint8_t)token.type
+    };
+    return (NodeRef)ast->nTokens++;
+}
+
+/* Copies children into extra, returns where they start */
+static NodeRef addList(FlatAst *ast, const NodeRef *children, size_t count) {
+    ast->extra = reserve(ast->extra, ast->nExtra, &ast->extraCapacity, sizeof(NodeRef), count);
+    NodeRef start = (NodeRef)ast->nExtra;
+    for (size_t i = 0; i < count; i++)
+        ast->extra[start + i] = children[i];
+    ast->nExtra += count;
+    return start;
+}
+
+static NodeRef addDeclaration(FlatAst *ast, NodeRef type, Register reg, NodeRef arraySizes, size_t arrayDepth) {
+    ast->declarations = reserve(ast->declarations, ast->nDeclarations, &ast->declarationsCapacity, sizeof(FlatDeclaration), 1);
+    ast->declarations[ast->nDeclarations] = (FlatDeclaration) {
+        .type = type,
+        .reg = (uint32_t)reg,
+        .arraySizes = arraySizes,
+        .arrayDepth = (uint32_t)arrayDepth
+    };
+    return (NodeRef)ast->nDeclarations++;
+}
+
+static void pushResult(Flattener *flattener, NodeRef ref) {
+    flattener->results = reserve(flattener->results, flattener->nResults, &flattener->resultsCapacity, sizeof(NodeRef), 1);
+    flattener->results[flattener->nResults++] = ref;
+}
+
+static bool flattenVisitor(void *data, Node *node, VisitStep step, size_t child);
+static NodeRef addFlatType(Flattener *flattener, const Type *type);
+
+/* Shared by declarations and parameters, which aren't Nodes */
+static NodeRef addVariable(Flattener *flattener, const VariableDeclerationNode *decl, NodeRef initializer) {
+    NodeRef type = addFlatType(flattener, &decl->type);
+    FlatAst *ast = flattener->ast;
+    ast->sizes = reserve(ast->sizes, ast->nSizes, &ast->sizesCapacity, sizeof(uint64_t), decl->arrayDepth);
+    NodeRef arraySizes = (NodeRef)ast->nSizes;
+    for (size_t i = 0; i < decl->arrayDepth; i++)
+        ast->sizes[ast->nSizes++] = decl->arraySizes[i];
+    NodeRef declaration = addDeclaration(ast, type, decl->reg, arraySizes, decl->arrayDepth);
+    return addNode(ast, NT_VARDECL, addToken(flattener, decl->name), initializer, declaration);
+}
+
+static NodeRef addFlatType(Flattener *flattener, const Type *type) {
+    /* Parameter initializers are visited on their own, types only nest as deep as they were written */
+    size_t mark = flattener->nResults;
+    for (size_t i = 0; i < type->nParameters; i++) {
+        const VariableDeclerationNode *parameter = type->parameters[i];
+        NodeRef initializer = NO_NODE;
+        if (parameter->initializer != NULL) {
+            visitNode(parameter->initializer, flattenVisitor, flattener);
+            initializer = flattener->results[--flattener->nResults];
+        }
+        NodeRef ref = addVariable(flattener, parameter, initializer);
+        pushResult(flattener, ref);
+    }
+    NodeRef parameters = addList(flattener->ast, flattener->results + mark, type->nParameters);
+    flattener->nResults = mark;
+    NodeRef base = (type->qualifiers & FUNCTION) ? addFlatType(flattener, type->type.returnType) : addString(flattener, type->type.base);
+
+    FlatAst *ast = flattener->ast;
+    ast->types = reserve(ast->types, ast->nTypes, &ast->typesCapacity, sizeof(FlatType), 1);
+    ast->types[ast->nTypes] = (FlatType) {
+        .qualifiers = (uint32_t)type->qualifiers,
+        .ptrDepth = (uint32_t)type->ptrDepth,
+        .base = base,
+        .parameters = parameters,
+        .nParameters = (uint32_t)type->nParameters
+    };
+    return (NodeRef)ast->nTypes++;
+}
+
+/* children points into the result stack, which flattening a type reuses, so it has to be read first */
+static NodeRef flattenLeave(Flattener *flattener, const Node *node, const NodeRef *children, size_t count) {
+    FlatAst *ast = flattener->ast;
+    switch (node->type) {
+        case NT_INT:
+        case NT_FLOAT:
+        case NT_STRING:
+        case NT_CHAR: {
+            ValueNode *value = (ValueNode*)node->node;
+            return addNode(ast, node->type, addToken(flattener, value->value), NO_NODE, NO_NODE);
+        }
+        case NT_VARACCESS: {
+            VariableAccessNode *access = (VariableAccessNode*)node->node;
+            return addNode(ast, NT_VARACCESS, addToken(flattener, access->name), NO_NODE, NO_NODE);
+        }
+        case NT_GOTO: {
+            GotoNode *jump = (GotoNode*)node->node;
+            return addNode(ast, NT_GOTO, addToken(flattener, jump->label), NO_NODE, NO_NODE);
+        }
+        case NT_LABEL: {
+            LabelNode *label = (LabelNode*)node->node;
+            return addNode(ast, NT_LABEL, addToken(flattener, label->name), NO_NODE, NO_NODE);
+        }
+        case NT_ASSIGN:
+        case NT_BINOP: {
+            BinaryOperationNode *binOp = (BinaryOperationNode*)node->node;
+            return addNode(ast, node->type, addToken(flattener, binOp->op), children[0], children[1]);
+        }
+        case NT_UNARYOP: {
+            UnaryOperationNode *unOp = (UnaryOperationNode*)node->node;
+            return addNode(ast, NT_UNARYOP, addToken(flattener, unOp->op), children[0], NO_NODE);
+        }
+        case NT_RETURN:
+            return addNode(ast, NT_RETURN, NO_NODE, children[0], NO_NODE);
+        case NT_ACCESS: {
+            AccessNode *access = (AccessNode*)node->node;
+            NodeRef op = addToken(flattener, access->op);
+            addToken(flattener, access->member);
+            return addNode(ast, NT_ACCESS, op, children[0], NO_NODE);
+        }
+        case NT_ARRAYACCESS:
+        case NT_WHILE:
+        case NT_TRY:
+            return addNode(ast, node->type, NO_NODE, children[0], children[1]);
+        case NT_FOR:
+            return addNode(ast, NT_FOR, NO_NODE, addList(ast, children, count), NO_NODE);
+        case NT_IF:
+            return addNode(ast, NT_IF, NO_NODE, addList(ast, children, count), (NodeRef)((IfNode*)node->node)->nCases);
+        case NT_FUNCCALL:
+            return addNode(ast, NT_FUNCCALL, NO_NODE, addList(ast, children, count), (NodeRef)(count - 1));
+        case NT_COMPOUND:
+            return addNode(ast, NT_COMPOUND, NO_NODE, addList(ast, children, count), (NodeRef)count);
+        case NT_CLASS:
+        case NT_UNION: {
+            TypeNode *type = (TypeNode*)node->node;
+            NodeRef fields = addList(ast, children, count);
+            return addNode(ast, node->type, addToken(flattener, type->name), fields, (NodeRef)count);
+        }
+        case NT_VARDECL: {
+            NodeRef initializer = children[0];
+            return addVariable(flattener, (VariableDeclerationNode*)node->node, initializer);
+        }
+        case NT_FUNCDECL: {
+            FunctionDeclerationNode *decl = (FunctionDeclerationNode*)node->node;
+            NodeRef body = children[0];
+            NodeRef declaration = addDeclaration(ast, addFlatType(flattener, &decl->type), NONE, NO_NODE, 0);
+            return addNode(ast, NT_FUNCDECL, addToken(flattener, decl->name), body, declaration);
+        }
+        default:
+            /* NT_NONE, NT_BREAK and NT_SWITCH carry nothing yet */
+            return addNode(ast, node->type, NO_NODE, NO_NODE, NO_NODE);
+    }
+}
+
+static bool flattenVisitor(void *data, Node *node, VisitStep step, size_t child) {
+    Flattener *flattener = (Flattener*)data;
+    if (step == VISIT_CHILD) {
+        if (nodeChild(node, child) == NULL)
+            pushResult(flattener, NO_NODE);
+    } else if (step == VISIT_LEAVE) {
+        /* Children are flattened before their parent, their indices are on top */
+        size_t count = nodeChildCount(node);
+        flattener->nResults -= count;
+        NodeRef ref = flattenLeave(flattener, node, flattener->results + flattener->nResults, count);
+        pushResult(flattener, ref);
+    }
+    return true;
+}
+
+NodeRef flattenNode(FlatAst *ast, const Node *node) {
+    Flattener flattener = {
+        .ast = ast
+    };
+    ast->root = NO_NODE;
+    if (node != NULL) {
+        visitNode((Node*)node, flattenVisitor, &flattener);
+        ast->root = flattener.results[0];
+    }
+    free(flattener.results);
+    free(flattener.strings);
+    return ast->root;
+}
+
+/* ref is missing or a node before parent, children always come first */
+static bool validChild(NodeRef ref, NodeRef parent) {
+    return ref == NO_NODE || ref < parent;
+}
+
+/* Operands the parser never leaves out, codegen doesn't check them */
+static bool validOperand(NodeRef ref, NodeRef parent) {
+    return ref != NO_NODE && ref < parent;
+}
+
+static bool validRange(size_t start, size_t count, size_t total) {
+    return start <= total && count <= total - start;
+}
+
+static bool validChildren(const FlatAst *ast, size_t start, size_t count, NodeRef parent) {
+    if (!validRange(start, count, ast->nExtra))
+        return false;
+    for (size_t i = 0; i < count; i++) {
+        if (!validChild(ast->extra[start + i], parent))
+            return false;
+    }
+    return true;
+}
+
+/* Fields and parameters are read as declarations, and have to be there */
+static bool validDeclarations(const FlatAst *ast, size_t start, size_t count, NodeRef parent) {
+    if (!validChildren(ast, start, count, parent))
+        return false;
+    for (size_t i = 0; i < count; i++) {
+        NodeRef ref = ast->extra[start + i];
+        if (ref == NO_NODE || flatType(ast, ref) != NT_VARDECL)
+            return false;
+    }
+    return true;
+}
+
+/* The strings section ends in a NUL, checked once, so any offset into it is a terminated string */
+static bool validString(const FlatAst *ast, NodeRef offset) {
+    return offset == NO_NODE || offset < ast->nStrings;
+}
+
+static bool validToken(const FlatAst *ast, NodeRef ref, size_t sourceLength) {
+    if (ref >= ast->nTokens)
+        return false;
+    const FlatToken *token = &ast->tokens[ref];
+    return validString(ast, token->value) && validRange(token->index, token->len, sourceLength);
+}
+
+/* Names are looked up by their value, which identifiers always have */
+static bool validName(const FlatAst *ast, NodeRef ref, size_t sourceLength) {
+    return validToken(ast, ref, sourceLength) && ast->tokens[ref].value != NO_NODE;
+}
+
+/* Return types come before the function types they belong to, so the chain ends */
+static bool validType(const FlatAst *ast, NodeRef ref, NodeRef parent) {
+    for (size_t depth = 0; depth < PARSER_MAX_DEPTH; depth++) {
+        if (ref >= ast->nTypes)
+            return false;
+        const FlatType *type = &ast->types[ref];
+        if (!validDeclarations(ast, type->parameters, type->nParameters, parent))
+            return false;
+        if (!(type->qualifiers & FUNCTION))
+            return type->base != NO_NODE && validString(ast, type->base);
+        if (type->base >= ref)
+            return false;
+        ref = type->base;
+    }
+    return false;
+}
+
+static bool validDeclaration(const FlatAst *ast, NodeRef ref, NodeRef parent) {
+    if (ref >= ast->nDeclarations)
+        return false;
+    const FlatDeclaration *declaration = &ast->declarations[ref];
+    /* Functions have no sizes at all, not even an empty range */
+    return validType(ast, declaration->type, parent) &&
+           (declaration->arrayDepth == 0 || validRange(declaration->arraySizes, declaration->arrayDepth, ast->nSizes));
+}
+
+static bool validNode(const FlatAst *ast, NodeRef ref, size_t sourceLength) {
+    const FlatNode *node = flatNode(ast, ref);
+    switch ((NodeType)node->type) {
+        case NT_NONE:
+        case NT_BREAK:
+        case NT_SWITCH:
+            return true;
+        case NT_INT:
+        case NT_FLOAT:
+        case NT_STRING:
+        case NT_CHAR:
+            return validToken(ast, node->token, sourceLength);
+        case NT_VARACCESS:
+        case NT_GOTO:
+        case NT_LABEL:
+            return validName(ast, node->token, sourceLength);
+        case NT_ASSIGN:
+        case NT_BINOP:
+            return validToken(ast, node->token, sourceLength) && validOperand(node->lhs, ref) && validOperand(node->rhs, ref);
+        case NT_UNARYOP:
+            return validToken(ast, node->token, sourceLength) && validOperand(node->lhs, ref);
+        case NT_RETURN:
+            return validChild(node->lhs, ref);
+        case NT_ACCESS:
+            return validToken(ast, node->token, sourceLength) && node->token + 1 != NO_NODE &&
+                   validName(ast, node->token + 1, sourceLength) && validOperand(node->lhs, ref);
+        case NT_ARRAYACCESS:
+            return validOperand(node->lhs, ref) && validOperand(node->rhs, ref);
+        case NT_WHILE:
+        case NT_TRY:
+            return validChild(node->lhs, ref) && validChild(node->rhs, ref);
+        case NT_FOR:
+            return validChildren(ast, node->lhs, 4, ref);
+        case NT_IF:
+            return validChildren(ast, node->lhs, (size_t)node->rhs * 2 + 1, ref);
+        case NT_FUNCCALL:
+            return validChildren(ast, node->lhs, (size_t)node->rhs + 1, ref) && ast->extra[node->lhs] != NO_NODE;
+        case NT_COMPOUND:
+            return validChildren(ast, node->lhs, node->rhs, ref);
+        case NT_CLASS:
+        case NT_UNION:
+            return validName(ast, node->token, sourceLength) && validDeclarations(ast, node->lhs, node->rhs, ref);
+        case NT_VARDECL:
+            return validName(ast, node->token, sourceLength) && validChild(node->lhs, ref) &&
+                   validDeclaration(ast, node->rhs, ref);
+        case NT_FUNCDECL:
+            /* The return type is read through the type, a base name in its place would be taken for one */
+            return validName(ast, node->token, sourceLength) &&
+                   (node->lhs == NO_NODE || (node->lhs < ref && flatType(ast, node->lhs) == NT_COMPOUND)) &&
+                   validDeclaration(ast, node->rhs, ref) &&
+                   (ast->types[ast->declarations[node->rhs].type].qualifiers & FUNCTION);
+        default:
+            return false;
+    }
+}
+
+bool validFlatAst(const FlatAst *ast, size_t sourceLength) {
+    if (ast->nStrings > 0 && ast->strings[ast->nStrings - 1] != '\0')
+        return false;
+    if (ast->root >= ast->nNodes)
+        return false;
+    for (NodeRef ref = 0; ref < ast->nNodes; ref++) {
+        if (!validNode(ast, ref, sourceLength))
+            return false;
+    }
+    return true;
+}
+
+typedef struct Inflater {
+    const FlatAst *ast;
+    Arena *arena;
+    Interner *interner;
+    /* Indexed like ast->nodes, children come first so theirs are always there */
+    Node **nodes;
+} Inflater;
+
+static Node *inflated(const Inflater *inflater, NodeRef ref) {
+    return ref == NO_NODE ? NULL : inflater->nodes[ref];
+}
+
+static void *inflateAlloc(const Inflater *inflater, size_t size) {
+    return arenaAlloc(inflater->arena, size);
+}
+
+static char *inflateString(const Inflater *inflater, NodeRef offset) {
+    /* Tokens and types hold interned strings as char*, the parser's are the same */
+    return offset == NO_NODE ? NULL : (char*)internString(inflater->interner, flatString(inflater->ast, offset));
+}
+
+static Token inflateToken(const Inflater *inflater, NodeRef ref) {
+    const FlatToken *token = &inflater->ast->tokens[ref];
+    Token result = {
+        .value = inflateString(inflater, token->value),
+        .index = token->index
+    };
+    result.len = token->len;
+    result.type = token->type;
+    return result;
+}
+
+static Node **inflateList(const Inflater *inflater, NodeRef start, size_t count) {
+    if (count == 0)
+        return NULL;
+    Node **list = inflateAlloc(inflater, count * sizeof(Node*));
+    const NodeRef *refs = flatExtra(inflater->ast, start);
+    for (size_t i = 0; i < count; i++)
+        list[i] = inflated(inflater, refs[i]);
+    return list;
+}
+
+/* Types only nest as deep as they were written, the same as in addFlatType */
+static void inflateType(const Inflater *inflater, NodeRef ref, Type *type) {
+    const FlatType *flat = &inflater->ast->types[ref];
+    type->qualifiers = (Qualifier)flat->qualifiers;
+    type->ptrDepth = flat->ptrDepth;
+    type->nParameters = flat->nParameters;
+    type->parameters = NULL;
+    if (flat->nParameters > 0) {
+        type->parameters = inflateAlloc(inflater, flat->nParameters * sizeof(VariableDeclerationNode*));
+        const NodeRef *parameters = flatExtra(inflater->ast, flat->parameters);
+        for (size_t i = 0; i < flat->nParameters; i++)
+            type->parameters[i] = (VariableDeclerationNode*)inflater->nodes[parameters[i]]->node;
+    }
+    if (flat->qualifiers & FUNCTION) {
+        type->type.returnType = inflateAlloc(inflater, sizeof(Type));
+        inflateType(inflater, flat->base, type->type.returnType);
+    } else {
+        type->type.base = inflateString(inflater, flat->base);
+    }
+}
+
+static void *inflatePayload(const Inflater *inflater, NodeRef ref) {
+    const FlatAst *ast = inflater->ast;
+    const FlatNode *flat = flatNode(ast, ref);
+    switch ((NodeType)flat->type) {
+        case NT_INT:
+        case NT_FLOAT:
+        case NT_STRING:
+        case NT_CHAR: {
+            ValueNode *value = inflateAlloc(inflater, sizeof(ValueNode));
+            value->value = inflateToken(inflater, flat->token);
+            return value;
+        }
+        case NT_VARACCESS: {
+            VariableAccessNode *access = inflateAlloc(inflater, sizeof(VariableAccessNode));
+            access->name = inflateToken(inflater, flat->token);
+            return access;
+        }
+        case NT_GOTO: {
+            GotoNode *jump = inflateAlloc(inflater, sizeof(GotoNode));
+            jump->label = inflateToken(inflater, flat->token);
+            return jump;
+        }
+        case NT_LABEL: {
+            LabelNode *label = inflateAlloc(inflater, sizeof(LabelNode));
+            label->name = inflateToken(inflater, flat->token);
+            return label;
+        }
+        case NT_ASSIGN:
+        case NT_BINOP: {
+            BinaryOperationNode *binOp = inflateAlloc(inflater, sizeof(BinaryOperationNode));
+            binOp->lhs = inflated(inflater, flat->lhs);
+            binOp->rhs = inflated(inflater, flat->rhs);
+            binOp->op = inflateToken(inflater, flat->token);
+            return binOp;
+        }
+        case NT_UNARYOP: {
+            UnaryOperationNode *unOp = inflateAlloc(inflater, sizeof(UnaryOperationNode));
+            unOp->value = inflated(inflater, flat->lhs);
+            unOp->op = inflateToken(inflater, flat->token);
+            return unOp;
+        }
+        case NT_RETURN:
+            /* The value is stored directly, there's no payload struct */
+            return inflated(inflater, flat->lhs);
+        case NT_ACCESS: {
+            AccessNode *access = inflateAlloc(inflater, sizeof(AccessNode));
+            access->object = inflated(inflater, flat->lhs);
+            access->op = inflateToken(inflater, flat->token);
+            access->member = inflateToken(inflater, flat->token + 1);
+            return access;
+        }
+        case NT_ARRAYACCESS: {
+            ArrayAccessNode *access = inflateAlloc(inflater, sizeof(ArrayAccessNode));
+            access->array = inflated(inflater, flat->lhs);
+            access->index = inflated(inflater, flat->rhs);
+            return access;
+        }
+        case NT_WHILE: {
+            WhileNode *loop = inflateAlloc(inflater, sizeof(WhileNode));
+            loop->condition = inflated(inflater, flat->lhs);
+            loop->body = inflated(inflater, flat->rhs);
+            return loop;
+        }
+        case NT_TRY: {
+            TryNode *try = inflateAlloc(inflater, sizeof(TryNode));
+            try->body = inflated(inflater, flat->lhs);
+            try->catchBody = inflated(inflater, flat->rhs);
+            return try;
+        }
+        case NT_FOR: {
+            ForNode *loop = inflateAlloc(inflater, sizeof(ForNode));
+            const NodeRef *parts = flatExtra(ast, flat->lhs);
+            loop->initializer = inflated(inflater, parts[0]);
+            loop->condition = inflated(inflater, parts[1]);
+            loop->increment = inflated(inflater, parts[2]);
+            loop->body = inflated(inflater, parts[3]);
+            return loop;
+        }
+        case NT_IF: {
+            IfNode *branch = inflateAlloc(inflater, sizeof(IfNode));
+            const NodeRef *cases = flatExtra(ast, flat->lhs);
+            branch->nCases = flat->rhs;
+            branch->conditions = inflateAlloc(inflater, branch->nCases * sizeof(Node*));
+            branch->bodies = inflateAlloc(inflater, branch->nCases * sizeof(Node*));
+            for (size_t i = 0; i < branch->nCases; i++) {
+                branch->conditions[i] = inflated(inflater, cases[i * 2]);
+                branch->bodies[i] = inflated(inflater, cases[i * 2 + 1]);
+            }
+            branch->elseCase = inflated(inflater, cases[branch->nCases * 2]);
+            return branch;
+        }
+        case NT_FUNCCALL: {
+            FunctionCallNode *call = inflateAlloc(inflater, sizeof(FunctionCallNode));
+            call->function = inflated(inflater, flatCallee(ast, ref));
+            call->nArguments = flat->rhs;
+            call->arguments = inflateList(inflater, flat->lhs + 1, call->nArguments);
+            return call;
+        }
+        case NT_COMPOUND: {
+            CompoundNode *compound = inflateAlloc(inflater, sizeof(CompoundNode));
+            compound->nStatements = flat->rhs;
+            compound->statements = inflateList(inflater, flat->lhs, compound->nStatements);
+            return compound;
+        }
+        case NT_CLASS:
+        case NT_UNION: {
+            TypeNode *type = inflateAlloc(inflater, sizeof(TypeNode));
+            type->nFields = flat->rhs;
+            type->fields = inflateList(inflater, flat->lhs, type->nFields);
+            type->name = inflateToken(inflater, flat->token);
+            return type;
+        }
+        case NT_VARDECL: {
+            VariableDeclerationNode *decl = inflateAlloc(inflater, sizeof(VariableDeclerationNode));
+            const FlatDeclaration *declaration = flatDeclaration(ast, ref);
+            decl->reg = (Register)declaration->reg;
+            inflateType(inflater, declaration->type, &decl->type);
+            decl->name = inflateToken(inflater, flat->token);
+            decl->initializer = inflated(inflater, flat->lhs);
+            decl->arrayDepth = declaration->arrayDepth;
+            decl->arraySizes = NULL;
+            if (decl->arrayDepth > 0) {
+                decl->arraySizes = inflateAlloc(inflater, decl->arrayDepth * sizeof(size_t));
+                for (size_t i = 0; i < decl->arrayDepth; i++)
+                    decl->arraySizes[i] = (size_t)ast->sizes[declaration->arraySizes + i];
+            }
+            return decl;
+        }
+        case NT_FUNCDECL: {
+            FunctionDeclerationNode *decl = inflateAlloc(inflater, sizeof(FunctionDeclerationNode));
+            inflateType(inflater, flatDeclaration(ast, ref)->type, &decl->type);
+            decl->name = inflateToken(inflater, flat->token);
+            decl->body = inflated(inflater, flat->lhs);
+            return decl;
+        }
+        default:
+            /* NT_NONE, NT_BREAK and NT_SWITCH carry nothing yet */
+            return NULL;
+    }
+}
+
+Node *inflateFlatAst(const FlatAst *ast, Arena *arena, Interner *interner) {
+    if (ast->root == NO_NODE)
+        return NULL;
+    Inflater inflater = {
+        .ast = ast,
+        .arena = arena,
+        .interner = interner,
+        .nodes = malloc(ast->nNodes * sizeof(Node*))
+    };
+    if (inflater.nodes == NULL) {
+        fprintf(stderr, "Fatal: Out of memory while inflating the AST.\n");
+        exit(1);
+    }
+    /* A forward scan, children before parents, so no node nests a call in another */
+    for (NodeRef ref = 0; ref < ast->nNodes; ref++) {
+        Node *node = inflateAlloc(&inflater, sizeof(Node));
+        node->type = flatType(ast, ref);
+        node->node = inflatePayload(&inflater, ref);
+        inflater.nodes[ref] = node;
+    }
+    Node *root = inflater.nodes[ast->root];
+    free(inflater.nodes);
+    return root;
+}
@@ -0,0 +1,222 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "fold.h"
+
+/* Longer literals are left as they were written, no double needs more than this either */
+#define FOLD_TEXT_SIZE 64
+
+typedef struct Constant {
+    bool isFloat;
+    uint64_t integer; /* The bits of an I64, arithmetic on them wraps around */
+    double real;
+} Constant;
+
+static int64_t asSigned(uint64_t value) {
+    return value <= INT64_MAX ? (int64_t)value : -(int64_t)~value - 1;
+}
+
+static bool isLiteral(const Node *node) {
+    return node->type == NT_INT || node->type == NT_FLOAT;
+}
+
+static bool readConstant(const char *source, const Node *node, Constant *constant) {
+    size_t len;
+    const char *text = tokenText(((ValueNode*)node->node)->value, source, &len);
+    if (len == 0 || len >= FOLD_TEXT_SIZE)
+        return false;
+    /* The source isn't NUL-terminated */
+    char buffer[FOLD_TEXT_SIZE];
+    memcpy(buffer, text, len);
+    buffer[len] = '\0';
+    constant->isFloat = node->type == NT_FLOAT;
+    if (constant->isFloat) {
+        char *end;
+        constant->real = strtod(buffer, &end);
+        return *end == '\0';
+    }
+    /* Only folded literals can be negative */
+    bool negative = buffer[0] == '-';
+    uint64_t value = 0;
+    for (size_t i = negative; i < len; i++) {
+        unsigned digit = (unsigned)(buffer[i] - '0');
+        if (digit > 9 || value > (UINT64_MAX - digit) / 10)
+            return false;
+        value = value * 10 + digit;
+    }
+    constant->integer = negative ? 0 - value : value;
+    return true;
+}
+
+/* False for results the lexer couldn't have read, like a double that needs an exponent */
+static bool writeConstant(const Constant *constant, char *text) {
+    if (!constant->isFloat) {
+        snprintf(text, FOLD_TEXT_SIZE, "%lld", (long long)asSigned(constant->integer));
+        return true;
+    }
+    if (!isfinite(constant->real))
+        return false;
+    /* %g drops trailing zeros, so 15 digits give short text for most results. 17 always read back the same */
+    snprintf(text, FOLD_TEXT_SIZE, "%.15g", constant->real);
+    if (strtod(text, NULL) != constant->real)
+        snprintf(text, FOLD_TEXT_SIZE, "%.17g", constant->real);
+    if (strchr(text, 'e') != NULL)
+        return false;
+    if (strchr(text, '.') == NULL)
+        strcat(text, ".0");
+    return true;
+}
+
+/* The node becomes a literal spanning start to end */
+static bool storeConstant(Interner *interner, Node *node, const Constant *constant, size_t start, size_t end) {
+    char text[FOLD_TEXT_SIZE];
+    if (end - start > TOKEN_MAX_LEN || !writeConstant(constant, text))
+        return false;
+    node->type = constant->isFloat ? NT_FLOAT : NT_INT;
+    ((ValueNode*)node->node)->value = (Token) {
+        .value = (char*)internString(interner, text),
+        .index = (uint32_t)start,
+        .len = (unsigned)(end - start),
+        .type = constant->isFloat ? TT_FLOAT : TT_INT
+    };
+    return true;
+}
+
+static bool foldIntegers(TokenType op, uint64_t a, uint64_t b, uint64_t *result) {
+    int64_t signedA = asSigned(a), signedB = asSigned(b);
+    switch (op) {
+        case TT_ADD: *result = a + b; break;
+        case TT_SUB: *result = a - b; break;
+        case TT_MUL: *result = a * b; break;
+        case TT_DIV:
+        case TT_MOD:
+            /* Both trap at run time, so does dividing the smallest I64 by -1 */
+            if (b == 0 || (signedA == INT64_MIN && signedB == -1))
+                return false;
+            *result = (uint64_t)(op == TT_DIV ? signedA / signedB : signedA % signedB);
+            break;
+        case TT_POW: {
+            if (signedB < 0)
+                return false;
+            uint64_t power = 1, base = a;
+            for (uint64_t exponent = b; exponent != 0; exponent >>= 1) {
+                if (exponent & 1)
+                    power *= base;
+                base *= base;
+            }
+            *result = power;
+        } break;
+        case TT_LSH:
+        case TT_RSH:
+            /* The hardware only looks at the low 6 bits of the count, what was meant is unclear */
+            if (signedB < 0 || signedB > 63)
+                return false;
+            if (op == TT_LSH)
+                *result = a << b;
+            else
+                *result = signedA < 0 ? ~(~a >> b) : a >> b; /* Arithmetic shift, I64 is signed */
+            break;
+        case TT_BAND: *result = a & b; break;
+        case TT_BOR:  *result = a | b; break;
+        case TT_BXOR: *result = a ^ b; break;
+        case TT_LT:   *result = signedA <  signedB; break;
+        case TT_GT:   *result = signedA >  signedB; break;
+        case TT_LTE:  *result = signedA <= signedB; break;
+        case TT_GTE:  *result = signedA >= signedB; break;
+        case TT_EQ:   *result = a == b; break;
+        case TT_NEQ:  *result = a != b; break;
+        case TT_AND:  *result = a != 0 && b != 0; break;
+        case TT_OR:   *result = a != 0 || b != 0; break;
+        case TT_XOR:  *result = (a != 0) != (b != 0); break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+/* An F64 operand makes it an F64 operation, comparisons still give an I64 */
+static bool foldReals(TokenType op, double a, double b, Constant *result) {
+    result->isFloat = true;
+    switch (op) {
+        case TT_ADD: result->real = a + b; break;
+        case TT_SUB: result->real = a - b; break;
+        case TT_MUL: result->real = a * b; break;
+        case TT_DIV:
+            if (b == 0)
+                return false;
+            result->real = a / b;
+            break;
+        case TT_LT:  result->isFloat = false; result->integer = a <  b; break;
+        case TT_GT:  result->isFloat = false; result->integer = a >  b; break;
+        case TT_LTE: result->isFloat = false; result->integer = a <= b; break;
+        case TT_GTE: result->isFloat = false; result->integer = a >= b; break;
+        case TT_EQ:  result->isFloat = false; result->integer = a == b; break;
+        case TT_NEQ: result->isFloat = false; result->integer = a != b; break;
+        case TT_AND: result->isFloat = false; result->integer = a != 0 && b != 0; break;
+        case TT_OR:  result->isFloat = false; result->integer = a != 0 || b != 0; break;
+        case TT_XOR: result->isFloat = false; result->integer = (a != 0) != (b != 0); break;
+        /* Bitwise operators aren't defined on F64, and ` and % would need libm */
+        default:
+            return false;
+    }
+    return true;
+}
+
+static double asReal(const Constant *constant) {
+    return constant->isFloat ? constant->real : (double)asSigned(constant->integer);
+}
+
+bool foldBinary(Interner *interner, const char *source, Node *lhs, Token op, const Node *rhs) {
+    Constant a, b, result;
+    /* Most operations have an operand that isn't a literal, nothing is read for them */
+    if (!isLiteral(lhs) || !isLiteral(rhs) || !readConstant(source, lhs, &a) || !readConstant(source, rhs, &b))
+        return false;
+    if (!a.isFloat && !b.isFloat) {
+        result.isFloat = false;
+        if (!foldIntegers(op.type, a.integer, b.integer, &result.integer))
+            return false;
+    } else if (!foldReals(op.type, asReal(&a), asReal(&b), &result)) {
+        return false;
+    }
+    Token first = ((ValueNode*)lhs->node)->value, last = ((ValueNode*)rhs->node)->value;
+    return storeConstant(interner, lhs, &result, first.index, (size_t)last.index + last.len);
+}
+
+bool foldUnary(Interner *interner, const char *source, Token op, Node *operand) {
+    if (op.type != TT_SUB || !isLiteral(operand))
+        return false;
+    Token *value = &((ValueNode*)operand->node)->value;
+    size_t len;
+    const char *text = tokenText(*value, source, &len);
+    size_t end = (size_t)value->index + value->len;
+    /* The negated text may be a sign longer, plus its NUL */
+    if (len == 0 || len + 2 > FOLD_TEXT_SIZE || end - op.index > TOKEN_MAX_LEN)
+        return false;
+    if (value->value == NULL && value->index == op.index + 1) {
+        /* -1 as written, the source is the text already */
+    } else {
+        /* Negating the text is exact for both, and readConstant wraps an I64 around the same way */
+        char negated[FOLD_TEXT_SIZE];
+        if (text[0] == '-') {
+            memcpy(negated, text + 1, len - 1);
+            negated[len - 1] = '\0';
+        } else {
+            negated[0] = '-';
+            memcpy(negated + 1, text, len);
+            negated[len + 1] = '\0';
+        }
+        value->value = (char*)intern(interner, negated, strlen(negated));
+    }
+    value->len = (unsigned)(end - op.index);
+    value->index = op.index;
+    return true;
+}
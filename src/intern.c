@@ -0,0 +1,111 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+
+#define INTERNER_INITIAL_CAPACITY 1024
+
+/* FNV-1a */
+static uint32_t hashString(const char *str, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static InternEntry *allocEntries(size_t capacity) {
+    InternEntry *entries = calloc(capacity, sizeof(InternEntry));
+    if (entries == NULL) {
+        fprintf(stderr, "Fatal: Out of memory while growing the string table.\n");
+        exit(1);
+    }
+    return entries;
+}
+
+void initInterner(Interner *interner) {
+    interner->capacity = INTERNER_INITIAL_CAPACITY;
+    interner->count = 0;
+    interner->entries = allocEntries(interner->capacity);
+    interner->byAtomCapacity = INTERNER_INITIAL_CAPACITY / 2;
+    interner->byAtom = malloc(interner->byAtomCapacity * sizeof(char*));
+    if (interner->byAtom == NULL) {
+        fprintf(stderr, "Fatal: Out of memory while growing the string table.\n");
+        exit(1);
+    }
+    initArena(&interner->strings, ARENA_BLOCK_SIZE);
+}
+
+void freeInterner(Interner *interner) {
+    free(interner->entries);
+    free(interner->byAtom);
+    interner->entries = NULL;
+    interner->byAtom = NULL;
+    interner->capacity = 0;
+    interner->byAtomCapacity = 0;
+    interner->count = 0;
+    freeArena(&interner->strings);
+}
+
+static void grow(Interner *interner) {
+    size_t capacity = interner->capacity * 2;
+    InternEntry *entries = allocEntries(capacity);
+    for (size_t i = 0; i < interner->capacity; i++) {
+        InternEntry entry = interner->entries[i];
+        if (entry.str == NULL)
+            continue;
+        size_t slot = entry.hash & (capacity - 1);
+        while (entries[slot].str != NULL)
+            slot = (slot + 1) & (capacity - 1);
+        entries[slot] = entry;
+    }
+    free(interner->entries);
+    interner->entries = entries;
+    interner->capacity = capacity;
+}
+
+const char *intern(Interner *interner, const char *str, size_t len) {
+    uint32_t hash = hashString(str, len);
+    size_t slot = hash & (interner->capacity - 1);
+    while (interner->entries[slot].str != NULL) {
+        InternEntry *entry = &interner->entries[slot];
+        if (entry->hash == hash && entry->len == len && !memcmp(entry->str, str, len))
+            return entry->str;
+        slot = (slot + 1) & (interner->capacity - 1);
+    }
+
+    /* The atom is stored right in front of the characters, see atomOf */
+    char *copy = arenaAlloc(&interner->strings, sizeof(Atom) + len + 1);
+    *(Atom*)copy = (Atom)interner->count;
+    copy += sizeof(Atom);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+
+    if (interner->count == interner->byAtomCapacity) {
+        interner->byAtomCapacity *= 2;
+        const char **byAtom = realloc(interner->byAtom, interner->byAtomCapacity * sizeof(char*));
+        if (byAtom == NULL) {
+            fprintf(stderr, "Fatal: Out of memory while growing the string table.\n");
+            exit(1);
+        }
+        interner->byAtom = byAtom;
+    }
+    interner->byAtom[interner->count] = copy;
+
+    interner->entries[slot] = (InternEntry) {
+        .str = copy,
+        .len = (uint32_t)len,
+        .hash = hash
+    };
+    if (++interner->count * 2 > interner->capacity)
+        grow(interner);
+    return copy;
+}
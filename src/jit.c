@@ -0,0 +1,248 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+/* MAP_ANONYMOUS */
+#define _DEFAULT_SOURCE
+#define _DARWIN_C_SOURCE
+#endif /* _WIN32 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif /* _WIN32 */
+
+#include "jit.h"
+
+/* jmp [rip + 0] followed by the address, padded to keep the stubs aligned */
+#define STUB_SIZE 16
+
+/*
+ * One mapping for the whole unit, regions are page aligned so each can get the
+ * protection it needs once it is relocated:
+ *   .text, stubs | .rodata | .data, .bss, GOT
+ */
+typedef struct Image {
+    uint8_t *memory;
+    size_t size;
+    uint8_t *sections[OBJECT_SECTIONS];
+    uint8_t *stubs;
+    uint8_t *got;
+    size_t executableSize; /* .text and the stubs */
+    size_t readOnlySize;
+} Image;
+
+static size_t pageSize(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    long size = sysconf(_SC_PAGESIZE);
+    return size > 0 ? (size_t)size : 4096;
+#endif /* _WIN32 */
+}
+
+static size_t alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static bool mapImage(Image *image, size_t size) {
+#ifdef _WIN32
+    image->memory = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    image->size = size;
+    return image->memory != NULL;
+#else
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    image->memory = memory != MAP_FAILED ? memory : NULL;
+    image->size = size;
+    return image->memory != NULL;
+#endif /* _WIN32 */
+}
+
+static void unmapImage(Image *image) {
+#ifdef _WIN32
+    VirtualFree(image->memory, 0, MEM_RELEASE);
+#else
+    munmap(image->memory, image->size);
+#endif /* _WIN32 */
+}
+
+/* Code becomes executable and stops being writable, constants become read only */
+static bool protectImage(Image *image) {
+#ifdef _WIN32
+    DWORD old;
+    return VirtualProtect(image->memory, image->executableSize, PAGE_EXECUTE_READ, &old) &&
+        (image->readOnlySize == 0 ||
+         VirtualProtect(image->memory + image->executableSize, image->readOnlySize, PAGE_READONLY, &old));
+#else
+    return mprotect(image->memory, image->executableSize, PROT_READ | PROT_EXEC) == 0 &&
+        (image->readOnlySize == 0 ||
+         mprotect(image->memory + image->executableSize, image->readOnlySize, PROT_READ) == 0);
+#endif /* _WIN32 */
+}
+
+/* Something this process already has loaded, NULL if nothing goes by that name */
+static void *hostSymbol(const char *name) {
+#ifdef _WIN32
+    /* The C runtime functions C programs link against are exported by msvcrt, ucrtbase only has the wide ones */
+    static const char *modules[] = { NULL, "msvcrt.dll", "ucrtbase.dll", "kernel32.dll" };
+    for (size_t i = 0; i < sizeof(modules) / sizeof(modules[0]); i++) {
+        HMODULE module = modules[i] != NULL ? LoadLibraryA(modules[i]) : GetModuleHandleA(NULL);
+        FARPROC procedure = module != NULL ? GetProcAddress(module, name) : NULL;
+        if (procedure != NULL) {
+            void *address;
+            memcpy(&address, &procedure, sizeof(address));
+            return address;
+        }
+    }
+    return NULL;
+#else
+    static void *self = NULL;
+    if (self == NULL)
+        self = dlopen(NULL, RTLD_NOW);
+    return self != NULL ? dlsym(self, name) : NULL;
+#endif /* _WIN32 */
+}
+
+/* Where every symbol that is referenced ended up, a stub stands in for a function outside the image */
+static bool resolveSymbols(Image *image, const ObjectCode *object, uint8_t **addresses, uint8_t **targets,
+                           Diagnostics *diagnostics) {
+    bool resolved = true;
+    size_t nStubs = 0;
+    for (size_t i = 0; i < object->nSymbols; i++) {
+        const Symbol *symbol = &object->symbols[i];
+        addresses[i] = targets[i] = NULL;
+        if (symbol->defined) {
+            addresses[i] = targets[i] = image->sections[symbol->section] + symbol->offset;
+            continue;
+        }
+        bool referenced = false;
+        for (size_t j = 0; j < object->nRelocations && !referenced; j++)
+            referenced = object->relocations[j].symbol == i;
+        if (!referenced)
+            continue;
+        addresses[i] = targets[i] = hostSymbol(symbol->name);
+        if (addresses[i] == NULL) {
+            report(diagnostics, "Fatal: '%s' isn't defined by the unit or the process running it.\n", symbol->name);
+            resolved = false;
+            continue;
+        }
+        if (symbol->function) {
+            uint8_t *stub = image->stubs + STUB_SIZE * nStubs++;
+            static const uint8_t jump[6] = { 0xFF, 0x25, 0x00, 0x00, 0x00, 0x00 };
+            memcpy(stub, jump, sizeof(jump));
+            memcpy(stub + sizeof(jump), &addresses[i], sizeof(addresses[i]));
+            targets[i] = stub;
+        }
+    }
+    return resolved;
+}
+
+static bool relocate(Image *image, const ObjectCode *object, uint8_t **addresses, uint8_t **targets,
+                     Diagnostics *diagnostics) {
+    for (size_t i = 0; i < object->nRelocations; i++) {
+        const Relocation *relocation = &object->relocations[i];
+        uint8_t *field = image->sections[relocation->section] + relocation->offset;
+        uint8_t *target;
+        switch (relocation->kind) {
+            case RELOCATION_CALL:
+                target = targets[relocation->symbol];
+                break;
+            case RELOCATION_GOT:
+                target = image->got + 8 * relocation->symbol;
+                memcpy(target, &addresses[relocation->symbol], sizeof(uint8_t*));
+                break;
+            default:
+                /* The address of a function outside the image is its stub, calling through it works the same */
+                target = targets[relocation->symbol];
+                break;
+        }
+        int64_t distance = (int64_t)((intptr_t)target - (intptr_t)(field + 4)) + relocation->addend;
+        if (distance < INT32_MIN || distance > INT32_MAX) {
+            report(diagnostics, "Fatal: '%s' is too far away from the code referring to it.\n",
+                   object->symbols[relocation->symbol].name);
+            return false;
+        }
+        int32_t value = (int32_t)distance;
+        memcpy(field, &value, sizeof(value));
+    }
+    return true;
+}
+
+bool runObjectCode(const ObjectCode *object, Diagnostics *diagnostics, int *status) {
+    size_t mainSymbol = object->nSymbols;
+    size_t nFunctions = 0;
+    for (size_t i = 0; i < object->nSymbols; i++) {
+        const Symbol *symbol = &object->symbols[i];
+        if (symbol->defined && symbol->function && symbol->name != NULL && !strcmp(symbol->name, "main"))
+            mainSymbol = i;
+        if (!symbol->defined && symbol->function)
+            nFunctions += 1;
+    }
+    if (mainSymbol == object->nSymbols) {
+        report(diagnostics, "Fatal: There is nothing to run, the unit has no top-level statements or main.\n");
+        return false;
+    }
+
+    size_t page = pageSize();
+    size_t offsets[OBJECT_SECTIONS];
+    offsets[OBJECT_TEXT] = 0;
+    size_t stubs = alignUp(object->sections[OBJECT_TEXT].length, STUB_SIZE);
+    offsets[OBJECT_RODATA] = alignUp(stubs + STUB_SIZE * nFunctions, page);
+    offsets[OBJECT_DATA] = alignUp(offsets[OBJECT_RODATA] + object->sections[OBJECT_RODATA].length, page);
+    offsets[OBJECT_BSS] = alignUp(offsets[OBJECT_DATA] + object->sections[OBJECT_DATA].length,
+                                  object->sections[OBJECT_BSS].alignment);
+    size_t got = alignUp(offsets[OBJECT_BSS] + object->sections[OBJECT_BSS].length, 8);
+    Image image;
+    if (!mapImage(&image, alignUp(got + 8 * object->nSymbols, page))) {
+        report(diagnostics, "Fatal: Couldn't map memory to run the unit in.\n");
+        return false;
+    }
+    /* Fresh mappings are zeroed, which is all .bss needs */
+    for (SectionId id = 0; id < OBJECT_SECTIONS; id++) {
+        image.sections[id] = image.memory + offsets[id];
+        if (id != OBJECT_BSS && object->sections[id].length > 0)
+            memcpy(image.sections[id], object->sections[id].data, object->sections[id].length);
+    }
+    image.stubs = image.memory + stubs;
+    image.got = image.memory + got;
+    image.executableSize = offsets[OBJECT_RODATA];
+    image.readOnlySize = offsets[OBJECT_DATA] - offsets[OBJECT_RODATA];
+
+    uint8_t **addresses = malloc((object->nSymbols ? object->nSymbols : 1) * 2 * sizeof(uint8_t*));
+    if (addresses == NULL) {
+        fprintf(stderr, "Fatal: Out of memory while loading code.\n");
+        exit(1);
+    }
+    uint8_t **targets = addresses + object->nSymbols;
+    bool loaded = resolveSymbols(&image, object, addresses, targets, diagnostics) &&
+        relocate(&image, object, addresses, targets, diagnostics);
+    if (loaded && !protectImage(&image)) {
+        report(diagnostics, "Fatal: Couldn't make the unit's code executable.\n");
+        loaded = false;
+    }
+    if (loaded) {
+        /* An object pointer can't be cast to a function pointer in ISO C, its bits can be copied */
+        int (*entry)(void);
+        memcpy(&entry, &addresses[mainSymbol], sizeof(entry));
+        *status = entry();
+        /* What the program printed comes before whatever is printed after it */
+        fflush(stdout);
+    }
+    free(addresses);
+    unmapImage(&image);
+    return loaded;
+}
@@ -8,12 +8,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
-#include <ctype.h>
 #include <limits.h>
 #include <inttypes.h>
-#include <assert.h>
 
 #include "lexer.h"
+#include "scan.h"
+
+/* Reads past the end of the source as NUL, the source doesn't have to be terminated */
+#define CHAR(INDEX) ((INDEX) < length ? source[(INDEX)] : '\0')
+
+/* ASCII only, unlike ctype these don't depend on the locale and take plain chars */
+#define ISDIGIT(C) ((C) >= '0' && (C) <= '9')
+#define ISXDIGIT(C) (ISDIGIT(C) || (((C) | 0x20) >= 'a' && ((C) | 0x20) <= 'f'))
+
+/* Diagnostics only carry an offset, the line and column are looked up when the message is written */
+#define ERROR_AT(OFFSET, ...) reportAt(lexer->diagnostics, &lexer->map, lexer->file, (OFFSET), __VA_ARGS__)
 
 typedef struct {
     const char* sequence;
@@ -34,1086 +43,586 @@ static const EscapeSequence escape_sequences[] = {
     {NULL, 0} 
 };
 
-static const char* keywords[] = {
-    "if", "else", "while", "for", "switch", "case", "asm", "try", "catch", "throw", "break", "goto", "class", "union",
-    /* Pseudo */
-    "no_warn", "reg", "noreg", "static", "extern", /* "import", */
-    NULL
+typedef struct {
+    const char* name;
+    size_t len;
+    TokenType type;
+} Keyword;
+
+/*
+ * Perfect hash over the keywords, indexed by KEYWORD_HASH. The slots were computed
+ * offline for this exact set, so adding a keyword means picking new multipliers
+ * that keep every keyword in a slot of its own.
+ */
+#define KEYWORD_HASH(STR, LEN) (((unsigned char)(STR)[0] + (unsigned char)(STR)[1] * 9 + (LEN) * 3) & 31)
+#define KEYWORD_MIN_LEN 2
+#define KEYWORD_MAX_LEN 7
+
+static const Keyword keywords[32] = {
+    [2]  = {"union",   5, TT_KW_UNION},
+    [4]  = {"noreg",   5, TT_KW_NOREG},
+    [5]  = {"if",      2, TT_KW_IF},
+    [8]  = {"reg",     3, TT_KW_REG},
+    [10] = {"no_warn", 7, TT_KW_NO_WARN},
+    [11] = {"throw",   5, TT_KW_THROW},
+    [14] = {"while",   5, TT_KW_WHILE},
+    [15] = {"extern",  6, TT_KW_EXTERN},
+    [17] = {"return",  6, TT_KW_RETURN},
+    [19] = {"break",   5, TT_KW_BREAK},
+    [20] = {"switch",  6, TT_KW_SWITCH},
+    [21] = {"asm",     3, TT_KW_ASM},
+    [22] = {"for",     3, TT_KW_FOR},
+    [24] = {"case",    4, TT_KW_CASE},
+    [25] = {"static",  6, TT_KW_STATIC},
+    [26] = {"goto",    4, TT_KW_GOTO},
+    [27] = {"catch",   5, TT_KW_CATCH},
+    [29] = {"else",    4, TT_KW_ELSE},
+    [30] = {"class",   5, TT_KW_CLASS},
+    [31] = {"try",     3, TT_KW_TRY}
+    /* "import" */
 };
 
-void freeTokens(Token* tokens, size_t nTokens) {
-    if (tokens == NULL) {
-        return;
+/* Returns TT_IDENTIFIER if the word isn't a keyword */
+static TokenType keywordType(const char* word, size_t len) {
+    if (len < KEYWORD_MIN_LEN || len > KEYWORD_MAX_LEN) {
+        return TT_IDENTIFIER;
     }
-
-    for (size_t i = 0; i < nTokens; i++) {
-        free(tokens[i].value);
-        tokens[i].value = NULL;
+    const Keyword* kw = &keywords[KEYWORD_HASH(word, len)];
+    if (kw->len == len && !memcmp(kw->name, word, len)) {
+        return kw->type;
     }
-    free(tokens);
+    return TT_IDENTIFIER;
 }
 
 
-static bool appendToken(Token** tokens, size_t* sTokens, size_t* nTokens, const char* file, size_t line, size_t col, Token token) {
-    assert(tokens != NULL);
-    assert(sTokens != NULL);
-    assert(nTokens != NULL);
-    if (*nTokens >= *sTokens) {
-        size_t newSize = (*sTokens == 0) ? 128 : (*sTokens * 2);
-        Token* newTokens = realloc(*tokens, newSize * sizeof(Token));
+enum {
+    CC_OTHER,
+    CC_SPACE,
+    CC_IDENTIFIER,
+    CC_DIGIT,
+    CC_OPERATOR,
+    CC_SLASH, /* Operator or the start of a comment */
+    CC_DOT,   /* Operator or the start of a float */
+    CC_CHAR,
+    CC_STRING
+};
+
+/* What a byte can start, nextToken dispatches on this. Bytes >= 0x80 are CC_OTHER */
+#define OT CC_OTHER
+#define WS CC_SPACE
+#define ID CC_IDENTIFIER
+#define DG CC_DIGIT
+#define OP CC_OPERATOR
+#define SL CC_SLASH
+#define DT CC_DOT
+#define CH CC_CHAR
+#define ST CC_STRING
+static const unsigned char charClass[256] = {
+    /* 0x00 */ OT, OT, OT, OT, OT, OT, OT, OT, OT, WS, WS, OT, OT, WS, OT, OT,
+    /* 0x10 */ OT, OT, OT, OT, OT, OT, OT, OT, OT, OT, OT, OT, OT, OT, OT, OT,
+    /* 0x20 */ WS, OP, ST, OT, OT, OP, OP, CH, OP, OP, OP, OP, OP, OP, DT, SL,
+    /* 0x30 */ DG, DG, DG, DG, DG, DG, DG, DG, DG, DG, OP, OP, OP, OP, OP, OT,
+    /* 0x40 */ OT, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID,
+    /* 0x50 */ ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, OP, OT, OP, OP, ID,
+    /* 0x60 */ OP, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID,
+    /* 0x70 */ ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, OP, OP, OP, OP, OT
+};
+#undef OT
+#undef WS
+#undef ID
+#undef DG
+#undef OP
+#undef SL
+#undef DT
+#undef CH
+#undef ST
+
+/*
+ * Operator trie. A node's continuations are a list ending with c == 0, and type
+ * is NO_OPERATOR for prefixes that aren't operators on their own, like "..".
+ */
+#define NO_OPERATOR TT_EOF
+
+typedef struct OperatorNode {
+    char c;
+    TokenType type;
+    const struct OperatorNode* next;
+} OperatorNode;
+
+#define END_OPERATORS { 0, NO_OPERATOR, NULL }
+
+static const OperatorNode lshNext[] = { { '=', TT_LSHEQ, NULL }, END_OPERATORS };
+static const OperatorNode rshNext[] = { { '=', TT_RSHEQ, NULL }, END_OPERATORS };
+static const OperatorNode dotDotNext[] = { { '.', TT_ELLIPSIS, NULL }, END_OPERATORS };
+
+static const OperatorNode addNext[] = { { '+', TT_INC, NULL }, { '=', TT_ADDEQ, NULL }, END_OPERATORS };
+static const OperatorNode subNext[] = { { '-', TT_DEC, NULL }, { '=', TT_SUBEQ, NULL }, { '>', TT_ARROW, NULL }, END_OPERATORS };
+static const OperatorNode mulNext[] = { { '=', TT_MULEQ, NULL }, END_OPERATORS };
+static const OperatorNode divNext[] = { { '=', TT_DIVEQ, NULL }, END_OPERATORS };
+static const OperatorNode modNext[] = { { '=', TT_MODEQ, NULL }, END_OPERATORS };
+static const OperatorNode ltNext[] = { { '=', TT_LTE, NULL }, { '<', TT_LSH, lshNext }, END_OPERATORS };
+static const OperatorNode gtNext[] = { { '=', TT_GTE, NULL }, { '>', TT_RSH, rshNext }, END_OPERATORS };
+static const OperatorNode bxorNext[] = { { '=', TT_XOREQ, NULL }, { '^', TT_XOR, NULL }, END_OPERATORS };
+static const OperatorNode bandNext[] = { { '&', TT_AND, NULL }, { '=', TT_ANDEQ, NULL }, END_OPERATORS };
+static const OperatorNode borNext[] = { { '|', TT_OR, NULL }, { '=', TT_OREQ, NULL }, END_OPERATORS };
+static const OperatorNode assignNext[] = { { '=', TT_EQ, NULL }, END_OPERATORS };
+static const OperatorNode notNext[] = { { '=', TT_NEQ, NULL }, END_OPERATORS };
+static const OperatorNode dotNext[] = { { '.', NO_OPERATOR, dotDotNext }, END_OPERATORS };
+
+/* Root of the trie, indexed by the first byte. Only bytes of class CC_OPERATOR, CC_SLASH and CC_DOT have an entry */
+static const OperatorNode operators[128] = {
+    ['+'] = { '+', TT_ADD, addNext },
+    ['-'] = { '-', TT_SUB, subNext },
+    ['*'] = { '*', TT_MUL, mulNext },
+    ['/'] = { '/', TT_DIV, divNext },
+    ['%'] = { '%', TT_MOD, modNext },
+    ['`'] = { '`', TT_POW, NULL },
+    ['!'] = { '!', TT_NOT, notNext },
+    ['<'] = { '<', TT_LT, ltNext },
+    ['>'] = { '>', TT_GT, gtNext },
+    ['~'] = { '~', TT_BNOT, NULL },
+    ['^'] = { '^', TT_BXOR, bxorNext },
+    ['&'] = { '&', TT_BAND, bandNext },
+    ['|'] = { '|', TT_BOR, borNext },
+    ['='] = { '=', TT_ASSIGN, assignNext },
+    ['('] = { '(', TT_LPAREN, NULL },
+    [')'] = { ')', TT_RPAREN, NULL },
+    ['['] = { '[', TT_LBRACKET, NULL },
+    [']'] = { ']', TT_RBRACKET, NULL },
+    ['{'] = { '{', TT_LBRACE, NULL },
+    ['}'] = { '}', TT_RBRACE, NULL },
+    [';'] = { ';', TT_SEMICOLON, NULL },
+    [':'] = { ':', TT_COLON, NULL },
+    ['.'] = { '.', TT_DOT, dotNext },
+    [','] = { ',', TT_COMMA, NULL }
+};
 
-        if (newTokens == NULL) {
-            fprintf(stderr, "%s:%zu:%zu: Memory alloation failed in appendToken\n", file, line, col);
-            perror("realloc");
-            freeTokens(*tokens, *nTokens);
-            *tokens = NULL;
+static bool appendToken(TokenStream* stream, Token token) {
+    if (stream->count == stream->capacity) {
+        size_t capacity = stream->capacity ? stream->capacity * 2 : 128;
+        uint8_t* types = realloc(stream->types, capacity * sizeof(uint8_t));
+        if (types != NULL) stream->types = types;
+        uint32_t* offsets = realloc(stream->offsets, capacity * sizeof(uint32_t));
+        if (offsets != NULL) stream->offsets = offsets;
+        uint32_t* lengths = realloc(stream->lengths, capacity * sizeof(uint32_t));
+        if (lengths != NULL) stream->lengths = lengths;
+        Atom* values = realloc(stream->values, capacity * sizeof(Atom));
+        if (values != NULL) stream->values = values;
+        if (types == NULL || offsets == NULL || lengths == NULL || values == NULL)
             return false;
-        }
-        *tokens = newTokens;
-        *sTokens = newSize;
+        stream->capacity = capacity;
     }
 
-    (*tokens)[(*nTokens)++] = token;
+    stream->types[stream->count] = (uint8_t)token.type;
+    stream->offsets[stream->count] = token.index;
+    stream->lengths[stream->count] = token.len;
+    stream->values[stream->count] = token.value ? atomOf(token.value) : NO_ATOM;
+    stream->count++;
     return true;
 }
 
-static char* handleEscapeSequence(const char* source, size_t* i, size_t* col, size_t* line, const char* file) {
+/* Decodes the escape sequence at CHAR(*i) into *result */
+static bool handleEscapeSequence(Lexer* lexer, size_t* i, char* result) {
+    const char* source = lexer->source;
+    size_t length = lexer->length;
     (*i)++;
-    (*col)++;
 
-    if (!source[*i]) {
-        fprintf(stderr, "%s:%zu:%zu: Unterminated escape sequence\n", file, *line, *col);
-        return NULL;
+    if (*i >= length) {
+        ERROR_AT(*i - 1, "Unterminated escape sequence.");
+        return false;
     }
 
     for (const EscapeSequence* es = escape_sequences; es->sequence; ++es) {
         size_t len = strlen(es->sequence);
         if (strncmp(source + *i - 1, es->sequence, len) == 0) {
             *i += len - 1;
-            *col += len - 1;
-            char* result = malloc(2); 
-            if (!result) {
-                perror("malloc");
-                return NULL;
-            }
-            result[0] = es->value;
-            result[1] = '\0';
-            return result;
+            *result = es->value;
+            return true;
         }
     }
 
-    if (source[*i] == 'x') {
+    if (CHAR(*i) == 'x') {
         (*i)++;
-        (*col)++;
         char hex_buffer[9] = { 0 }; 
         int hex_digits = 0;
 
-        while (isxdigit(source[*i]) && hex_digits < 8) {
-            hex_buffer[hex_digits++] = source[*i];
+        while (ISXDIGIT(CHAR(*i)) && hex_digits < 8) {
+            hex_buffer[hex_digits++] = CHAR(*i);
             (*i)++;
-            (*col)++;
         }
 
         if (!hex_digits) {
-            fprintf(stderr, "%s:%zu:%zu: Expected hexadecimal digits after '\\x'.\n", file, *line, *col);
-            return NULL;
+            ERROR_AT(*i, "Expected hexadecimal digits after '\\x'.");
+            return false;
         }
 
         unsigned long long val = strtoull(hex_buffer, NULL, 16);
         if (val > UCHAR_MAX) {
-            fprintf(stderr, "%s:%zu:%zu: Hexadecimal escape sequence out of range.\n", file, *line, *col);
+            ERROR_AT(*i, "Hexadecimal escape sequence out of range.");
         }
 
-        char* result = malloc(2);
-        if (!result) {
-            perror("malloc");
-            return NULL;
-        }
-        result[0] = (char)val;
-        result[1] = '\0';
-        return result;
+        *result = (char)val;
+        return true;
     }
-    else if (isdigit(source[*i])) {
+    else if (ISDIGIT(CHAR(*i))) {
         char octal_buffer[4] = { 0 };
         int octal_digits = 0;
-        while (source[*i] >= '0' && source[*i] <= '7' && octal_digits < 3) {
-            octal_buffer[octal_digits++] = source[*i];
+        while (CHAR(*i) >= '0' && CHAR(*i) <= '7' && octal_digits < 3) {
+            octal_buffer[octal_digits++] = CHAR(*i);
             (*i)++;
-            (*col)++;
         }
 
         if (!octal_digits) {
-            fprintf(stderr, "%s:%zu:%zu: Expected octal digits after '\\'.\n", file, *line, *col);
-            return NULL;
+            ERROR_AT(*i, "Expected octal digits after '\\'.");
+            return false;
         }
 
         unsigned long long val = strtoull(octal_buffer, NULL, 8);
         if (val > UCHAR_MAX) {
-            fprintf(stderr, "%s:%zu:%zu: Octal escape sequence out of range.\n", file, *line, *col);
+            ERROR_AT(*i, "Octal escape sequence out of range.");
         }
 
-        char* result = malloc(2);
-        if (!result) {
-            perror("malloc");
-            return NULL;
-        }
-        result[0] = (char)val;
-        result[1] = '\0';
-        return result;
+        *result = (char)val;
+        return true;
     }
     else {
-        char unrecognized = source[*i];
+        char unrecognized = CHAR(*i);
         (*i)++;
-        (*col)++;
-        fprintf(stderr, "%s:%zu:%zu: Warning: Unrecognized escape sequence '\\%c'\n", file, *line, *col - 1, unrecognized);
+        ERROR_AT(*i - 1, "Warning: Unrecognized escape sequence '\\%c'.", unrecognized);
 
-        char* result = malloc(2);
-        if (!result) {
-            perror("malloc");
-            return NULL;
-        }
-        result[0] = unrecognized;
-        result[1] = '\0';
-        return result;
+        *result = unrecognized;
+        return true;
     }
 }
 
 
-Token* tokenize(const char* source, const char* file) {
-    if (source == NULL || file == NULL) {
-        fprintf(stderr, "Error: NULL source or file argument passed to tokenize.\n");
-        return NULL;
+void initLexer(Lexer* lexer, const char* source, size_t length, const char* file, Interner* interner, Diagnostics* diagnostics) {
+    lexer->source = source;
+    lexer->length = length;
+    lexer->file = file;
+    lexer->interner = interner;
+    lexer->diagnostics = diagnostics;
+    lexer->index = 0;
+    lexer->failed = false;
+    initSourceMap(&lexer->map, source, length);
+    if (length > TOKEN_MAX_INDEX) {
+        report(diagnostics, "%s: Source file too big.\n", file);
+        lexer->failed = true;
     }
+}
 
-    Token* tokens = malloc(128 * sizeof(Token));
-    size_t sTokens = 128;
-    size_t nTokens = 0;
-    size_t i = 0;
-    size_t line = 1;
-    size_t col = 1;
-
-    while (source[i]) {
-        switch (source[i]) {
-        case '\t':
-        case '\r':
-        case ' ':
-            i++;
-            col++;
-            break;
-
-        case '\n':
-            i++;
-            line++;
-            col = 1;  
-            break;
-
-
-        case '+': {
-            TokenType type = TT_ADD;
-            size_t len = 1;
-
-            if (source[i + 1] == '+') {
-                type = TT_INC;
-                len = 2;
-                i++;
-                col++;
-            }
-            else if (source[i + 1] == '=') {
-                type = TT_ADDEQ;
-                len = 2;
-                i++;
-                col++;
-            }
-
-            Token token = {
-                .type = type,
-                .value = NULL,
-                .index = i - len + 1,
-                .col = col - len + 1,
-                .line = line,
-                .len = len
-            };
-
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) {
-                return NULL;
-            }
-
-            i++;
-            col++;
-            break;
-        }
-        case '-': {
-            TokenType type = TT_SUB;
-            size_t len = 1;
-
-            if (source[i + 1] == '-') {
-                type = TT_DEC;
-                len = 2;
-                i++;
-                col++;
-            }
-            else if (source[i + 1] == '=') {
-                type = TT_SUBEQ;
-                len = 2;
-                i++;
-                col++;
-            }
-            else if (source[i + 1] == '>') {
-                type = TT_ARROW;
-                len = 2;
-                i++;
-                col++;
-            }
-
-            Token token = {
-                .type = type,
-                .value = NULL,
-                .index = i - len + 1,
-                .col = col - len + 1,
-                .line = line,
-                .len = len
-            };
-
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) {
-                return NULL;
-            }
-
-            i++;
-            col++;
-            break;
-        }
-
-        case '*': {
-            TokenType type = TT_MUL;
-            size_t len = 1;
-
-            if (source[i + 1] == '=') {
-                type = TT_MULEQ;
-                len = 2;
-                i++;
-                col++;
-            }
-
-            Token token = {
-                .type = type,
-                .value = NULL,
-                .index = i - len + 1,
-                .col = col - len + 1,
-                .line = line,
-                .len = len
-            };
-
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) {
-                return NULL;
-            }
-
-            i++;
-            col++;
-            break;
-        }
+void freeLexer(Lexer* lexer) {
+    freeSourceMap(&lexer->map);
+}
 
-        case '/': {
-            if (source[i + 1] == '=') {
-                Token token = {
-                    .type = TT_DIVEQ,
-                    .value = NULL,
-                    .index = i,
-                    .col = col,
-                    .line = line,
-                    .len = 2
-                };
-
-                if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) {
-                    return NULL;
-                }
+/* Saves the position for the next call and hands the token to the caller */
+#define EMIT(TOKEN) do { \
+        lexer->index = i; \
+        return (TOKEN); \
+    } while (0)
+
+/* The error has already been reported, from now on only EOF is returned */
+#define FAIL() do { \
+        lexer->failed = true; \
+        EMIT(eof_token); \
+    } while (0)
+
+/* Token.len is 24 bits wide */
+#define CHECK_LENGTH(LEN) do { \
+        if ((LEN) > TOKEN_MAX_LEN) { \
+            ERROR_AT(i, "Token too long."); \
+            FAIL(); \
+        } \
+    } while (0)
+
+Token nextToken(Lexer* lexer) {
+    const char* source = lexer->source;
+    size_t length = lexer->length;
+    Interner* interner = lexer->interner;
+    size_t i = lexer->index;
+
+    Token eof_token = {
+        .type = TT_EOF,
+        .value = NULL,
+        .index = i,
+        .len = 0
+    };
+
+    if (lexer->failed) {
+        return eof_token;
+    }
 
-                i += 2;
-                col += 2;
-            }
-            else if (source[i + 1] == '/') { 
-                while (source[i] && source[i] != '\n') {
-                    i++;
-                }
-            }
-            else if (source[i + 1] == '*') { 
-                i++; 
-                while (source[++i] && !(source[i] == '*' && source[i + 1] == '/'));
-
-                if (!source[i]) {
-                    fprintf(stderr, "%s:%zu:%zu: Reached EOF while parsng block comment.\n", file, line, col);
-                    freeTokens(tokens, nTokens);
-                    return NULL;
+    while (i < length) {
+        switch (charClass[(unsigned char)source[i]]) {
+        case CC_SPACE: {
+            i = scanWhitespace(source, i, length);
+        } break;
+
+        case CC_SLASH: {
+            if (CHAR(i + 1) == '/') { 
+                i = scanLine(source, i, length);
+                break;
+            }
+            else if (CHAR(i + 1) == '*') { 
+                size_t end = i + 2;
+                for (;;) {
+                    end = scanStar(source, end, length);
+                    if (end >= length || CHAR(end + 1) == '/')
+                        break;
+                    end++;
                 }
-                i++;
 
-            }
-            else { 
-                Token token = {
-                    .type = TT_DIV,
-                    .value = NULL,
-                    .index = i,
-                    .col = col,
-                    .line = line,
-                    .len = 1
-                };
-
-                if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) {
-                    return NULL;
+                if (end >= length) {
+                    ERROR_AT(i, "Reached EOF while parsng block comment.");
+                    FAIL();
                 }
-
-                i++;
-                col++;
+                i = end + 2;
+                break;
             }
-            break;
+            goto match_operator;
         }
 
-        case '%': {
-            TokenType type = TT_MOD;
-            size_t len = 1;
-
-            if (source[i + 1] == '=') {
-                type = TT_MODEQ;
-                len = 2;
-                i++;
-                col++;
-            }
-
-            Token token = {
-                .type = type,
-                .value = NULL,
-                .index = i - len + 1,
-                .col = col - len + 1,
-                .line = line,
-                .len = len
-            };
-
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) {
-                return NULL;
-            }
-
-            i++;
-            col++;
-            break;
-        }
-                
-        case '<': {
-            TokenType type = TT_LT;
-            size_t len = 1;
-
-            if (source[i + 1] == '=') {
-                type = TT_LTE;
-                len = 2;
-                i++;
-                col++;
-            }
-            else if (source[i + 1] == '<') {
-                len = 2;
-                i++;
-                col++;
-                if (source[i + 1] == '=') {
-                    type = TT_LSHEQ;
-                    len = 3;
-                    i++;
-                    col++;
-                }
-                else {
-                    type = TT_LSH;
-                }
-            }
-
-            Token token = {
-                .type = type,
-                .value = NULL,
-                .index = i - len + 1,
-                .col = col - len + 1,
-                .line = line,
-                .len = len
-            };
-
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) {
-                return NULL;
-            }
-
-            i++;
-            col++;
-            break;
-        }
+        case CC_DOT:
+            if (ISDIGIT(CHAR(i + 1)))
+                goto parse_number;
+            goto match_operator;
 
-                
-        case '>': {
-            TokenType type = TT_GT;
+        case CC_OPERATOR:
+        match_operator: {
+            /* Longest match, the token is the last node on the path that ends an operator */
+            const OperatorNode* node = &operators[(unsigned char)source[i]];
+            TokenType type = node->type;
             size_t len = 1;
-
-            if (source[i + 1] == '=') {
-                type = TT_GTE;
-                len = 2;
-                i++;
-                col++;
-            }
-            else if (source[i + 1] == '>') {
-                len = 2;
-                i++;
-                col++;
-                if (source[i + 1] == '=') {
-                    type = TT_RSHEQ;
-                    len = 3;
-                    i++;
-                    col++;
-                }
-                else {
-                    type = TT_RSH;
+            for (size_t j = i + 1; node->next != NULL && j < length; j++) {
+                const OperatorNode* next = node->next;
+                while (next->c && next->c != source[j])
+                    next++;
+                if (!next->c)
+                    break;
+                node = next;
+                if (node->type != NO_OPERATOR) {
+                    type = node->type;
+                    len = j - i + 1;
                 }
             }
 
             Token token = {
                 .type = type,
                 .value = NULL,
-                .index = i - len + 1,
-                .col = col - len + 1,
-                .line = line,
-                .len = len
-            };
-
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) {
-                return NULL;
-            }
-
-            i++;
-            col++;
-            break;
-        }
-
-
-        case '~': {
-            Token token = {
-                .type = TT_BNOT,
-                .value = NULL,
                 .index = i,
-                .col = col,
-                .line = line,
-                .len = 1
-            };
-
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) {
-                return NULL;
-            }
-
-            i++;
-            col++;
-            break;
-        }
-
-        case '^': {
-            TokenType type = TT_BXOR;
-            size_t len = 1;
-
-            if (source[i + 1] == '=') {
-                type = TT_XOREQ;
-                len = 2;
-                i++;
-                col++;
-            }
-            else if (source[i + 1] == '^') {  
-
-                type = TT_XOR;
-                len = 2;
-                i++;
-                col++;
-            }
-
-            Token token = {
-                .type = type,
-                .value = NULL,
-                .index = i - len + 1,
-                .col = col - len + 1,
-                .line = line,
                 .len = len
             };
-
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) {
-                return NULL;
-            }
-
-            i++;
-            col++;
-            break;
-        }
-
-
-        case '`': {
-            Token token = {
-                .type = TT_POW,
-                .value = NULL,
-                .index = i,
-                .col = col,
-                .line = line,
-                .len = 1
-            };
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) return NULL;
-            i++;
-            col++;
-            break;
+            i += len;
+            EMIT(token);
         }
 
-        case '&': {
-            TokenType type = TT_BAND;
-            size_t len = 1;
-
-            if (source[i + 1] == '&') { 
-                type = TT_AND;
-                len = 2;
-                i++;
-                col++;
-            }
-            else if (source[i + 1] == '=') {
-                type = TT_ANDEQ;
-                len = 2;
-                i++;
-                col++;
-            }
-
-            Token token = {
-                .type = type,
-                .value = NULL,
-                .index = i - len + 1,
-                .col = col - len + 1,
-                .line = line,
-                .len = len
-            };
-
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) {
-                return NULL;
-            }
-
-            i++;
-            col++;
-            break;
-        }
-
-        case '|': {
-            TokenType type = TT_BOR;
-            size_t len = 1;
-
-            if (source[i + 1] == '|') { 
-                type = TT_OR;
-                len = 2;
-                i++;
-                col++;
-            }
-            else if (source[i + 1] == '=') {
-                type = TT_OREQ;
-                len = 2;
-                i++;
-                col++;
-            }
-
-            Token token = {
-                .type = type,
-                .value = NULL,
-                .index = i - len + 1,
-                .col = col - len + 1,
-                .line = line,
-                .len = len
-            };
-
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) {
-                return NULL;
-            }
-
-            i++;
-            col++;
-            break;
-        }
-
-        case '=': {
-            TokenType type = TT_ASSIGN;
-            size_t len = 1;
-
-            if (source[i + 1] == '=') {
-
-                type = TT_EQ;
-                len = 2;
-                i++;
-                col++;
-            }
-
-            Token token = {
-                .type = type,
-                .value = NULL,
-                .index = i - len + 1,
-                .col = col - len + 1,
-                .line = line,
-                .len = len
-            };
-
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) {
-                return NULL;
-            }
-
-            i++;
-            col++;
-            break;
-        }
-
-        case '!': {
-            TokenType type = TT_NOT;
-            size_t len = 1;
-
-            if (source[i + 1] == '=') {
-                type = TT_NEQ;
-                len = 2;
-                i++;
-                col++;
-            }
-
-            Token token = {
-                .type = type,
-                .value = NULL,
-                .index = i - len + 1,
-                .col = col - len + 1,
-                .line = line,
-                .len = len
-            };
-
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) {
-                return NULL;
-            }
-
-            i++;
-            col++;
-            break;
-        }
-        case '(': {
-            Token token = {
-                .type = TT_LPAREN,
-                .value = NULL,
-                .index = i,
-                .col = col,
-                .line = line,
-                .len = 1
-            };
-
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) {
-                return NULL;
-            }
-            i++;
-            col++;
-            break;
-        }
-
-        case ')': {
-            Token token = {
-                .type = TT_RPAREN,
-                .value = NULL,
-                .index = i,
-                .col = col,
-                .line = line,
-                .len = 1
-            };
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) return NULL;
-            i++;
-            col++;
-            break;
-        }
-
-        case '{': {
-            Token token = {
-                .type = TT_LBRACE,
-                .value = NULL,
-                .index = i,
-                .col = col,
-                .line = line,
-                .len = 1
-            };
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) return NULL;
-            i++;
-            col++;
-            break;
-        }
-
-        case '}': {
-            Token token = {
-                .type = TT_RBRACE,
-                .value = NULL,
-                .index = i,
-                .col = col,
-                .line = line,
-                .len = 1
-            };
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) return NULL;
-            i++;
-            col++;
-            break;
-        }
-
-        case '[': {
-            Token token = {
-                .type = TT_LBRACKET,
-                .value = NULL,
-                .index = i,
-                .col = col,
-                .line = line,
-                .len = 1
-            };
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) return NULL;
-            i++;
-            col++;
-            break;
-        }
-
-        case ']': {
-            Token token = {
-                .type = TT_RBRACKET,
-                .value = NULL,
-                .index = i,
-                .col = col,
-                .line = line,
-                .len = 1
-            };
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) return NULL;
-            i++;
-            col++;
-            break;
-        }
-        case ';': {
-            Token token = {
-                .type = TT_SEMICOLON,
-                .value = NULL,
-                .index = i,
-                .col = col,
-                .line = line,
-                .len = 1
-            };
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) return NULL;
-            i++;
-            col++;
-            break;
-        }
-        case ':': {
-            Token token = {
-                .type = TT_COLON,
-                .value = NULL,
-                .index = i,
-                .col = col,
-                .line = line,
-                .len = 1
-            };
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) return NULL;
-            i++;
-            col++;
-            break;
-        }
-
-        case '.': {
-            if (isdigit(source[i + 1])) { 
-                goto parse_number;
-            }
-            else if (source[i + 1] == '.' && source[i + 2] == '.') { 
-                Token token = {
-                    .type = TT_ELLIPSIS,
-                    .value = NULL,
-                    .index = i,
-                    .col = col,
-                    .line = line,
-                    .len = 3
-                };
-                if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) return NULL;
-                i += 3;
-                col += 3;
-            }
-            else { 
-                Token token = {
-                    .type = TT_DOT,
-                    .value = NULL,
-                    .index = i,
-                    .col = col,
-                    .line = line,
-                    .len = 1
-                };
-                if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) return NULL;
-                i++;
-                col++;
-            }
-            break;
-        }
-
-        case ',': {
-            Token token = {
-                .type = TT_COMMA,
-                .value = NULL,
-                .index = i,
-                .col = col,
-                .line = line,
-                .len = 1
-            };
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) return NULL;
-            i++;
-            col++;
-            break;
-        }
-
-        case '\'': {
+        case CC_CHAR: {
             size_t start = i;
-            size_t start_col = col;
             i++;
-            col++;
 
-            char* char_value = NULL;
+            /* Only escaped characters get a value, plain ones are read from the source */
+            const char* char_value = NULL;
 
-            if (source[i] == '\\') { 
-                char_value = handleEscapeSequence(source, &i, &col, &line, file);
-                if (!char_value) {
-                    freeTokens(tokens, nTokens);
-                    return NULL;
+            if (CHAR(i) == '\\') { 
+                char decoded;
+                if (!handleEscapeSequence(lexer, &i, &decoded)) {
+                    FAIL();
                 }
+                char_value = intern(interner, &decoded, 1);
             }
-            else if (source[i] != '\'') { 
-                char_value = malloc(2);
-                if (!char_value) {
-                    perror("malloc");
-                    freeTokens(tokens, nTokens);
-                    return NULL;
-                }
-                char_value[0] = source[i];
-                char_value[1] = '\0';
+            else if (CHAR(i) != '\'') { 
                 i++;
-                col++;
             }
             else { 
-                fprintf(stderr, "%s:%zu:%zu: Empty character constnt.\n", file, line, col);
-                freeTokens(tokens, nTokens);
-                return NULL;
+                ERROR_AT(start, "Empty character constnt.");
+                FAIL();
             }
 
 
 
-            if (source[i] != '\'') {
-                fprintf(stderr, "%s:%zu:%zu: Unterminated character constant.\n", file, line, col);
-                free(char_value);
-                freeTokens(tokens, nTokens);
-                return NULL;
+            if (CHAR(i) != '\'') {
+                ERROR_AT(start, "Unterminated character constant.");
+                FAIL();
             }
             i++;
-            col++;
 
             Token token = {
                 .type = TT_CHAR,
-                .value = char_value,
+                .value = (char*)char_value,
                 .index = start,
-                .col = start_col,
-                .line = line,
                 .len = i - start
             };
 
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) {
-                free(char_value);
-                freeTokens(tokens, nTokens);
-                return NULL;
-            }
-            break;
+            EMIT(token);
         }
-        case '"': {
+        case CC_STRING: {
             size_t start = i;
-            size_t start_col = col;
             i++; 
-            col++;
-
-            size_t string_length = 0;
-            char* string_value = NULL;
-
-            while (source[i] && source[i] != '"') {
-                char* escaped = NULL;
-                if (source[i] == '\\') { 
-                    escaped = handleEscapeSequence(source, &i, &col, &line, file);
-                    if (!escaped) { 
-                        free(string_value);
-                        freeTokens(tokens, nTokens);
-                        return NULL;
-                    }
-                    size_t escaped_len = strlen(escaped);
-
-                    char* new_string_value = realloc(string_value, string_length + escaped_len + 1);
-                    if (!new_string_value) {
-                        perror("realloc");
-                        free(string_value);
-                        free(escaped);
-                        freeTokens(tokens, nTokens);
-                        return NULL;
-                    }
-                    string_value = new_string_value;
-                    memcpy(string_value + string_length, escaped, escaped_len);
-                    string_length += escaped_len;
-                    free(escaped);
 
-                }
-                else { 
-                    char* new_string_value = realloc(string_value, string_length + 2); 
-                    if (!new_string_value) {
-                        perror("realloc");
-                        free(string_value);
-                        freeTokens(tokens, nTokens);
-                        return NULL;
-                    }
-                    string_value = new_string_value;
-                    string_value[string_length++] = source[i];
+            bool escaped = false;
+            for (;;) {
+                i = scanString(source, i, length);
+                if (CHAR(i) != '\\')
+                    break;
+                if (i + 1 >= length) {
                     i++;
-                    col++;
+                    break;
                 }
+                /* Skip the escaped character, it may be a quote */
+                escaped = true;
+                i += 2;
             }
 
-            if (!source[i]) {
-                fprintf(stderr, "%s:%zu:%zu: Unterminated string literal.\n", file, line, col);
-                free(string_value);
-                freeTokens(tokens, nTokens);
-                return NULL;
+            if (CHAR(i) != '"') {
+                ERROR_AT(start, "Unterminated string literal.");
+                FAIL();
             }
 
             i++; 
-            col++;
-
-            if (string_value) {
-                string_value[string_length] = '\0';
-            }
-            else {
-                string_value = calloc(1, 1);
+            CHECK_LENGTH(i - start);
+
+            /*
+             * Strings without escape sequences are read straight from the source, the others
+             * are decoded and interned. The decoded string is never longer than the literal.
+             */
+            const char* string_value = NULL;
+            if (escaped) {
+                char* decoded = malloc(i - start - 1);
+                if (!decoded) {
+                    ERROR_AT(start, "Out of memory while decoding string literal.");
+                    FAIL();
+                }
+                size_t string_length = 0;
+                size_t j = start + 1;
+                while (j < i - 1) {
+                    if (source[j] == '\\') {
+                        if (!handleEscapeSequence(lexer, &j, decoded + string_length)) {
+                            free(decoded);
+                            FAIL();
+                        }
+                        string_length++;
+                    }
+                    else {
+                        decoded[string_length++] = source[j++];
+                    }
+                }
+                string_value = intern(interner, decoded, string_length);
+                free(decoded);
             }
 
             Token token = {
                 .type = TT_STRING,
-                .value = string_value,
+                .value = (char*)string_value,
                 .index = start,
-                .col = start_col,
-                .line = line,
                 .len = i - start
             };
 
-            if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) {
-                free(string_value);
-                freeTokens(tokens, nTokens);
-                return NULL;
-            }
+            EMIT(token);
+        }
+        case CC_IDENTIFIER: {
+            size_t start = i;
+            i = scanIdentifier(source, i, length);
+            size_t len = i - start;
+            CHECK_LENGTH(len);
+
+            TokenType type = keywordType(source + start, len);
 
-            break;
+            Token token = {
+                .type = type,
+                .value = type == TT_IDENTIFIER ? (char*)intern(interner, source + start, len) : NULL,
+                .index = start,
+                .len = len
+            };
+
+            EMIT(token);
         }
-        default: {
-            if (isalpha(source[i]) || source[i] == '_') {
-                size_t start = i;
-                while (isalnum(source[i]) || source[i] == '_') {
-                    i++;
-                    col++;
-                }
-                size_t len = i - start;
 
-                char* value = malloc(len + 1); 
-                if (value == NULL) {
-                    fprintf(stderr, "%s:%zu:%zu: Memory allocation failed.\n", file, line, col);
-                    freeTokens(tokens, nTokens);
-                    return NULL;
-                }
-                memcpy(value, source + start, len);
-                value[len] = '\0';
+        case CC_DIGIT:
+        parse_number: {
+            size_t start = i;
+            bool hasDot = false;
 
-                bool isKeyword = false;
-                for (const char** kw = keywords; *kw != NULL; kw++) {
-                    if (strcmp(value, *kw) == 0) {
-                        isKeyword = true;
-                        break;
-                    }
+            for (;;) {
+                i = scanDigits(source, i, length);
+                if (CHAR(i) != '.')
+                    break;
+                if (hasDot) { 
+                    ERROR_AT(i, "Malformed float.");
+                    FAIL();
                 }
+                hasDot = true;
+                i++;
+            }
 
-                Token token = {
-                    .type = isKeyword ? TT_KEYWORD : TT_IDENTIFIER,
-                    .value = value,
-                    .index = start,
-                    .line = line,
-                    .col = col - len, 
-                    .len = len
-                };
-
-                if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) {
-                    free(value); 
-                    return NULL;
-                }
+            size_t len = i - start;
+            CHECK_LENGTH(len);
 
+            Token token = {
+                .type = hasDot ? TT_FLOAT : TT_INT,
+                .value = NULL,
+                .index = start,
+                .len = len
+            };
 
-            }
-            else if (isdigit(source[i]) || source[i] == '.') { 
-                goto parse_number;
-            }
-            else { 
-                fprintf(stderr, "%s:%zu:%zu: Unexpected character '%c'.\n", file, line, col, source[i]);
-                freeTokens(tokens, nTokens);
-                return NULL;
-            }
-            break;
-        } 
+            EMIT(token);
+        }
+
+        default:
+            ERROR_AT(i, "Unexpected character '%c'.", CHAR(i));
+            FAIL();
         } 
     } 
 
-    Token eof_token;
-
-    eof_token.type = TT_EOF;
-    eof_token.value = NULL;
     eof_token.index = i;
-    eof_token.col = col;
-    eof_token.line = line;
-    eof_token.len = 0;
+    EMIT(eof_token);
+}
 
-    if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, eof_token)) {
-        return NULL;
+bool tokenize(TokenStream* stream, const char* source, size_t length, const char* file, Interner* interner, Diagnostics* diagnostics) {
+    stream->types = NULL;
+    stream->offsets = NULL;
+    stream->lengths = NULL;
+    stream->values = NULL;
+    stream->count = 0;
+    stream->capacity = 0;
+    if (source == NULL || file == NULL || interner == NULL) {
+        report(diagnostics, "Error: NULL source or file argument passed to tokenize.\n");
+        return false;
     }
 
-    return tokens;
-
-parse_number:
-    {
-        size_t start = i;
-        bool hasDot = false;
+    Lexer lexer;
+    initLexer(&lexer, source, length, file, interner, diagnostics);
 
-        while (isdigit(source[i]) || source[i] == '.') {
-            if (source[i] == '.') {
-                if (hasDot) { 
-                    fprintf(stderr, "%s:%zu:%zu: Malformed float.\n", file, line, col);
-                    freeTokens(tokens, nTokens);
-                    return NULL;
-                }
-                hasDot = true;
-            }
-            i++;
-        }
-
-        size_t len = i - start;
-        char* value = malloc(len + 1);
-
-        if (!value) {
-            fprintf(stderr, "%s:%zu:%zu: Memory allocation failed.\n", file, line, col);
-            freeTokens(tokens, nTokens);
-            return NULL;
-        }
-
-        strncpy(value, source + start, len);
-        value[len] = '\0';
-
-        Token token = {
-            .type = hasDot ? TT_FLOAT : TT_INT,
-            .value = value,
-            .index = start,
-            .col = col,
-            .line = line,
-            .len = len
-        };
-
-        if (!appendToken(&tokens, &sTokens, &nTokens, file, line, col, token)) {
-            free(value);
-            freeTokens(tokens, nTokens);
-            return NULL;
+    Token token;
+    do {
+        token = nextToken(&lexer);
+        if (!appendToken(stream, token)) {
+            report(diagnostics, "%s: Out of memory while storing tokens.\n", file);
+            freeLexer(&lexer);
+            freeTokenStream(stream);
+            return false;
         }
+    } while (token.type != TT_EOF);
 
-        col += len;
-        
+    freeLexer(&lexer);
+    if (lexer.failed) {
+        freeTokenStream(stream);
+        return false;
     }
+    return true;
+}
 
-
+void freeTokenStream(TokenStream* stream) {
+    free(stream->types);
+    free(stream->offsets);
+    free(stream->lengths);
+    free(stream->values);
+    stream->types = NULL;
+    stream->offsets = NULL;
+    stream->lengths = NULL;
+    stream->values = NULL;
+    stream->count = 0;
+    stream->capacity = 0;
+}
 
 #ifdef DEBUG
 const char* tokenTypeAsString(Token token) {
@@ -1122,8 +631,46 @@ const char* tokenTypeAsString(Token token) {
         return "EOF";
     case TT_IDENTIFIER:
         return "IDENTIFIER";
-    case TT_KEYWORD:
-        return "KEYWORD";
+    case TT_KW_IF:
+        return "KW_IF";
+    case TT_KW_ELSE:
+        return "KW_ELSE";
+    case TT_KW_WHILE:
+        return "KW_WHILE";
+    case TT_KW_FOR:
+        return "KW_FOR";
+    case TT_KW_SWITCH:
+        return "KW_SWITCH";
+    case TT_KW_CASE:
+        return "KW_CASE";
+    case TT_KW_ASM:
+        return "KW_ASM";
+    case TT_KW_TRY:
+        return "KW_TRY";
+    case TT_KW_CATCH:
+        return "KW_CATCH";
+    case TT_KW_THROW:
+        return "KW_THROW";
+    case TT_KW_BREAK:
+        return "KW_BREAK";
+    case TT_KW_GOTO:
+        return "KW_GOTO";
+    case TT_KW_RETURN:
+        return "KW_RETURN";
+    case TT_KW_CLASS:
+        return "KW_CLASS";
+    case TT_KW_UNION:
+        return "KW_UNION";
+    case TT_KW_NO_WARN:
+        return "KW_NO_WARN";
+    case TT_KW_REG:
+        return "KW_REG";
+    case TT_KW_NOREG:
+        return "KW_NOREG";
+    case TT_KW_STATIC:
+        return "KW_STATIC";
+    case TT_KW_EXTERN:
+        return "KW_EXTERN";
     case TT_INT:
         return "INT";
     case TT_FLOAT:
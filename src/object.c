@@ -0,0 +1,486 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "object.h"
+
+#define SECTION_INITIAL_CAPACITY 256
+#define OBJECT_INITIAL_CAPACITY 64
+
+/* ELF64, see the System V ABI and its x86-64 supplement */
+#define ELF_HEADER_SIZE 64
+#define ELF_SECTION_HEADER_SIZE 64
+#define ELF_SYMBOL_SIZE 24
+#define ELF_RELA_SIZE 24
+#define ELF_MACHINE_X86_64 62
+#define SHT_PROGBITS 1
+#define SHT_SYMTAB 2
+#define SHT_STRTAB 3
+#define SHT_RELA 4
+#define SHT_NOBITS 8
+#define SHF_WRITE 0x1
+#define SHF_ALLOC 0x2
+#define SHF_EXECINSTR 0x4
+#define SHF_INFO_LINK 0x40
+#define STB_LOCAL 0
+#define STB_GLOBAL 1
+#define STT_NOTYPE 0
+#define STT_OBJECT 1
+#define STT_FUNC 2
+#define STT_SECTION 3
+#define R_X86_64_PC32 2
+#define R_X86_64_PLT32 4
+#define R_X86_64_GOTPCREL 9
+
+/* COFF, see the PE format specification */
+#define COFF_HEADER_SIZE 20
+#define COFF_SECTION_HEADER_SIZE 40
+#define COFF_RELOCATION_SIZE 10
+#define COFF_SYMBOL_SIZE 18
+#define COFF_MACHINE_AMD64 0x8664
+#define COFF_CODE 0x00000020
+#define COFF_INITIALIZED_DATA 0x00000040
+#define COFF_UNINITIALIZED_DATA 0x00000080
+#define COFF_EXECUTE 0x20000000
+#define COFF_READ 0x40000000
+#define COFF_WRITE 0x80000000u
+#define COFF_REL32 0x0004
+#define COFF_EXTERNAL 2
+#define COFF_STATIC 3
+#define COFF_FUNCTION_TYPE 0x20
+
+static const char *sectionNames[OBJECT_SECTIONS] = { ".text", ".data", ".rodata", ".bss" };
+static const char *coffSectionNames[OBJECT_SECTIONS] = { ".text", ".data", ".rdata", ".bss" };
+
+void initSection(Section *section, size_t alignment) {
+    section->data = NULL;
+    section->length = 0;
+    section->capacity = 0;
+    section->alignment = alignment;
+}
+
+void freeSection(Section *section) {
+    free(section->data);
+    initSection(section, section->alignment);
+}
+
+void sectionBytes(Section *section, const void *bytes, size_t length) {
+    if (section->length + length > section->capacity) {
+        size_t capacity = section->capacity ? section->capacity : SECTION_INITIAL_CAPACITY;
+        while (capacity < section->length + length)
+            capacity *= 2;
+        uint8_t *data = realloc(section->data, capacity);
+        if (data == NULL) {
+            fprintf(stderr, "Fatal: Out of memory while generating code.\n");
+            exit(1);
+        }
+        section->data = data;
+        section->capacity = capacity;
+    }
+    if (bytes != NULL)
+        memcpy(section->data + section->length, bytes, length);
+    else
+        memset(section->data + section->length, 0, length);
+    section->length += length;
+}
+
+size_t alignSection(Section *section, size_t alignment) {
+    size_t padding = (alignment - section->length % alignment) % alignment;
+    if (padding > 0)
+        sectionBytes(section, NULL, padding);
+    if (alignment > section->alignment)
+        section->alignment = alignment;
+    return section->length;
+}
+
+void initObjectCode(ObjectCode *object) {
+    static const size_t alignments[OBJECT_SECTIONS] = { 16, 8, 8, 8 };
+    for (SectionId id = 0; id < OBJECT_SECTIONS; id++)
+        initSection(&object->sections[id], alignments[id]);
+    object->symbols = NULL;
+    object->nSymbols = 0;
+    object->symbolsCapacity = 0;
+    object->relocations = NULL;
+    object->nRelocations = 0;
+    object->relocationsCapacity = 0;
+    /* References to unnamed data are made against the section it is in */
+    for (SectionId id = 0; id < OBJECT_SECTIONS; id++)
+        addSymbol(object, (Symbol) { .name = sectionNames[id], .section = id, .offset = 0, .defined = true });
+}
+
+void freeObjectCode(ObjectCode *object) {
+    for (SectionId id = 0; id < OBJECT_SECTIONS; id++)
+        free(object->sections[id].data);
+    free(object->symbols);
+    free(object->relocations);
+}
+
+/* Grows an array of count items to hold one more */
+static void *reserve(void *items, size_t count, size_t *capacity, size_t size) {
+    if (count < *capacity)
+        return items;
+    size_t grown = *capacity ? *capacity * 2 : OBJECT_INITIAL_CAPACITY;
+    items = realloc(items, grown * size);
+    if (items == NULL) {
+        fprintf(stderr, "Fatal: Out of memory while generating code.\n");
+        exit(1);
+    }
+    *capacity = grown;
+    return items;
+}
+
+size_t addSymbol(ObjectCode *object, Symbol symbol) {
+    object->symbols = reserve(object->symbols, object->nSymbols, &object->symbolsCapacity, sizeof(Symbol));
+    object->symbols[object->nSymbols] = symbol;
+    return object->nSymbols++;
+}
+
+void addRelocation(ObjectCode *object, Relocation relocation) {
+    object->relocations = reserve(object->relocations, object->nRelocations, &object->relocationsCapacity, sizeof(Relocation));
+    object->relocations[object->nRelocations++] = relocation;
+}
+
+/* Object files are little-endian whatever the host is */
+static void put16(Section *out, uint64_t value) {
+    uint8_t bytes[2] = { (uint8_t)value, (uint8_t)(value >> 8) };
+    sectionBytes(out, bytes, sizeof(bytes));
+}
+
+static void put32(Section *out, uint64_t value) {
+    put16(out, value & 0xFFFF);
+    put16(out, value >> 16);
+}
+
+static void put64(Section *out, uint64_t value) {
+    put32(out, value & 0xFFFFFFFF);
+    put32(out, value >> 32);
+}
+
+static void patch32(uint8_t *at, uint64_t value) {
+    for (size_t i = 0; i < 4; i++)
+        at[i] = (uint8_t)(value >> (8 * i));
+}
+
+/* Appends a NUL-terminated string, returns where it starts */
+static size_t putString(Section *strings, const char *string) {
+    size_t offset = strings->length;
+    sectionBytes(strings, string, strlen(string) + 1);
+    return offset;
+}
+
+/* An undefined symbol nothing refers to, e.g. a prototype that was never called, is left out */
+static bool *referencedSymbols(const ObjectCode *object) {
+    bool *referenced = calloc(object->nSymbols ? object->nSymbols : 1, sizeof(bool));
+    if (referenced == NULL)
+        return NULL;
+    for (size_t i = 0; i < object->nSymbols; i++)
+        referenced[i] = object->symbols[i].defined;
+    for (size_t i = 0; i < object->nRelocations; i++)
+        referenced[object->relocations[i].symbol] = true;
+    return referenced;
+}
+
+static bool writeBuffer(const Section *buffer, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL)
+        return false;
+    bool written = fwrite(buffer->data, 1, buffer->length, f) == buffer->length;
+    return fclose(f) == 0 && written;
+}
+
+static void elfSectionHeader(Section *out, size_t name, uint32_t type, uint64_t flags, size_t offset, size_t size,
+                             uint32_t link, uint32_t info, size_t alignment, size_t entrySize) {
+    put32(out, name);
+    put32(out, type);
+    put64(out, flags);
+    put64(out, 0);
+    put64(out, offset);
+    put64(out, size);
+    put32(out, link);
+    put32(out, info);
+    put64(out, alignment);
+    put64(out, entrySize);
+}
+
+static bool writeElf(const ObjectCode *object, const char *path, const bool *referenced) {
+    /* Sections 1 to 4 are the object's, followed by a .rela section for each one with relocations */
+    size_t relocationCounts[OBJECT_SECTIONS] = { 0 };
+    for (size_t i = 0; i < object->nRelocations; i++)
+        relocationCounts[object->relocations[i].section] += 1;
+    size_t relaIndex[OBJECT_SECTIONS], nSections = 1 + OBJECT_SECTIONS;
+    for (SectionId id = 0; id < OBJECT_SECTIONS; id++)
+        relaIndex[id] = relocationCounts[id] ? nSections++ : 0;
+    /* .note.GNU-stack comes last */
+    size_t symtabIndex = nSections, strtabIndex = nSections + 1, shstrtabIndex = nSections + 2;
+    nSections += 4;
+
+    /* Locals have to come before globals, the section symbols first */
+    size_t *elfIndex = malloc((object->nSymbols ? object->nSymbols : 1) * sizeof(size_t));
+    if (elfIndex == NULL)
+        return false;
+    Section symtab, strtab, shstrtab;
+    initSection(&symtab, 8);
+    initSection(&strtab, 1);
+    initSection(&shstrtab, 1);
+    sectionBytes(&symtab, NULL, ELF_SYMBOL_SIZE);
+    putString(&strtab, "");
+    size_t nElfSymbols = 1, firstGlobal = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1)
+            firstGlobal = nElfSymbols;
+        for (size_t i = 0; i < object->nSymbols; i++) {
+            const Symbol *symbol = &object->symbols[i];
+            bool global = symbol->global || !symbol->defined;
+            if (global != (pass == 1) || !referenced[i])
+                continue;
+            elfIndex[i] = nElfSymbols++;
+            bool isSection = i < OBJECT_SECTIONS;
+            put32(&symtab, isSection ? 0 : putString(&strtab, symbol->name));
+            uint8_t type = isSection ? STT_SECTION : symbol->function ? STT_FUNC : symbol->defined ? STT_OBJECT : STT_NOTYPE;
+            sectionByte(&symtab, (uint8_t)(((global ? STB_GLOBAL : STB_LOCAL) << 4) | type));
+            sectionByte(&symtab, 0);
+            put16(&symtab, symbol->defined ? 1 + symbol->section : 0);
+            put64(&symtab, symbol->defined ? symbol->offset : 0);
+            put64(&symtab, 0);
+        }
+    }
+
+    Section out;
+    initSection(&out, 8);
+    sectionBytes(&out, NULL, ELF_HEADER_SIZE);
+    size_t offsets[OBJECT_SECTIONS], relaOffsets[OBJECT_SECTIONS];
+    for (SectionId id = 0; id < OBJECT_SECTIONS; id++) {
+        offsets[id] = alignSection(&out, 16);
+        if (id != OBJECT_BSS)
+            sectionBytes(&out, object->sections[id].data, object->sections[id].length);
+    }
+    for (SectionId id = 0; id < OBJECT_SECTIONS; id++) {
+        relaOffsets[id] = alignSection(&out, 8);
+        for (size_t i = 0; relocationCounts[id] && i < object->nRelocations; i++) {
+            const Relocation *relocation = &object->relocations[i];
+            if (relocation->section != id)
+                continue;
+            uint32_t type = relocation->kind == RELOCATION_CALL ? R_X86_64_PLT32 :
+                relocation->kind == RELOCATION_GOT ? R_X86_64_GOTPCREL : R_X86_64_PC32;
+            put64(&out, relocation->offset);
+            put64(&out, ((uint64_t)elfIndex[relocation->symbol] << 32) | type);
+            /* The field is relative to its own start for ELF, not to its end */
+            put64(&out, (uint64_t)(relocation->addend - 4));
+        }
+    }
+    size_t symtabOffset = alignSection(&out, 8);
+    sectionBytes(&out, symtab.data, symtab.length);
+    size_t strtabOffset = out.length;
+    sectionBytes(&out, strtab.data, strtab.length);
+
+    size_t names[OBJECT_SECTIONS], relaNames[OBJECT_SECTIONS];
+    putString(&shstrtab, "");
+    for (SectionId id = 0; id < OBJECT_SECTIONS; id++) {
+        char name[32];
+        snprintf(name, sizeof(name), ".rela%s", sectionNames[id]);
+        relaNames[id] = putString(&shstrtab, name);
+        /* ".rela.text" ends with ".text" */
+        names[id] = relaNames[id] + strlen(".rela");
+    }
+    size_t symtabName = putString(&shstrtab, ".symtab"), strtabName = putString(&shstrtab, ".strtab");
+    size_t shstrtabName = putString(&shstrtab, ".shstrtab"), noteName = putString(&shstrtab, ".note.GNU-stack");
+    size_t shstrtabOffset = out.length;
+    sectionBytes(&out, shstrtab.data, shstrtab.length);
+
+    size_t headersOffset = alignSection(&out, 8);
+    sectionBytes(&out, NULL, ELF_SECTION_HEADER_SIZE);
+    static const uint64_t flags[OBJECT_SECTIONS] = {
+        SHF_ALLOC | SHF_EXECINSTR, SHF_ALLOC | SHF_WRITE, SHF_ALLOC, SHF_ALLOC | SHF_WRITE
+    };
+    for (SectionId id = 0; id < OBJECT_SECTIONS; id++) {
+        elfSectionHeader(&out, names[id], id == OBJECT_BSS ? SHT_NOBITS : SHT_PROGBITS, flags[id], offsets[id],
+            object->sections[id].length, 0, 0, object->sections[id].alignment, 0);
+    }
+    for (SectionId id = 0; id < OBJECT_SECTIONS; id++) {
+        if (relaIndex[id] != 0) {
+            elfSectionHeader(&out, relaNames[id], SHT_RELA, SHF_INFO_LINK, relaOffsets[id], relocationCounts[id] * ELF_RELA_SIZE,
+                (uint32_t)symtabIndex, 1 + id, 8, ELF_RELA_SIZE);
+        }
+    }
+    elfSectionHeader(&out, symtabName, SHT_SYMTAB, 0, symtabOffset, symtab.length, (uint32_t)strtabIndex, (uint32_t)firstGlobal, 8, ELF_SYMBOL_SIZE);
+    elfSectionHeader(&out, strtabName, SHT_STRTAB, 0, strtabOffset, strtab.length, 0, 0, 1, 0);
+    elfSectionHeader(&out, shstrtabName, SHT_STRTAB, 0, shstrtabOffset, shstrtab.length, 0, 0, 1, 0);
+    /* Marks the stack as not executable */
+    elfSectionHeader(&out, noteName, SHT_PROGBITS, 0, shstrtabOffset, 0, 0, 0, 1, 0);
+
+    static const uint8_t ident[16] = { 0x7F, 'E', 'L', 'F', 2 /* 64-bit */, 1 /* Little-endian */, 1 /* Version */ };
+    Section header;
+    initSection(&header, 8);
+    sectionBytes(&header, ident, sizeof(ident));
+    put16(&header, 1); /* Relocatable */
+    put16(&header, ELF_MACHINE_X86_64);
+    put32(&header, 1);
+    put64(&header, 0);
+    put64(&header, 0);
+    put64(&header, headersOffset);
+    put32(&header, 0);
+    put16(&header, ELF_HEADER_SIZE);
+    put16(&header, 0);
+    put16(&header, 0);
+    put16(&header, ELF_SECTION_HEADER_SIZE);
+    put16(&header, nSections);
+    put16(&header, shstrtabIndex);
+    memcpy(out.data, header.data, ELF_HEADER_SIZE);
+
+    bool written = writeBuffer(&out, path);
+    freeSection(&header);
+    freeSection(&out);
+    freeSection(&symtab);
+    freeSection(&strtab);
+    freeSection(&shstrtab);
+    free(elfIndex);
+    return written;
+}
+
+/* Names of up to 8 bytes are stored in place, longer ones in the string table */
+static void coffName(Section *out, Section *strings, const char *name) {
+    size_t length = strlen(name);
+    if (length <= 8) {
+        char inPlace[8] = { 0 };
+        memcpy(inPlace, name, length);
+        sectionBytes(out, inPlace, sizeof(inPlace));
+        return;
+    }
+    put32(out, 0);
+    put32(out, 4 + putString(strings, name));
+}
+
+static uint32_t coffAlignment(size_t alignment) {
+    uint32_t log = 0;
+    while (((size_t)1 << log) < alignment && log < 13)
+        log++;
+    return (log + 1) << 20;
+}
+
+static bool writeCoff(const ObjectCode *object, const char *path, const bool *referenced) {
+    size_t relocationCounts[OBJECT_SECTIONS] = { 0 };
+    for (size_t i = 0; i < object->nRelocations; i++)
+        relocationCounts[object->relocations[i].section] += 1;
+    for (SectionId id = 0; id < OBJECT_SECTIONS; id++) {
+        /* The relocation count field is 16 bits, the overflow encoding isn't worth it here */
+        if (relocationCounts[id] > UINT16_MAX)
+            return false;
+    }
+
+    /* Section symbols take an auxiliary record each, which counts as a symbol */
+    size_t *coffIndex = malloc((object->nSymbols ? object->nSymbols : 1) * sizeof(size_t));
+    if (coffIndex == NULL)
+        return false;
+    Section symbols, strings;
+    initSection(&symbols, 1);
+    initSection(&strings, 1);
+    size_t nCoffSymbols = 0;
+    for (size_t i = 0; i < object->nSymbols; i++) {
+        const Symbol *symbol = &object->symbols[i];
+        if (!referenced[i])
+            continue;
+        coffIndex[i] = nCoffSymbols;
+        bool isSection = i < OBJECT_SECTIONS;
+        coffName(&symbols, &strings, isSection ? coffSectionNames[i] : symbol->name);
+        put32(&symbols, symbol->defined ? symbol->offset : 0);
+        put16(&symbols, symbol->defined ? 1 + symbol->section : 0);
+        put16(&symbols, symbol->function ? COFF_FUNCTION_TYPE : 0);
+        sectionByte(&symbols, symbol->global || !symbol->defined ? COFF_EXTERNAL : COFF_STATIC);
+        sectionByte(&symbols, isSection ? 1 : 0);
+        nCoffSymbols += 1;
+        if (isSection) {
+            put32(&symbols, object->sections[i].length);
+            put16(&symbols, relocationCounts[i]);
+            sectionBytes(&symbols, NULL, COFF_SYMBOL_SIZE - 6);
+            nCoffSymbols += 1;
+        }
+    }
+
+    Section out;
+    initSection(&out, 4);
+    size_t sectionsOffset = COFF_HEADER_SIZE + OBJECT_SECTIONS * COFF_SECTION_HEADER_SIZE;
+    sectionBytes(&out, NULL, sectionsOffset);
+    size_t offsets[OBJECT_SECTIONS], relocationOffsets[OBJECT_SECTIONS];
+    for (SectionId id = 0; id < OBJECT_SECTIONS; id++) {
+        offsets[id] = alignSection(&out, 4);
+        if (id == OBJECT_BSS)
+            continue;
+        sectionBytes(&out, object->sections[id].data, object->sections[id].length);
+        /* The addend is stored in the field itself */
+        for (size_t i = 0; i < object->nRelocations; i++) {
+            const Relocation *relocation = &object->relocations[i];
+            if (relocation->section == id)
+                patch32(out.data + offsets[id] + relocation->offset, (uint64_t)relocation->addend);
+        }
+    }
+    for (SectionId id = 0; id < OBJECT_SECTIONS; id++) {
+        relocationOffsets[id] = out.length;
+        for (size_t i = 0; relocationCounts[id] && i < object->nRelocations; i++) {
+            const Relocation *relocation = &object->relocations[i];
+            if (relocation->section != id)
+                continue;
+            put32(&out, relocation->offset);
+            put32(&out, coffIndex[relocation->symbol]);
+            put16(&out, COFF_REL32);
+        }
+    }
+    size_t symbolsOffset = out.length;
+    sectionBytes(&out, symbols.data, symbols.length);
+    put32(&out, 4 + strings.length);
+    sectionBytes(&out, strings.data, strings.length);
+
+    Section header;
+    initSection(&header, 4);
+    put16(&header, COFF_MACHINE_AMD64);
+    put16(&header, OBJECT_SECTIONS);
+    put32(&header, 0);
+    put32(&header, symbolsOffset);
+    put32(&header, nCoffSymbols);
+    put16(&header, 0);
+    put16(&header, 0);
+    static const uint32_t characteristics[OBJECT_SECTIONS] = {
+        COFF_CODE | COFF_EXECUTE | COFF_READ,
+        COFF_INITIALIZED_DATA | COFF_READ | COFF_WRITE,
+        COFF_INITIALIZED_DATA | COFF_READ,
+        COFF_UNINITIALIZED_DATA | COFF_READ | COFF_WRITE
+    };
+    for (SectionId id = 0; id < OBJECT_SECTIONS; id++) {
+        const Section *section = &object->sections[id];
+        char name[8] = { 0 };
+        memcpy(name, coffSectionNames[id], strlen(coffSectionNames[id]));
+        sectionBytes(&header, name, sizeof(name));
+        put32(&header, 0);
+        put32(&header, 0);
+        put32(&header, section->length);
+        put32(&header, id == OBJECT_BSS || section->length == 0 ? 0 : offsets[id]);
+        put32(&header, relocationCounts[id] ? relocationOffsets[id] : 0);
+        put32(&header, 0);
+        put16(&header, relocationCounts[id]);
+        put16(&header, 0);
+        put32(&header, characteristics[id] | coffAlignment(section->alignment));
+    }
+    memcpy(out.data, header.data, header.length);
+
+    bool written = writeBuffer(&out, path);
+    freeSection(&header);
+    freeSection(&out);
+    freeSection(&symbols);
+    freeSection(&strings);
+    free(coffIndex);
+    return written;
+}
+
+bool writeObjectFile(const ObjectCode *object, ObjectFormat format, const char *path) {
+    bool *referenced = referencedSymbols(object);
+    if (referenced == NULL)
+        return false;
+    bool written = format == OBJECT_ELF ? writeElf(object, path, referenced) : writeCoff(object, path, referenced);
+    free(referenced);
+    return written;
+}
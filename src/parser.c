@@ -4,6 +4,8 @@
  * See LICENSE for license.
  */
 
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,62 +13,261 @@
 
 #include "lexer.h"
 #include "parser.h"
+#include "visitor.h"
+#include "fold.h"
 
 #define ISTOKENTYPE(TOKEN, TYPE) ((TOKEN).type == (TYPE))
-#define ISTOKENVALUE(TOKEN, VALUE) (!strcmp((TOKEN).value, (VALUE)))
+/* Identifiers are interned, so their values can be compared by pointer */
+#define ISTOKENVALUE(TOKEN, VALUE) ((TOKEN).value == (VALUE))
 #define ISTOKEN(TOKEN, TYPE, VALUE) (ISTOKENTYPE((TOKEN), (TYPE)) && ISTOKENVALUE((TOKEN), (VALUE)))
-#define CURRENTTOKEN(CTX) ((CTX)->current)
+#define CURRENTTOKEN(CTX) (*peekToken((CTX), 0))
 #define ISCURRENTTOKENTYPE(CTX, TYPE) ISTOKENTYPE(CURRENTTOKEN(CTX), (TYPE))
 #define ISCURRENTTOKENVALUE(CTX, VALUE) ISTOKENVALUE(CURRENTTOKEN(CTX), (VALUE))
 #define ISCURRENTTOKEN(CTX, TYPE, VALUE) ISTOKEN(CURRENTTOKEN(CTX), (TYPE), (VALUE))
-#define NEXTTOKEN(CTX) ((CTX)->tokens[(CTX)->index + 1])
+#define NEXTTOKEN(CTX) (*peekToken((CTX), 1))
 #define ISNEXTTOKENTYPE(CTX, TYPE) ISTOKENTYPE(NEXTTOKEN(CTX), (TYPE))
 #define ISNEXTTOKENVALUE(CTX, VALUE) ISTOKENVALUE(NEXTTOKEN(CTX), (VALUE))
 #define ISNEXTTOKEN(CTX, TYPE, VALUE) ISTOKEN(NEXTTOKEN(CTX), (TYPE), (VALUE))
 
+#define NEW(CTX, TYPE) ((TYPE*)parserAlloc((CTX), sizeof(TYPE)))
+
 #define ISCURRENTTOKENATYPE(CTX) isType(CTX, CURRENTTOKEN(CTX))
 #define ISNEXTTOKENATYPE(CTX) isType(CTX, NEXTTOKEN(CTX))
 
+/*
+ * Reports an error spanning TOKEN, printf-style. Nothing is reported while panicking, or at
+ * the TT_EOF a lexer error cuts the tokens off with, that error has been reported already
+ */
+#define PARSER_ERROR(CTX, TOKEN, ...) do { \
+    if (!(CTX)->panicking && !((CTX)->lexer->failed && (TOKEN).type == TT_EOF)) { \
+        reportSpan((CTX)->diagnostics, (CTX)->map, (CTX)->file, (TOKEN).index, (TOKEN).len, __VA_ARGS__); \
+        (CTX)->errors++; \
+    } \
+    (CTX)->panicking = true; \
+} while (0)
+
 
 Node *parseExpression(ParserContext *ctx);
+Node *parseStatement(ParserContext *ctx);
+
+/* Has to be followed by leaveNesting whether what is nested parsed or not, unless it returns false */
+static bool enterNesting(ParserContext *ctx) {
+    if (ctx->depth == PARSER_MAX_DEPTH) {
+        PARSER_ERROR(ctx, CURRENTTOKEN(ctx), "Nested too deeply, at most %d levels are allowed.", PARSER_MAX_DEPTH);
+        return false;
+    }
+    ctx->depth++;
+    return true;
+}
+
+static void leaveNesting(ParserContext *ctx) {
+    ctx->depth--;
+}
+
+char *regAsString(Register reg) {
+    switch (reg) {
+        case NONE:
+        case AUTO:
+        case NOREG:
+            return NULL;
+        case REG_RAX: return "RAX";
+        case REG_RBX: return "RBX";
+        case REG_RCX: return "RCX";
+        case REG_RDX: return "RDX";
+        case REG_RSI: return "RSI";
+        case REG_RDI: return "RDI";
+        case REG_RBP: return "RBP";
+        case REG_RSP: return "RSP";
+        case REG_R8: return "R8";
+        case REG_R9: return "R9";
+        case REG_R10: return "R10";
+        case REG_R11: return "R11";
+        case REG_R12: return "R12";
+        case REG_R13: return "R13";
+        case REG_R14: return "R14";
+        case REG_R15: return "R15";
+        case REG_EAX: return "EAX";
+        case REG_EBX: return "EBX";
+        case REG_ECX: return "ECX";
+        case REG_ESP: return "ESP";
+        case REG_EBP: return "EBP";
+        case REG_EDI: return "EDI";
+        case REG_ESI: return "ESI";
+        case REG_EDX: return "EDX";
+        case REG_AX: return "AX";
+        case REG_BX: return "BX";
+        case REG_CX: return "CX";
+        case REG_SP: return "SP";
+        case REG_BP: return "BP";
+        case REG_DI: return "DI";
+        case REG_SI: return "SI";
+        case REG_DX: return "DX";
+        case REG_AH: return "AH";
+        case REG_AL: return "AL";
+        case REG_BH: return "BH";
+        case REG_BL: return "BL";
+        case REG_CH: return "CH";
+        case REG_CL: return "CL";
+        case REG_SPL: return "SPL";
+        case REG_BPL: return "BPL";
+        case REG_DIL: return "DIL";
+        case REG_SIL: return "SIL";
+        case REG_DH: return "DH";
+        case REG_DL: return "DL";
+        case REG_XMM0: return "XMM0";
+        case REG_XMM1: return "XMM1";
+        case REG_XMM2: return "XMM2";
+        case REG_XMM3: return "XMM3";
+        case REG_XMM4: return "XMM4";
+        case REG_XMM5: return "XMM5";
+        case REG_XMM6: return "XMM6";
+        case REG_XMM7: return "XMM7";
+    }
+    return NULL;
+}
+
+/* NONE if name isn't one of the registers variables can be put in */
+static Register registerFromName(const char *name) {
+    for (Register reg = REG_RAX; reg <= REG_XMM7; reg++) {
+        if (!strcmp(regAsString(reg), name))
+            return reg;
+    }
+    return NONE;
+}
+
+/* Copies the list started at mark out of the scratch vector, NULL if it is empty */
+static Node **freezeNodes(ParserContext *ctx, size_t mark, size_t *count) {
+    *count = ctx->scratch.count - mark;
+    Node **nodes = NULL;
+    if (*count) {
+        nodes = parserAlloc(ctx, *count * sizeof(Node*));
+        for (size_t i = 0; i < *count; i++)
+            nodes[i] = ctx->scratch.items[mark + i];
+    }
+    dropList(ctx, mark);
+    return nodes;
+}
+
+/* If cases are pushed as condition, body pairs */
+static void freezeIfCases(ParserContext *ctx, size_t mark, IfNode *statement) {
+    statement->nCases = (ctx->scratch.count - mark) / 2;
+    statement->conditions = parserAlloc(ctx, statement->nCases * sizeof(Node*));
+    statement->bodies = parserAlloc(ctx, statement->nCases * sizeof(Node*));
+    for (size_t i = 0; i < statement->nCases; i++) {
+        statement->conditions[i] = ctx->scratch.items[mark + i * 2];
+        statement->bodies[i] = ctx->scratch.items[mark + i * 2 + 1];
+    }
+    dropList(ctx, mark);
+}
+
+static void freezeParameters(ParserContext *ctx, size_t mark, Type *function) {
+    function->nParameters = ctx->scratch.count - mark;
+    function->parameters = NULL;
+    if (function->nParameters) {
+        function->parameters = parserAlloc(ctx, function->nParameters * sizeof(VariableDeclerationNode*));
+        for (size_t i = 0; i < function->nParameters; i++)
+            function->parameters[i] = ctx->scratch.items[mark + i];
+    }
+    dropList(ctx, mark);
+}
+
+/* Reports that what was expected instead of the current token. Returns NULL, for ending a parse function with */
+static void *expected(ParserContext *ctx, const char *what) {
+    Token token = CURRENTTOKEN(ctx);
+    if (token.type == TT_EOF)
+        PARSER_ERROR(ctx, token, "Expected %s before the end of the file.", what);
+    else
+        PARSER_ERROR(ctx, token, "Expected %s, found '%.*s'.", what, (int)token.len, ctx->source + token.index);
+    return NULL;
+}
+
+/*
+ * Panic mode. Skips the rest of a statement that failed to parse: up to and including
+ * its ';', or the '}' closing a block that was opened after the error. A '}' without
+ * an open block belongs to the enclosing one and is left for it. An else following
+ * either is still part of the failed if statement and skipped along with its body.
+ */
+static void synchronize(ParserContext *ctx) {
+    size_t depth = 0;
+    while (!ISCURRENTTOKENTYPE(ctx, TT_EOF)) {
+        bool end = false;
+        if (ISCURRENTTOKENTYPE(ctx, TT_SEMICOLON)) {
+            end = depth == 0;
+        } else if (ISCURRENTTOKENTYPE(ctx, TT_LBRACE)) {
+            depth++;
+        } else if (ISCURRENTTOKENTYPE(ctx, TT_RBRACE)) {
+            if (depth == 0)
+                break;
+            end = --depth == 0;
+        }
+        advance(ctx);
+        if (end && !ISCURRENTTOKENTYPE(ctx, TT_KW_ELSE))
+            break;
+    }
+    ctx->panicking = false;
+}
+
+/* Reports the block opened at open as never closed, the current token shouldn't be inside it */
+static void unclosed(ParserContext *ctx, Token open) {
+    /* A lexer error cut the file short, the block may well have been closed */
+    if (!ISCURRENTTOKENTYPE(ctx, TT_EOF) || !ctx->lexer->failed)
+        PARSER_ERROR(ctx, open, "Unclosed '{'.");
+}
+
+/*
+ * Recovery point, called after a statement or field came back NULL. Anything left on the
+ * scratch vector above mark belonged to the failed statement. Failing without saying why
+ * is reported here, so no error goes unreported.
+ */
+static void recover(ParserContext *ctx, size_t mark) {
+    if (!ctx->panicking) {
+        Token token = CURRENTTOKEN(ctx);
+        if (token.type == TT_EOF)
+            PARSER_ERROR(ctx, token, "Unexpected end of file.");
+        else
+            PARSER_ERROR(ctx, token, "Unexpected '%.*s'.", (int)token.len, ctx->source + token.index);
+    }
+    dropList(ctx, mark);
+    synchronize(ctx);
+}
 
 Node *parseLiteralExpression(ParserContext *ctx) {
     if (ISCURRENTTOKENTYPE(ctx, TT_INT)) {
-        ValueNode *value = malloc(sizeof(ValueNode));
+        ValueNode *value = NEW(ctx, ValueNode);
         value->value = CURRENTTOKEN(ctx);
-        Node *intNode = malloc(sizeof(Node));
+        Node *intNode = NEW(ctx, Node);
         intNode->type = NT_INT;
         intNode->node = value;
         advance(ctx);
         return intNode;
     } else if (ISCURRENTTOKENTYPE(ctx, TT_FLOAT)) {
-        ValueNode *value = malloc(sizeof(ValueNode));
+        ValueNode *value = NEW(ctx, ValueNode);
         value->value = CURRENTTOKEN(ctx);
-        Node *fltNode = malloc(sizeof(Node));
+        Node *fltNode = NEW(ctx, Node);
         fltNode->type = NT_FLOAT;
         fltNode->node = value;
         advance(ctx);
         return fltNode;
     } else if (ISCURRENTTOKENTYPE(ctx, TT_STRING)) {
-        ValueNode *value = malloc(sizeof(ValueNode));
+        ValueNode *value = NEW(ctx, ValueNode);
         value->value = CURRENTTOKEN(ctx);
-        Node *strNode = malloc(sizeof(Node));
+        Node *strNode = NEW(ctx, Node);
         strNode->type = NT_STRING;
         strNode->node = value;
         advance(ctx);
         return strNode;
     } else if (ISCURRENTTOKENTYPE(ctx, TT_CHAR)) {
-        ValueNode *value = malloc(sizeof(ValueNode));
+        ValueNode *value = NEW(ctx, ValueNode);
         value->value = CURRENTTOKEN(ctx);
-        Node *chrNode = malloc(sizeof(Node));
+        Node *chrNode = NEW(ctx, Node);
         chrNode->type = NT_CHAR;
         chrNode->node = value;
         advance(ctx);
         return chrNode;
     } else if (ISCURRENTTOKENTYPE(ctx, TT_IDENTIFIER)) {
-        VariableAccessNode *access = malloc(sizeof(VariableAccessNode));
+        VariableAccessNode *access = NEW(ctx, VariableAccessNode);
         access->name = CURRENTTOKEN(ctx);
-        Node *accessNode = malloc(sizeof(Node));
+        Node *accessNode = NEW(ctx, Node);
         accessNode->type = NT_VARACCESS;
         accessNode->node = access;
         advance(ctx);
@@ -74,20 +275,15 @@ Node *parseLiteralExpression(ParserContext *ctx) {
     } else if (ISCURRENTTOKENTYPE(ctx, TT_LPAREN)) {
         advance(ctx);
         Node *expression = parseExpression(ctx);
-        if (expression == NULL) {
-            /* TODO: Error message here */
-            return NULL;
-        }
-        if (!ISCURRENTTOKENTYPE(ctx, TT_RPAREN)) {
-            /* TODO: Error message here */
+        if (expression == NULL)
             return NULL;
-        }
+        if (!ISCURRENTTOKENTYPE(ctx, TT_RPAREN))
+            return expected(ctx, "')'");
         advance(ctx);
         return expression;
     }
 
-    /* TODO: Error message here */
-    return NULL;
+    return expected(ctx, "an expression");
 }
 
 Node *parseTypeCastExpression(ParserContext *ctx) {
@@ -95,8 +291,10 @@ Node *parseTypeCastExpression(ParserContext *ctx) {
     while (ISCURRENTTOKENTYPE(ctx, TT_LPAREN) && ISNEXTTOKENATYPE(ctx)) {
         advance(ctx);
         /* TODO: Parse type here */
-        while (!ISCURRENTTOKENTYPE(ctx, TT_RPAREN))
+        while (!ISCURRENTTOKENTYPE(ctx, TT_RPAREN) && !ISCURRENTTOKENTYPE(ctx, TT_EOF))
             advance(ctx);
+        if (!ISCURRENTTOKENTYPE(ctx, TT_RPAREN))
+            return expected(ctx, "')'");
         advance(ctx);
     }
     return literal;
@@ -104,87 +302,78 @@ Node *parseTypeCastExpression(ParserContext *ctx) {
 
 Node *parseAccessExpression(ParserContext *ctx) {
     Node *access = parseTypeCastExpression(ctx);
+    if (access == NULL)
+        return NULL;
     while (
         ISCURRENTTOKENTYPE(ctx, TT_LPAREN) || ISCURRENTTOKENTYPE(ctx, TT_LBRACKET) ||
         ISCURRENTTOKENTYPE(ctx, TT_DOT)    || ISCURRENTTOKENTYPE(ctx, TT_ARROW)
     ) {
         if (ISCURRENTTOKENTYPE(ctx, TT_LPAREN) && !ISNEXTTOKENATYPE(ctx)) {
             advance(ctx);
-            Node **arguments = NULL;
-            size_t nArguments = 0;
+            /* Skipped arguments are NULL */
+            size_t arguments = beginList(ctx);
             if (!ISCURRENTTOKENTYPE(ctx, TT_RPAREN)) {
                 if (ISCURRENTTOKENTYPE(ctx, TT_COMMA)) {
-                    arguments = realloc(arguments, (nArguments + 1) * sizeof(Node*));
-                    arguments[nArguments++] = NULL;
+                    pushList(ctx, NULL);
                 } else {
                     Node *expression = parseExpression(ctx);
                     if (expression == NULL) {
-                        /* TODO: Error message here */
+                        dropList(ctx, arguments);
                         return NULL;
                     }
-                    arguments = realloc(arguments, (nArguments + 1) * sizeof(Node*));
-                    arguments[nArguments++] = expression;
+                    pushList(ctx, expression);
                 }
                 while (ISCURRENTTOKENTYPE(ctx, TT_COMMA)) {
                     advance(ctx);
                     if (ISCURRENTTOKENTYPE(ctx, TT_COMMA) || ISCURRENTTOKENTYPE(ctx, TT_RPAREN)) {
-                        arguments = realloc(arguments, (nArguments + 1) * sizeof(Node*));
-                        arguments[nArguments++] = NULL;
+                        pushList(ctx, NULL);
                     } else {
                         Node *expression = parseExpression(ctx);
                         if (expression == NULL) {
-                            /* TODO: Error message here */
+                            dropList(ctx, arguments);
                             return NULL;
                         }
-                        arguments = realloc(arguments, (nArguments + 1) * sizeof(Node*));
-                        arguments[nArguments++] = expression;
+                        pushList(ctx, expression);
                     }
                 }
             }
             if (!ISCURRENTTOKENTYPE(ctx, TT_RPAREN)) {
-                /* TODO: Error message here */
-                return NULL;
+                dropList(ctx, arguments);
+                return expected(ctx, "',' or ')'");
             }
             advance(ctx);
-            FunctionCallNode *funcCall = malloc(sizeof(FunctionCallNode));
+            FunctionCallNode *funcCall = NEW(ctx, FunctionCallNode);
             funcCall->function = access;
-            funcCall->arguments = arguments;
-            funcCall->nArguments = nArguments;
-            access = malloc(sizeof(Node));
+            funcCall->arguments = freezeNodes(ctx, arguments, &funcCall->nArguments);
+            access = NEW(ctx, Node);
             access->type = NT_FUNCCALL;
             access->node = funcCall;
         } else if (ISCURRENTTOKENTYPE(ctx, TT_LBRACKET)) {
             advance(ctx);
             Node *index = parseExpression(ctx);
-            if (index == NULL) {
-                /* TODO: Error message here */
-                return NULL;
-            }
-            if (!ISCURRENTTOKENTYPE(ctx, TT_RBRACKET)) {
-                /* TODO: Error message here */
+            if (index == NULL)
                 return NULL;
-            }
+            if (!ISCURRENTTOKENTYPE(ctx, TT_RBRACKET))
+                return expected(ctx, "']'");
             advance(ctx);
-            ArrayAccessNode *arrayAccess = malloc(sizeof(ArrayAccessNode));
+            ArrayAccessNode *arrayAccess = NEW(ctx, ArrayAccessNode);
             arrayAccess->array = access;
             arrayAccess->index = index;
-            access = malloc(sizeof(Node));
+            access = NEW(ctx, Node);
             access->type = NT_ARRAYACCESS;
             access->node = arrayAccess;
         } else {
             Token op = CURRENTTOKEN(ctx);
             advance(ctx);
-            if (!ISCURRENTTOKENTYPE(ctx, TT_IDENTIFIER)) {
-                /* TODO: Error message here */
-                return NULL;
-            }
+            if (!ISCURRENTTOKENTYPE(ctx, TT_IDENTIFIER))
+                return expected(ctx, "a member name");
             Token member = CURRENTTOKEN(ctx);
             advance(ctx);
-            AccessNode *acc = malloc(sizeof(AccessNode));
+            AccessNode *acc = NEW(ctx, AccessNode);
             acc->object = access;
             acc->op = op;
             acc->member = member;
-            access = malloc(sizeof(Node));
+            access = NEW(ctx, Node);
             access->type = NT_ACCESS;
             access->node = acc;
         }
@@ -196,557 +385,717 @@ Node *parseUnaryExpression(ParserContext *ctx) {
     if (ISCURRENTTOKENTYPE(ctx, TT_SUB) || ISCURRENTTOKENTYPE(ctx, TT_MUL)) {
         Token op = CURRENTTOKEN(ctx);
         advance(ctx);
+        if (!enterNesting(ctx))
+            return NULL;
         Node *expression = parseUnaryExpression(ctx);
-        if (expression == NULL) {
-            /* TODO: Error message here */
+        leaveNesting(ctx);
+        if (expression == NULL)
             return NULL;
-        }
-        UnaryOperationNode *unOp = malloc(sizeof(UnaryOperationNode));
+        if (foldUnary(ctx->interner, ctx->source, op, expression))
+            return expression;
+        UnaryOperationNode *unOp = NEW(ctx, UnaryOperationNode);
         unOp->op = op;
         unOp->value = expression;
-        Node *res = malloc(sizeof(Node));
+        Node *res = NEW(ctx, Node);
         res->type = NT_UNARYOP;
         res->node = unOp;
+        return res;
     }
     return parseAccessExpression(ctx);
 }
 
-Node *parseFactorExpression(ParserContext *ctx) {
+/*
+ * Binding power of the binary operators, higher binds tighter. 0 means the
+ * token doesn't continue an expression. Every level is left associative.
+ */
+static const unsigned char binaryPrecedence[TT_ELLIPSIS + 1] = {
+    [TT_ASSIGN] = 1, [TT_ADDEQ] = 1, [TT_SUBEQ] = 1, [TT_MULEQ] = 1, [TT_DIVEQ] = 1,
+    [TT_MODEQ]  = 1, [TT_LSHEQ] = 1, [TT_RSHEQ] = 1, [TT_ANDEQ] = 1, [TT_OREQ]  = 1,
+    [TT_XOREQ]  = 1,
+    [TT_OR]     = 2,
+    [TT_XOR]    = 3,
+    [TT_AND]    = 4,
+    [TT_EQ]     = 5, [TT_NEQ] = 5,
+    [TT_LT]     = 6, [TT_GT]  = 6, [TT_LTE] = 6, [TT_GTE] = 6,
+    [TT_ADD]    = 7, [TT_SUB] = 7,
+    [TT_BOR]    = 8,
+    [TT_BXOR]   = 9,
+    [TT_BAND]   = 10,
+    [TT_MUL]    = 11, [TT_DIV] = 11, [TT_MOD] = 11,
+    [TT_POW]    = 12, [TT_LSH] = 12, [TT_RSH] = 12
+};
+
+#define PRECEDENCE(TOKEN) ((TOKEN).type <= TT_ELLIPSIS ? binaryPrecedence[(TOKEN).type] : 0)
+#define RELATIONAL_PRECEDENCE (binaryPrecedence[TT_LT])
+
+/* Parses operators binding at least as tight as minPrecedence */
+static Node *parseBinaryExpression(ParserContext *ctx, unsigned minPrecedence) {
     Node *lhs = parseUnaryExpression(ctx);
-    while (ISCURRENTTOKENTYPE(ctx, TT_POW) || ISCURRENTTOKENTYPE(ctx, TT_LSH) || ISCURRENTTOKENTYPE(ctx, TT_RSH)) {
+    if (lhs == NULL)
+        return NULL;
+    unsigned precedence;
+    while ((precedence = PRECEDENCE(CURRENTTOKEN(ctx))) >= minPrecedence) {
         Token op = CURRENTTOKEN(ctx);
         advance(ctx);
-        Node *rhs = parseUnaryExpression(ctx);
-        BinaryOperationNode *binop = malloc(sizeof(BinaryOperationNode));
+        Node *rhs = parseBinaryExpression(ctx, precedence + 1);
+        if (rhs == NULL)
+            return NULL;
+        /* a < b < c is a range check in HolyC and not (a < b) < c, a chain is never folded */
+        bool chained = precedence == RELATIONAL_PRECEDENCE && PRECEDENCE(CURRENTTOKEN(ctx)) == RELATIONAL_PRECEDENCE;
+        if (!chained && foldBinary(ctx->interner, ctx->source, lhs, op, rhs)) {
+            if (ctx->arena == NULL)
+                freeNode(rhs);
+            continue;
+        }
+        BinaryOperationNode *binop = NEW(ctx, BinaryOperationNode);
         binop->lhs = lhs;
         binop->rhs = rhs;
         binop->op = op;
-        lhs = malloc(sizeof(Node));
+        lhs = NEW(ctx, Node);
         lhs->type = NT_BINOP;
         lhs->node = binop;
     }
     return lhs;
 }
 
-Node *parseTermExpression(ParserContext *ctx) {
-    Node *lhs = parseFactorExpression(ctx);
-    while (ISCURRENTTOKENTYPE(ctx, TT_MUL) || ISCURRENTTOKENTYPE(ctx, TT_DIV) || ISCURRENTTOKENTYPE(ctx, TT_MOD)) {
-        Token op = CURRENTTOKEN(ctx);
-        advance(ctx);
-        Node *rhs = parseFactorExpression(ctx);
-        BinaryOperationNode *binop = malloc(sizeof(BinaryOperationNode));
-        binop->lhs = lhs;
-        binop->rhs = rhs;
-        binop->op = op;
-        lhs = malloc(sizeof(Node));
-        lhs->type = NT_BINOP;
-        lhs->node = binop;
-    }
-    return lhs;
+Node *parseExpression(ParserContext *ctx) {
+    if (!enterNesting(ctx))
+        return NULL;
+    Node *expression = parseBinaryExpression(ctx, 1);
+    leaveNesting(ctx);
+    return expression;
 }
 
-Node *parseBinaryAndExpression(ParserContext *ctx) {
-    Node *lhs = parseTermExpression(ctx);
-    while (ISCURRENTTOKENTYPE(ctx, TT_BAND)) {
-        Token op = CURRENTTOKEN(ctx);
-        advance(ctx);
-        Node *rhs = parseTermExpression(ctx);
-        BinaryOperationNode *binop = malloc(sizeof(BinaryOperationNode));
-        binop->lhs = lhs;
-        binop->rhs = rhs;
-        binop->op = op;
-        lhs = malloc(sizeof(Node));
-        lhs->type = NT_BINOP;
-        lhs->node = binop;
+static bool isDeclerationStart(ParserContext *ctx) {
+    switch (CURRENTTOKEN(ctx).type) {
+        case TT_KW_STATIC:
+        case TT_KW_EXTERN:
+        case TT_KW_REG:
+        case TT_KW_NOREG:
+            return true;
+        default:
+            return ISCURRENTTOKENATYPE(ctx);
     }
-    return lhs;
 }
 
-Node *parseBinaryXorExpression(ParserContext *ctx) {
-    Node *lhs = parseBinaryAndExpression(ctx);
-    while (ISCURRENTTOKENTYPE(ctx, TT_BXOR)) {
-        Token op = CURRENTTOKEN(ctx);
+/* Qualifiers, register, base type and pointer depth, everything before the name */
+static bool parseDeclerationType(ParserContext *ctx, Type *type, Register *reg) {
+    type->qualifiers = 0;
+    type->ptrDepth = 0;
+    type->parameters = NULL;
+    type->nParameters = 0;
+    *reg = NONE;
+    for (;;) {
+        if (ISCURRENTTOKENTYPE(ctx, TT_KW_STATIC)) {
+            type->qualifiers |= STATIC;
+        } else if (ISCURRENTTOKENTYPE(ctx, TT_KW_EXTERN)) {
+            type->qualifiers |= EXTERN;
+        } else if (ISCURRENTTOKENTYPE(ctx, TT_KW_NOREG)) {
+            *reg = NOREG;
+        } else if (ISCURRENTTOKENTYPE(ctx, TT_KW_REG)) {
+            /* The register is optional, reg on its own lets the compiler pick one */
+            advance(ctx);
+            *reg = AUTO;
+            if (ISCURRENTTOKENTYPE(ctx, TT_IDENTIFIER) && registerFromName(CURRENTTOKEN(ctx).value) != NONE) {
+                *reg = registerFromName(CURRENTTOKEN(ctx).value);
+                advance(ctx);
+            }
+            continue;
+        } else {
+            break;
+        }
         advance(ctx);
-        Node *rhs = parseBinaryAndExpression(ctx);
-        BinaryOperationNode *binop = malloc(sizeof(BinaryOperationNode));
-        binop->lhs = lhs;
-        binop->rhs = rhs;
-        binop->op = op;
-        lhs = malloc(sizeof(Node));
-        lhs->type = NT_BINOP;
-        lhs->node = binop;
     }
-    return lhs;
-}
-
-Node *parseBinaryOrExpression(ParserContext *ctx) {
-    Node *lhs = parseBinaryXorExpression(ctx);
-    while (ISCURRENTTOKENTYPE(ctx, TT_BOR)) {
-        Token op = CURRENTTOKEN(ctx);
-        advance(ctx);
-        Node *rhs = parseBinaryXorExpression(ctx);
-        BinaryOperationNode *binop = malloc(sizeof(BinaryOperationNode));
-        binop->lhs = lhs;
-        binop->rhs = rhs;
-        binop->op = op;
-        lhs = malloc(sizeof(Node));
-        lhs->type = NT_BINOP;
-        lhs->node = binop;
+    if (!ISCURRENTTOKENATYPE(ctx)) {
+        expected(ctx, "a type");
+        return false;
     }
-    return lhs;
-}
-
-Node *parseArithmeticExpression(ParserContext *ctx) {
-    Node *lhs = parseBinaryOrExpression(ctx);
-    while (ISCURRENTTOKENTYPE(ctx, TT_ADD)  || ISCURRENTTOKENTYPE(ctx, TT_SUB)) {
-        Token op = CURRENTTOKEN(ctx);
+    type->type.base = CURRENTTOKEN(ctx).value;
+    advance(ctx);
+    while (ISCURRENTTOKENTYPE(ctx, TT_MUL)) {
+        type->ptrDepth += 1;
         advance(ctx);
-        Node *rhs = parseBinaryOrExpression(ctx);
-        BinaryOperationNode *binop = malloc(sizeof(BinaryOperationNode));
-        binop->lhs = lhs;
-        binop->rhs = rhs;
-        binop->op = op;
-        lhs = malloc(sizeof(Node));
-        lhs->type = NT_BINOP;
-        lhs->node = binop;
     }
-    return lhs;
+    return true;
 }
 
-Node *parseComparisonExpression(ParserContext *ctx) {
-    Node *lhs = parseArithmeticExpression(ctx);
-    while (
-        ISCURRENTTOKENTYPE(ctx, TT_LT)  || ISCURRENTTOKENTYPE(ctx, TT_GT) ||
-        ISCURRENTTOKENTYPE(ctx, TT_LTE) || ISCURRENTTOKENTYPE(ctx, TT_GTE)
-    ) {
-        Token op = CURRENTTOKEN(ctx);
+/* Array sizes and initializer of a variable, the name has been parsed already */
+static bool parseVariableRest(ParserContext *ctx, VariableDeclerationNode *decl) {
+    decl->arraySizes = NULL;
+    decl->arrayDepth = 0;
+    decl->initializer = NULL;
+    while (ISCURRENTTOKENTYPE(ctx, TT_LBRACKET)) {
+        advance(ctx);
+        if (!ISCURRENTTOKENTYPE(ctx, TT_INT)) {
+            expected(ctx, "an array size");
+            return false;
+        }
+        size_t len;
+        const char *text = tokenText(CURRENTTOKEN(ctx), ctx->source, &len);
+        char digits[32];
+        if (len >= sizeof(digits)) {
+            PARSER_ERROR(ctx, CURRENTTOKEN(ctx), "Array size is too large.");
+            return false;
+        }
+        memcpy(digits, text, len);
+        digits[len] = '\0';
+        /* Arrays are hardly ever more than a few dimensions deep */
+        decl->arraySizes = parserRealloc(ctx, decl->arraySizes, decl->arrayDepth * sizeof(size_t), (decl->arrayDepth + 1) * sizeof(size_t));
+        if (decl->arraySizes == NULL) {
+            fprintf(stderr, "Fatal: Out of memory while parsing an array decleration.\n");
+            exit(1);
+        }
+        /* Integer tokens are decimal, a leading 0 doesn't make them octal */
+        errno = 0;
+        unsigned long long size = strtoull(digits, NULL, 10);
+        if (errno == ERANGE || size > SIZE_MAX) {
+            PARSER_ERROR(ctx, CURRENTTOKEN(ctx), "Array size is too large.");
+            return false;
+        }
+        decl->arraySizes[decl->arrayDepth++] = (size_t)size;
+        advance(ctx);
+        if (!ISCURRENTTOKENTYPE(ctx, TT_RBRACKET)) {
+            expected(ctx, "']'");
+            return false;
+        }
         advance(ctx);
-        Node *rhs = parseArithmeticExpression(ctx);
-        BinaryOperationNode *binop = malloc(sizeof(BinaryOperationNode));
-        binop->lhs = lhs;
-        binop->rhs = rhs;
-        binop->op = op;
-        lhs = malloc(sizeof(Node));
-        lhs->type = NT_BINOP;
-        lhs->node = binop;
     }
-    return lhs;
-}
-
-Node *parseEqualityExpression(ParserContext *ctx) {
-    Node *lhs = parseComparisonExpression(ctx);
-    while (ISCURRENTTOKENTYPE(ctx, TT_EQ) || ISCURRENTTOKENTYPE(ctx, TT_NEQ)) {
-        Token op = CURRENTTOKEN(ctx);
+    if (ISCURRENTTOKENTYPE(ctx, TT_ASSIGN)) {
         advance(ctx);
-        Node *rhs = parseComparisonExpression(ctx);
-        BinaryOperationNode *binop = malloc(sizeof(BinaryOperationNode));
-        binop->lhs = lhs;
-        binop->rhs = rhs;
-        binop->op = op;
-        lhs = malloc(sizeof(Node));
-        lhs->type = NT_BINOP;
-        lhs->node = binop;
+        decl->initializer = parseExpression(ctx);
+        if (decl->initializer == NULL)
+            return false;
     }
-    return lhs;
+    return true;
 }
 
-Node *parseAndExpression(ParserContext *ctx) {
-    Node *lhs = parseEqualityExpression(ctx);
-    while (ISCURRENTTOKENTYPE(ctx, TT_AND)) {
-        Token op = CURRENTTOKEN(ctx);
-        advance(ctx);
-        Node *rhs = parseEqualityExpression(ctx);
-        BinaryOperationNode *binop = malloc(sizeof(BinaryOperationNode));
-        binop->lhs = lhs;
-        binop->rhs = rhs;
-        binop->op = op;
-        lhs = malloc(sizeof(Node));
-        lhs->type = NT_BINOP;
-        lhs->node = binop;
-    }
-    return lhs;
+static VariableDeclerationNode *parseParameter(ParserContext *ctx) {
+    VariableDeclerationNode *parameter = NEW(ctx, VariableDeclerationNode);
+    if (!parseDeclerationType(ctx, &parameter->type, &parameter->reg))
+        return NULL;
+    if (!ISCURRENTTOKENTYPE(ctx, TT_IDENTIFIER))
+        return expected(ctx, "a parameter name");
+    parameter->name = CURRENTTOKEN(ctx);
+    advance(ctx);
+    if (!parseVariableRest(ctx, parameter))
+        return NULL;
+    return parameter;
 }
 
-Node *parseXorExpression(ParserContext *ctx) {
-    Node *lhs = parseAndExpression(ctx);
-    while (ISCURRENTTOKENTYPE(ctx, TT_XOR)) {
-        Token op = CURRENTTOKEN(ctx);
+/* From the opening to the closing parenthesis, a trailing ... makes the function VARARG */
+static bool parseParameters(ParserContext *ctx, Type *function) {
+    advance(ctx);
+    size_t parameters = beginList(ctx);
+    while (!ISCURRENTTOKENTYPE(ctx, TT_RPAREN)) {
+        if (ISCURRENTTOKENTYPE(ctx, TT_ELLIPSIS)) {
+            function->qualifiers |= VARARG;
+            advance(ctx);
+            break;
+        }
+        VariableDeclerationNode *parameter = parseParameter(ctx);
+        if (parameter == NULL) {
+            dropList(ctx, parameters);
+            return false;
+        }
+        pushList(ctx, parameter);
+        if (!ISCURRENTTOKENTYPE(ctx, TT_COMMA))
+            break;
         advance(ctx);
-        Node *rhs = parseAndExpression(ctx);
-        BinaryOperationNode *binop = malloc(sizeof(BinaryOperationNode));
-        binop->lhs = lhs;
-        binop->rhs = rhs;
-        binop->op = op;
-        lhs = malloc(sizeof(Node));
-        lhs->type = NT_BINOP;
-        lhs->node = binop;
     }
-    return lhs;
+    if (!ISCURRENTTOKENTYPE(ctx, TT_RPAREN)) {
+        dropList(ctx, parameters);
+        expected(ctx, "',' or ')'");
+        return false;
+    }
+    advance(ctx);
+    freezeParameters(ctx, parameters, function);
+    return true;
 }
 
-Node *parseOrExpression(ParserContext *ctx) {
-    Node *lhs = parseXorExpression(ctx);
-    while (ISCURRENTTOKENTYPE(ctx, TT_OR)) {
-        Token op = CURRENTTOKEN(ctx);
-        advance(ctx);
-        Node *rhs = parseXorExpression(ctx);
-        BinaryOperationNode *binop = malloc(sizeof(BinaryOperationNode));
-        binop->lhs = lhs;
-        binop->rhs = rhs;
-        binop->op = op;
-        lhs = malloc(sizeof(Node));
-        lhs->type = NT_BINOP;
-        lhs->node = binop;
+/* Variable or function decleration. Whatever ends it, a ';' or the body of a function, is left for the caller */
+static Node *parseDecleration(ParserContext *ctx) {
+    Type type;
+    Register reg;
+    if (!parseDeclerationType(ctx, &type, &reg))
+        return NULL;
+    if (!ISCURRENTTOKENTYPE(ctx, TT_IDENTIFIER))
+        return expected(ctx, "a name");
+    Token name = CURRENTTOKEN(ctx);
+    advance(ctx);
+
+    Node *decleration = NEW(ctx, Node);
+    if (ISCURRENTTOKENTYPE(ctx, TT_LPAREN)) {
+        FunctionDeclerationNode *function = NEW(ctx, FunctionDeclerationNode);
+        /* Qualifiers belong to the function, the return type is just the base type and pointer depth */
+        Type *returnType = NEW(ctx, Type);
+        *returnType = type;
+        returnType->qualifiers = 0;
+        function->type = (Type) {
+            .qualifiers = type.qualifiers | FUNCTION,
+            .ptrDepth = 0,
+            .parameters = NULL,
+            .nParameters = 0,
+            .type.returnType = returnType
+        };
+        function->name = name;
+        function->body = NULL;
+        if (!parseParameters(ctx, &function->type))
+            return NULL;
+        decleration->type = NT_FUNCDECL;
+        decleration->node = function;
+        return decleration;
     }
-    return lhs;
+
+    VariableDeclerationNode *variable = NEW(ctx, VariableDeclerationNode);
+    variable->reg = reg;
+    variable->type = type;
+    variable->name = name;
+    if (!parseVariableRest(ctx, variable))
+        return NULL;
+    decleration->type = NT_VARDECL;
+    decleration->node = variable;
+    return decleration;
 }
 
-Node *parseAssignmentExpression(ParserContext *ctx) {
-    Node *lhs = parseOrExpression(ctx);
-    while (
-        ISCURRENTTOKENTYPE(ctx, TT_ASSIGN) || ISCURRENTTOKENTYPE(ctx, TT_LSHEQ) ||
-        ISCURRENTTOKENTYPE(ctx, TT_RSHEQ)  || ISCURRENTTOKENTYPE(ctx, TT_MULEQ) ||
-        ISCURRENTTOKENTYPE(ctx, TT_DIVEQ)  || ISCURRENTTOKENTYPE(ctx, TT_ANDEQ) ||
-        ISCURRENTTOKENTYPE(ctx, TT_OREQ)   || ISCURRENTTOKENTYPE(ctx, TT_XOREQ) ||
-        ISCURRENTTOKENTYPE(ctx, TT_ADDEQ)  || ISCURRENTTOKENTYPE(ctx, TT_SUBEQ)
-    ) {
-        Token op = CURRENTTOKEN(ctx);
+/* Classes and unions, the name is registered as a type in the current scope */
+static Node *parseTypeDecleration(ParserContext *ctx) {
+    NodeType kind = ISCURRENTTOKENTYPE(ctx, TT_KW_CLASS) ? NT_CLASS : NT_UNION;
+    advance(ctx);
+    if (!ISCURRENTTOKENTYPE(ctx, TT_IDENTIFIER))
+        return expected(ctx, "a type name");
+    TypeNode *type = NEW(ctx, TypeNode);
+    type->name = CURRENTTOKEN(ctx);
+    advance(ctx);
+    /* Registered before the fields, so they can point to the type they are in */
+    registerType(ctx, type->name.value);
+    Token open = CURRENTTOKEN(ctx);
+    if (!ISCURRENTTOKENTYPE(ctx, TT_LBRACE))
+        return expected(ctx, "'{'");
+    advance(ctx);
+    size_t fields = beginList(ctx);
+    while (!ISCURRENTTOKENTYPE(ctx, TT_RBRACE)) {
+        if (ISCURRENTTOKENTYPE(ctx, TT_EOF) || ISCURRENTTOKENTYPE(ctx, TT_KW_CLASS) || ISCURRENTTOKENTYPE(ctx, TT_KW_UNION)) {
+            /*
+             * Types don't nest, so the '}' is missing. The type is kept as far as it got and
+             * nothing is skipped, whatever comes next is parsed as the statement it is
+             */
+            unclosed(ctx, open);
+            ctx->panicking = false;
+            Node *typeNode = NEW(ctx, Node);
+            type->fields = freezeNodes(ctx, fields, &type->nFields);
+            typeNode->type = kind;
+            typeNode->node = type;
+            return typeNode;
+        }
+        /* Every field is a recovery point, a broken one doesn't take the rest of the class with it */
+        size_t mark = ctx->scratch.count;
+        Node *field = isDeclerationStart(ctx) ? parseDecleration(ctx) : expected(ctx, "a field");
+        if (field != NULL && field->type != NT_VARDECL) {
+            PARSER_ERROR(ctx, ((FunctionDeclerationNode*)field->node)->name, "Only variables can be declared in a class or union.");
+            field = NULL;
+        } else if (field != NULL && !ISCURRENTTOKENTYPE(ctx, TT_SEMICOLON)) {
+            field = expected(ctx, "';'");
+        }
+        if (field == NULL) {
+            recover(ctx, mark);
+            continue;
+        }
         advance(ctx);
-        Node *rhs = parseOrExpression(ctx);
-        BinaryOperationNode *binop = malloc(sizeof(BinaryOperationNode));
-        binop->lhs = lhs;
-        binop->rhs = rhs;
-        binop->op = op;
-        lhs = malloc(sizeof(Node));
-        lhs->type = NT_BINOP;
-        lhs->node = binop;
+        pushList(ctx, field);
     }
-    return lhs;
-}
+    advance(ctx);
+    type->fields = freezeNodes(ctx, fields, &type->nFields);
+    if (!ISCURRENTTOKENTYPE(ctx, TT_SEMICOLON))
+        return expected(ctx, "';'");
+    advance(ctx);
 
-Node *parseExpression(ParserContext *ctx) {
-    return parseAssignmentExpression(ctx);
+    Node *typeNode = NEW(ctx, Node);
+    typeNode->type = kind;
+    typeNode->node = type;
+    return typeNode;
 }
 
 Node *parseVariableDeclerationOrExpression(ParserContext *ctx) {
-    /* TODO: Variable declerations */
+    if (isDeclerationStart(ctx)) {
+        Node *decleration = parseDecleration(ctx);
+        if (decleration != NULL && decleration->type != NT_VARDECL) {
+            PARSER_ERROR(ctx, ((FunctionDeclerationNode*)decleration->node)->name, "Functions can't be declared in a for loop header.");
+            return NULL;
+        }
+        return decleration;
+    }
     return parseExpression(ctx);
 }
 
-Node *parseStatement(ParserContext *ctx) {
-    if (ISCURRENTTOKENTYPE(ctx, TT_KEYWORD)) {
-        if (ISCURRENTTOKENVALUE(ctx, "if")) {
-            IfNode *statement = malloc(sizeof(IfNode));
-            Node *ifNode = malloc(sizeof(Node));
+static Node *parseNestedStatement(ParserContext *ctx) {
+    switch (CURRENTTOKEN(ctx).type) {
+        case TT_KW_IF: {
+            IfNode *statement = NEW(ctx, IfNode);
+            Node *ifNode = NEW(ctx, Node);
             ifNode->type = NT_IF;
             ifNode->node = statement;
             advance(ctx);
-            if (!ISCURRENTTOKENTYPE(ctx, TT_LPAREN)) {
-                /* TODO: Error message */
-                return NULL;
-            }
+            if (!ISCURRENTTOKENTYPE(ctx, TT_LPAREN))
+                return expected(ctx, "'('");
             advance(ctx);
             Node *condition = parseExpression(ctx);
-            if (condition == NULL) {
-                /* TODO: Error message */
-                return NULL;
-            }
-            if (!ISCURRENTTOKENTYPE(ctx, TT_RPAREN)) {
-                /* TODO: Error message */
+            if (condition == NULL)
                 return NULL;
-            }
+            if (!ISCURRENTTOKENTYPE(ctx, TT_RPAREN))
+                return expected(ctx, "')'");
             advance(ctx);
             Node *body = parseStatement(ctx);
+            if (body == NULL)
+                return NULL;
 
-            statement->bodies = malloc(sizeof(Node*));
-            statement->conditions = malloc(sizeof(Node*));
-            statement->nCases = 1;
-            statement->bodies[0] = body;
-            statement->conditions[0] = condition;
-            while (ISCURRENTTOKEN(ctx, TT_KEYWORD, "else") && ISNEXTTOKEN(ctx, TT_KEYWORD, "if")) {
+            size_t cases = beginList(ctx);
+            pushList(ctx, condition);
+            pushList(ctx, body);
+            while (ISCURRENTTOKENTYPE(ctx, TT_KW_ELSE) && ISNEXTTOKENTYPE(ctx, TT_KW_IF)) {
                 advance(ctx);
                 advance(ctx);
                 if (!ISCURRENTTOKENTYPE(ctx, TT_LPAREN)) {
-                    /* TODO: Error message */
-                    return NULL;
+                    dropList(ctx, cases);
+                    return expected(ctx, "'('");
                 }
                 advance(ctx);
                 Node *caseCondition = parseExpression(ctx);
-                if (!ISCURRENTTOKENTYPE(ctx, TT_RPAREN)) {
-                    /* TODO: Error message */
+                if (caseCondition == NULL) {
+                    dropList(ctx, cases);
                     return NULL;
                 }
+                if (!ISCURRENTTOKENTYPE(ctx, TT_RPAREN)) {
+                    dropList(ctx, cases);
+                    return expected(ctx, "')'");
+                }
                 advance(ctx);
                 Node *caseBody = parseStatement(ctx);
                 if (caseBody == NULL) {
-                    /* TODO: Error message */
+                    dropList(ctx, cases);
                     return NULL;
                 }
-                statement->bodies = realloc(statement->bodies, (statement->nCases + 1) * sizeof(Node*));
-                statement->conditions = realloc(statement->conditions, (statement->nCases + 1) * sizeof(Node*));
-                statement->bodies[statement->nCases] = caseBody;
-                statement->conditions[statement->nCases] = caseCondition;
-                statement->nCases += 1;
+                pushList(ctx, caseCondition);
+                pushList(ctx, caseBody);
             }
-            if (ISCURRENTTOKEN(ctx, TT_KEYWORD, "else")) {
+            freezeIfCases(ctx, cases, statement);
+            if (ISCURRENTTOKENTYPE(ctx, TT_KW_ELSE)) {
                 advance(ctx);
                 statement->elseCase = parseStatement(ctx);
-                if (statement->elseCase == NULL) {
-                    /* TODO: Error message */
+                if (statement->elseCase == NULL)
                     return NULL;
-                }
             } else {
                 statement->elseCase = NULL;
             }
             return ifNode;
-        } else if (ISCURRENTTOKENVALUE(ctx, "while")) {
+        }
+        case TT_KW_WHILE: {
             advance(ctx);
-            if (!ISCURRENTTOKENTYPE(ctx, TT_LPAREN)) {
-                /* TODO: Error message */
-                return NULL;
-            }
+            if (!ISCURRENTTOKENTYPE(ctx, TT_LPAREN))
+                return expected(ctx, "'('");
             advance(ctx);
             Node *condition = parseExpression(ctx);
-            if (condition == NULL) {
-                /* TODO: Error message */
-                return NULL;
-            }
-            if (!ISCURRENTTOKENTYPE(ctx, TT_RPAREN)) {
-                /* TODO: Error message */
+            if (condition == NULL)
                 return NULL;
-            }
+            if (!ISCURRENTTOKENTYPE(ctx, TT_RPAREN))
+                return expected(ctx, "')'");
             advance(ctx);
             Node *body = parseStatement(ctx);
-            if (body == NULL) {
-                /* TODO: Error message */
+            if (body == NULL)
                 return NULL;
-            }
-            WhileNode *statement = malloc(sizeof(WhileNode));
+            WhileNode *statement = NEW(ctx, WhileNode);
             statement->body = body;
             statement->condition = condition;
-            Node *whileNode = malloc(sizeof(Node));
+            Node *whileNode = NEW(ctx, Node);
             whileNode->node = statement;
             whileNode->type = NT_WHILE;
             return whileNode;
-        } else if (ISCURRENTTOKENVALUE(ctx, "for")) {
-            ForNode *statement = malloc(sizeof(ForNode));
-            Node *loop = malloc(sizeof(Node));
+        }
+        case TT_KW_FOR: {
+            ForNode *statement = NEW(ctx, ForNode);
+            Node *loop = NEW(ctx, Node);
             loop->type = NT_FOR;
             loop->node = statement;
             advance(ctx);
-            if (!ISCURRENTTOKENTYPE(ctx, TT_LPAREN)) {
-                /* TODO: Error message */
-                return NULL;
-            }
+            if (!ISCURRENTTOKENTYPE(ctx, TT_LPAREN))
+                return expected(ctx, "'('");
             advance(ctx);
             if (!ISCURRENTTOKENTYPE(ctx, TT_SEMICOLON)) {
                 statement->initializer = parseVariableDeclerationOrExpression(ctx);
-                if (statement->initializer == NULL) {
-                    /* TODO: Error message */
+                if (statement->initializer == NULL)
                     return NULL;
-                }
             } else {
                 statement->initializer = NULL;
             }
-            if (!ISCURRENTTOKENTYPE(ctx, TT_SEMICOLON)) {
-                /* TODO: Error message */
-                return NULL;
-            }
+            if (!ISCURRENTTOKENTYPE(ctx, TT_SEMICOLON))
+                return expected(ctx, "';'");
             advance(ctx);
             if (!ISCURRENTTOKENTYPE(ctx, TT_SEMICOLON)) {
                 statement->condition = parseExpression(ctx);
-                if (statement->condition == NULL) {
-                    /* TODO: Error message */
+                if (statement->condition == NULL)
                     return NULL;
-                }
             } else {
                 statement->condition = NULL;
             }
-            if (!ISCURRENTTOKENTYPE(ctx, TT_SEMICOLON)) {
-                /* TODO: Error message */
-                return NULL;
-            }
+            if (!ISCURRENTTOKENTYPE(ctx, TT_SEMICOLON))
+                return expected(ctx, "';'");
             advance(ctx);
             if (!ISCURRENTTOKENTYPE(ctx, TT_RPAREN)) {
                 statement->increment = parseVariableDeclerationOrExpression(ctx);
-                if (statement->increment == NULL) {
-                    /* TODO: Error message */
+                if (statement->increment == NULL)
                     return NULL;
-                }
             } else {
                 statement->increment = NULL;
             }
-            if (!ISCURRENTTOKENTYPE(ctx, TT_RPAREN)) {
-                /* TODO: Error message */
-                return NULL;
-            }
+            if (!ISCURRENTTOKENTYPE(ctx, TT_RPAREN))
+                return expected(ctx, "')'");
             advance(ctx);
             Node *body = parseStatement(ctx);
-            if (body == NULL) {
-                /* TODO: Error message */
+            if (body == NULL)
                 return NULL;
-            }
             statement->body = body;
             return loop;
-        } else if (ISCURRENTTOKENVALUE(ctx, "goto")) {
+        }
+        case TT_KW_GOTO: {
             advance(ctx);
-            if (!ISCURRENTTOKENTYPE(ctx, TT_IDENTIFIER)) {
-                /* TODO: Error message */
-                return NULL;
-            }
+            if (!ISCURRENTTOKENTYPE(ctx, TT_IDENTIFIER))
+                return expected(ctx, "a label");
             Token label = CURRENTTOKEN(ctx);
             advance(ctx);
-            if (!ISCURRENTTOKENTYPE(ctx, TT_SEMICOLON)) {
-                /* TODO: Error message */
-                return NULL;
-            }
+            if (!ISCURRENTTOKENTYPE(ctx, TT_SEMICOLON))
+                return expected(ctx, "';'");
             advance(ctx);
-            GotoNode *statement = malloc(sizeof(GotoNode));
+            GotoNode *statement = NEW(ctx, GotoNode);
             statement->label = label;
-            Node *gotoNode = malloc(sizeof(Node));
+            Node *gotoNode = NEW(ctx, Node);
             gotoNode->node = statement;
             gotoNode->type = NT_GOTO;
             return gotoNode;
-        } else if (ISCURRENTTOKENVALUE(ctx, "try")) {
+        }
+        case TT_KW_TRY: {
             advance(ctx);
             Node *body = parseStatement(ctx);
-            if (body == NULL) {
-                /* TODO: Error message */
-                return NULL;
-            }
-            if (!ISCURRENTTOKEN(ctx, TT_KEYWORD, "catch")) {
-                /* TODO: Error message */
+            if (body == NULL)
                 return NULL;
-            }
+            if (!ISCURRENTTOKENTYPE(ctx, TT_KW_CATCH))
+                return expected(ctx, "'catch'");
             advance(ctx);
             Node *handler = parseStatement(ctx);
-            if (handler == NULL) {
-                /* TODO: Error message */
+            if (handler == NULL)
                 return NULL;
-            }
-            TryNode *statement = malloc(sizeof(TryNode));
+            TryNode *statement = NEW(ctx, TryNode);
             statement->body = body;
             statement->catchBody = handler;
-            Node *tryNode = malloc(sizeof(TryNode));
+            Node *tryNode = NEW(ctx, Node);
             tryNode->node = statement;
             tryNode->type = NT_TRY;
             return tryNode;
-        } else if (ISCURRENTTOKENVALUE(ctx, "break")) {
+        }
+        case TT_KW_CLASS:
+        case TT_KW_UNION:
+            return parseTypeDecleration(ctx);
+        case TT_KW_BREAK: {
             advance(ctx);
-            Node *breakNode = malloc(sizeof(Node));
+            Node *breakNode = NEW(ctx, Node);
             breakNode->type = NT_BREAK;
-            if (!ISCURRENTTOKENTYPE(ctx, TT_SEMICOLON)) {
-                /* TODO: Error message */
-                return NULL;
-            }
+            breakNode->node = NULL;
+            if (!ISCURRENTTOKENTYPE(ctx, TT_SEMICOLON))
+                return expected(ctx, "';'");
             advance(ctx);
             return breakNode;
-        } else if (ISCURRENTTOKENVALUE(ctx, "return")) {
+        }
+        case TT_KW_RETURN: {
             advance(ctx);
-            Node *returnNode = malloc(sizeof(Node));
+            Node *returnNode = NEW(ctx, Node);
             returnNode->node = NULL;
             returnNode->type = NT_RETURN;
             if (!ISCURRENTTOKENTYPE(ctx, TT_SEMICOLON)) {
                 returnNode->node = parseExpression(ctx);
-                if (returnNode->node == NULL) {
-                    /* TODO: Error message */
+                if (returnNode->node == NULL)
                     return NULL;
-                }
-            }
-            if (!ISCURRENTTOKENTYPE(ctx, TT_SEMICOLON)) {
-                /* TODO: Error message */
-                return NULL;
             }
+            if (!ISCURRENTTOKENTYPE(ctx, TT_SEMICOLON))
+                return expected(ctx, "';'");
             advance(ctx);
             return returnNode;
         }
-    } else if (ISCURRENTTOKENATYPE(ctx)) {
-        /* Parse variable- and function declerations here */
-        return NULL;
+        default:
+            break;
+    }
+    if (isDeclerationStart(ctx)) {
+        Node *decleration = parseDecleration(ctx);
+        if (decleration == NULL)
+            return NULL;
+        if (decleration->type == NT_FUNCDECL && ISCURRENTTOKENTYPE(ctx, TT_LBRACE)) {
+            FunctionDeclerationNode *function = (FunctionDeclerationNode*)decleration->node;
+            function->body = parseStatement(ctx);
+            return function->body != NULL ? decleration : NULL;
+        }
+        /* Variables and prototypes */
+        if (!ISCURRENTTOKENTYPE(ctx, TT_SEMICOLON))
+            return expected(ctx, decleration->type == NT_FUNCDECL ? "'{' or ';'" : "';'");
+        advance(ctx);
+        return decleration;
     } else if (ISCURRENTTOKENTYPE(ctx, TT_LBRACE)) {
+        Token open = CURRENTTOKEN(ctx);
         advance(ctx);
-        Node *compound = malloc(sizeof(Node));
-        CompoundNode *statement = malloc(sizeof(CompoundNode));
-        statement->nStatements = 0;
-        statement->statements = NULL;
+        Node *compound = NEW(ctx, Node);
+        CompoundNode *statement = NEW(ctx, CompoundNode);
 
-        while (!ISCURRENTTOKENTYPE(ctx, TT_RBRACE)) {
+        /* Types declared inside the block go out of scope with it */
+        size_t scope = pushTypeScope(&ctx->types);
+        size_t statements = beginList(ctx);
+        while (!ISCURRENTTOKENTYPE(ctx, TT_RBRACE) && !ISCURRENTTOKENTYPE(ctx, TT_EOF)) {
+            size_t mark = ctx->scratch.count;
             Node *stmnt = parseStatement(ctx);
-            if (statement == NULL)
-                return NULL;
-            statement->statements = realloc(statement->statements, (statement->nStatements + 1) * sizeof(Node*));
-            statement->statements[statement->nStatements++] = stmnt;
+            if (stmnt == NULL) {
+                /* The block is still parsed to the end, only the broken statement is left out */
+                recover(ctx, mark);
+                continue;
+            }
+            pushList(ctx, stmnt);
         }
+        popTypeScope(&ctx->types, scope);
         if (ISCURRENTTOKENTYPE(ctx, TT_EOF)) {
-            /* TODO: Error message here */
+            unclosed(ctx, open);
+            dropList(ctx, statements);
             return NULL;
         }
+        statement->statements = freezeNodes(ctx, statements, &statement->nStatements);
         advance(ctx);
 
         compound->type = NT_COMPOUND;
         compound->node = statement;
         return compound;
     } else if (ISCURRENTTOKENTYPE(ctx, TT_SEMICOLON)) {
-        Node *statement = malloc(sizeof(Node));
+        Node *statement = NEW(ctx, Node);
         statement->type = NT_NONE;
+        statement->node = NULL;
         advance(ctx);
         return statement;
     } else if (ISCURRENTTOKENTYPE(ctx, TT_IDENTIFIER) && ISNEXTTOKENTYPE(ctx, TT_COLON)) {
         Token label = CURRENTTOKEN(ctx);
         advance(ctx);
         advance(ctx);
-        LabelNode *statement = malloc(sizeof(LabelNode));
+        LabelNode *statement = NEW(ctx, LabelNode);
         statement->name = label;
-        Node *labelNode = malloc(sizeof(Node));
+        Node *labelNode = NEW(ctx, Node);
         labelNode->node = statement;
         labelNode->type = NT_LABEL;
         return labelNode;
     }
     Node *expression = parseExpression(ctx);
-    if (expression == NULL) {
-        /* TODO: Print some error to the user */
+    if (expression == NULL)
         return NULL;
-    }
-    if (!ISCURRENTTOKENTYPE(ctx, TT_SEMICOLON)) {
-        /* TODO: Error message */
-        return NULL;
-    }
+    if (!ISCURRENTTOKENTYPE(ctx, TT_SEMICOLON))
+        return expected(ctx, "';'");
     advance(ctx);
     return expression;
 }
 
-Node *parse(Token *tokens, const char *file, const char *source) {
-    ParserContext ctx = {
-        .tokens = tokens,
-        .index = -1,
-        .file = file,
-        .source = source,
-        .types = NULL,
-        .nTypes = 0
-    };
+Node *parseStatement(ParserContext *ctx) {
+    if (!enterNesting(ctx))
+        return NULL;
+    Node *statement = parseNestedStatement(ctx);
+    leaveNesting(ctx);
+    return statement;
+}
+
+Node *parse(Lexer *lexer, Arena *arena) {
+    return parseUnit(lexer, arena, NULL, NULL);
+}
+
+void initUnitTypes(TypeRegistry *types, Interner *interner, const TypeRegistry *prefix) {
+    if (prefix != NULL) {
+        /* The prefix includes the built-ins */
+        copyTypeRegistry(types, prefix);
+        return;
+    }
+    initTypeRegistry(types);
     /* Register the built-in types */
     const char *builtins[] = {
         "U0", "I0", "U8", "I8", "U16", "I16", "U32", "I32", "U64", "I64", NULL
     };
-    registerTypes(&ctx, (char**)builtins);
+    for (const char **builtin = builtins; *builtin; builtin++)
+        addType(types, internString(interner, *builtin));
+}
+
+void beginParser(ParserContext *ctx, Lexer *lexer, TypeRegistry types) {
+    *ctx = (ParserContext) {
+        .lexer = lexer,
+        .index = 0,
+        .arena = NULL,
+        .interner = lexer->interner,
+        .types = types,
+        .file = lexer->file,
+        .source = lexer->source,
+        .map = &lexer->map,
+        .diagnostics = lexer->diagnostics
+    };
+    initVector(&ctx->scratch);
+    for (size_t i = 0; i < PARSER_LOOKAHEAD; i++)
+        ctx->lookahead[i] = nextToken(lexer);
+}
 
-    advance(&ctx);
+TypeRegistry endParser(ParserContext *ctx) {
+    freeVector(&ctx->scratch);
+    return ctx->types;
+}
 
-    Node *AST = malloc(sizeof(Node));
-    CompoundNode *program = malloc(sizeof(CompoundNode));
-    program->nStatements = 0;
-    program->statements = NULL;
+void seekParser(ParserContext *ctx, size_t offset) {
+    /* The lookahead is thrown away, nothing else depends on where the lexer is */
+    ctx->lexer->index = offset;
+    ctx->lexer->failed = false;
+    ctx->index = 0;
+    for (size_t i = 0; i < PARSER_LOOKAHEAD; i++)
+        ctx->lookahead[i] = nextToken(ctx->lexer);
+}
 
-    while (!ISCURRENTTOKENTYPE(&ctx, TT_EOF)) {
-        Node *statement = parseStatement(&ctx);
-        if (statement == NULL)
-            break;
-        program->statements = realloc(program->statements, (program->nStatements + 1) * sizeof(Node*));
-        program->statements[program->nStatements++] = statement;
+Node *parseTopLevel(ParserContext *ctx, Arena *arena) {
+    ctx->arena = arena;
+    if (ISCURRENTTOKENTYPE(ctx, TT_RBRACE)) {
+        /* There is no block to close up here, and synchronize won't skip it */
+        PARSER_ERROR(ctx, CURRENTTOKEN(ctx), "Unmatched '}'.");
+        ctx->panicking = false;
+        advance(ctx);
+        return NULL;
+    }
+    size_t mark = ctx->scratch.count;
+    Node *statement = parseStatement(ctx);
+    if (statement == NULL)
+        recover(ctx, mark);
+    return statement;
+}
+
+Node *parseUnit(Lexer *lexer, Arena *arena, const TypeRegistry *prefix, TypeRegistry *types) {
+    TypeRegistry registry;
+    initUnitTypes(&registry, lexer->interner, prefix);
+    ParserContext ctx;
+    beginParser(&ctx, lexer, registry);
+    ctx.arena = arena;
+
+    Node *AST = NEW(&ctx, Node);
+    CompoundNode *program = NEW(&ctx, CompoundNode);
+    size_t statements = beginList(&ctx);
+    while (!parserAtEnd(&ctx)) {
+        Node *statement = parseTopLevel(&ctx, arena);
+        if (statement != NULL)
+            pushList(&ctx, statement);
     }
+    program->statements = freezeNodes(&ctx, statements, &program->nStatements);
 
     AST->type = NT_COMPOUND;
     AST->node = program;
+    registry = endParser(&ctx);
+    if (ctx.errors > 0 || lexer->failed) {
+        freeTypeRegistry(&registry);
+        if (arena == NULL)
+            freeNode(AST);
+        return NULL;
+    }
+    if (types != NULL)
+        *types = registry;
+    else
+        freeTypeRegistry(&registry);
     return AST;
 }
 
@@ -758,7 +1107,9 @@ void freeType(Type *type) {
             if (type->parameters[i]->arraySizes != NULL)
                 free(type->parameters[i]->arraySizes);
             freeType(&type->parameters[i]->type);
+            free(type->parameters[i]);
         }
+        free(type->parameters);
     }
     if (type->qualifiers & FUNCTION) {
         freeType(type->type.returnType);
@@ -766,109 +1117,51 @@ void freeType(Type *type) {
     }
 }
 
-void freeNode(Node *node) {
+/* Children are freed before their parent is left, only the parent's own allocations remain */
+static bool freeVisitor(void *data, Node *node, VisitStep step, size_t child) {
+    (void)data;
+    (void)child;
+    if (step != VISIT_LEAVE)
+        return true;
     switch (node->type) {
-        case NT_ASSIGN:
-        case NT_BINOP: {
-            BinaryOperationNode *binOp = (BinaryOperationNode*)node->node;
-            freeNode(binOp->lhs);
-            freeNode(binOp->rhs);
-        } break;
-        case NT_UNARYOP: {
-            UnaryOperationNode *unOp = (UnaryOperationNode*)node->node;
-            freeNode(unOp->value);
-        } break;
         case NT_VARDECL: {
             VariableDeclerationNode *decl = (VariableDeclerationNode*)node->node;
-            if (decl->initializer != NULL)
-                freeNode(decl->initializer);
             if (decl->arraySizes != NULL)
                 free(decl->arraySizes);
             freeType(&decl->type);
         } break;
-        case NT_FUNCCALL: {
-            FunctionCallNode *call = (FunctionCallNode*)node->node;
-            freeNode(call->function);
-            for (size_t i = 0; i < call->nArguments; i++)
-                if (call->arguments[i] != NULL)
-                    freeNode(call->arguments[i]);
-            if (call->arguments)
-                free(call->arguments);
-        } break;
-        case NT_FUNCDECL: {
-            FunctionDeclerationNode *decl = (FunctionDeclerationNode*)node->node;
-            for (size_t i = 0; i < decl->body->nStatements; i++)
-                freeNode(decl->body->statements[i]);
-            if (decl->body->statements)
-                free(decl->body->statements);
-            free(decl->body);
-            freeType(&decl->type);
-        } break;
-        case NT_ARRAYACCESS: {
-            ArrayAccessNode *access = (ArrayAccessNode*)node->node;
-            freeNode(access->array);
-            freeNode(access->index);
-        } break;
-        case NT_ACCESS: {
-            AccessNode *access = (AccessNode*)node->node;
-            freeNode(access->object);
-        } break;
-        case NT_FOR: {
-            ForNode *loop = (ForNode*)node->node;
-            if (loop->initializer)
-                freeNode(loop->initializer);
-            if (loop->condition)
-                freeNode(loop->condition);
-            if (loop->increment)
-                freeNode(loop->increment);
-            freeNode(loop->body);
-        } break;
-        case NT_WHILE: {
-            WhileNode *loop = (WhileNode*)node->node;
-            freeNode(loop->condition);
-            freeNode(loop->body);
-        } break;
+        case NT_FUNCDECL:
+            freeType(&((FunctionDeclerationNode*)node->node)->type);
+            break;
+        case NT_FUNCCALL:
+            free(((FunctionCallNode*)node->node)->arguments);
+            break;
         case NT_IF: {
             IfNode *statement = (IfNode*)node->node;
-            for (size_t i = 0; i < statement->nCases; i++) {
-                freeNode(statement->conditions[i]);
-                freeNode(statement->bodies[i]);
-            }
-            if (statement->elseCase)
-                freeNode(statement->elseCase);
             free(statement->conditions);
             free(statement->bodies);
         } break;
-        case NT_TRY: {
-            TryNode *try = (TryNode*)node->node;
-            freeNode(try->body);
-            freeNode(try->catchBody);
-        } break;
         case NT_CLASS:
-        case NT_UNION: {
-            TypeNode *type = (TypeNode*)node->node;
-            for (size_t i = 0; i < type->nFields; i++) {
-                VariableDeclerationNode *decl = type->fields[i];
-                if (decl->initializer != NULL)
-                    freeNode(decl->initializer);
-                if (decl->arraySizes != NULL)
-                    free(decl->arraySizes);
-            }
-            if (type->fields != NULL)
-                free(type->fields);
-        } break;
-        case NT_COMPOUND: {
-            CompoundNode *compound = (CompoundNode*)node->node;
-            for (size_t i = 0; i < compound->nStatements; i++)
-                freeNode(compound->statements[i]);
-            if (compound->statements)
-                free(compound->statements);
-        }
+        case NT_UNION:
+            free(((TypeNode*)node->node)->fields);
+            break;
+        case NT_COMPOUND:
+            free(((CompoundNode*)node->node)->statements);
+            break;
+        case NT_RETURN:
+            /* The value was a child and is gone already */
+            free(node);
+            return true;
         default:
             break;
     }
     free(node->node);
     free(node);
+    return true;
+}
+
+void freeNode(Node *node) {
+    visitNode(node, freeVisitor, NULL);
 }
 
 #ifdef TRANSPILER
@@ -915,359 +1208,336 @@ char *operatorFromToken(Token token) {
     }
 }
 
-char *regAsString(Register reg) {
-    switch (reg) {
-        case NONE:
-        case AUTO:
-            return NULL;
-        case REG_RAX: return "RAX";
-        case REG_RBX: return "RBX";
-        case REG_RCX: return "RCX";
-        case REG_RDX: return "RDX";
-        case REG_RSI: return "RSI";
-        case REG_RDI: return "RDI";
-        case REG_RBP: return "RBP";
-        case REG_RSP: return "RSP";
-        case REG_R8: return "R8";
-        case REG_R9: return "R9";
-        case REG_R10: return "R10";
-        case REG_R11: return "R11";
-        case REG_R12: return "R12";
-        case REG_R13: return "R13";
-        case REG_R14: return "R14";
-        case REG_R15: return "R15";
-        case REG_EAX: return "EAX";
-        case REG_EBX: return "EBX";
-        case REG_ECX: return "ECX";
-        case REG_ESP: return "ESP";
-        case REG_EBP: return "EBP";
-        case REG_EDI: return "EDI";
-        case REG_ESI: return "ESI";
-        case REG_EDX: return "EDX";
-        case REG_AX: return "AX";
-        case REG_BX: return "BX";
-        case REG_CX: return "CX";
-        case REG_SP: return "SP";
-        case REG_BP: return "BP";
-        case REG_DI: return "DI";
-        case REG_SI: return "SI";
-        case REG_DX: return "DX";
-        case REG_AH: return "AH";
-        case REG_AL: return "AL";
-        case REG_BH: return "BH";
-        case REG_BL: return "BL";
-        case REG_CH: return "CH";
-        case REG_CL: return "CL";
-        case REG_SPL: return "SPL";
-        case REG_BPL: return "BPL";
-        case REG_DIL: return "DIL";
-        case REG_SIL: return "SIL";
-        case REG_DH: return "DH";
-        case REG_DL: return "DL";
-        case REG_XMM0: return "XMM0";
-        case REG_XMM1: return "XMM1";
-        case REG_XMM2: return "XMM2";
-        case REG_XMM3: return "XMM3";
-        case REG_XMM4: return "XMM4";
-        case REG_XMM5: return "XMM5";
-        case REG_XMM6: return "XMM6";
-        case REG_XMM7: return "XMM7";
+static void printQualifiers(FILE *out, Qualifier qualifiers) {
+    if (qualifiers & STATIC) fprintf(out, "static ");
+    if (qualifiers & PUBLIC) fprintf(out, "public ");
+    if (qualifiers & PRIVATE) fprintf(out, "private ");
+    if (qualifiers & EXTERN) fprintf(out, "extern ");
+}
+
+void printTypedVariable(FILE *out, Type type, Token name, const char *source);
+
+static void printParameters(FILE *out, const Type *type, const char *source) {
+    for (size_t j = 0; j < type->nParameters; j++) {
+        printTypedVariable(out, type->parameters[j]->type, type->parameters[j]->name, source);
+        if (type->parameters[j]->initializer != NULL) {
+            fprintf(out, " = ");
+            printNode(out, type->parameters[j]->initializer, 0, source);
+        }
+        if (j < type->nParameters - 1)
+            fprintf(out, ", ");
+    }
+    if (type->qualifiers & VARARG) {
+        if (type->nParameters > 0)
+            fprintf(out, ", ");
+        fprintf(out, "...");
+    }
+}
+
+/* Function types are printed from the innermost return type out, this lists them in that order and returns how many return types there are */
+static size_t unwindFunctionType(Type type, Type **stack) {
+    *stack = malloc(sizeof(Type));
+    (*stack)[0] = type;
+    size_t depth = 0;
+    while (((*stack)[depth].qualifiers & FUNCTION) && ((*stack)[depth].type.returnType->qualifiers & FUNCTION)) {
+        *stack = realloc(*stack, (depth + 2) * sizeof(Type));
+        (*stack)[depth + 1] = *(*stack)[depth].type.returnType;
+        depth += 1;
     }
+    return depth;
 }
 
-void printTypedVariable(Type type, Token name) {
+/* The innermost function type holds the return type everything else is built around */
+static void printReturnType(FILE *out, const Type *innermost) {
+    const Type *base = (innermost->qualifiers & FUNCTION) ? innermost->type.returnType : innermost;
+    fprintf(out, "%s", base->type.base);
+    for (size_t i = 0; i < base->ptrDepth; i++)
+        fprintf(out, "*");
+    fprintf(out, " ");
+}
+
+void printTypedVariable(FILE *out, Type type, Token name, const char *source) {
     if (!(type.qualifiers & FUNCTION)) {
-        if (type.qualifiers & STATIC) printf("static ");
-        if (type.qualifiers & PUBLIC) printf("public ");
-        if (type.qualifiers & PRIVATE) printf("private ");
-        if (type.qualifiers & EXTERN) printf("extern ");
-        printf("%s ", type.type.base);
+        printQualifiers(out, type.qualifiers);
+        fprintf(out, "%s ", type.type.base);
         for (size_t i = 0; i < type.ptrDepth; i++)
-            printf("*");
-        printf("%s", name.value);
+            fprintf(out, "*");
+        fprintf(out, "%s", name.value);
         return;
     }
-    Type *stack = malloc(sizeof(Type));
-    stack[0] = type;
-    size_t depth = 0;
-    while ((stack[depth].qualifiers & FUNCTION) && (stack[depth].type.returnType->qualifiers & FUNCTION)) {
-        stack = realloc(stack, (depth + 2) * sizeof(Type));
-        stack[depth + 1] = *stack[depth].type.returnType;
-        depth += 1;
+    Type *stack;
+    size_t depth = unwindFunctionType(type, &stack);
+    printQualifiers(out, stack[depth].qualifiers);
+    printReturnType(out, &stack[depth]);
+    for (size_t i = depth + 1; i-- > 0;) {
+        fprintf(out, "(");
+        for (size_t j = 0; j < stack[i].ptrDepth; j++)
+            fprintf(out, "*");
+        printQualifiers(out, stack[i].qualifiers);
+    }
+    fprintf(out, "%s", name.value);
+    for (size_t i = 0; i < depth + 1; i++) {
+        fprintf(out, ")(");
+        printParameters(out, &stack[i], source);
+        fprintf(out, ")");
     }
-    if (stack[depth].qualifiers & STATIC) printf("static ");
-    if (stack[depth].qualifiers & PUBLIC) printf("public ");
-    if (stack[depth].qualifiers & PRIVATE) printf("private ");
-    if (stack[depth].qualifiers & EXTERN) printf("extern ");
-    printf("%s", stack[depth].type.base);
-    for (size_t i = 0; i < stack[depth].ptrDepth; i++)
-        printf("*");
-    for (size_t i = depth; i >= 0; i--) {
-        printf("(");
+    free(stack);
+}
+
+static void printFunctionHeader(FILE *out, const FunctionDeclerationNode *funcDecl, const char *source) {
+    Type *stack;
+    size_t depth = unwindFunctionType(funcDecl->type, &stack);
+    printQualifiers(out, stack[depth].qualifiers);
+    printReturnType(out, &stack[depth]);
+    for (size_t i = depth; i > 0; i--) {
+        fprintf(out, "(");
         for (size_t j = 0; j < stack[i].ptrDepth; j++)
-            printf("*");
-        if (stack[i].qualifiers & STATIC) printf("static ");
-        if (stack[i].qualifiers & PUBLIC) printf("public ");
-        if (stack[i].qualifiers & PRIVATE) printf("private ");
-        if (stack[i].qualifiers & EXTERN) printf("extern ");
+            fprintf(out, "*");
+        printQualifiers(out, stack[i].qualifiers);
     }
-    printf("%s", name.value);
+    fprintf(out, "%s", funcDecl->name.value);
     for (size_t i = 0; i < depth + 1; i++) {
-        printf(")(");
-        for (size_t j = 0; j < stack[i].nParameters; j++) {
-            printTypedVariable(stack[i].parameters[j]->type, stack[i].parameters[j]->name);
-            if (stack[i].parameters[j]->initializer != NULL) {
-                printf(" = ");
-                printNode(stack[i].parameters[j]->initializer, 0);
+        if (i > 0) fprintf(out, ")");
+        fprintf(out, "(");
+        printParameters(out, &stack[i], source);
+        fprintf(out, ")");
+    }
+    free(stack);
+}
+
+static void printIndent(FILE *out, size_t depth) {
+    for (size_t j = 0; j < depth; j++)
+        fprintf(out, "  ");
+}
+
+typedef struct Printer {
+    FILE *out;
+    const char *source;
+    /* Indentation of every node on the path to the current one */
+    size_t *depths;
+    size_t nDepths;
+    size_t depthsCapacity;
+    /* Indentation of the next node entered */
+    size_t next;
+} Printer;
+
+/* Statements are followed by ";\n", labels end their own line */
+static void endStatement(FILE *out, Node *statement) {
+    if (statement->type != NT_LABEL)
+        fprintf(out, ";\n");
+}
+
+static bool printVisitor(void *data, Node *node, VisitStep step, size_t child) {
+    Printer *printer = (Printer*)data;
+    FILE *out = printer->out;
+    if (step == VISIT_ENTER) {
+        if (printer->nDepths == printer->depthsCapacity) {
+            printer->depthsCapacity = printer->depthsCapacity ? printer->depthsCapacity * 2 : 64;
+            printer->depths = realloc(printer->depths, printer->depthsCapacity * sizeof(size_t));
+            if (printer->depths == NULL) {
+                fprintf(stderr, "Fatal: Out of memory while printing the AST.\n");
+                exit(1);
             }
-            if (j < stack[i].nParameters - 1)
-                printf(", ");
-        }
-        if (stack[i].qualifiers & VARARG) {
-            if (stack[i].nParameters > 0)
-                printf(", ");
-            printf("...");
         }
-        printf(")");
+        printer->depths[printer->nDepths++] = printer->next;
     }
-}
+    size_t depth = printer->depths[printer->nDepths - 1];
+    if (step == VISIT_LEAVE)
+        printer->nDepths -= 1;
+    /* Expressions are never indented, only statement bodies are */
+    printer->next = 0;
 
-void printNode(Node *node, size_t depth) {
     switch (node->type) {
         case NT_NONE: break;
         case NT_INT:
-        case NT_FLOAT: {
-            printf("%s", ((ValueNode*)node->node)->value.value);
-        } break;
-        case NT_STRING: {
-            printf("\"%s\"", ((ValueNode*)node->node)->value.value);
-        } break;
+        case NT_FLOAT:
+        case NT_STRING:
         case NT_CHAR: {
-            printf("'%s'", ((ValueNode*)node->node)->value.value);
+            /* Print literals as they were written, escape sequences included. Folded ones span an expression, their value is printed */
+            Token value = ((ValueNode*)node->node)->value;
+            bool folded = (node->type == NT_INT || node->type == NT_FLOAT) && value.value != NULL;
+            if (step == VISIT_ENTER && folded)
+                fprintf(out, "%s", value.value);
+            else if (step == VISIT_ENTER)
+                fprintf(out, "%.*s", (int)value.len, printer->source + value.index);
         } break;
         case NT_ASSIGN:
         case NT_BINOP: {
             BinaryOperationNode *binOp = (BinaryOperationNode*)node->node;
-            printf("(");
-            printNode(binOp->lhs, 0);
-            printf(" %s ", operatorFromToken(binOp->op));
-            printNode(binOp->rhs, 0);
-            printf(")");
+            if (step == VISIT_ENTER)
+                fprintf(out, "(");
+            else if (step == VISIT_CHILD && child == 1)
+                fprintf(out, " %s ", operatorFromToken(binOp->op));
+            else if (step == VISIT_LEAVE)
+                fprintf(out, ")");
         } break;
         case NT_UNARYOP: {
             UnaryOperationNode *unOp = (UnaryOperationNode*)node->node;
-            printf("(");
-            printf("%s", operatorFromToken(unOp->op));
-            printNode(unOp->value, 0);
-            printf(")");
+            if (step == VISIT_ENTER)
+                fprintf(out, "(%s", operatorFromToken(unOp->op));
+            else if (step == VISIT_LEAVE)
+                fprintf(out, ")");
         } break;
         case NT_VARACCESS: {
             VariableAccessNode *varAccess = (VariableAccessNode*)node->node;
-            printf("%s", varAccess->name.value);
+            if (step == VISIT_ENTER)
+                fprintf(out, "%s", varAccess->name.value);
         } break;
         case NT_VARDECL: {
             VariableDeclerationNode *varDecl = (VariableDeclerationNode*)node->node;
-            if (varDecl->reg == AUTO) {
-                printf("reg ");
-            } else if (varDecl->reg == NONE) {
-                printf("noreg ");
-            } else {
-                printf("reg %s ", regAsString(varDecl->reg));
-            }
-            printTypedVariable(varDecl->type, varDecl->name);
-            for (size_t i = 0; i < varDecl->arrayDepth; i++)
-                printf("[%zu]", varDecl->arraySizes[i]);
-            if (varDecl->initializer != NULL) {
-                printf(" = ");
-                printNode(varDecl->initializer, 0);
+            if (step == VISIT_ENTER) {
+                if (varDecl->reg == AUTO) {
+                    fprintf(out, "reg ");
+                } else if (varDecl->reg == NOREG) {
+                    fprintf(out, "noreg ");
+                } else if (varDecl->reg != NONE) {
+                    fprintf(out, "reg %s ", regAsString(varDecl->reg));
+                }
+                printTypedVariable(out, varDecl->type, varDecl->name, printer->source);
+                for (size_t i = 0; i < varDecl->arrayDepth; i++)
+                    fprintf(out, "[%zu]", varDecl->arraySizes[i]);
+            } else if (step == VISIT_CHILD && varDecl->initializer != NULL) {
+                fprintf(out, " = ");
             }
         } break;
         case NT_FUNCCALL: {
             FunctionCallNode *funcCall = (FunctionCallNode*)node->node;
-            printf("(");
-            printNode(funcCall->function, 0);
-            printf("(");
-            for (size_t i = 0; i < funcCall->nArguments; i++) {
-                printNode(funcCall->arguments[i], 0);
-                if (i < funcCall->nArguments - 1)
-                    printf(", ");
+            if (step == VISIT_ENTER) {
+                fprintf(out, "(");
+            } else if (step == VISIT_CHILD && child > 0) {
+                fprintf(out, child == 1 ? "(" : ", ");
+            } else if (step == VISIT_LEAVE) {
+                if (funcCall->nArguments == 0)
+                    fprintf(out, "(");
+                fprintf(out, "))");
             }
-            printf("))");
         } break;
         case NT_FUNCDECL: {
-            FunctionDeclerationNode *funcDecl = (FunctionDeclerationNode*)node->node;
-            Type type = funcDecl->type;
-            Token name = funcDecl->name;
-            Type *stack = malloc(sizeof(Type));
-            stack[0] = type;
-            size_t depth = 0;
-            while ((stack[depth].qualifiers & FUNCTION) && (stack[depth].type.returnType->qualifiers & FUNCTION)) {
-                stack = realloc(stack, (depth + 2) * sizeof(Type));
-                stack[depth + 1] = *stack[depth].type.returnType;
-                depth += 1;
+            if (step == VISIT_ENTER) {
+                FunctionDeclerationNode *funcDecl = (FunctionDeclerationNode*)node->node;
+                printFunctionHeader(out, funcDecl, printer->source);
+                if (funcDecl->body != NULL)
+                    fprintf(out, " ");
             }
-            if (stack[depth].qualifiers & STATIC) printf("static ");
-            if (stack[depth].qualifiers & PUBLIC) printf("public ");
-            if (stack[depth].qualifiers & PRIVATE) printf("private ");
-            if (stack[depth].qualifiers & EXTERN) printf("extern ");
-            printf("%s", stack[depth].type.base);
-            for (size_t i = 0; i < stack[depth].ptrDepth; i++)
-                printf("*");
-            for (size_t i = depth; i > 0; i--) {
-                printf("(");
-                for (size_t j = 0; j < stack[i].ptrDepth; j++)
-                    printf("*");
-                if (stack[i].qualifiers & STATIC) printf("static ");
-                if (stack[i].qualifiers & PUBLIC) printf("public ");
-                if (stack[i].qualifiers & PRIVATE) printf("private ");
-                if (stack[i].qualifiers & EXTERN) printf("extern ");
-            }
-            printf("%s", name.value);
-            for (size_t i = 0; i < depth + 1; i++) {
-                if (i > 0) printf(")");
-                printf("(");
-                for (size_t j = 0; j < stack[i].nParameters; j++) {
-                    printTypedVariable(stack[i].parameters[j]->type, stack[i].parameters[j]->name);
-                    if (stack[i].parameters[j]->initializer != NULL) {
-                        printf(" = ");
-                        printNode(stack[i].parameters[j]->initializer, 0);
-                    }
-                    if (j < stack[i].nParameters - 1)
-                        printf(", ");
-                }
-                if (stack[i].qualifiers & VARARG) {
-                    if (stack[i].nParameters > 0)
-                        printf(", ");
-                    printf("...");
-                }
-                printf(")");
-            }
-            printf(" ");
-            Node tmp = (Node) {
-                .type = NT_COMPOUND,
-                .node = funcDecl->body
-            };
-            printNode(&tmp, depth + 1);
+            printer->next = depth + 1;
         } break;
         case NT_ARRAYACCESS: {
-            ArrayAccessNode *access = (ArrayAccessNode*)node->node;
-            printf("(");
-            printNode(access->array, 0);
-            printf("[");
-            printNode(access->index, 0);
-            printf("]");
-            printf(")");
+            if (step == VISIT_ENTER)
+                fprintf(out, "(");
+            else if (step == VISIT_CHILD && child == 1)
+                fprintf(out, "[");
+            else if (step == VISIT_LEAVE)
+                fprintf(out, "])");
         } break;
         case NT_ACCESS: {
             AccessNode *access = (AccessNode*)node->node;
-            printf("(");
-            printNode(access->object, 0);
-            printf("%s%s)", operatorFromToken(access->op), access->member.value);
+            if (step == VISIT_ENTER)
+                fprintf(out, "(");
+            else if (step == VISIT_LEAVE)
+                fprintf(out, "%s%s)", operatorFromToken(access->op), access->member.value);
         } break;
         case NT_FOR: {
-            ForNode *forLoop = (ForNode*)node->node;
-            printf("for (");
-            if (forLoop->initializer)
-                printNode(forLoop->initializer, 0);
-            printf(";");
-            if (forLoop->condition)
-                printNode(forLoop->condition, 0);
-            printf(";");
-            if (forLoop->increment)
-                printNode(forLoop->increment, 0);
-            printf(") ");
-            printNode(forLoop->body, depth);
+            if (step == VISIT_ENTER) {
+                fprintf(out, "for (");
+            } else if (step == VISIT_CHILD && child > 0) {
+                fprintf(out, child < 3 ? ";" : ") ");
+                if (child == 3)
+                    printer->next = depth;
+            }
         } break;
         case NT_WHILE: {
-            WhileNode *whileLoop = (WhileNode*)node->node;
-            printf("while (");
-            printNode(whileLoop->condition, 0);
-            printf(") ");
-            printNode(whileLoop->body, depth);
+            if (step == VISIT_ENTER) {
+                fprintf(out, "while (");
+            } else if (step == VISIT_CHILD && child == 1) {
+                fprintf(out, ") ");
+                printer->next = depth;
+            }
         } break;
         case NT_IF: {
-            IfNode* ifStatement = (IfNode*)node->node;
-            printf("if (");
-            printNode(ifStatement->conditions[0], 0);
-            printf(") ");
-            printNode(ifStatement->bodies[0], depth);
-            for (size_t i = 1; i < ifStatement->nCases; i++) {
-                printf(" else if (");
-                printNode(ifStatement->conditions[i], 0);
-                printf(") ");
-                printNode(ifStatement->bodies[i], depth);
-            }
-            if (ifStatement->elseCase != NULL) {
-                printf(" else ");
-                printNode(ifStatement->elseCase, depth);
+            IfNode *ifStatement = (IfNode*)node->node;
+            if (step == VISIT_ENTER) {
+                fprintf(out, "if (");
+            } else if (step == VISIT_CHILD) {
+                if (child == ifStatement->nCases * 2) {
+                    if (ifStatement->elseCase != NULL)
+                        fprintf(out, " else ");
+                    printer->next = depth;
+                } else if (child % 2) {
+                    fprintf(out, ") ");
+                    printer->next = depth;
+                } else if (child > 0) {
+                    fprintf(out, " else if (");
+                }
             }
         } break;
         case NT_SWITCH: {
-            printf("TODO: NT_SWITCH");
+            if (step == VISIT_ENTER)
+                fprintf(out, "TODO: NT_SWITCH");
         } break;
         case NT_GOTO: {
-            printf("goto %s", ((GotoNode*)node->node)->label.value);
+            if (step == VISIT_ENTER)
+                fprintf(out, "goto %s", ((GotoNode*)node->node)->label.value);
         } break;
         case NT_LABEL: {
-            printf("%s:", ((LabelNode*)node->node)->name.value);
+            if (step == VISIT_ENTER)
+                fprintf(out, "%s:", ((LabelNode*)node->node)->name.value);
         } break;
         case NT_BREAK: {
-            printf("break");
+            if (step == VISIT_ENTER)
+                fprintf(out, "break");
         } break;
         case NT_RETURN: {
-            printf("return ");
-            if (node->node != NULL)
-                printNode(node->node, 0);
+            if (step == VISIT_ENTER)
+                fprintf(out, "return ");
         } break;
         case NT_TRY: {
-            TryNode *try = (TryNode*)node->node;
-            printf("try ");
-            printNode(try->body, depth);
-            printf(" catch ");
-            printNode(try->catchBody, depth);
-        } break;
-        case NT_CLASS: {
-            TypeNode *type = (TypeNode*)node->node;
-            printf("class %s {\n", type->name.value);
-            for (size_t i = 0; i < type->nFields; i++) {
-                for (size_t j = 0; j < depth; j++)
-                    printf("  ");
-                Node tmp = (Node) {
-                    .type = NT_VARDECL,
-                    .node = type->fields[i]
-                };
-                printNode(&tmp, 0);
-                printf(";\n");
-            }
-            printf("}");
+            if (step == VISIT_ENTER)
+                fprintf(out, "try ");
+            else if (step == VISIT_CHILD && child == 1)
+                fprintf(out, " catch ");
+            printer->next = depth;
         } break;
+        case NT_CLASS:
         case NT_UNION: {
             TypeNode *type = (TypeNode*)node->node;
-            printf("union %s {\n", type->name.value);
-            for (size_t i = 0; i < type->nFields; i++) {
-                for (size_t j = 0; j < depth; j++)
-                    printf("  ");
-                Node tmp = (Node) {
-                    .type = NT_VARDECL,
-                    .node = type->fields[i]
-                };
-                printNode(&tmp, 0);
-                printf(";\n");
+            if (step == VISIT_ENTER) {
+                fprintf(out, "%s %s {\n", node->type == NT_CLASS ? "class" : "union", type->name.value);
+            } else if (step == VISIT_CHILD) {
+                if (child > 0)
+                    fprintf(out, ";\n");
+                printIndent(out, depth);
+            } else {
+                if (type->nFields > 0)
+                    fprintf(out, ";\n");
+                fprintf(out, "}");
             }
-            printf("}");
         } break;
         case NT_COMPOUND: {
             CompoundNode *compound = (CompoundNode*)node->node;
-            printf("{\n");
-            for (size_t i = 0; i < compound->nStatements; i++) {
-                for (size_t j = 0; j < depth; j++)
-                    printf("  ");
-                printNode(compound->statements[i], depth + 1);
-                if (compound->statements[i]->type != NT_LABEL)
-                    printf(";\n");
+            if (step == VISIT_ENTER) {
+                fprintf(out, "{\n");
+            } else if (step == VISIT_CHILD) {
+                if (child > 0)
+                    endStatement(out, compound->statements[child - 1]);
+                printIndent(out, depth);
+                printer->next = depth + 1;
+            } else {
+                if (compound->nStatements > 0)
+                    endStatement(out, compound->statements[compound->nStatements - 1]);
+                fprintf(out, "}");
             }
-            printf("}");
         } break;
     }
+    return true;
+}
+
+void printNode(FILE *out, Node *node, size_t depth, const char *source) {
+    Printer printer = {
+        .out = out,
+        .source = source,
+        .next = depth
+    };
+    visitNode(node, printVisitor, &printer);
+    free(printer.depths);
 }
 #endif /* TRANSPILER */
@@ -0,0 +1,32 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#include "pch.h"
+#include "lexer.h"
+
+bool loadPrecompiledHeader(PrecompiledHeader *header, const char *path, Interner *interner, Diagnostics *diagnostics) {
+    if (!openSourceFile(&header->file, path, diagnostics))
+        return false;
+    /* Tokens point into the source, it stays open as long as the declarations are around */
+    initArena(&header->arena, ARENA_BLOCK_SIZE);
+    Lexer lexer;
+    initLexer(&lexer, header->file.data, header->file.length, path, interner, diagnostics);
+    header->declarations = parseUnit(&lexer, &header->arena, NULL, &header->types);
+    freeLexer(&lexer);
+    if (header->declarations == NULL) {
+        freeArena(&header->arena);
+        closeSourceFile(&header->file);
+        return false;
+    }
+    return true;
+}
+
+void freePrecompiledHeader(PrecompiledHeader *header) {
+    freeTypeRegistry(&header->types);
+    freeArena(&header->arena);
+    closeSourceFile(&header->file);
+    header->declarations = NULL;
+}
@@ -0,0 +1,176 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif /* _WIN32 */
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif /* _WIN32 */
+
+#include "profile.h"
+#include "visitor.h"
+
+static const char *phaseNames[PHASE_COUNT] = {
+    [PHASE_READ] = "read",
+    [PHASE_LEX] = "lex",
+    [PHASE_CACHE_LOAD] = "cache_load",
+    [PHASE_PARSE] = "parse",
+    [PHASE_CACHE_STORE] = "cache_store",
+    [PHASE_CODEGEN] = "codegen",
+    [PHASE_RELEASE] = "release"
+};
+
+static const char *nodeTypeNames[NT_COMPOUND + 1] = {
+    [NT_NONE] = "NT_NONE",
+    [NT_INT] = "NT_INT",
+    [NT_FLOAT] = "NT_FLOAT",
+    [NT_STRING] = "NT_STRING",
+    [NT_CHAR] = "NT_CHAR",
+    [NT_BINOP] = "NT_BINOP",
+    [NT_UNARYOP] = "NT_UNARYOP",
+    [NT_VARACCESS] = "NT_VARACCESS",
+    [NT_VARDECL] = "NT_VARDECL",
+    [NT_ASSIGN] = "NT_ASSIGN",
+    [NT_FUNCCALL] = "NT_FUNCCALL",
+    [NT_FUNCDECL] = "NT_FUNCDECL",
+    [NT_ARRAYACCESS] = "NT_ARRAYACCESS",
+    [NT_ACCESS] = "NT_ACCESS",
+    [NT_FOR] = "NT_FOR",
+    [NT_WHILE] = "NT_WHILE",
+    [NT_IF] = "NT_IF",
+    [NT_SWITCH] = "NT_SWITCH",
+    [NT_GOTO] = "NT_GOTO",
+    [NT_LABEL] = "NT_LABEL",
+    [NT_BREAK] = "NT_BREAK",
+    [NT_RETURN] = "NT_RETURN",
+    [NT_TRY] = "NT_TRY",
+    [NT_CLASS] = "NT_CLASS",
+    [NT_UNION] = "NT_UNION",
+    [NT_COMPOUND] = "NT_COMPOUND"
+};
+
+uint64_t profileClock(void) {
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000u +
+        (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000u / (uint64_t)frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#endif /* _WIN32 */
+}
+
+static bool countVisitor(void *data, Node *node, VisitStep step, size_t child) {
+    (void)child;
+    if (step == VISIT_ENTER)
+        ((UnitProfile*)data)->nodes[node->type] += 1;
+    return true;
+}
+
+void countNodes(UnitProfile *profile, Node *root) {
+    visitNode(root, countVisitor, profile);
+}
+
+void countFlatNodes(UnitProfile *profile, const FlatAst *ast) {
+    for (size_t i = 0; i < ast->nNodes; i++)
+        profile->nodes[ast->nodes[i].type] += 1;
+}
+
+static double seconds(uint64_t nanoseconds) {
+    return nanoseconds / 1e9;
+}
+
+static double perSecond(size_t amount, uint64_t nanoseconds) {
+    return nanoseconds ? amount / seconds(nanoseconds) : 0.0;
+}
+
+static void printJsonString(FILE *out, const char *str) {
+    fputc('"', out);
+    for (; *str; str++) {
+        unsigned char c = (unsigned char)*str;
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+/* Everything but the path, wall and jobs, which only some entries have */
+static void printProfile(FILE *out, const UnitProfile *profile, uint64_t total, const char *indent) {
+    fprintf(out, "%s\"bytes\": %zu,\n", indent, profile->bytes);
+    fprintf(out, "%s\"tokens\": %zu,\n", indent, profile->tokens);
+    fprintf(out, "%s\"seconds\": {", indent);
+    for (size_t i = 0; i < PHASE_COUNT; i++)
+        fprintf(out, "%s\"%s\": %.9f", i ? ", " : "", phaseNames[i], seconds(profile->phases[i]));
+    fprintf(out, ", \"total\": %.9f},\n", seconds(total));
+    /* Tokens per second of lexing alone, bytes per second of everything done to the file */
+    fprintf(out, "%s\"tokens_per_second\": %.1f,\n", indent, perSecond(profile->tokens, profile->phases[PHASE_LEX]));
+    fprintf(out, "%s\"bytes_per_second\": %.1f,\n", indent, perSecond(profile->bytes, total));
+    fprintf(out, "%s\"nodes\": {", indent);
+    bool first = true;
+    for (size_t i = 0; i <= NT_COMPOUND; i++) {
+        if (profile->nodes[i] == 0)
+            continue;
+        fprintf(out, "%s\"%s\": %zu", first ? "" : ", ", nodeTypeNames[i], profile->nodes[i]);
+        first = false;
+    }
+    fprintf(out, "},\n");
+    fprintf(out, "%s\"allocations\": {\"ast\": {\"count\": %zu, \"bytes\": %zu}, \"strings\": {\"count\": %zu, \"bytes\": %zu}}", indent,
+        profile->astAllocations, profile->astBytes, profile->stringAllocations, profile->stringBytes);
+}
+
+static uint64_t profileTotal(const UnitProfile *profile) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < PHASE_COUNT; i++)
+        total += profile->phases[i];
+    return total;
+}
+
+void printTimeReport(FILE *out, const char **paths, const UnitProfile *profiles, size_t count, uint64_t wall, size_t jobs) {
+    UnitProfile sum;
+    memset(&sum, 0, sizeof(UnitProfile));
+    size_t cached = 0;
+    fprintf(out, "{\n  \"files\": [\n");
+    for (size_t i = 0; i < count; i++) {
+        const UnitProfile *profile = &profiles[i];
+        fprintf(out, "    {\n      \"path\": ");
+        printJsonString(out, paths[i]);
+        fprintf(out, ",\n      \"cached\": %s,\n", profile->cached ? "true" : "false");
+        printProfile(out, profile, profileTotal(profile), "      ");
+        fprintf(out, "\n    }%s\n", i + 1 < count ? "," : "");
+
+        for (size_t j = 0; j < PHASE_COUNT; j++)
+            sum.phases[j] += profile->phases[j];
+        for (size_t j = 0; j <= NT_COMPOUND; j++)
+            sum.nodes[j] += profile->nodes[j];
+        sum.bytes += profile->bytes;
+        sum.tokens += profile->tokens;
+        sum.astAllocations += profile->astAllocations;
+        sum.astBytes += profile->astBytes;
+        sum.stringAllocations += profile->stringAllocations;
+        sum.stringBytes += profile->stringBytes;
+        cached += profile->cached;
+    }
+    /* Phases are summed over all workers, throughput is against the wall time of the whole run */
+    fprintf(out, "  ],\n  \"total\": {\n");
+    fprintf(out, "    \"files\": %zu,\n    \"cached\": %zu,\n    \"jobs\": %zu,\n", count, cached, jobs);
+    fprintf(out, "    \"wall_seconds\": %.9f,\n", seconds(wall));
+    printProfile(out, &sum, wall, "    ");
+    fprintf(out, "\n  }\n}\n");
+}
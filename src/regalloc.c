@@ -0,0 +1,163 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "regalloc.h"
+
+X86Register machineRegister(Register reg) {
+    switch (reg) {
+        case REG_RAX: case REG_EAX: case REG_AX: case REG_AH: case REG_AL: return X86_RAX;
+        case REG_RBX: case REG_EBX: case REG_BX: case REG_BH: case REG_BL: return X86_RBX;
+        case REG_RCX: case REG_ECX: case REG_CX: case REG_CH: case REG_CL: return X86_RCX;
+        case REG_RDX: case REG_EDX: case REG_DX: case REG_DH: case REG_DL: return X86_RDX;
+        case REG_RSI: case REG_ESI: case REG_SI: case REG_SIL: return X86_RSI;
+        case REG_RDI: case REG_EDI: case REG_DI: case REG_DIL: return X86_RDI;
+        case REG_RBP: case REG_EBP: case REG_BP: case REG_BPL: return X86_RBP;
+        case REG_RSP: case REG_ESP: case REG_SP: case REG_SPL: return X86_RSP;
+        case REG_R8: return X86_R8;
+        case REG_R9: return X86_R9;
+        case REG_R10: return X86_R10;
+        case REG_R11: return X86_R11;
+        case REG_R12: return X86_R12;
+        case REG_R13: return X86_R13;
+        case REG_R14: return X86_R14;
+        case REG_R15: return X86_R15;
+        default: return X86_NONE;
+    }
+}
+
+static bool overlaps(const LiveInterval *a, const LiveInterval *b) {
+    return a->start <= b->end && b->start <= a->end;
+}
+
+static bool isPinned(const LiveInterval *interval) {
+    return interval->request > NOREG && !interval->pinRefused;
+}
+
+/* Whether interval can go in reg as far as calls and the variables pinned to reg are concerned */
+static bool canUse(const LiveInterval *intervals, const size_t *pinned, size_t nPinned, const LiveInterval *interval,
+                   X86Register reg, const CallingConvention *convention) {
+    if (interval->crossesCall && !isCalleeSaved(convention, reg))
+        return false;
+    for (size_t i = 0; i < nPinned; i++) {
+        const LiveInterval *other = &intervals[pinned[i]];
+        if (other != interval && other->assigned == reg && overlaps(other, interval))
+            return false;
+    }
+    return true;
+}
+
+static bool startsBefore(const LiveInterval *intervals, size_t a, size_t b) {
+    return intervals[a].start != intervals[b].start ? intervals[a].start < intervals[b].start : a < b;
+}
+
+/* Insertion sort, variables come in the order they were declared, which is nearly sorted already */
+static void sortByStart(size_t *order, size_t count, const LiveInterval *intervals) {
+    for (size_t i = 1; i < count; i++) {
+        size_t item = order[i], j = i;
+        while (j > 0 && startsBefore(intervals, item, order[j - 1])) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = item;
+    }
+}
+
+/* reg on its own, or a pin that couldn't be honoured */
+static bool asksForRegister(const LiveInterval *interval) {
+    return interval->request == AUTO || interval->request > NOREG;
+}
+
+/* Which of two variables is better off in memory: one without a reg qualifier, then the one that lives longer */
+static bool spillsFirst(const LiveInterval *a, const LiveInterval *b) {
+    if (asksForRegister(a) != asksForRegister(b))
+        return asksForRegister(b);
+    return a->end > b->end;
+}
+
+void allocateRegisters(LiveInterval *intervals, size_t count, const X86Register *available, size_t nAvailable,
+                       const CallingConvention *convention) {
+    size_t *order = malloc((count ? count : 1) * sizeof(size_t));
+    size_t *pinned = malloc((count ? count : 1) * sizeof(size_t));
+    size_t *active = malloc((count ? count : 1) * sizeof(size_t));
+    if (order == NULL || pinned == NULL || active == NULL) {
+        fprintf(stderr, "Fatal: Out of memory while allocating registers.\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < count; i++) {
+        order[i] = i;
+        intervals[i].assigned = X86_NONE;
+        intervals[i].pinRefused = false;
+    }
+    sortByStart(order, count, intervals);
+
+    /* Pins first, in the order the variables were declared. A later one that clashes with an earlier one loses */
+    size_t nPinned = 0;
+    for (size_t i = 0; i < count; i++) {
+        LiveInterval *interval = &intervals[order[i]];
+        if (interval->request <= NOREG)
+            continue;
+        X86Register reg = machineRegister(interval->request);
+        bool usable = false;
+        for (size_t j = 0; j < nAvailable; j++)
+            usable = usable || available[j] == reg;
+        if (!usable || !canUse(intervals, pinned, nPinned, interval, reg, convention)) {
+            interval->pinRefused = true;
+            continue;
+        }
+        interval->assigned = reg;
+        pinned[nPinned++] = order[i];
+    }
+
+    /* Everything else in order of where it starts, active holds the ones in registers that are still live */
+    size_t nActive = 0;
+    for (size_t i = 0; i < count; i++) {
+        LiveInterval *interval = &intervals[order[i]];
+        if (interval->request == NOREG || isPinned(interval))
+            continue;
+        size_t kept = 0;
+        for (size_t j = 0; j < nActive; j++) {
+            if (intervals[active[j]].end >= interval->start)
+                active[kept++] = active[j];
+        }
+        nActive = kept;
+
+        X86Register chosen = X86_NONE;
+        for (size_t j = 0; j < nAvailable && chosen == X86_NONE; j++) {
+            X86Register reg = available[j];
+            bool taken = !canUse(intervals, pinned, nPinned, interval, reg, convention);
+            for (size_t k = 0; k < nActive && !taken; k++)
+                taken = intervals[active[k]].assigned == reg;
+            if (!taken)
+                chosen = reg;
+        }
+        if (chosen != X86_NONE) {
+            interval->assigned = chosen;
+            active[nActive++] = order[i];
+            continue;
+        }
+
+        /* Out of registers, either this variable or one holding a register it could use goes to memory */
+        size_t victim = count;
+        for (size_t j = 0; j < nActive; j++) {
+            LiveInterval *other = &intervals[active[j]];
+            if (!canUse(intervals, pinned, nPinned, interval, other->assigned, convention))
+                continue;
+            if (spillsFirst(other, victim == count ? interval : &intervals[active[victim]]))
+                victim = j;
+        }
+        if (victim == count)
+            continue;
+        interval->assigned = intervals[active[victim]].assigned;
+        intervals[active[victim]].assigned = X86_NONE;
+        active[victim] = order[i];
+    }
+    free(order);
+    free(pinned);
+    free(active);
+}
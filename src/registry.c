@@ -0,0 +1,120 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "registry.h"
+#include "intern.h"
+
+#define REGISTRY_INITIAL_CAPACITY 64
+
+/* Atoms are dense, so a multiplicative hash spreads them well enough */
+#define SLOT(NAME, CAPACITY) (((size_t)atomOf(NAME) * 2654435761u) & ((CAPACITY) - 1))
+
+static void *allocOrDie(void *ptr, size_t size) {
+    ptr = realloc(ptr, size);
+    if (ptr == NULL) {
+        fprintf(stderr, "Fatal: Out of memory while growing the type registry.\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static void insert(const char **slots, size_t capacity, const char *name) {
+    size_t slot = SLOT(name, capacity);
+    while (slots[slot] != NULL)
+        slot = (slot + 1) & (capacity - 1);
+    slots[slot] = name;
+}
+
+void initTypeRegistry(TypeRegistry *registry) {
+    registry->capacity = REGISTRY_INITIAL_CAPACITY;
+    registry->slots = calloc(registry->capacity, sizeof(char*));
+    registry->orderCapacity = REGISTRY_INITIAL_CAPACITY / 2;
+    registry->order = allocOrDie(NULL, registry->orderCapacity * sizeof(char*));
+    registry->count = 0;
+    if (registry->slots == NULL) {
+        fprintf(stderr, "Fatal: Out of memory while allocating the type registry.\n");
+        exit(1);
+    }
+}
+
+void freeTypeRegistry(TypeRegistry *registry) {
+    free(registry->slots);
+    free(registry->order);
+    registry->slots = NULL;
+    registry->order = NULL;
+    registry->capacity = 0;
+    registry->orderCapacity = 0;
+    registry->count = 0;
+}
+
+void copyTypeRegistry(TypeRegistry *copy, const TypeRegistry *registry) {
+    /* Copying the slots as they are keeps the table identical to inserting the names one by one */
+    copy->capacity = registry->capacity;
+    copy->slots = allocOrDie(NULL, copy->capacity * sizeof(char*));
+    memcpy(copy->slots, registry->slots, copy->capacity * sizeof(char*));
+    copy->orderCapacity = registry->orderCapacity;
+    copy->order = allocOrDie(NULL, copy->orderCapacity * sizeof(char*));
+    memcpy(copy->order, registry->order, registry->count * sizeof(char*));
+    copy->count = registry->count;
+}
+
+bool containsType(const TypeRegistry *registry, const char *name) {
+    size_t slot = SLOT(name, registry->capacity);
+    while (registry->slots[slot] != NULL) {
+        if (registry->slots[slot] == name)
+            return true;
+        slot = (slot + 1) & (registry->capacity - 1);
+    }
+    return false;
+}
+
+bool addType(TypeRegistry *registry, const char *name) {
+    if (containsType(registry, name))
+        return false;
+    if (registry->count == registry->orderCapacity) {
+        registry->orderCapacity *= 2;
+        registry->order = allocOrDie(registry->order, registry->orderCapacity * sizeof(char*));
+    }
+    registry->order[registry->count++] = name;
+    if (registry->count * 2 > registry->capacity) {
+        /*
+         * Rehash in insertion order. This keeps the table identical to inserting
+         * the names one by one, which is what makes LIFO removal in popTypeScope safe.
+         */
+        free(registry->slots);
+        registry->capacity *= 2;
+        registry->slots = calloc(registry->capacity, sizeof(char*));
+        if (registry->slots == NULL) {
+            fprintf(stderr, "Fatal: Out of memory while growing the type registry.\n");
+            exit(1);
+        }
+        for (size_t i = 0; i < registry->count; i++)
+            insert(registry->slots, registry->capacity, registry->order[i]);
+    } else {
+        insert(registry->slots, registry->capacity, name);
+    }
+    return true;
+}
+
+void popTypeScope(TypeRegistry *registry, size_t scope) {
+    /*
+     * The most recently inserted name took the first free slot on its probe
+     * sequence and nothing inserted before it probes past that slot, so clearing
+     * it restores the table to how it was before the insertion.
+     */
+    while (registry->count > scope) {
+        const char *name = registry->order[--registry->count];
+        size_t slot = SLOT(name, registry->capacity);
+        while (registry->slots[slot] != name)
+            slot = (slot + 1) & (registry->capacity - 1);
+        registry->slots[slot] = NULL;
+    }
+}
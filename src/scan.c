@@ -0,0 +1,157 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#include <stdint.h>
+
+#include "scan.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SCAN_BLOCK 32
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCAN_BLOCK 16
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+/* Bit n of a mask stands for byte n of a block */
+typedef uint32_t Mask;
+
+/* Undefined for a mask of 0 */
+static inline unsigned lowestBit(Mask mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctz(mask);
+#elif defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    unsigned index = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+#define ISWHITESPACE(C) ((C) == ' ' || (C) == '\t' || (C) == '\r' || (C) == '\n')
+#define ISIDENTIFIER(C) (((C) >= 'a' && (C) <= 'z') || ((C) >= 'A' && (C) <= 'Z') || ((C) >= '0' && (C) <= '9') || (C) == '_')
+#define ISDIGIT(C) ((C) >= '0' && (C) <= '9')
+
+#ifdef SCAN_BLOCK
+#if SCAN_BLOCK == 32
+typedef __m256i Vector;
+#define FULL_MASK 0xFFFFFFFFu
+#define LOAD(P) _mm256_loadu_si256((const __m256i*)(P))
+#define SPLAT(C) _mm256_set1_epi8((char)(C))
+#define EQ(A, B) _mm256_cmpeq_epi8((A), (B))
+#define GT(A, B) _mm256_cmpgt_epi8((A), (B))
+#define OR(A, B) _mm256_or_si256((A), (B))
+#define AND(A, B) _mm256_and_si256((A), (B))
+#define MASK(V) ((Mask)_mm256_movemask_epi8(V))
+#else
+typedef __m128i Vector;
+#define FULL_MASK 0xFFFFu
+#define LOAD(P) _mm_loadu_si128((const __m128i*)(P))
+#define SPLAT(C) _mm_set1_epi8((char)(C))
+#define EQ(A, B) _mm_cmpeq_epi8((A), (B))
+#define GT(A, B) _mm_cmpgt_epi8((A), (B))
+#define OR(A, B) _mm_or_si128((A), (B))
+#define AND(A, B) _mm_and_si128((A), (B))
+#define MASK(V) ((Mask)_mm_movemask_epi8(V))
+#endif
+
+/* Signed compares are fine for these ranges, bytes >= 0x80 are negative and never match */
+#define INRANGE(V, LOW, HIGH) AND(GT((V), SPLAT((LOW) - 1)), GT(SPLAT((HIGH) + 1), (V)))
+
+static inline Mask whitespaceMask(Vector block) {
+    return MASK(OR(OR(EQ(block, SPLAT(' ')), EQ(block, SPLAT('\t'))), OR(EQ(block, SPLAT('\r')), EQ(block, SPLAT('\n')))));
+}
+
+static inline Mask identifierMask(Vector block) {
+    /* Setting bit 5 folds upper case letters onto lower case ones and leaves no other byte in 'a'..'z' */
+    Vector folded = OR(block, SPLAT(0x20));
+    return MASK(OR(OR(INRANGE(folded, 'a', 'z'), INRANGE(block, '0', '9')), EQ(block, SPLAT('_'))));
+}
+
+static inline Mask digitMask(Vector block) {
+    return MASK(INRANGE(block, '0', '9'));
+}
+
+static inline Mask byteMask(Vector block, char c) {
+    return MASK(EQ(block, SPLAT(c)));
+}
+#endif /* SCAN_BLOCK */
+
+size_t scanWhitespace(const char *source, size_t i, size_t length) {
+#ifdef SCAN_BLOCK
+    for (; i + SCAN_BLOCK <= length; i += SCAN_BLOCK) {
+        Mask stop = ~whitespaceMask(LOAD(source + i)) & FULL_MASK;
+        if (stop)
+            return i + lowestBit(stop);
+    }
+#endif /* SCAN_BLOCK */
+    while (i < length && ISWHITESPACE(source[i]))
+        i++;
+    return i;
+}
+
+size_t scanIdentifier(const char *source, size_t i, size_t length) {
+#ifdef SCAN_BLOCK
+    for (; i + SCAN_BLOCK <= length; i += SCAN_BLOCK) {
+        Mask stop = ~identifierMask(LOAD(source + i)) & FULL_MASK;
+        if (stop)
+            return i + lowestBit(stop);
+    }
+#endif /* SCAN_BLOCK */
+    while (i < length && ISIDENTIFIER(source[i]))
+        i++;
+    return i;
+}
+
+size_t scanDigits(const char *source, size_t i, size_t length) {
+#ifdef SCAN_BLOCK
+    for (; i + SCAN_BLOCK <= length; i += SCAN_BLOCK) {
+        Mask stop = ~digitMask(LOAD(source + i)) & FULL_MASK;
+        if (stop)
+            return i + lowestBit(stop);
+    }
+#endif /* SCAN_BLOCK */
+    while (i < length && ISDIGIT(source[i]))
+        i++;
+    return i;
+}
+
+/* Shared by the functions below, finds the first of up to two bytes */
+static size_t scanUntil(const char *source, size_t i, size_t length, char first, char second) {
+#ifdef SCAN_BLOCK
+    for (; i + SCAN_BLOCK <= length; i += SCAN_BLOCK) {
+        Vector block = LOAD(source + i);
+        Mask stop = byteMask(block, first) | byteMask(block, second);
+        if (stop)
+            return i + lowestBit(stop);
+    }
+#endif /* SCAN_BLOCK */
+    while (i < length && source[i] != first && source[i] != second)
+        i++;
+    return i;
+}
+
+size_t scanString(const char *source, size_t i, size_t length) {
+    return scanUntil(source, i, length, '"', '\\');
+}
+
+size_t scanStar(const char *source, size_t i, size_t length) {
+    return scanUntil(source, i, length, '*', '*');
+}
+
+size_t scanLine(const char *source, size_t i, size_t length) {
+    return scanUntil(source, i, length, '\n', '\n');
+}
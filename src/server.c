@@ -0,0 +1,302 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif /* _WIN32 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#else
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#endif /* _WIN32 */
+
+#include "server.h"
+
+#define DIRECTORY_BUFFER_SIZE 256
+
+#ifdef _WIN32
+#define PIPE_PREFIX "\\\\.\\pipe\\"
+#define PIPE_BUFFER_SIZE (64 * 1024)
+#define PIPE_POLL_INTERVAL 5 /* Milliseconds */
+
+static HANDLE createInstance(const char *pipe, bool first) {
+    DWORD mode = PIPE_ACCESS_DUPLEX | (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0);
+    return CreateNamedPipeA(pipe, mode, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
+        PIPE_UNLIMITED_INSTANCES, PIPE_BUFFER_SIZE, PIPE_BUFFER_SIZE, 0, NULL);
+}
+
+static char *pipeName(const char *name) {
+    size_t length = strlen(PIPE_PREFIX) + strlen(name) + 1;
+    char *pipe = malloc(length);
+    if (pipe != NULL)
+        snprintf(pipe, length, "%s%s", PIPE_PREFIX, name);
+    return pipe;
+}
+
+bool listenServer(Listener *listener, const char *name) {
+    listener->pipe = pipeName(name);
+    if (listener->pipe == NULL)
+        return false;
+    /* The first instance can only be created once, a second server on the same name fails here */
+    listener->instance = createInstance(listener->pipe, true);
+    if (listener->instance == INVALID_HANDLE_VALUE) {
+        free(listener->pipe);
+        return false;
+    }
+    return true;
+}
+
+void closeListener(Listener *listener) {
+    if (listener->instance != NULL)
+        CloseHandle(listener->instance);
+    free(listener->pipe);
+}
+
+bool acceptClient(Listener *listener, Connection *connection) {
+    if (listener->instance == NULL) {
+        listener->instance = createInstance(listener->pipe, false);
+        if (listener->instance == INVALID_HANDLE_VALUE) {
+            listener->instance = NULL;
+            return false;
+        }
+    }
+    /* A client that connected before the call is connected already */
+    if (!ConnectNamedPipe(listener->instance, NULL) && GetLastError() != ERROR_PIPE_CONNECTED) {
+        CloseHandle(listener->instance);
+        listener->instance = NULL;
+        return false;
+    }
+    connection->handle = listener->instance;
+    connection->server = true;
+    connection->timeout = 0;
+    listener->instance = NULL;
+    return true;
+}
+
+bool connectServer(Connection *connection, const char *name) {
+    char *pipe = pipeName(name);
+    if (pipe == NULL)
+        return false;
+    HANDLE handle = CreateFileA(pipe, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+    /* Up, but between two clients */
+    if (handle == INVALID_HANDLE_VALUE && GetLastError() == ERROR_PIPE_BUSY && WaitNamedPipeA(pipe, NMPWAIT_USE_DEFAULT_WAIT))
+        handle = CreateFileA(pipe, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+    free(pipe);
+    if (handle == INVALID_HANDLE_VALUE)
+        return false;
+    connection->handle = handle;
+    connection->server = false;
+    connection->timeout = 0;
+    return true;
+}
+
+void closeConnection(Connection *connection) {
+    if (connection->server) {
+        /* Everything written has to reach the client before the instance goes away */
+        FlushFileBuffers(connection->handle);
+        DisconnectNamedPipe(connection->handle);
+    }
+    CloseHandle(connection->handle);
+}
+
+bool sendBytes(Connection *connection, const void *data, size_t length) {
+    const char *bytes = data;
+    while (length > 0) {
+        DWORD chunk = length > PIPE_BUFFER_SIZE ? PIPE_BUFFER_SIZE : (DWORD)length, written;
+        if (!WriteFile(connection->handle, bytes, chunk, &written, NULL))
+            return false;
+        bytes += written;
+        length -= written;
+    }
+    return true;
+}
+
+/* Pipes opened for synchronous reads can't time out, so a read waits here until there is something to read */
+static bool awaitBytes(Connection *connection) {
+    ULONGLONG deadline = GetTickCount64() + connection->timeout;
+    for (;;) {
+        DWORD available;
+        if (!PeekNamedPipe(connection->handle, NULL, 0, NULL, &available, NULL))
+            return false;
+        if (available > 0)
+            return true;
+        if (GetTickCount64() >= deadline)
+            return false;
+        Sleep(PIPE_POLL_INTERVAL);
+    }
+}
+
+bool receiveBytes(Connection *connection, void *data, size_t length) {
+    char *bytes = data;
+    while (length > 0) {
+        DWORD chunk = length > PIPE_BUFFER_SIZE ? PIPE_BUFFER_SIZE : (DWORD)length, read;
+        if (connection->timeout > 0 && !awaitBytes(connection))
+            return false;
+        if (!ReadFile(connection->handle, bytes, chunk, &read, NULL) || read == 0)
+            return false;
+        bytes += read;
+        length -= read;
+    }
+    return true;
+}
+
+bool setReceiveTimeout(Connection *connection, unsigned milliseconds) {
+    connection->timeout = milliseconds;
+    return true;
+}
+
+char *workingDirectory(void) {
+    return _getcwd(NULL, 0);
+}
+
+/* Rooted or with a drive. C:file is relative to the drive's own directory, the client's can't help with it */
+static bool isAbsolute(const char *path) {
+    return path[0] == '/' || path[0] == '\\' || (path[0] != '\0' && path[1] == ':');
+}
+#else
+static bool socketAddress(struct sockaddr_un *address, const char *name) {
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    if (strlen(name) >= sizeof(address->sun_path))
+        return false;
+    strcpy(address->sun_path, name);
+    return true;
+}
+
+bool listenServer(Listener *listener, const char *name) {
+    struct sockaddr_un address;
+    if (!socketAddress(&address, name))
+        return false;
+    /* Nothing answering on an existing socket means its server is gone, the socket is reused */
+    Connection running;
+    if (connectServer(&running, name)) {
+        closeConnection(&running);
+        return false;
+    }
+    unlink(name);
+    listener->socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener->socket < 0)
+        return false;
+    if (bind(listener->socket, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener->socket, SOMAXCONN) != 0) {
+        close(listener->socket);
+        return false;
+    }
+    listener->path = malloc(strlen(name) + 1);
+    if (listener->path != NULL)
+        strcpy(listener->path, name);
+    /* A client going away mid-response is an error from send, not a signal that ends the server */
+    signal(SIGPIPE, SIG_IGN);
+    return true;
+}
+
+void closeListener(Listener *listener) {
+    close(listener->socket);
+    if (listener->path != NULL)
+        unlink(listener->path);
+    free(listener->path);
+}
+
+bool acceptClient(Listener *listener, Connection *connection) {
+    do {
+        connection->socket = accept(listener->socket, NULL, NULL);
+    } while (connection->socket < 0 && errno == EINTR);
+    return connection->socket >= 0;
+}
+
+bool connectServer(Connection *connection, const char *name) {
+    struct sockaddr_un address;
+    if (!socketAddress(&address, name))
+        return false;
+    connection->socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection->socket < 0)
+        return false;
+    if (connect(connection->socket, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(connection->socket);
+        return false;
+    }
+    return true;
+}
+
+void closeConnection(Connection *connection) {
+    close(connection->socket);
+}
+
+bool sendBytes(Connection *connection, const void *data, size_t length) {
+    const char *bytes = data;
+    while (length > 0) {
+        ssize_t sent = send(connection->socket, bytes, length, 0);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+        bytes += sent;
+        length -= (size_t)sent;
+    }
+    return true;
+}
+
+bool receiveBytes(Connection *connection, void *data, size_t length) {
+    char *bytes = data;
+    while (length > 0) {
+        ssize_t received = recv(connection->socket, bytes, length, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        bytes += received;
+        length -= (size_t)received;
+    }
+    return true;
+}
+
+char *workingDirectory(void) {
+    size_t capacity = DIRECTORY_BUFFER_SIZE;
+    for (;;) {
+        char *path = malloc(capacity);
+        if (path == NULL)
+            return NULL;
+        if (getcwd(path, capacity) != NULL)
+            return path;
+        free(path);
+        if (errno != ERANGE)
+            return NULL;
+        capacity *= 2;
+    }
+}
+
+bool setReceiveTimeout(Connection *connection, unsigned milliseconds) {
+    struct timeval timeout = { .tv_sec = milliseconds / 1000, .tv_usec = (milliseconds % 1000) * 1000 };
+    return setsockopt(connection->socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0;
+}
+
+static bool isAbsolute(const char *path) {
+    return path[0] == '/';
+}
+#endif /* _WIN32 */
+
+char *resolvePath(const char *directory, const char *path) {
+    size_t directoryLength = isAbsolute(path) ? 0 : strlen(directory), pathLength = strlen(path);
+    char *resolved = malloc(directoryLength + 1 + pathLength + 1);
+    if (resolved == NULL)
+        return NULL;
+    size_t length = directoryLength;
+    memcpy(resolved, directory, directoryLength);
+    if (length > 0 && directory[length - 1] != '/' && directory[length - 1] != '\\')
+        resolved[length++] = '/';
+    memcpy(resolved + length, path, pathLength + 1);
+    return resolved;
+}
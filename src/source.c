@@ -0,0 +1,147 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif /* _WIN32 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif /* _WIN32 */
+
+#include "source.h"
+
+#define READ_CHUNK_SIZE (64 * 1024)
+
+/* Fallback for streams that can't be mapped, reads until EOF so the size doesn't have to be known up front */
+static bool readStream(SourceFile *source, FILE *f, const char *path, Diagnostics *diagnostics) {
+    size_t capacity = READ_CHUNK_SIZE;
+    size_t length = 0;
+    char *buffer = malloc(capacity);
+    if (buffer == NULL) {
+        report(diagnostics, "Fatal: Out of memory while reading input file '%s'.\n", path);
+        return false;
+    }
+    for (;;) {
+        if (length == capacity) {
+            capacity *= 2;
+            char *grown = realloc(buffer, capacity);
+            if (grown == NULL) {
+                report(diagnostics, "Fatal: Input file '%s' too big.\n", path);
+                free(buffer);
+                return false;
+            }
+            buffer = grown;
+        }
+        size_t read = fread(buffer + length, 1, capacity - length, f);
+        length += read;
+        if (read == 0)
+            break;
+    }
+    if (ferror(f)) {
+        report(diagnostics, "Fatal: Failed to read input file '%s'.\n", path);
+        free(buffer);
+        return false;
+    }
+    source->data = buffer;
+    source->length = length;
+    source->mapped = false;
+    return true;
+}
+
+static bool readFile(SourceFile *source, const char *path, Diagnostics *diagnostics) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        report(diagnostics, "Fatal: couldn't open input file '%s'.\n", path);
+        return false;
+    }
+    bool result = readStream(source, f, path, diagnostics);
+    fclose(f);
+    return result;
+}
+
+#ifdef _WIN32
+static bool mapFile(SourceFile *source, const char *path) {
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    if (GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        CloseHandle(file);
+        return false;
+    }
+    const char *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == NULL) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    source->data = data;
+    source->length = (size_t)size.QuadPart;
+    source->mapped = true;
+    source->file = file;
+    source->mapping = mapping;
+    return true;
+}
+#else
+static bool mapFile(SourceFile *source, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    /* The mapping keeps the file referenced, the descriptor isn't needed anymore */
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+    source->data = data;
+    source->length = (size_t)info.st_size;
+    source->mapped = true;
+    return true;
+}
+#endif /* _WIN32 */
+
+bool openSourceFile(SourceFile *source, const char *path, Diagnostics *diagnostics) {
+    if (!strcmp(path, "-"))
+        return readStream(source, stdin, "<stdin>", diagnostics);
+    if (mapFile(source, path))
+        return true;
+    return readFile(source, path, diagnostics);
+}
+
+void closeSourceFile(SourceFile *source) {
+    if (source->mapped) {
+    #ifdef _WIN32
+        UnmapViewOfFile(source->data);
+        CloseHandle(source->mapping);
+        CloseHandle(source->file);
+    #else
+        munmap((void*)source->data, source->length);
+    #endif /* _WIN32 */
+    } else {
+        free((void*)source->data);
+    }
+    source->data = NULL;
+    source->length = 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sourcemap.h"
+#include "scan.h"
+
+void initSourceMap(SourceMap *map, const char *source, size_t length) {
+    map->source = source;
+    map->length = length;
+    map->lineStarts = NULL;
+    map->nLines = 0;
+    map->capacity = 0;
+}
+
+void freeSourceMap(SourceMap *map) {
+    free(map->lineStarts);
+    map->lineStarts = NULL;
+    map->nLines = 0;
+    map->capacity = 0;
+}
+
+static void reserveLines(SourceMap *map, size_t nLines) {
+    if (nLines <= map->capacity)
+        return;
+    size_t capacity = map->capacity ? map->capacity : 64;
+    while (capacity < nLines)
+        capacity *= 2;
+    uint32_t *lineStarts = realloc(map->lineStarts, capacity * sizeof(uint32_t));
+    if (lineStarts == NULL) {
+        fprintf(stderr, "Fatal: Out of memory while building the line table.\n");
+        exit(1);
+    }
+    map->lineStarts = lineStarts;
+    map->capacity = capacity;
+}
+
+static void buildLineStarts(SourceMap *map) {
+    reserveLines(map, 1);
+    map->lineStarts[map->nLines++] = 0;
+    for (size_t i = scanLine(map->source, 0, map->length); i < map->length; i = scanLine(map->source, i + 1, map->length)) {
+        reserveLines(map, map->nLines + 1);
+        map->lineStarts[map->nLines++] = (uint32_t)(i + 1);
+    }
+}
+
+/* First line starting after offset */
+static size_t lineAfter(const SourceMap *map, size_t offset) {
+    size_t low = 0, high = map->nLines;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (map->lineStarts[middle] <= offset)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+void editSourceMap(SourceMap *map, const char *source, size_t newLength, size_t offset, size_t removed, size_t length) {
+    map->source = source;
+    map->length = newLength;
+    if (map->lineStarts == NULL)
+        return;
+    /* A line starts right after its line break, the removed ones end the lines in (offset, offset + removed] */
+    size_t first = lineAfter(map, offset);
+    size_t end = lineAfter(map, offset + removed);
+    size_t inserted = 0;
+    for (size_t i = scanLine(source, offset, offset + length); i < offset + length; i = scanLine(source, i + 1, offset + length))
+        inserted++;
+    size_t nLines = map->nLines - (end - first) + inserted;
+    reserveLines(map, nLines);
+    memmove(map->lineStarts + first + inserted, map->lineStarts + end, (map->nLines - end) * sizeof(uint32_t));
+    uint32_t delta = (uint32_t)length - (uint32_t)removed;
+    for (size_t i = first + inserted; i < nLines; i++)
+        map->lineStarts[i] += delta;
+    size_t line = first;
+    for (size_t i = scanLine(source, offset, offset + length); i < offset + length; i = scanLine(source, i + 1, offset + length))
+        map->lineStarts[line++] = (uint32_t)(i + 1);
+    map->nLines = nLines;
+}
+
+void sourcePosition(SourceMap *map, size_t offset, size_t *line, size_t *col) {
+    if (map->lineStarts == NULL)
+        buildLineStarts(map);
+    /* Last line starting at or before offset */
+    size_t low = 0, high = map->nLines;
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+        if (map->lineStarts[middle] <= offset)
+            low = middle;
+        else
+            high = middle;
+    }
+    *line = low + 1;
+    *col = offset - map->lineStarts[low] + 1;
+}
+
+const char *sourceLine(SourceMap *map, size_t line, size_t *len) {
+    if (map->lineStarts == NULL)
+        buildLineStarts(map);
+    size_t start = map->lineStarts[line - 1];
+    size_t end = line < map->nLines ? map->lineStarts[line] - 1 : map->length;
+    if (end > start && map->source[end - 1] == '\r')
+        end--;
+    *len = end - start;
+    return map->source + start;
+}
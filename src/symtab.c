@@ -0,0 +1,118 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "symtab.h"
+#include "intern.h"
+
+/* Most scopes only declare a handful of names */
+#define SCOPE_INITIAL_CAPACITY 8
+
+/* Atoms are dense, so a multiplicative hash spreads them well enough */
+#define SLOT(NAME, IS_TYPE, CAPACITY) \
+    ((((size_t)atomOf(NAME) * 2 + (IS_TYPE)) * 2654435761u) & ((CAPACITY) - 1))
+
+static size_t slotOf(const ScopeEntry *slots, size_t capacity, const char *name, bool isType) {
+    size_t slot = SLOT(name, isType, capacity);
+    while (slots[slot].name != NULL && (slots[slot].name != name || slots[slot].isType != isType))
+        slot = (slot + 1) & (capacity - 1);
+    return slot;
+}
+
+static ScopeEntry *allocSlots(Arena *arena, size_t capacity) {
+    ScopeEntry *slots = arenaAlloc(arena, capacity * sizeof(ScopeEntry));
+    memset(slots, 0, capacity * sizeof(ScopeEntry));
+    return slots;
+}
+
+void initScope(Scope *scope, const Scope *parent) {
+    scope->parent = parent;
+    scope->slots = NULL;
+    scope->capacity = 0;
+    scope->count = 0;
+    scope->unused = NULL;
+}
+
+void *declareInScope(Scope *scope, Arena *arena, const char *name, bool isType, void *symbol) {
+    if ((scope->count + 1) * 2 > scope->capacity) {
+        /* The old slots stay in the arena, scopes rarely grow more than once or twice */
+        size_t capacity = scope->capacity ? scope->capacity * 2 : SCOPE_INITIAL_CAPACITY;
+        ScopeEntry *slots = allocSlots(arena, capacity);
+        for (size_t i = 0; i < scope->capacity; i++) {
+            const ScopeEntry *entry = &scope->slots[i];
+            if (entry->name != NULL)
+                slots[slotOf(slots, capacity, entry->name, entry->isType)] = *entry;
+        }
+        scope->slots = slots;
+        scope->capacity = capacity;
+    }
+    ScopeEntry *entry = &scope->slots[slotOf(scope->slots, scope->capacity, name, isType)];
+    void *previous = entry->symbol;
+    if (entry->name == NULL) {
+        scope->count += 1;
+        previous = NULL;
+    }
+    *entry = (ScopeEntry) { .name = name, .isType = isType, .symbol = symbol };
+    return previous;
+}
+
+void *findInScope(const Scope *scope, const char *name, bool isType) {
+    if (scope->count == 0)
+        return NULL;
+    const ScopeEntry *entry = &scope->slots[slotOf(scope->slots, scope->capacity, name, isType)];
+    return entry->name != NULL ? entry->symbol : NULL;
+}
+
+void *lookupInScopes(const Scope *scope, const char *name, bool isType) {
+    for (; scope != NULL; scope = scope->parent) {
+        void *symbol = findInScope(scope, name, isType);
+        if (symbol != NULL)
+            return symbol;
+    }
+    return NULL;
+}
+
+void initSymbolTable(SymbolTable *table, Arena *arena, const Scope *outer) {
+    table->arena = arena;
+    table->outer = outer;
+    table->innermost = NULL;
+    table->unused = NULL;
+}
+
+void pushScope(SymbolTable *table) {
+    const Scope *parent = table->innermost != NULL ? table->innermost : table->outer;
+    Scope *scope = table->unused;
+    if (scope != NULL) {
+        table->unused = scope->unused;
+        if (scope->count > 0)
+            memset(scope->slots, 0, scope->capacity * sizeof(ScopeEntry));
+        scope->count = 0;
+        scope->parent = parent;
+        scope->unused = NULL;
+    } else {
+        scope = arenaAlloc(table->arena, sizeof(Scope));
+        initScope(scope, parent);
+    }
+    table->innermost = scope;
+}
+
+void popScope(SymbolTable *table) {
+    Scope *scope = table->innermost;
+    /* Only scopes the table pushed are ever innermost, their parents are too unless it is outer */
+    table->innermost = scope->parent != table->outer ? (Scope*)scope->parent : NULL;
+    scope->unused = table->unused;
+    table->unused = scope;
+}
+
+void *declareSymbol(SymbolTable *table, const char *name, bool isType, void *symbol) {
+    return declareInScope(table->innermost, table->arena, name, isType, symbol);
+}
+
+void *lookupSymbol(const SymbolTable *table, const char *name, bool isType) {
+    return lookupInScopes(table->innermost != NULL ? table->innermost : table->outer, name, isType);
+}
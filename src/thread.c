@@ -0,0 +1,115 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif /* _WIN32 */
+
+#ifdef _WIN32
+#include <windows.h>
+#endif /* _WIN32 */
+
+#include "thread.h"
+
+#ifdef _WIN32
+static DWORD WINAPI threadEntry(LPVOID thread) {
+    ((Thread*)thread)->function(((Thread*)thread)->argument);
+    return 0;
+}
+
+bool startThread(Thread *thread, ThreadFunction function, void *argument) {
+    thread->function = function;
+    thread->argument = argument;
+    thread->handle = CreateThread(NULL, 0, threadEntry, thread, 0, NULL);
+    return thread->handle != NULL;
+}
+
+void joinThread(Thread *thread) {
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+}
+
+void initMutex(Mutex *mutex) {
+    InitializeSRWLock((PSRWLOCK)&mutex->lock);
+}
+
+void freeMutex(Mutex *mutex) {
+    /* SRW locks don't own any resources */
+    (void)mutex;
+}
+
+void lockMutex(Mutex *mutex) {
+    AcquireSRWLockExclusive((PSRWLOCK)&mutex->lock);
+}
+
+void unlockMutex(Mutex *mutex) {
+    ReleaseSRWLockExclusive((PSRWLOCK)&mutex->lock);
+}
+
+void initCondition(Condition *condition) {
+    InitializeConditionVariable((PCONDITION_VARIABLE)&condition->condition);
+}
+
+void freeCondition(Condition *condition) {
+    /* Neither do condition variables */
+    (void)condition;
+}
+
+void waitCondition(Condition *condition, Mutex *mutex) {
+    SleepConditionVariableSRW((PCONDITION_VARIABLE)&condition->condition, (PSRWLOCK)&mutex->lock, INFINITE, 0);
+}
+
+void wakeCondition(Condition *condition) {
+    WakeAllConditionVariable((PCONDITION_VARIABLE)&condition->condition);
+}
+#else
+static void *threadEntry(void *thread) {
+    ((Thread*)thread)->function(((Thread*)thread)->argument);
+    return NULL;
+}
+
+bool startThread(Thread *thread, ThreadFunction function, void *argument) {
+    thread->function = function;
+    thread->argument = argument;
+    return pthread_create(&thread->handle, NULL, threadEntry, thread) == 0;
+}
+
+void joinThread(Thread *thread) {
+    pthread_join(thread->handle, NULL);
+}
+
+void initMutex(Mutex *mutex) {
+    pthread_mutex_init(&mutex->lock, NULL);
+}
+
+void freeMutex(Mutex *mutex) {
+    pthread_mutex_destroy(&mutex->lock);
+}
+
+void lockMutex(Mutex *mutex) {
+    pthread_mutex_lock(&mutex->lock);
+}
+
+void unlockMutex(Mutex *mutex) {
+    pthread_mutex_unlock(&mutex->lock);
+}
+
+void initCondition(Condition *condition) {
+    pthread_cond_init(&condition->condition, NULL);
+}
+
+void freeCondition(Condition *condition) {
+    pthread_cond_destroy(&condition->condition);
+}
+
+void waitCondition(Condition *condition, Mutex *mutex) {
+    pthread_cond_wait(&condition->condition, &mutex->lock);
+}
+
+void wakeCondition(Condition *condition) {
+    pthread_cond_broadcast(&condition->condition);
+}
+#endif /* _WIN32 */
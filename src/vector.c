@@ -0,0 +1,34 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "vector.h"
+
+#define VECTOR_INITIAL_CAPACITY 64
+
+void initVector(Vector *vector) {
+    vector->items = NULL;
+    vector->count = 0;
+    vector->capacity = 0;
+}
+
+void freeVector(Vector *vector) {
+    free(vector->items);
+    initVector(vector);
+}
+
+void growVector(Vector *vector) {
+    size_t capacity = vector->capacity ? vector->capacity * 2 : VECTOR_INITIAL_CAPACITY;
+    void **items = realloc(vector->items, capacity * sizeof(void*));
+    if (items == NULL) {
+        fprintf(stderr, "Fatal: Out of memory while growing a vector of %zu items.\n", capacity);
+        exit(1);
+    }
+    vector->items = items;
+    vector->capacity = capacity;
+}
@@ -0,0 +1,152 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "visitor.h"
+
+#define VISITOR_INITIAL_CAPACITY 64
+
+size_t nodeChildCount(const Node *node) {
+    switch (node->type) {
+        case NT_ASSIGN:
+        case NT_BINOP:
+        case NT_ARRAYACCESS:
+        case NT_WHILE:
+        case NT_TRY:
+            return 2;
+        case NT_UNARYOP:
+        case NT_VARDECL:
+        case NT_FUNCDECL:
+        case NT_ACCESS:
+        case NT_RETURN:
+            return 1;
+        case NT_FOR:
+            return 4;
+        case NT_IF:
+            return ((IfNode*)node->node)->nCases * 2 + 1;
+        case NT_FUNCCALL:
+            return ((FunctionCallNode*)node->node)->nArguments + 1;
+        case NT_CLASS:
+        case NT_UNION:
+            return ((TypeNode*)node->node)->nFields;
+        case NT_COMPOUND:
+            return ((CompoundNode*)node->node)->nStatements;
+        default:
+            return 0;
+    }
+}
+
+Node *nodeChild(const Node *node, size_t child) {
+    switch (node->type) {
+        case NT_ASSIGN:
+        case NT_BINOP: {
+            BinaryOperationNode *binOp = (BinaryOperationNode*)node->node;
+            return child == 0 ? binOp->lhs : binOp->rhs;
+        }
+        case NT_UNARYOP:
+            return ((UnaryOperationNode*)node->node)->value;
+        case NT_VARDECL:
+            return ((VariableDeclerationNode*)node->node)->initializer;
+        case NT_FUNCDECL:
+            return ((FunctionDeclerationNode*)node->node)->body;
+        case NT_RETURN:
+            /* The value is stored directly, there's no payload struct */
+            return (Node*)node->node;
+        case NT_ACCESS:
+            return ((AccessNode*)node->node)->object;
+        case NT_ARRAYACCESS: {
+            ArrayAccessNode *access = (ArrayAccessNode*)node->node;
+            return child == 0 ? access->array : access->index;
+        }
+        case NT_WHILE: {
+            WhileNode *loop = (WhileNode*)node->node;
+            return child == 0 ? loop->condition : loop->body;
+        }
+        case NT_TRY: {
+            TryNode *try = (TryNode*)node->node;
+            return child == 0 ? try->body : try->catchBody;
+        }
+        case NT_FOR: {
+            ForNode *loop = (ForNode*)node->node;
+            switch (child) {
+                case 0: return loop->initializer;
+                case 1: return loop->condition;
+                case 2: return loop->increment;
+                default: return loop->body;
+            }
+        }
+        case NT_IF: {
+            /* Condition and body of each case, then the else case */
+            IfNode *statement = (IfNode*)node->node;
+            if (child == statement->nCases * 2)
+                return statement->elseCase;
+            return child % 2 ? statement->bodies[child / 2] : statement->conditions[child / 2];
+        }
+        case NT_FUNCCALL: {
+            FunctionCallNode *call = (FunctionCallNode*)node->node;
+            return child == 0 ? call->function : call->arguments[child - 1];
+        }
+        case NT_CLASS:
+        case NT_UNION:
+            return ((TypeNode*)node->node)->fields[child];
+        case NT_COMPOUND:
+            return ((CompoundNode*)node->node)->statements[child];
+        default:
+            return NULL;
+    }
+}
+
+typedef struct VisitFrame {
+    Node *node;
+    size_t next;
+    size_t count;
+} VisitFrame;
+
+typedef struct VisitStack {
+    VisitFrame *frames;
+    size_t count;
+    size_t capacity;
+} VisitStack;
+
+static void enter(VisitStack *stack, Node *node, NodeVisitor visitor, void *data) {
+    if (stack->count == stack->capacity) {
+        stack->capacity = stack->capacity ? stack->capacity * 2 : VISITOR_INITIAL_CAPACITY;
+        stack->frames = realloc(stack->frames, stack->capacity * sizeof(VisitFrame));
+        if (stack->frames == NULL) {
+            fprintf(stderr, "Fatal: Out of memory while walking the AST.\n");
+            exit(1);
+        }
+    }
+    size_t count = nodeChildCount(node);
+    stack->frames[stack->count++] = (VisitFrame) {
+        .node = node,
+        .next = visitor(data, node, VISIT_ENTER, 0) ? 0 : count,
+        .count = count
+    };
+}
+
+void visitNode(Node *root, NodeVisitor visitor, void *data) {
+    if (root == NULL)
+        return;
+    VisitStack stack = { NULL, 0, 0 };
+    enter(&stack, root, visitor, data);
+    while (stack.count > 0) {
+        /* Not a pointer, entering a child can move the frames */
+        VisitFrame frame = stack.frames[stack.count - 1];
+        if (frame.next == frame.count) {
+            stack.count -= 1;
+            visitor(data, frame.node, VISIT_LEAVE, 0);
+            continue;
+        }
+        stack.frames[stack.count - 1].next += 1;
+        Node *child = nodeChild(frame.node, frame.next);
+        if (visitor(data, frame.node, VISIT_CHILD, frame.next) && child != NULL)
+            enter(&stack, child, visitor, data);
+    }
+    free(stack.frames);
+}
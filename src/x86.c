@@ -0,0 +1,353 @@
+/*
+ * This file is part of the tinyhcc project.
+ * https://github.com/wofflevm/tinyhcc
+ * See LICENSE for license.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "x86.h"
+
+#define ASSEMBLER_INITIAL_CAPACITY 64
+
+#define REX 0x40
+#define REX_W 0x08
+#define REX_R 0x04
+#define REX_B 0x01
+
+static const X86Register sysvArguments[] = { X86_RDI, X86_RSI, X86_RDX, X86_RCX, X86_R8, X86_R9 };
+static const X86Register sysvCalleeSaved[] = { X86_RBX, X86_R12, X86_R13, X86_R14, X86_R15 };
+static const X86Register windowsArguments[] = { X86_RCX, X86_RDX, X86_R8, X86_R9 };
+static const X86Register windowsCalleeSaved[] = { X86_RBX, X86_RSI, X86_RDI, X86_R12, X86_R13, X86_R14, X86_R15 };
+
+const CallingConvention SYSV_CALLING_CONVENTION = {
+    sysvArguments, sizeof(sysvArguments) / sizeof(*sysvArguments),
+    sysvCalleeSaved, sizeof(sysvCalleeSaved) / sizeof(*sysvCalleeSaved),
+    0
+};
+
+const CallingConvention WINDOWS_CALLING_CONVENTION = {
+    windowsArguments, sizeof(windowsArguments) / sizeof(*windowsArguments),
+    windowsCalleeSaved, sizeof(windowsCalleeSaved) / sizeof(*windowsCalleeSaved),
+    32
+};
+
+void initAssembler(Assembler *as) {
+    initSection(&as->code, 16);
+    as->labels = NULL;
+    as->nLabels = 0;
+    as->labelsCapacity = 0;
+    as->fixups = NULL;
+    as->nFixups = 0;
+    as->fixupsCapacity = 0;
+}
+
+void freeAssembler(Assembler *as) {
+    freeSection(&as->code);
+    free(as->labels);
+    free(as->fixups);
+}
+
+static void *grow(void *items, size_t *capacity, size_t size) {
+    size_t grown = *capacity ? *capacity * 2 : ASSEMBLER_INITIAL_CAPACITY;
+    items = realloc(items, grown * size);
+    if (items == NULL) {
+        fprintf(stderr, "Fatal: Out of memory while generating code.\n");
+        exit(1);
+    }
+    *capacity = grown;
+    return items;
+}
+
+size_t newLabel(Assembler *as) {
+    if (as->nLabels == as->labelsCapacity)
+        as->labels = grow(as->labels, &as->labelsCapacity, sizeof(size_t));
+    as->labels[as->nLabels] = LABEL_UNBOUND;
+    return as->nLabels++;
+}
+
+void bindLabel(Assembler *as, size_t label) {
+    as->labels[label] = as->code.length;
+}
+
+static void put32(Assembler *as, uint32_t value) {
+    for (size_t i = 0; i < 4; i++)
+        sectionByte(&as->code, (uint8_t)(value >> (8 * i)));
+}
+
+static void patch32(Assembler *as, size_t offset, uint32_t value) {
+    for (size_t i = 0; i < 4; i++)
+        as->code.data[offset + i] = (uint8_t)(value >> (8 * i));
+}
+
+void resolveLabels(Assembler *as) {
+    for (size_t i = 0; i < as->nFixups; i++) {
+        LabelFixup *fixup = &as->fixups[i];
+        patch32(as, fixup->offset, (uint32_t)(as->labels[fixup->label] - (fixup->offset + 4)));
+    }
+    as->nFixups = 0;
+}
+
+static void jumpTo(Assembler *as, size_t label) {
+    if (as->nFixups == as->fixupsCapacity)
+        as->fixups = grow(as->fixups, &as->fixupsCapacity, sizeof(LabelFixup));
+    as->fixups[as->nFixups++] = (LabelFixup) { .label = label, .offset = as->code.length };
+    put32(as, 0);
+}
+
+static void byte(Assembler *as, uint8_t value) {
+    sectionByte(&as->code, value);
+}
+
+/* Emitted if any bit is set, or if force is, for the byte registers that need it */
+static void rex(Assembler *as, bool wide, X86Register reg, X86Register rm, bool force) {
+    uint8_t prefix = (wide ? REX_W : 0) | (reg >= X86_R8 ? REX_R : 0) | (rm >= X86_R8 ? REX_B : 0);
+    if (prefix != 0 || force)
+        byte(as, REX | prefix);
+}
+
+static void modrmRegister(Assembler *as, X86Register reg, X86Register rm) {
+    byte(as, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* [base + displacement], rsp and r12 need a SIB byte, rbp and r13 always a displacement */
+static void modrmMemory(Assembler *as, X86Register reg, X86Register base, int32_t displacement) {
+    uint8_t mod = displacement == 0 && (base & 7) != X86_RBP ? 0x00 :
+        displacement >= INT8_MIN && displacement <= INT8_MAX ? 0x40 : 0x80;
+    byte(as, mod | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == X86_RSP)
+        byte(as, 0x24);
+    if (mod == 0x40)
+        byte(as, (uint8_t)displacement);
+    else if (mod == 0x80)
+        put32(as, (uint32_t)displacement);
+}
+
+/* Register to register with the operands the other way around to the mov r/m, r forms */
+static void registerForm(Assembler *as, bool wide, uint8_t opcode, X86Register reg, X86Register rm) {
+    rex(as, wide, reg, rm, false);
+    byte(as, opcode);
+    modrmRegister(as, reg, rm);
+}
+
+void emitMove(Assembler *as, X86Register to, X86Register from) {
+    if (to != from)
+        registerForm(as, true, 0x89, from, to);
+}
+
+void emitMoveImmediate(Assembler *as, X86Register to, int64_t value) {
+    if (value >= 0 && value <= UINT32_MAX) {
+        /* Writing the low half clears the high one */
+        rex(as, false, X86_RAX, to, false);
+        byte(as, 0xB8 + (to & 7));
+        put32(as, (uint32_t)value);
+    } else if (value >= INT32_MIN && value <= INT32_MAX) {
+        rex(as, true, X86_RAX, to, false);
+        byte(as, 0xC7);
+        modrmRegister(as, X86_RAX, to);
+        put32(as, (uint32_t)value);
+    } else {
+        rex(as, true, X86_RAX, to, false);
+        byte(as, 0xB8 + (to & 7));
+        put32(as, (uint32_t)value);
+        put32(as, (uint32_t)((uint64_t)value >> 32));
+    }
+}
+
+void emitLoad(Assembler *as, X86Register to, X86Register base, int32_t displacement, size_t size, bool isSigned) {
+    switch (size) {
+        case 8:
+            rex(as, true, to, base, false);
+            byte(as, 0x8B);
+            break;
+        case 4:
+            /* movsxd, or a 32-bit mov that clears the high half */
+            rex(as, isSigned, to, base, false);
+            byte(as, isSigned ? 0x63 : 0x8B);
+            break;
+        default:
+            rex(as, isSigned, to, base, false);
+            byte(as, 0x0F);
+            byte(as, (size == 1 ? 0xB6 : 0xB7) + (isSigned ? 0x08 : 0x00));
+            break;
+    }
+    modrmMemory(as, to, base, displacement);
+}
+
+void emitStore(Assembler *as, X86Register base, int32_t displacement, X86Register from, size_t size) {
+    if (size == 2)
+        byte(as, 0x66);
+    /* Without a REX prefix spl, bpl, sil and dil would be ah, ch, dh and bh */
+    rex(as, size == 8, from, base, size == 1 && from >= X86_RSP);
+    byte(as, size == 1 ? 0x88 : 0x89);
+    modrmMemory(as, from, base, displacement);
+}
+
+void emitLea(Assembler *as, X86Register to, X86Register base, int32_t displacement) {
+    if (displacement == 0) {
+        emitMove(as, to, base);
+        return;
+    }
+    rex(as, true, to, base, false);
+    byte(as, 0x8D);
+    modrmMemory(as, to, base, displacement);
+}
+
+void emitExtend(Assembler *as, X86Register reg, size_t size, bool isSigned) {
+    switch (size) {
+        case 8:
+            break;
+        case 4:
+            if (isSigned)
+                registerForm(as, true, 0x63, reg, reg);
+            else
+                registerForm(as, false, 0x89, reg, reg);
+            break;
+        default:
+            rex(as, isSigned, reg, reg, size == 1 && reg >= X86_RSP);
+            byte(as, 0x0F);
+            byte(as, (size == 1 ? 0xB6 : 0xB7) + (isSigned ? 0x08 : 0x00));
+            modrmRegister(as, reg, reg);
+            break;
+    }
+}
+
+static size_t ripRelative(Assembler *as, uint8_t opcode, X86Register to) {
+    rex(as, true, to, X86_RAX, false);
+    byte(as, opcode);
+    byte(as, 0x05 | ((to & 7) << 3));
+    size_t field = as->code.length;
+    put32(as, 0);
+    return field;
+}
+
+size_t emitLeaRelative(Assembler *as, X86Register to) {
+    return ripRelative(as, 0x8D, to);
+}
+
+size_t emitLoadRelative(Assembler *as, X86Register to) {
+    return ripRelative(as, 0x8B, to);
+}
+
+void emitOperation(Assembler *as, X86Operation operation, X86Register to, X86Register from) {
+    registerForm(as, true, (uint8_t)((operation << 3) | 0x01), from, to);
+}
+
+void emitOperationImmediate(Assembler *as, X86Operation operation, X86Register to, int32_t value) {
+    bool small = value >= INT8_MIN && value <= INT8_MAX;
+    rex(as, true, X86_RAX, to, false);
+    byte(as, small ? 0x83 : 0x81);
+    modrmRegister(as, (X86Register)operation, to);
+    if (small)
+        byte(as, (uint8_t)value);
+    else
+        put32(as, (uint32_t)value);
+}
+
+void emitTest(Assembler *as, X86Register a, X86Register b) {
+    registerForm(as, true, 0x85, b, a);
+}
+
+void emitMultiply(Assembler *as, X86Register to, X86Register from) {
+    rex(as, true, to, from, false);
+    byte(as, 0x0F);
+    byte(as, 0xAF);
+    modrmRegister(as, to, from);
+}
+
+void emitMultiplyImmediate(Assembler *as, X86Register to, X86Register from, int32_t value) {
+    bool small = value >= INT8_MIN && value <= INT8_MAX;
+    rex(as, true, to, from, false);
+    byte(as, small ? 0x6B : 0x69);
+    modrmRegister(as, to, from);
+    if (small)
+        byte(as, (uint8_t)value);
+    else
+        put32(as, (uint32_t)value);
+}
+
+void emitNegate(Assembler *as, X86Register reg) {
+    rex(as, true, X86_RAX, reg, false);
+    byte(as, 0xF7);
+    modrmRegister(as, (X86Register)3, reg);
+}
+
+void emitShift(Assembler *as, X86Shift shift, X86Register reg) {
+    rex(as, true, X86_RAX, reg, false);
+    byte(as, 0xD3);
+    modrmRegister(as, (X86Register)shift, reg);
+}
+
+void emitShiftImmediate(Assembler *as, X86Shift shift, X86Register reg, uint8_t count) {
+    rex(as, true, X86_RAX, reg, false);
+    byte(as, count == 1 ? 0xD1 : 0xC1);
+    modrmRegister(as, (X86Register)shift, reg);
+    if (count != 1)
+        byte(as, count);
+}
+
+void emitDivide(Assembler *as, X86Register divisor, bool isSigned) {
+    if (isSigned) {
+        /* cqo */
+        byte(as, REX | REX_W);
+        byte(as, 0x99);
+    } else {
+        registerForm(as, false, 0x31, X86_RDX, X86_RDX);
+    }
+    rex(as, true, X86_RAX, divisor, false);
+    byte(as, 0xF7);
+    modrmRegister(as, (X86Register)(isSigned ? 7 : 6), divisor);
+}
+
+void emitExchange(Assembler *as, X86Register a, X86Register b) {
+    if (a != b)
+        registerForm(as, true, 0x87, a, b);
+}
+
+void emitSet(Assembler *as, X86Condition condition, X86Register reg) {
+    rex(as, false, X86_RAX, reg, reg >= X86_RSP);
+    byte(as, 0x0F);
+    byte(as, 0x90 + condition);
+    modrmRegister(as, X86_RAX, reg);
+    emitExtend(as, reg, 1, false);
+}
+
+void emitPush(Assembler *as, X86Register reg) {
+    rex(as, false, X86_RAX, reg, false);
+    byte(as, 0x50 + (reg & 7));
+}
+
+void emitPop(Assembler *as, X86Register reg) {
+    rex(as, false, X86_RAX, reg, false);
+    byte(as, 0x58 + (reg & 7));
+}
+
+void emitJump(Assembler *as, size_t label) {
+    byte(as, 0xE9);
+    jumpTo(as, label);
+}
+
+void emitJumpIf(Assembler *as, X86Condition condition, size_t label) {
+    byte(as, 0x0F);
+    byte(as, 0x80 + condition);
+    jumpTo(as, label);
+}
+
+size_t emitCall(Assembler *as) {
+    byte(as, 0xE8);
+    size_t field = as->code.length;
+    put32(as, 0);
+    return field;
+}
+
+void emitCallRegister(Assembler *as, X86Register reg) {
+    rex(as, false, X86_RAX, reg, false);
+    byte(as, 0xFF);
+    modrmRegister(as, (X86Register)2, reg);
+}
+
+void emitReturn(Assembler *as) {
+    byte(as, 0xC3);
+}